@@ -8,9 +8,9 @@ static void handle_sigint(int signal);
 
 #define BUILD BUILD_DIR
 
-extern void main_myproject(void);
+extern void main_city_emergency_project(int argc, char **argv);
 
-int main(void)
+int main(int argc, char **argv)
 {
     /* SIGINT is not blocked by the posix port */
     signal(SIGINT, handle_sigint);
@@ -22,7 +22,7 @@ int main(void)
     console_init();
 
     // -- user application main -- //
-    main_city_emergency_project();
+    main_city_emergency_project(argc, argv);
 
     // -- fail safe while loop, we should not reach here --//
     while (1)
@@ -17,69 +17,509 @@
 
 /* Includes */
 
-#include "FreeRTOS.h"
-#include "task.h"
-#include "queue.h"
-#include "semphr.h"
+#include "os_port.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <stdint.h>
 
 /////////////////////////
 
 /* Defines */
 
-#define CODE_POLICE     1   // department codes
+#define CODE_POLICE     1   // department codes of the built-in configuration
 #define CODE_AMBULANCE  2
 #define CODE_FIRE       3
 
-#define MAX_CODE        3      // maximum code value (for randome generation)
 #define MAX_PRIORITY    3     // maximum priority value (for randome generation)
 
-#define MAX_POLICE      4   // department maximum available resources
+#define MAX_DEPARTMENTS 8          // department slots of the per department tables, a configuration file defines up to this many
+#define DEPARTMENT_NAME_LEN 24    // longest department display name (with the terminating 0)
+#define DEPARTMENT_KEY_LEN  16   // longest department key (options, profiles, reports)
+#define MAX_DISTRICTS 8           // districts of a city, each with its own generator, eventBuffer, dispatcher and departments
+
+#define MAX_POLICE      4   // department maximum available resources (built-in configuration, --config and --police etc. override)
 #define MAX_AMBULANCE   3
 #define MAX_FIRE        2
 
 #define DEPARTMENT_QUEUE_LEN 5    // queue length for each department, if no resources are available
-#define MAX_EVENTS      10       // maximum amount of generated events before dispatched to departments
+#define DEPARTMENT_MAX_UNITS 64   // largest fleet of a department, the maximum count of its unit semaphore (live resize limit)
+#define MAX_EVENTS      10       // maximum amount of generated events before dispatched to departments (default of simParams.bufferLen, status display rows)
 
 #define DISPATCH_TIME_CONST_MS          1500       // constant time (ms) for dispatcher to dispatcha call (event)
 #define EVENT_GEN_TIME_MAX_MS           2000      // maximum time (ms) for random event generator
 #define EVENT_GEN_TIME_MIN_MS           1000     // minimum time (ms) for random event generator
 #define DEPARTMENT_HANDLE_TIME_MAX_MS   8000    // maximum time (ms) for random handle time of a department
 #define DEPARTMENT_HANDLE_TIME_MIN_MS   3000   // minimum time (ms) for random handle time of a department
+#define DEPARTMENT_RETRY_DELAY_MS       500   // delay (ms) of a department before retrying an event that had no resource
+#define DISPATCH_SEND_TIMEOUT_MS        100  // maximum time (ms) the dispatcher waits for space in a full department queue
 
 #define MAX_LOG_LINES 10   // maximum number of logger message lines shown in terminal display
+#define LOG_LINE_LEN  200  // maximum length of a single logger message line
+
+#ifndef HEADLESS_MODE
+#define HEADLESS_MODE 0    // default run mode, 1 = no status display (set with "make HEADLESS=1" or "--headless")
+#endif
+
+#define DES_DEFAULT_HOURS 24.0   // default simulated time of a discrete-event run
+
+#define SIM_LAG_WARN_MS 20                 // a task this much behind its scaled schedule (wall time) had a late wake-up
+#define SIM_LAG_WARN_INTERVAL_MS 5000     // at most one lag warning per interval
+
+#define RECORD_STREAM_RECORDS 256      // records the generators can queue for the recorder task
+#define RECORD_BATCH 32               // records the recorder task takes per receive
+#define RECORD_FILE_BUFFER 65536     // stdio buffer of the recording file (bytes)
+#define RECORD_FLUSH_MS 1000        // the recording is flushed after this much time without events
+
+#define INI_LINE_LEN 256             // longest line of a profile or configuration file
+#define TASK_STACK_DEFAULT 0        // TaskConfig.stackWords value for the default stack (OS_MIN_STACK_WORDS * 4)
+#define DIURNAL_HOURS 24            // values of a diurnal rate curve, one per hour from midnight
+#define PROFILE_MAX_BURSTS 16      // burst episodes of a workload profile
+#define PROFILE_MAX_EMPTY_SEGMENTS 100000   // rate 0 segments (about 11 years) before a profile is considered exhausted
+#define ALIAS_MAX 16              // outcomes of an alias table
+
+#define REPLAY_RELEASE_BYTES (16u * 1024 * 1024)   // replayed trace pages are released from the mapping in steps of this size
+
+#define STATUS_PAGE_PERIOD_MS 100   // update period of the shared memory status page
+
+#define SHARD_POLL_MS        1      // the shard link task drains the incoming rings this often (real time)
+#define SHARD_PUBLISH_MS     100    // shard metrics publish period (real time)
+#define SHARD_AID_TIMEOUT_MS 50     // wait for the reply of another shard before asking the next one (real time)
+
+#define HISTORY_SECONDS 3600   // metrics history ring sizes: 1 s samples for the last hour,
+#define HISTORY_MINUTES 1440  // 1 min samples for the last day,
+#define HISTORY_HOURS   720   // 1 h samples for the last 30 days
+
+#define COMMAND_POLL_MS  200   // console command polling period
+#define COMMAND_LINE_LEN 200   // maximum length of a console command line
+
+#define FORECAST_DEFAULT_MINUTES 30   // forecast horizon when the command does not give one (model time)
+#define FORECAST_MAX_MINUTES 1440     // longest forecast horizon
+#define FORECAST_RUNS 8               // fast-forward runs of each forecast scenario, one seed each
+
+#define CPU_SAMPLE_MS     1000   // CPU sampler period (real time)
+#define CPU_WINDOW_SHORT  10     // sliding windows of the CPU shares, in samples
+#define CPU_WINDOW_LONG   60
+#define CPU_MAX_TASKS     512    // tasks listed per sample (EventWorker tasks included)
+#define CPU_MAX_GROUPS    128    // task names (and EventWorker departments) tracked
+#define CPU_TOP_SHOWN     8      // top consumers on the status display
+#define WORKER_TASK_PREFIX "W:"  // EventWorker tasks are named "W:<department label>", grouped by department
+
+#define STACK_MAX_NAMES    64    // task names mapped to their kind for the stack report (EventWorker names repeat)
+#define STACK_HEADROOM_PCT 25    // suggested stack = peak use + this share, see stack_stats_exit_report()
+#define STACK_ROUND_WORDS  256   // suggested stacks are rounded up to a multiple of this
+
+#define HIST_SUB_BITS 5    // latency histogram precision, each power of two range is split into 2^HIST_SUB_BITS buckets (~3%)
+#define HIST_BUCKETS  ((1 << HIST_SUB_BITS) + (32 - HIST_SUB_BITS) * (1 << HIST_SUB_BITS))  // buckets for the full 32 bit range
 
 ///////////////////////////////// end Defines
 
 /* Variables */
 
+typedef enum {   // event life cycle stages measured by the latency histograms
+    STAGE_BUFFER_WAIT = 0,   // generated -> dispatched (waiting in the eventBuffer)
+    STAGE_QUEUE_WAIT,        // dispatched -> first received by the department (waiting in the department queue)
+    STAGE_UNIT_WAIT,         // received -> unit assigned (including requeues when no resource is available)
+    STAGE_SERVICE,           // unit assigned -> completed (handling time)
+    STAGE_END_TO_END,        // generated -> completed
+    NUM_STAGES
+} LatencyStage;
+
+typedef enum {   // latency rows on the status display, switched with the latency console command
+    LATENCY_VIEW_TOTAL = 0,   // every stage, end-to-end per priority and per department
+    LATENCY_VIEW_PRIORITY,    // every stage per priority
+    LATENCY_VIEW_DEPARTMENT,  // every stage per department
+    NUM_LATENCY_VIEWS
+} LatencyView;
+
 typedef struct {   // emergency event object
     int code;
     int priority;
+    int district;               // district the event happened in (index, 0 = first)
+    int requeues;               // times the event was sent back to the department queue
+    OsTick generatedTick;   // time stamps of the event life cycle
+    OsTick dispatchedTick;
+    OsTick receivedTick;
+    OsTick assignedTick;
+    uint32_t handleMs;          // handling time (ms, model time), drawn when the event is generated
 } Event;
 
 typedef struct {   // department parameters (metadata) object
-    QueueHandle_t queue;
-    SemaphoreHandle_t semaphore;
+    OsQueue queue;
+    OsSemaphore semaphore;   // free units, created with DEPARTMENT_MAX_UNITS as the maximum count
     const char *departmentName;
+    int code;
+    int district;                  // district index of the department
+    uint32_t units;                // live fleet size, changed by department_resize()
+    uint32_t retiring;             // busy units to retire when their handler finishes (the fleet shrank while they were busy)
 } DepartmentParams;
 
 typedef struct {   //  arguments object for the event handler task
     Event evt;
     DepartmentParams *params;
-    BaseType_t borrowed;
-    SemaphoreHandle_t borrowedFrom;
+    int borrowed;
+    DepartmentParams *borrowedFrom;   // the department that lent the unit (of this or of another district)
+    int aidShard;                     // shard process that lent the unit (mutual aid across shards), -1 = a unit of this process
+    int aidLender;                    // district of the lending shard that owns the unit
+    struct ActiveHandling *tracked;   // the handling as published for forecasts, NULL = not tracked
 } EventHandlerArgs;
 
-extern QueueHandle_t xPoliceQueue, xAmbulanceQueue, xFireQueue;   // queue handles
-extern SemaphoreHandle_t xPoliceSemaphore, xAmbulanceSemaphore, xFireSemaphore;  // semasphore handles
-extern SemaphoreHandle_t xLogMutex, xResourceMutex, xEventBufferMutex;   
+typedef struct {   // one district of the city: its own event source, eventBuffer, dispatcher and departments
+    int index;                       // 0 = first district
+    Event *eventBuffer;              // generated calls (events) before dispatched (simParams.bufferLen entries)
+    int eventCount;                  // pending events counter
+    OsMutex bufferMutex;             // guards eventBuffer and eventCount
+    OsMutex resourceMutex;           // one department of the district borrows at a time
+    DepartmentParams *departments;   // simParams.departmentCount entries, indexed by code - 1
+} District;
+
+typedef struct {   // lock hold time statistics (ns), measured from the status display side
+    unsigned long last;
+    unsigned long max;
+    unsigned long total;
+    unsigned long samples;
+} LockHoldStats;
+
+typedef struct {   // consistent copy of the system state, rendered by the status display outside of any lock
+    char logLines[MAX_LOG_LINES][LOG_LINE_LEN];   // log messages in chronological order (oldest first)
+    int logCount;
+    Event pending[MAX_EVENTS];                     // copy of the first MAX_EVENTS events of the eventBuffer
+    int pendingCount;                              // events in the eventBuffers (may be more than copied)
+    int districtPending[MAX_DISTRICTS];            // events in the eventBuffer of each district
+    uint32_t freeUnits[MAX_DEPARTMENTS];           // available resources (all districts), indexed by department code - 1
+    uint32_t busyUnits[MAX_DEPARTMENTS];           // units handling an event (all districts), indexed by department code - 1
+    uint32_t queueDepth[MAX_DEPARTMENTS];          // department queue lengths (all districts), indexed by department code - 1
+} StatusSnapshot;
+
+typedef struct {   // lock-free log-linear (HDR style) latency histogram, values in ticks
+    uint32_t counts[HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint32_t max;
+} LatencyHistogram;
+
+typedef struct {   // low-cost metrics sink, all counters are updated with relaxed atomic increments
+    unsigned long generated;                          // events created by the generator
+    unsigned long droppedBuffer;                     // events dropped because the eventBuffer was full
+    unsigned long dispatched;                       // events taken from the eventBuffer by the dispatcher
+    unsigned long droppedQueue[MAX_DEPARTMENTS];   // events dropped because the department queue was full
+    unsigned long delayed[MAX_DEPARTMENTS];       // events requeued because no resource was available
+    unsigned long borrowed[MAX_DEPARTMENTS];     // events handled with a resource borrowed from another department
+    unsigned long handled[MAX_DEPARTMENTS];     // events that got a resource and started handling
+    unsigned long completed[MAX_DEPARTMENTS];  // events that finished handling
+    unsigned long mutualAid[MAX_DEPARTMENTS];   // events handled with a unit lent by another district (same department)
+    unsigned long aidLent[MAX_DISTRICTS];      // units a district lent to other districts, indexed by district
+    unsigned long aidReceived[MAX_DISTRICTS];  // units a district received from other districts
+    unsigned long districtGenerated[MAX_DISTRICTS];
+    unsigned long districtDropped[MAX_DISTRICTS];    // eventBuffer drops per district
+    unsigned long districtCompleted[MAX_DISTRICTS];
+    unsigned long lateWakeups;                // tasks that fell behind the scaled schedule (host cannot keep up with the time scale)
+    unsigned long maxLagMs;                  // largest lag behind schedule (ms, wall time)
+    LatencyHistogram latency[NUM_STAGES];                        // stage latency of completed events, all events
+    LatencyHistogram latencyByPriority[NUM_STAGES][MAX_PRIORITY];  // indexed by priority - 1
+    LatencyHistogram latencyByDept[NUM_STAGES][MAX_DEPARTMENTS];   // indexed by department code - 1
+} SystemMetrics;
+
+typedef struct {   // instantaneous system values, read without any lock
+    uint32_t pending;                           // events waiting in the eventBuffers of all districts
+    uint32_t totalUnits[MAX_DEPARTMENTS];      // live fleet sizes, indexed by department code - 1
+    uint32_t freeUnits[MAX_DEPARTMENTS];       // available resources, indexed by department code - 1
+    uint32_t queueDepth[MAX_DEPARTMENTS];     // department queue lengths, indexed by department code - 1
+} SystemGauges;
+
+typedef enum {   // metrics history resolutions
+    HISTORY_1S = 0,
+    HISTORY_1M,
+    HISTORY_1H,
+    NUM_HISTORY_LEVELS
+} HistoryLevel;
+
+typedef struct {   // one metrics history sample, aggregated over [startSec, startSec + seconds)
+    uint32_t startSec;                       // interval start, seconds since the program started
+    uint32_t seconds;                       // number of 1 s samples merged into this sample
+    float pendingAvg;                      // gauges: average and extreme over the interval
+    uint32_t pendingMax;
+    float queueAvg[MAX_DEPARTMENTS];
+    uint32_t queueMax[MAX_DEPARTMENTS];
+    float freeAvg[MAX_DEPARTMENTS];
+    uint32_t freeMin[MAX_DEPARTMENTS];
+    uint32_t generated;                  // counters: events in the interval
+    uint32_t completed;
+    uint32_t dropped;
+    uint32_t borrowed;
+    uint64_t latencySum;               // end-to-end latency of the events completed in the interval (ticks)
+    uint32_t latencyCount;
+    uint32_t latencyP95;              // worst 1 s p95 in the interval
+    uint32_t latencyMax;
+} HistorySample;
+
+typedef struct {   // run options, parsed from the command line
+    int headless;          // 1 = do not create the status display task
+    unsigned long duration; // run time in seconds before the program exits, 0 = run forever
+    int statusPage;        // 1 = publish the live counters to the shared memory status page
+    int des;               // 1 = discrete-event mode (virtual time, no scheduler)
+    double simHours;       // simulated hours of a discrete-event run
+    double timeScale;      // time compression factor of the real-time mode, every model delay is divided by it
+    uint64_t seed;         // master seed of the workload random streams
+    int seedSet;           // 1 = seed given on the command line, 0 = seeded from the clock
+    const char *recordPath;   // record the generated events to this file, NULL = no recording
+    const char *replayPath;   // replay the events of this trace instead of the random workload, NULL = random
+    const char *profilePath;  // draw the workload from this profile file, NULL = built-in random workload
+    int json;                 // 1 = print the run summary as one JSON object (machine readable, parameter sweeps)
+    double replaySpeed;       // replayed arrival offsets are divided by this factor
+    int replayFast;           // 1 = replay as fast as possible, ignore the arrival offsets
+    int shardIndex;           // this process is shard shardIndex of shardCount (--shard i/n, set by the shard launcher)
+    int shardCount;           // 1 = a whole city in one process
+    const char *shardLink;    // shared memory link of the shards (--shard-link), NULL = not sharded
+    double ratePerMin;        // --rate: Poisson arrivals per minute (model time) of each district, 0 = generation_gap_ms of the configuration
+    unsigned long eventLimit; // --events: generate this many events, end the run once they are all completed or dropped, 0 = no limit
+    const char *cpuLogPath;   // --cpu-log: write every CPU sample to this CSV file, NULL = no log
+    const char *stackReportPath;   // --stack-report: track the peak stack use per task kind, write the suggested stacks here at exit
+} ProjectOptions;
+
+typedef enum {   // random streams of a master seed, one per workload property (and per district)
+    RNG_STREAM_EVENTS = 0,    // department codes and priorities
+    RNG_STREAM_GAPS,          // time between generated events
+    RNG_STREAM_SERVICE,       // handling times
+    NUM_RNG_STREAMS           // streams of one district, district n uses streams n * NUM_RNG_STREAMS and up
+} RngStream;
+
+typedef struct {   // xoshiro256** generator state, owned by a single task
+    uint64_t s[4];
+} RngState;
+
+typedef struct {   // the random streams that make up a workload, owned by the generating task
+    RngState events;
+    RngState gaps;
+    RngState service;
+} WorkloadRng;
+
+typedef enum {   // random time distributions of the configuration
+    DIST_CONSTANT = 0,     // always minMs
+    DIST_UNIFORM,          // [minMs, maxMs)
+    DIST_EXPONENTIAL       // minMs + exponential with mean meanMs, capped at maxMs (0 = no cap)
+} TimeDistKind;
+
+typedef struct {   // random time (ms, model time) of the configuration
+    TimeDistKind kind;
+    uint32_t minMs;
+    uint32_t maxMs;
+    uint32_t meanMs;
+} TimeDist;
 
-extern Event eventBuffer[MAX_EVENTS];  // event buffer for generated calls (events) before dispatched
-extern int eventCount;   // pending events counter
+typedef enum {   // task kinds with a configured priority and stack
+    TASK_GENERATOR = 0,
+    TASK_DISPATCHER,
+    TASK_DEPARTMENT,
+    TASK_HANDLER,
+    TASK_DISPLAY,
+    TASK_HISTORY,
+    TASK_COMMANDS,
+    TASK_STATUS_PAGE,
+    TASK_RECORDER,
+    TASK_SHARD_LINK,
+    TASK_FORECAST,
+    TASK_CPU_STATS,
+    NUM_TASK_KINDS
+} TaskKind;
+
+typedef struct {   // priority and stack of a task kind
+    unsigned priority;
+    uint32_t stackWords;   // stack depth passed to os_task_create, TASK_STACK_DEFAULT = OS_MIN_STACK_WORDS * 4
+} TaskConfig;
+
+typedef struct {   // one department of the configuration, the department code is its index + 1
+    char name[DEPARTMENT_NAME_LEN];     // display name, e.g. "Fire Department"
+    char label[DEPARTMENT_NAME_LEN];    // short name for tables and task names, e.g. "Fire"
+    char key[DEPARTMENT_KEY_LEN];       // option, profile and report key, e.g. "fire" (--fire <units>)
+    uint32_t units;                     // resources
+    uint32_t queueLen;                  // department queue length
+    TimeDist handle;                    // handling time
+    double weight;                      // share of the events of the random workload
+    int borrowFrom[MAX_DEPARTMENTS];    // department codes to borrow from, in order
+    int borrowCount;
+} DepartmentConfig;
+
+typedef struct {   // model parameters: the built-in configuration (#define values), a --config file, then command line overrides
+    int departmentCount;                          // configured departments, codes 1..departmentCount
+    DepartmentConfig departments[MAX_DEPARTMENTS];   // indexed by department code - 1
+    uint32_t bufferLen;                // eventBuffer size
+    TimeDist generationGap;            // time between generated events (random workload)
+    uint32_t dispatchMs;               // dispatcher work time per event
+    uint32_t sendTimeoutMs;            // dispatcher wait for space in a full department queue
+    uint32_t retryMs;                  // department retry delay when no resource was available
+    int borrow;                        // 1 = departments borrow units of other departments when they have none
+    int districtCount;                 // districts of the city, each runs the configured departments and workload
+    int mutualAid;                     // 1 = a department with no unit in its district borrows from the same department of another district
+    TaskConfig tasks[NUM_TASK_KINDS];  // task priorities and stacks, indexed by TaskKind
+} SimParams;
+
+typedef struct {   // alias method table (Vose), one categorical draw in constant time
+    int n;
+    double prob[ALIAS_MAX];      // probability to keep the column's own outcome
+    uint8_t alias[ALIAS_MAX];    // the other outcome of the column
+} AliasTable;
+
+typedef struct {   // burst episode of a workload profile (mass-casualty incident, storm)
+    char name[32];                       // profile section name
+    double startSec;                     // first start (seconds from the start of the run)
+    double durationSec;
+    double repeatSec;                    // 0 = once
+    double multiplier;                   // arrival rate multiplier while active
+    uint32_t departments;                // bit (code - 1) set = the burst applies to the department
+    int hasPriorityMix;                  // 1 = the priority mix below replaces the department's while active
+    double priorityMix[MAX_PRIORITY];    // weights of priority 1, 2, 3
+} WorkloadBurst;
+
+typedef struct {   // parametric workload loaded from a profile file
+    double ratePerHour[MAX_DEPARTMENTS];                // base Poisson arrival rates, indexed by department code - 1
+    double priorityMix[MAX_DEPARTMENTS][MAX_PRIORITY];  // weights of priority 1, 2, 3
+    TimeDist handle[MAX_DEPARTMENTS];                  // handling time, the configured one unless the profile sets a range
+    double diurnal[DIURNAL_HOURS];                    // hourly rate multipliers
+    int burstCount;
+    WorkloadBurst bursts[PROFILE_MAX_BURSTS];
+} WorkloadProfile;
+
+typedef struct {   // arrival process state of a profile event source
+    double nowSec;                                   // arrival time of the last event
+    double segmentEndSec;                            // the rates are constant until this time
+    double rates[MAX_DEPARTMENTS];                   // events per second in the segment
+    double totalRate;
+    AliasTable departmentTable;                      // department draw, weighted by the rates
+    AliasTable priorityTable[MAX_DEPARTMENTS];       // priority draw per department
+} ProfileState;
+
+typedef int (*IniHandler)(void *ctx, const char *section, const char *key, const char *value);   // 1 = entry accepted
+
+typedef struct {   // read position in the mapped replay trace, one per replaying task
+    size_t offset;          // next record (bytes from the start of the file)
+    size_t released;        // trace bytes before this offset were released from memory
+    uint64_t lastTick;      // arrival time of the last decoded record (delta decoding)
+    unsigned long skipped;  // records with a department code or priority this build does not have
+    unsigned long index;    // records decoded so far
+    int first;              // the cursor returns records first, first + stride, ... (one district's share)
+    int stride;
+} ReplayCursor;
+
+typedef struct EventSource EventSource;
+
+struct EventSource {   // where generated events come from: the random workload, a workload profile or a replayed trace
+    int (*next)(EventSource *source, Event *evt, uint64_t *arrivalTick);   // 1 = next event and its arrival (model ticks), 0 = no more events
+    WorkloadRng rng;        // random source: the workload streams
+    uint64_t clock;         // random source: arrival of the next event
+    ReplayCursor cursor;    // replay source: position in the trace
+    ProfileState profile;   // profile source: arrival process (uses rng too)
+};
+
+typedef struct {   // scaled delay schedule of one task (time scale)
+    double carry;          // fraction of a tick carried to the next delay
+    OsTick wake;       // tick the previous delay was scheduled to end at
+    double dueNs;          // host wall time (ns) the previous delay was due
+    int started;           // 0 = the next delay starts a new schedule from now
+} SimTimer;
+
+typedef enum {   // discrete-event pending entry types, one per task delay or handler in the real-time mode
+    DES_GENERATE = 0,      // EventGeneratorTask wakes up with the next event (evt)
+    DES_DISPATCH,          // DispatcherTask wakes up
+    DES_DEPARTMENT_WAKE,   // DepartmentTask retry delay ends
+    DES_COMPLETE           // EventHandlerTask finishes handling
+} DesEntryType;
+
+typedef struct {   // discrete-event pending entry
+    uint64_t time;         // virtual time (ticks)
+    uint64_t seq;          // schedule order, breaks ties between entries at the same time
+    DesEntryType type;
+    int district;          // district index (DES_GENERATE, DES_DISPATCH, DES_DEPARTMENT_WAKE, DES_COMPLETE)
+    int code;              // department code (DES_DEPARTMENT_WAKE, DES_COMPLETE)
+    int unitFrom;          // department code the handling unit belongs to (DES_COMPLETE)
+    int unitDistrict;      // district the handling unit belongs to (DES_COMPLETE, another one after mutual aid)
+    Event evt;             // event being handled (DES_COMPLETE)
+} DesEntry;
+
+typedef struct {   // discrete-event department queue (same length as the FreeRTOS queue)
+    Event *items;          // queueLen entries of the department configuration
+    int capacity;
+    int head;
+    int count;
+} DesQueue;
+
+typedef struct {   // one district of the discrete-event model
+    Event *buffer;                         // the eventBuffer (simParams.bufferLen entries)
+    int bufferCapacity;
+    int bufferCount;
+    DesQueue queues[MAX_DEPARTMENTS];      // indexed by department code - 1
+    uint32_t freeUnits[MAX_DEPARTMENTS];
+    uint32_t retiring[MAX_DEPARTMENTS];    // busy units that retire instead of coming back (forecast of a shrunk fleet)
+    int sleeping[MAX_DEPARTMENTS];         // 1 while the department is in its retry delay
+    EventSource source;                    // random workload or replay, the same as the real-time generator
+} DesDistrict;
+
+typedef struct {   // discrete-event simulation state
+    uint64_t now;                          // virtual clock (ticks)
+    uint64_t seq;
+    DesEntry *heap;                        // pending-event priority queue (binary min heap on time, seq)
+    int heapCount;
+    int heapCapacity;
+    DesDistrict districts[MAX_DISTRICTS];  // simParams.districtCount districts
+    SystemMetrics *metrics;                // metrics sink of the run, systemMetrics or the private sink of a forecast
+    int forecast;                          // 1 = a forecast run next to the live tasks, nothing is recorded
+} DesState;
+
+typedef struct ActiveHandling {   // a unit busy with an event, published for forecasts (seqlock, written by its handler only)
+    uint32_t sequence;     // odd from handling_end() (and while free) until the next handler has written the slot
+    uint32_t active;       // 1 while the handling runs, the slot is free at 0
+    Event evt;             // the event, assignedTick is the start of the handling
+    int code;              // department handling the event
+    int unitCode;          // department that owns the unit (another one after a borrow)
+    int unitDistrict;      // district that owns the unit (another one after mutual aid)
+} ActiveHandling;
+
+typedef struct {   // a busy unit in a forecast snapshot
+    ActiveHandling handling;   // time stamps in model ticks
+    uint64_t doneTick;         // model time the handling ends
+} ForecastBusy;
+
+typedef struct {   // live state copied for a forecast, the time stamps in model ticks
+    uint64_t now;                                          // model time of the copy
+    Event *buffer;                                         // eventBuffer copies, simParams.bufferLen entries per district
+    int bufferCount[MAX_DISTRICTS];
+    uint32_t queueDepth[MAX_DISTRICTS][MAX_DEPARTMENTS];   // indexed by district, department code - 1
+    uint32_t freeUnits[MAX_DISTRICTS][MAX_DEPARTMENTS];
+    uint32_t retiring[MAX_DISTRICTS][MAX_DEPARTMENTS];
+    ForecastBusy *busy;                                    // units busy with an event
+    int busyCount;
+} ForecastSnapshot;
+
+typedef struct {   // what-if fleet change of a forecast scenario
+    int code;              // department code, 0 = no change
+    int district;          // district index
+    int delta;             // units added (negative: retired)
+} FleetChange;
+
+typedef struct {   // forecast command parameters
+    uint32_t minutes;      // horizon (model time)
+    FleetChange change;    // the what-if scenario, run next to the unchanged one
+} ForecastRequest;
+
+typedef struct {   // CPU share of a task (or of the EventWorker tasks of a department), in percent of one core
+    char name[24];
+    double shortPct;   // over the last CPU_WINDOW_SHORT samples
+    double longPct;    // over the last CPU_WINDOW_LONG samples
+} CpuShare;
+
+#define METRIC_INC(counter) __atomic_fetch_add(&(counter), 1, __ATOMIC_RELAXED)   // increment a metrics counter from any task
+
+extern SystemMetrics systemMetrics;   // metrics sink
+extern ProjectOptions projectOptions;
+extern SimParams simParams;   // model parameters of this run
+
+extern OsMutex xLogMutex;   
+extern OsMutex xHistoryMutex;   // guards the metrics history rings
+
+extern District *districts;   // the districts of the city, simParams.districtCount entries
+
+extern WorkloadProfile workloadProfile;   // the loaded workload profile (--profile)
 
 ///////////////////////////////// end Variables
 
@@ -89,32 +529,109 @@ extern int eventCount;   // pending events counter
  * @brief task function for generating random emergency calls (events).
  *
  * This task function simulates incoming emergency calls by creating random events
- * at random time intervals and inserting them into a shared priority event buffer (eventBuffer).
- * Events are categorized by department code (Police, Ambulance, Fire) and assigned a random priority.
+ * at random time intervals and inserting them into the priority event buffer (eventBuffer) of its district.
+ * Events are categorized by department code (one of the configured departments) and assigned a random priority.
  * 
- * @param pvParameters Not used. Pass NULL.
+ * @param pvParameters A pointer to the District the task generates events for.
  *
  * @return void
  * 
- * @note This task should be started during system initialization.
+ * @note This task should be started during system initialization, once per district.
  * 
- * @warning If the eventBuffer is full (reaches MAX_EVENTS), new events are dropped.
+ * @warning If the eventBuffer is full (reaches simParams.bufferLen), new events are dropped.
  */
 void EventGeneratorTask(void *pvParameters);
 
+/**
+ * @brief Function that creates a random event (department code, priority and handling time), without time stamps.
+ *
+ * Shared by EventGeneratorTask and the discrete-event engine. Every random property comes from its own
+ * stream, so a master seed gives the same workload in both modes, whatever the task interleaving.
+ *
+ * @param rng The workload streams of the calling task.
+ * @param[out] evt Receives the new event.
+ *
+ * @return void
+ */
+void generate_random_event(WorkloadRng *rng, Event *evt);
+
+/**
+ * @brief Function that draws the random time until the next generated event.
+ *
+ * @param rng The workload streams of the calling task.
+ *
+ * @return Time in ms, drawn from simParams.generationGap.
+ */
+uint32_t draw_generation_gap_ms(WorkloadRng *rng);
+
+/**
+ * @brief Function that prepares the event source of a generating task (EventGeneratorTask or the discrete-event engine).
+ *
+ * The source replays the trace opened with replay_open() when projectOptions.replayPath is set,
+ * draws the loaded workload profile when projectOptions.profilePath is set, otherwise it draws
+ * the built-in random workload. Random draws come from projectOptions.seed, every district has its own
+ * streams of it. With several districts, district n replays every districtCount-th record of the trace from record n.
+ *
+ * @param[out] source The event source.
+ * @param district The district index the source generates events for.
+ *
+ * @return void
+ */
+void event_source_init(EventSource *source, int district);
+
+/**
+ * @brief Function that takes one event of the --events limit before a generator draws the next event.
+ *
+ * The limit counts the events of all the districts (process wide), forecast runs do not take from it.
+ *
+ * @return integer that is 1 if the event may be generated, 0 once the limit is used up (always 1 without a limit).
+ */
+int event_limit_reserve(void);
+
+/**
+ * @brief Function that initializes the event source of a forecast run, starting at a given model time.
+ *
+ * Draws the loaded workload profile (at its rates of that time) or the random workload, from its own seed.
+ * A replay run forecasts with the random workload, the trace is read by the live generator only.
+ *
+ * @param[out] source The event source.
+ * @param district The district index the source generates events for.
+ * @param seed Master seed of the forecast run.
+ * @param startTick Model time of the first arrival draw.
+ *
+ * @return void
+ */
+void event_source_fork(EventSource *source, int district, uint64_t seed, uint64_t startTick);
+
+/**
+ * @brief Function that places an event in a priority ordered event buffer (highest priority first).
+ *
+ * No locking, the caller owns the buffer. insert_event() calls it under the district bufferMutex,
+ * the discrete-event engine calls it on its own buffer.
+ *
+ * @param buffer The event buffer.
+ * @param[in,out] count Number of events in the buffer.
+ * @param capacity Size of the buffer.
+ * @param evt The event to insert.
+ *
+ * @return integer that is 1 if the event was inserted, 0 if the buffer was full.
+ */
+int event_buffer_push(Event *buffer, int *count, int capacity, Event evt);
+
 /**
  * @brief Function to insert a generated event into the eventBuffer in descending priority order.
  *
- * This function adds a new emergency event to the global event buffer,
+ * This function adds a new emergency event to the event buffer of a district,
  * with a descending priority order (highest priority first).
- * If the buffer is full (`MAX_EVENTS` reached), the event is dropped.
+ * If the buffer is full (`simParams.bufferLen` reached), the event is dropped.
  *
  *
+ * @param district The district of the event.
  * @param evt The event to insert into the buffer.
  *
  * @warning If the event buffer is full, the event will be dropped.
  */
-void insert_event(Event evt);
+void insert_event(District *district, Event evt);
 
 /**
  * @brief Task function that dispatches the highest-priority event to the appropriate department queue.
@@ -122,9 +639,9 @@ void insert_event(Event evt);
  * This task  retrieves events from the eventBuffer and sends them to the correct department queue
  * (Police, Ambulance, or Fire Department) based on event code.
  *
- * @param pvParameters Not used. Pass NULL.
+ * @param pvParameters A pointer to the District the task dispatches for, only its own eventBuffer and departments are used.
  *
- * @note his task should be started during system initialization.
+ * @note his task should be started during system initialization, once per district.
  * 
  * @warning Dispatcher will delay an event when queues are full, dispatcher is blocked during the delay but does not indefinitely.
  */
@@ -136,11 +653,65 @@ void DispatcherTask(void *pvParameters);
  * This function takes the event with the highest priority from the eventBuffer.
  * Events are stored in descending priority order, so the first event is always the most urgent.
  *
+ * @param district The district whose eventBuffer is read.
  * @param[out] evtOut Pointer to an Event structure that will receive the result.
  *
  * @return integer that is 1 if an event was successfully retrieved, 0 if the buffer was empty.
  */
-int get_highest_priority_event(Event *evtOut);
+int get_highest_priority_event(District *district, Event *evtOut);
+
+/**
+ * @brief Function that removes the first (highest priority) event from a priority ordered event buffer.
+ *
+ * No locking, the caller owns the buffer (see event_buffer_push()).
+ *
+ * @param buffer The event buffer.
+ * @param[in,out] count Number of events in the buffer.
+ * @param[out] evtOut Receives the event.
+ *
+ * @return integer that is 1 if an event was removed, 0 if the buffer was empty.
+ */
+int event_buffer_pop(Event *buffer, int *count, Event *evtOut);
+
+/**
+ * @brief Function that draws the random handling time of an event.
+ *
+ * @param rng The workload streams of the calling task.
+ * @param code The department code of the event.
+ *
+ * @return Time in ms, drawn from the handling time distribution of the department.
+ */
+uint32_t draw_handling_time_ms(WorkloadRng *rng, int code);
+
+/**
+ * @brief Function that borrows a resource from another department, in the department's configured borrow order.
+ *
+ * The borrow policy is shared by DepartmentTask (semaphores) and the discrete-event engine (unit counters),
+ * only the way a unit is taken differs.
+ *
+ * @param code Code of the department that needs a resource.
+ * @param tryTake Function that takes one unit of the given department without blocking, returns 1 on success.
+ * @param ctx Context passed to tryTake.
+ *
+ * @return The code of the department the resource was borrowed from, 0 if none had a free resource.
+ */
+int borrow_unit(int code, int (*tryTake)(int code, void *ctx), void *ctx);
+
+/**
+ * @brief Function that borrows a unit of the same department from another district (mutual aid).
+ *
+ * Called only when the district has no unit left (own department and in-district borrowing),
+ * nearest districts first: district + 1, district - 1, district + 2, ... (the districts form a ring).
+ * Shared by DepartmentTask and the discrete-event engine like borrow_unit().
+ *
+ * @param district Index of the district that needs a unit.
+ * @param code Department code.
+ * @param tryTake Function that takes one unit of the department in the given district without blocking, returns 1 on success.
+ * @param ctx Context passed to tryTake.
+ *
+ * @return Index of the district that lent the unit, -1 if none had a free unit or mutual aid is off.
+ */
+int mutual_aid_unit(int district, int code, int (*tryTake)(int district, int code, void *ctx), void *ctx);
 
 /**
  * @brief Task function, per emergency department, that recives events and handles them.
@@ -175,6 +746,42 @@ void DepartmentTask(void *pvParameters);
  */
 void EventHandlerTask(void *pvParameters);
 
+/**
+ * @brief Function that changes the fleet size of a department while the system runs.
+ *
+ * Added units are given to the unit semaphore (a unit still waiting to retire goes back into service first).
+ * Removed units are taken from the semaphore when free; busy units are retired by their EventHandlerTask
+ * when it finishes, so an in-flight event is never cut short. Only atomic operations and non-blocking
+ * semaphore calls are used, the dispatcher and the department tasks never wait for a resize.
+ *
+ * @param params The department (of one district).
+ * @param units New fleet size, at most DEPARTMENT_MAX_UNITS (0 takes the department out of service).
+ *
+ * @return The previous fleet size, -1 if the size is invalid.
+ */
+int department_resize(DepartmentParams *params, uint32_t units);
+
+/**
+ * @brief Function that gives a unit back to its department when its handler is done with it.
+ *
+ * If the fleet shrank while the unit was busy, the unit is retired instead of given back.
+ *
+ * @param owner The department that owns the unit (of any district of this process).
+ *
+ * @return void
+ */
+void department_return_unit(DepartmentParams *owner);
+
+/**
+ * @brief Function that counts the units of a department that are handling an event.
+ *
+ * @param params The department (of one district).
+ * @param freeUnits Free units of the department (its semaphore count), as read by the caller.
+ *
+ * @return Busy units: the fleet size plus the units waiting to retire, minus the free ones.
+ */
+uint32_t department_busy_units(const DepartmentParams *params, uint32_t freeUnits);
+
 /**
  * @brief Task function that updates the terminal diapay with current system status and recent log messages.
  *
@@ -193,6 +800,88 @@ void EventHandlerTask(void *pvParameters);
  */
 void UpdateDisplayTask(void *pvParameters);
 
+/**
+ * @brief Function that copies a consistent snapshot of the system state for the status display.
+ *
+ * Copies the eventBuffer, the semaphore counts and the queue depths of each district under its bufferMutex,
+ * one district at a time, then the log ring under xLogMutex (the two are never held together).
+ * No formatting or I/O is done while the mutexes are held, so a slow terminal never stalls the other tasks.
+ * The time each mutex was held is recorded in the lock hold statistics.
+ *
+ * @param[out] snap Pointer to a StatusSnapshot structure that will receive the copy.
+ *
+ * @return void
+ */
+void take_status_snapshot(StatusSnapshot *snap);
+
+/**
+ * @brief Function that returns the hold time statistics of the snapshot critical sections.
+ *
+ * @param[out] logHold Receives the xLogMutex hold statistics (may be NULL).
+ * @param[out] bufferHold Receives the district bufferMutex hold statistics (may be NULL).
+ *
+ * @return void
+ */
+void get_display_lock_stats(LockHoldStats *logHold, LockHoldStats *bufferHold);
+
+/**
+ * @brief Function that selects the latency rows shown by the status display (latency console command).
+ *
+ * @param view The view, LATENCY_VIEW_TOTAL at start.
+ *
+ * @return void
+ */
+void set_display_latency_view(LatencyView view);
+
+/**
+ * @brief Function that returns the latency view shown by the status display.
+ */
+LatencyView get_display_latency_view(void);
+
+#if LOCK_PROFILE
+
+/**
+ * @brief Function that names a mutex or a counting semaphore for the lock contention profiler.
+ *
+ * Only named objects are profiled, the os_mutex_lock/unlock and os_semaphore_take/give calls of the others
+ * go straight to the backend. Call it after creating the object, before the tasks start.
+ *
+ * @param object The OsMutex or OsSemaphore.
+ * @param name Name in the report, e.g. "eventBuffer" (kept, not copied).
+ * @param district District of the object (shown when the city has districts), -1 for a global object.
+ *
+ * @return void
+ */
+void lock_profile_name(const void *object, const char *name, int district);
+
+/**
+ * @brief Function that prints the lock contention report.
+ *
+ * Mutexes: acquisitions, contended acquisitions (the mutex was held, the task had to wait), wait and hold
+ * time percentiles and the tasks that held the mutex longest. Semaphores: takes, failed takes and gives.
+ *
+ * @param out Stream to print to.
+ * @param compact 1 = one line per object (status display), 0 = with the top holders of each mutex (exit report).
+ *
+ * @return void
+ */
+void lock_profile_print(FILE *out, int compact);
+
+/**
+ * @brief Function that prints the lock contention report at exit (atexit() handler).
+ *
+ * On stdout after the run summary, on stderr with --json so the summary stays one JSON line.
+ *
+ * @return void
+ */
+void lock_profile_exit_report(void);
+
+#else
+
+#define lock_profile_name(object, name, district) ((void)0)   // built without the profiler: nothing is recorded
+
+#endif
+
 /**
  * @brief Logger function to display a message for each performed action in the system.
  *
@@ -205,6 +894,815 @@ void UpdateDisplayTask(void *pvParameters);
  */
 void log_message(const char *msg);
 
+/**
+ * @brief Function that records a value in a latency histogram.
+ *
+ * Lock-free, safe to call from any task. Values below 2^HIST_SUB_BITS are exact,
+ * larger values are kept with a relative precision of 2^-HIST_SUB_BITS.
+ *
+ * @param hist The histogram.
+ * @param value The value to record (ticks).
+ *
+ * @return void
+ */
+void histogram_record(LatencyHistogram *hist, uint32_t value);
+
+/**
+ * @brief Function that returns a percentile of a latency histogram.
+ *
+ * @param hist The histogram.
+ * @param percentile The percentile to compute, between 0 and 100.
+ *
+ * @return The highest value equivalent to the percentile bucket, 0 if the histogram is empty.
+ */
+uint32_t histogram_percentile(const LatencyHistogram *hist, double percentile);
+
+/**
+ * @brief Function that records the stage latencies of a completed event.
+ *
+ * Computes every LatencyStage from the event time stamps and records it in the overall,
+ * per priority and per department histograms of the metrics sink.
+ *
+ * @param evt The completed event (all time stamps set).
+ * @param code The code of the department that handled the event.
+ * @param completedTick The tick count when handling ended.
+ *
+ * @return void
+ */
+void record_event_latency(const Event *evt, int code, OsTick completedTick);
+
+/**
+ * @brief Function that records the stage latencies of a completed event whose time stamps are model ticks.
+ *
+ * Used by the discrete-event engine, whose clock is model time already (no time scale conversion).
+ *
+ * @param metrics The metrics sink (systemMetrics, or the private sink of a forecast).
+ * @param evt The completed event (all time stamps set, model ticks).
+ * @param code The code of the department that handled the event.
+ * @param completedTick The model tick when handling ended.
+ *
+ * @return void
+ */
+void record_model_latency(SystemMetrics *metrics, const Event *evt, int code, OsTick completedTick);
+
+/**
+ * @brief Function that reads the instantaneous system values without taking any mutex.
+ *
+ * @param[out] gauges Receives the pending events, fleet sizes, free units and queue depths, summed over the districts.
+ *
+ * @return void
+ */
+void read_system_gauges(SystemGauges *gauges);
+
+/**
+ * @brief Task function that samples the system every second into the metrics history.
+ *
+ * Samples the same values as the status display (pending calls, free units, queue lengths) plus
+ * throughput, drops, borrows and end-to-end latency. 1 s samples are kept for HISTORY_SECONDS,
+ * and are downsampled incrementally into 1 min (HISTORY_MINUTES) and 1 h (HISTORY_HOURS) rings.
+ * All memory is static, the history never grows.
+ *
+ * @param pvParameters Not used. Pass NULL.
+ *
+ * @return void
+ */
+void HistoryTask(void *pvParameters);
+
+/**
+ * @brief Function that exports a window of the metrics history to a CSV file.
+ *
+ * The window is copied out in short chunks under the history mutex and written to the file
+ * without holding it, so the simulation never stops during an export.
+ *
+ * @param level Resolution to export (HISTORY_1S, HISTORY_1M or HISTORY_1H).
+ * @param fromSec Window start, seconds since the program started.
+ * @param toSec Window end (exclusive), seconds since the program started.
+ * @param path Output CSV file path.
+ *
+ * @return Number of exported samples, -1 if the file cannot be written.
+ */
+int history_export_csv(HistoryLevel level, uint32_t fromSec, uint32_t toSec, const char *path);
+
+/**
+ * @brief Task function that reads console commands from stdin and runs them.
+ *
+ * Polls stdin every COMMAND_POLL_MS without blocking (like traceOnEnter()), so typing a command
+ * never stalls the simulation. "help" lists the available commands.
+ *
+ * @param pvParameters Not used. Pass NULL.
+ *
+ * @return void
+ */
+void CommandTask(void *pvParameters);
+
+/**
+ * @brief Function that prints a console command reply.
+ *
+ * Replies go to the log (shown by the status display), and to stdout in headless mode.
+ *
+ * @param fmt printf style format string.
+ *
+ * @return void
+ */
+void command_reply(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+/**
+ * @brief Function that prints the p50/p95/p99/max latency of every stage, and end-to-end per priority and per department.
+ *
+ * Reads the histograms without any lock, used by the status display and the run summary.
+ *
+ * @return void
+ */
+void print_latency_report(void);
+
+/**
+ * @brief Function that prints the p50/p95/p99/max latency rows of one view (see LatencyView).
+ *
+ * LATENCY_VIEW_TOTAL is print_latency_report(), the other views print every stage per priority or per department.
+ *
+ * @param view The rows to print.
+ *
+ * @return void
+ */
+void print_stage_latency(LatencyView view);
+
+/**
+ * @brief Function that prints the run summary as one line of flat JSON (--json).
+ *
+ * Model parameters, counters, throughput, drop rate and latency percentiles (model ticks), one key each,
+ * so parameter sweeps and scripts can read it without a JSON library.
+ *
+ * @return void
+ */
+void print_metrics_json(void);
+
+/**
+ * @brief Function that prints the run summary (throughput, drops, borrows and latency percentiles) from the metrics sink.
+ *
+ * Registered with atexit() at startup, so the summary is printed when the run time ends or on Ctrl+C.
+ *
+ * @return void
+ */
+void print_metrics_summary(void);
+
+/**
+ * @brief Function that creates and maps the POSIX shared memory status page (STATUS_PAGE_NAME).
+ *
+ * The page is removed with shm_unlink() when the program exits.
+ *
+ * @return integer that is 1 if the page is mapped, 0 on error (the error is printed).
+ */
+int status_page_create(void);
+
+/**
+ * @brief Task function that publishes the live counters to the shared memory status page.
+ *
+ * Every STATUS_PAGE_PERIOD_MS, reads the metrics sink, the semaphore counts, the queue depths and the
+ * latency percentiles without taking any mutex, and writes them to the page inside a seqlock.
+ * External monitors (tools/status_reader.c) read the page without any IPC round-trip.
+ *
+ * @param pvParameters Not used. Pass NULL.
+ *
+ * @return void
+ *
+ * @note status_page_create() must succeed before this task is created.
+ */
+void StatusPageTask(void *pvParameters);
+
+/**
+ * @brief Function that maps the shared memory link of a sharded city (projectOptions.shardLink).
+ *
+ * The launcher (tools/shards.c) creates and initializes the link; the shard checks its layout,
+ * registers its pid and creates the reply queues of its departments.
+ *
+ * @return integer that is 1 if the link is mapped, 0 on error (the error is printed).
+ */
+int shard_link_attach(void);
+
+/**
+ * @brief Task function that serves the shared memory link of a sharded city.
+ *
+ * Every SHARD_POLL_MS drains the rings from the other shards: lends a free unit for an aid request
+ * (non-blocking take), gives back the returned units and forwards the replies to the waiting departments.
+ * Every SHARD_PUBLISH_MS publishes the metrics of this shard to its slot of the link.
+ *
+ * @param pvParameters Not used. Pass NULL.
+ *
+ * @return void
+ *
+ * @note shard_link_attach() must succeed before this task is created.
+ */
+void ShardLinkTask(void *pvParameters);
+
+/**
+ * @brief Function that asks the other shards of the city for a unit of a department (mutual aid across processes).
+ *
+ * Called by DepartmentTask when its district and the other districts of this process have no free unit.
+ * Asks the shards nearest first, one at a time, and waits up to SHARD_AID_TIMEOUT_MS for each reply.
+ * A grant that arrives after the timeout is returned to its shard by the link task.
+ *
+ * @param params The department that needs a unit.
+ * @param[out] lender Receives the district (inside the lending shard) that owns the lent unit.
+ *
+ * @return index of the shard that lent a unit, -1 if none could (or the city is not sharded).
+ */
+int shard_request_aid(const DepartmentParams *params, int *lender);
+
+/**
+ * @brief Function that gives a unit lent by another shard back to it.
+ *
+ * @param shard Index of the lending shard.
+ * @param code Department code of the unit.
+ * @param lender District of the lending shard that owns the unit.
+ *
+ * @return void
+ */
+void shard_return_unit(int shard, int code, int lender);
+
+/**
+ * @brief Function that publishes the metrics of this shard to its slot of the shared memory link.
+ *
+ * Called periodically by ShardLinkTask and once more when the program exits, so the launcher always
+ * merges the final counts.
+ *
+ * @return void
+ */
+void shard_publish_metrics(void);
+
+/**
+ * @brief Function that allocates the table of busy units published for forecasts.
+ *
+ * @return integer that is 1 on success, 0 if the table could not be allocated (forecasts see no busy units).
+ */
+int forecast_init(void);
+
+/**
+ * @brief Function that publishes the start of a handling, so a forecast sees the busy unit.
+ *
+ * Lock-free: claims a free slot of the unit owner and writes it under its seqlock.
+ *
+ * @param evt The event, assignedTick set.
+ * @param code The department handling the event.
+ * @param unitDistrict District that owns the unit.
+ * @param unitCode Department that owns the unit.
+ *
+ * @return The slot to pass to handling_end(), NULL if not tracked.
+ */
+ActiveHandling *handling_begin(const Event *evt, int code, int unitDistrict, int unitCode);
+
+/**
+ * @brief Function that publishes the end of a handling.
+ *
+ * @param slot The handling_begin() result, NULL is ignored.
+ *
+ * @return void
+ */
+void handling_end(ActiveHandling *slot);
+
+/**
+ * @brief Function that copies the live state and starts a forecast in the background (ForecastTask).
+ *
+ * The copy holds each district bufferMutex as briefly as the status display does; queue depths,
+ * free units and busy units are read without locks.
+ *
+ * @param request The horizon and the what-if fleet change.
+ *
+ * @return integer that is 1 if the forecast started, 0 if one is still running, -1 on error.
+ */
+int forecast_start(const ForecastRequest *request);
+
+/**
+ * @brief Task function that runs the fast-forward simulations of a forecast and replies with the results.
+ *
+ * Runs FORECAST_RUNS discrete-event runs from the live state copy for the unchanged fleets and, when
+ * the request has one, for the what-if fleet change (the same seeds, so the scenarios differ by the change only).
+ * Replies with the predicted waiting calls at the horizon and the end-to-end latency percentiles.
+ *
+ * @param pvParameters The forecast job of forecast_start().
+ *
+ * @return void
+ */
+void ForecastTask(void *pvParameters);
+
+/**
+ * @brief Function that prepares the CPU sampler (the CSV log with --cpu-log).
+ *
+ * @return integer that is 1 on success, 0 if the log file could not be created.
+ */
+int cpu_stats_init(void);
+
+/**
+ * @brief Task function that samples the run time of every task once per CPU_SAMPLE_MS.
+ *
+ * Lists the tasks (os_task_list(), uxTaskGetSystemState() on FreeRTOS), groups them by name and the EventWorker
+ * tasks by department, and keeps the run time of each group per sample in a ring, for the shares over
+ * the CPU_WINDOW_SHORT and CPU_WINDOW_LONG windows. The run time of EventWorker tasks that ended between
+ * two samples comes from cpu_stats_worker_done(). With --cpu-log every sample is appended to the CSV file,
+ * with --stack-report the stack high-water marks of the listed tasks go to stack_stats_sample().
+ *
+ * @param pvParameters Not used.
+ *
+ * @return void
+ */
+void CpuStatsTask(void *pvParameters);
+
+/**
+ * @brief Function that adds the run time of the calling EventWorker task to its department, right before it ends.
+ *
+ * @param code Department code of the worker.
+ *
+ * @return void
+ */
+void cpu_stats_worker_done(int code);
+
+/**
+ * @brief Function that returns the top CPU consumers, by their share over the short window.
+ *
+ * @param[out] top Receives up to max shares, largest first.
+ * @param max Size of the top array.
+ *
+ * @return The number of shares, 0 before the first two samples.
+ */
+int cpu_stats_top(CpuShare *top, int max);
+
+/**
+ * @brief Function that notes a created task for the stack report (--stack-report, no effect without it).
+ *
+ * Keeps the stack of the task kind and the task name, so the sampled tasks can be counted to their kind.
+ *
+ * @param name The task name.
+ * @param kind The task kind.
+ * @param stackWords The stack the task was created with.
+ *
+ * @return void
+ */
+void stack_stats_task_created(const char *name, TaskKind kind, uint32_t stackWords);
+
+/**
+ * @brief Function that takes the stack high-water marks of the tasks of one CPU sample (CpuStatsTask).
+ *
+ * @param tasks The listed tasks.
+ * @param count Number of tasks.
+ *
+ * @return void
+ */
+void stack_stats_sample(const OsTaskInfo *tasks, int count);
+
+/**
+ * @brief Function that takes the stack high-water mark of the calling task right before it ends (--stack-report only).
+ *
+ * Short tasks (EventWorker, Forecast) mostly start and end between two samples.
+ *
+ * @param kind Kind of the calling task.
+ *
+ * @return void
+ */
+void stack_stats_task_done(TaskKind kind);
+
+/**
+ * @brief Function that prints the peak stack use of each task kind and writes the suggested stacks (atexit() handler).
+ *
+ * The suggestion is the peak use plus STACK_HEADROOM_PCT, rounded up to STACK_ROUND_WORDS and at least
+ * OS_MIN_STACK_WORDS, written to the --stack-report file as a [tasks] section that --config loads.
+ *
+ * @return void
+ */
+void stack_stats_exit_report(void);
+
+/**
+ * @brief Function that names an EventWorker task after its department ("W:Police").
+ *
+ * @param[out] name Receives the task name.
+ * @param size Size of name.
+ * @param code Department code.
+ *
+ * @return name
+ */
+const char *worker_task_name(char *name, size_t size, int code);
+
+/**
+ * @brief Function that initializes a discrete-event simulation state (empty buffers, all units free).
+ *
+ * @param[out] state The simulation state.
+ *
+ * @return void
+ */
+void des_init(DesState *state);
+
+/**
+ * @brief Function that initializes a discrete-event state from a copy of the live state (forecast run).
+ *
+ * The eventBuffers and fleets are the copied ones, the busy units complete at their remaining handling time.
+ * Department queue contents are not visible through the queues: the copied depths are filled with events
+ * drawn from the workload, queued at the time of the copy.
+ *
+ * @param[out] state The simulation state.
+ * @param snap The live state copy.
+ * @param change What-if fleet change, NULL or code 0 for none.
+ * @param seed Master seed of the run's workload.
+ * @param metrics The private metrics sink of the forecast.
+ *
+ * @return void
+ */
+void des_init_forecast(DesState *state, const ForecastSnapshot *snap, const FleetChange *change, uint64_t seed, SystemMetrics *metrics);
+
+/**
+ * @brief Function that runs the discrete-event simulation until the given virtual time.
+ *
+ * Pops the earliest pending entry, jumps the virtual clock to it and runs the matching task logic,
+ * which schedules its next wake up. Metrics and latencies go to the metrics sink of the state (systemMetrics after des_init()).
+ *
+ * @param state The simulation state.
+ * @param untilTick Virtual time (ticks) to stop at.
+ *
+ * @return void
+ */
+void des_run(DesState *state, uint64_t untilTick);
+
+/**
+ * @brief Function that frees the memory of a discrete-event simulation state.
+ *
+ * @param state The simulation state.
+ *
+ * @return void
+ */
+void des_free(DesState *state);
+
+/**
+ * @brief Function that runs the whole discrete-event mode (--des) for projectOptions.simHours of virtual time.
+ *
+ * @return void
+ */
+void run_discrete_event_simulation(void);
+
+/**
+ * @brief Function that returns the simulation time, in ticks.
+ *
+ * @return The virtual clock after a discrete-event run, the OS tick count times the time scale otherwise.
+ */
+uint64_t simulation_now_ticks(void);
+
+/**
+ * @brief Function that seeds a random generator with one stream of a master seed.
+ *
+ * Different streams of the same seed never overlap (xoshiro jump), the same seed and stream
+ * always give the same numbers.
+ *
+ * @param[out] rng The generator state.
+ * @param seed The master seed.
+ * @param stream The stream number (RngStream).
+ *
+ * @return void
+ */
+void rng_seed(RngState *rng, uint64_t seed, uint32_t stream);
+
+/**
+ * @brief Function that returns the next 64 random bits of a generator.
+ *
+ * @param rng The generator state.
+ *
+ * @return 64 random bits.
+ */
+uint64_t rng_next(RngState *rng);
+
+/**
+ * @brief Function that returns an unbiased random integer below a bound.
+ *
+ * @param rng The generator state.
+ * @param bound Upper bound (exclusive), greater than 0.
+ *
+ * @return Random integer in [0, bound).
+ */
+uint32_t rng_below(RngState *rng, uint32_t bound);
+
+/**
+ * @brief Function that returns a random double in [0, 1).
+ *
+ * @param rng The generator state.
+ *
+ * @return Random double in [0, 1).
+ */
+double rng_uniform(RngState *rng);
+
+/**
+ * @brief Function that seeds the workload streams (RngStream) of a task with a master seed.
+ *
+ * @param[out] rng The workload streams.
+ * @param seed The master seed.
+ * @param district District index, every district draws from its own streams (district 0 from the first ones).
+ *
+ * @return void
+ */
+void workload_rng_init(WorkloadRng *rng, uint64_t seed, int district);
+
+/**
+ * @brief Function that reads an INI style file and passes every key = value entry to a handler.
+ *
+ * Errors (missing file, bad line, entry rejected by the handler) are printed with the file and line.
+ *
+ * @param path The file.
+ * @param handler Called with the current section ("" before the first one), the key and the value.
+ * @param ctx Passed to the handler.
+ *
+ * @return integer that is 1 if the whole file was read, 0 on error.
+ */
+int ini_parse(const char *path, IniHandler handler, void *ctx);
+
+/**
+ * @brief Function that parses a comma separated list of numbers.
+ *
+ * @param value The text.
+ * @param[out] out Receives the numbers.
+ * @param max Size of out.
+ *
+ * @return The number of values, -1 if the text is not a list of at most max numbers.
+ */
+int ini_parse_list(const char *value, double *out, int max);
+
+/**
+ * @brief Function that maps a department key of the configuration ("police", "ambulance", "fire", any case) to its code.
+ *
+ * @param name The department key.
+ *
+ * @return The department code, 0 if no configured department has the key.
+ */
+int department_code_from_name(const char *name);
+
+/**
+ * @brief Function that loads a configuration file into simParams, replacing the built-in configuration.
+ *
+ * Sections: [system] with buffer_len, generation_gap_ms, dispatch_ms, send_timeout_ms, retry_ms, borrow;
+ * [department <key>] with name, label, units, queue_len, handle_ms, weight, borrow_from (the first
+ * department section replaces the built-in departments, codes follow the file order); [tasks] with
+ * <task>_priority and <task>_stack. Times are "constant <ms>", "uniform <min> <max>" or
+ * "exponential <mean> [<max>]". Missing values keep the built-in defaults.
+ *
+ * @param path The configuration file.
+ *
+ * @return integer that is 1 if the configuration was loaded and is valid, 0 on error (printed).
+ */
+int config_load(const char *path);
+
+/**
+ * @brief Function that creates a task with the configured priority and stack of its kind.
+ *
+ * @param code The task function.
+ * @param name The task name.
+ * @param kind The task kind (simParams.tasks entry).
+ * @param params The task parameter.
+ *
+ * @return The os_task_create() result, 1 if the task was created.
+ */
+int task_create(OsTaskFunction code, const char *name, TaskKind kind, void *params);
+
+/**
+ * @brief Function that returns the configuration key of a task kind ("handler" for handler_priority and handler_stack).
+ */
+const char *task_kind_key(TaskKind kind);
+
+/**
+ * @brief Function that draws a random time from a configured distribution.
+ *
+ * @param dist The distribution.
+ * @param rng The generator state.
+ *
+ * @return Time in ms.
+ */
+uint32_t time_dist_draw(const TimeDist *dist, RngState *rng);
+
+/**
+ * @brief Function that returns the mean of a configured time distribution.
+ *
+ * @param dist The distribution.
+ *
+ * @return Mean time in ms.
+ */
+double time_dist_mean(const TimeDist *dist);
+
+/**
+ * @brief Function that builds an alias table from (not normalized) weights.
+ *
+ * @param[out] table The alias table.
+ * @param weights Outcome weights, all 0 gives a uniform table.
+ * @param n Number of outcomes, at most ALIAS_MAX.
+ *
+ * @return void
+ */
+void alias_build(AliasTable *table, const double *weights, int n);
+
+/**
+ * @brief Function that draws an outcome from an alias table with one random number.
+ *
+ * @param table The alias table.
+ * @param rng The generator state.
+ *
+ * @return The outcome, 0 to n - 1.
+ */
+int alias_draw(const AliasTable *table, RngState *rng);
+
+/**
+ * @brief Function that loads a workload profile file into workloadProfile.
+ *
+ * Sections: [department <key>] (a configured department) with rate_per_hour, priority_mix, handle_ms;
+ * [diurnal] with curve (24 hourly multipliers); [burst <name>] with start_h, duration_min,
+ * repeat_h, multiplier, departments, priority_mix. Missing values keep the built-in workload.
+ *
+ * @param path The profile file.
+ *
+ * @return integer that is 1 if the profile was loaded, 0 on error (printed).
+ */
+int profile_load(const char *path);
+
+/**
+ * @brief Function that starts the arrival process of a profile event source.
+ *
+ * @param[out] s The arrival process state.
+ * @param startSec Model time (seconds) the process starts at, 0 for a run from the start.
+ *
+ * @return void
+ */
+void profile_state_init(ProfileState *s, double startSec);
+
+/**
+ * @brief Function that draws the next event of the workload profile.
+ *
+ * @param s The arrival process state.
+ * @param rng The workload streams (gaps: arrivals, events: department and priority, service: handling time).
+ * @param[out] evt Receives the event (no time stamps).
+ * @param[out] arrivalTick Receives the arrival time (model ticks from the start of the run).
+ *
+ * @return integer that is 1 if an event was drawn, 0 if the profile rate stays 0.
+ */
+int profile_next(ProfileState *s, WorkloadRng *rng, Event *evt, uint64_t *arrivalTick);
+
+/**
+ * @brief Function that memory-maps a trace file (event_record.h format) for replay and checks its header.
+ *
+ * @param path The trace file.
+ *
+ * @return integer that is 1 if the trace was mapped, 0 otherwise.
+ */
+int replay_open(const char *path);
+
+/**
+ * @brief Function that places a replay cursor at the first record of the mapped trace.
+ *
+ * The cursor returns the records first, first + stride, first + 2 * stride ... (one district of a city
+ * replays its share of a trace), stride 1 returns every record.
+ *
+ * @param[out] cursor The replay cursor.
+ * @param first Index of the first record returned.
+ * @param stride Record index step.
+ *
+ * @return void
+ */
+void replay_cursor_init(ReplayCursor *cursor, int first, int stride);
+
+/**
+ * @brief Function that decodes the next event of the mapped trace.
+ *
+ * Records with a department code or priority outside this build's range are skipped and counted.
+ * The arrival time is converted to this build's tick rate and divided by projectOptions.replaySpeed.
+ *
+ * @param cursor The replay cursor.
+ * @param[out] evt Receives the event (no time stamps).
+ * @param[out] arrivalTick Receives the arrival time (model ticks from the start of the trace).
+ *
+ * @return integer that is 1 if an event was decoded, 0 at the end of the trace.
+ */
+int replay_next(ReplayCursor *cursor, Event *evt, uint64_t *arrivalTick);
+
+/**
+ * @brief Function that opens the recording file (event_record.h format) and writes its header.
+ *
+ * The file is completed and closed by an atexit() handler, which also prints the record count.
+ *
+ * @param path The recording file.
+ *
+ * @return integer that is 1 if the file was opened, 0 otherwise.
+ */
+int recorder_open(const char *path);
+
+/**
+ * @brief Function that creates the recorder stream buffer and RecorderTask (real-time mode).
+ *
+ * Without it (discrete-event mode) record_event() encodes the records in line.
+ *
+ * @return void
+ */
+void recorder_start(void);
+
+/**
+ * @brief Function that records a generated event, if recording.
+ *
+ * Does not wait for the recorder and does no file I/O in the real-time mode, the record goes through a stream
+ * buffer to RecorderTask (a full stream buffer loses the record and counts it). The generators of the districts
+ * take turns on a short mutex, a stream buffer has one writer. The recorded arrival times never go back: a record
+ * that overtook another generator's later one gets that later time.
+ *
+ * @param evt The generated event.
+ * @param arrivalTick Arrival time in model ticks (simulation_now_ticks() in real time).
+ *
+ * @return void
+ */
+void record_event(const Event *evt, uint64_t arrivalTick);
+
+/**
+ * @brief Task function that encodes the recorded events and writes them to the recording file.
+ *
+ * @param pvParameters Unused.
+ *
+ * @return void
+ */
+void RecorderTask(void *pvParameters);
+
+/**
+ * @brief Function that converts a model delay to ticks, divided by the time scale (projectOptions.timeScale).
+ *
+ * The fraction of a tick that does not fit is kept in the caller's carry and added to the next conversion,
+ * so short scaled delays keep their average length instead of rounding to zero.
+ *
+ * @param ms Model delay (ms).
+ * @param[in,out] carry Fraction of a tick carried between conversions, owned by the calling task (start at 0).
+ *
+ * @return The scaled delay in ticks.
+ */
+OsTick sim_ms_to_ticks(uint32_t ms, double *carry);
+
+/**
+ * @brief Function that delays the calling task for a scaled model delay and checks that it keeps up.
+ *
+ * Delays chain from the previous scheduled wake up (os_delay_until), so a task that runs in a loop keeps
+ * an exact schedule. The schedule is also followed on the host clock: a task more than SIM_LAG_WARN_MS
+ * behind it counts as a late wake-up in the metrics and logs a warning (at most one per
+ * SIM_LAG_WARN_INTERVAL_MS), the POSIX port cannot keep up with the time scale.
+ *
+ * @param timer The task's schedule (zero initialized before the first delay).
+ * @param ms Model delay (ms).
+ *
+ * @return void
+ */
+void sim_delay_ms(SimTimer *timer, uint32_t ms);
+
+/**
+ * @brief Function that makes the next sim_delay_ms() start from now, after the task blocked on something else.
+ *
+ * @param timer The task's schedule.
+ *
+ * @return void
+ */
+void sim_timer_restart(SimTimer *timer);
+
+/**
+ * @brief Function that converts a real tick difference to simulated (model) ticks.
+ *
+ * @param ticks Tick difference measured with os_tick_count().
+ *
+ * @return The tick difference multiplied by the time scale.
+ */
+uint32_t sim_ticks_from_real(OsTick ticks);
+
+/**
+ * @brief Function that parses the command line run options into projectOptions.
+ *
+ * Supported options:
+ * --headless        do not create the status display task, only print the summary at exit
+ * --duration <sec>  exit after the given run time (seconds)
+ * --status-page     publish the live counters to the shared memory status page
+ * --des             discrete-event mode, run in virtual time and print the summary
+ * --sim-hours <h>   simulated hours of a discrete-event run (default DES_DEFAULT_HOURS)
+ * --time-scale <x>  run the model x times faster than real time
+ * --seed <n>        master seed of the workload, the same seed gives the same workload
+ * --record <file>   record the generated events to a binary file (event_record.h)
+ * --replay <file>   replay a recorded trace instead of the random workload
+ * --replay-speed <x> divide the replayed arrival offsets by x
+ * --replay-fast     replay as fast as the system takes the events
+ * --profile <file>  draw the workload from a profile file (Poisson rates, priority mixes, bursts, diurnal curve)
+ * --config <file>   load the configuration file (config_load()) before the other options
+ * --<department> <n>, --queue-len <n>, --buffer-len <n>, --dispatch-ms <ms>, --retry-ms <ms>
+ *                   override the model parameters (simParams)
+ * --json            print the run summary as one JSON object
+ * --help            print the usage and exit
+ *
+ * @param argc Argument count from main().
+ * @param argv Argument vector from main().
+ *
+ * @return void
+ *
+ * @warning An unknown option prints the usage and exits the program.
+ */
+void parse_project_options(int argc, char **argv);
+
+/**
+ * @brief User application main, creates all queues, semaphores and tasks and starts the scheduler.
+ *
+ * @param argc Argument count from main().
+ * @param argv Argument vector from main().
+ *
+ * @return void, the scheduler does not return.
+ */
+void main_city_emergency_project(int argc, char **argv);
+
 ///////////////////////////////// end Function Signatures
 
 #endif
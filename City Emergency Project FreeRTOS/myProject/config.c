@@ -0,0 +1,312 @@
+/**
+******************************************************************************
+* @file           : config.c
+* @author         : Nimrod Elstein
+* @brief          : Source code related to the runtime configuration (departments, sizing, timing, tasks)
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* simParams starts as the built-in configuration (the #define values). A
+* configuration file (--config) replaces any part of it, then the command line
+* options override single values. Everything sized by the configuration (queues,
+* semaphores, eventBuffers, department parameters of every district) is allocated once at startup.
+*
+******************************************************************************
+*/
+
+#include "city_emergency_project.h"
+#include <ctype.h>
+
+#define HANDLE_DEFAULT { DIST_UNIFORM, DEPARTMENT_HANDLE_TIME_MIN_MS, DEPARTMENT_HANDLE_TIME_MAX_MS, 0 }
+
+SimParams simParams = {   // the built-in configuration
+    .departmentCount = 3,
+    .departments = {
+        { "Police", "Police", "police", MAX_POLICE, DEPARTMENT_QUEUE_LEN, HANDLE_DEFAULT, 1.0, { CODE_FIRE, CODE_AMBULANCE }, 2 },
+        { "Ambulance", "Ambulance", "ambulance", MAX_AMBULANCE, DEPARTMENT_QUEUE_LEN, HANDLE_DEFAULT, 1.0, { CODE_POLICE, CODE_FIRE }, 2 },
+        { "Fire Department", "Fire", "fire", MAX_FIRE, DEPARTMENT_QUEUE_LEN, HANDLE_DEFAULT, 1.0, { CODE_POLICE, CODE_AMBULANCE }, 2 },
+    },
+    .bufferLen = MAX_EVENTS,
+    .generationGap = { DIST_UNIFORM, EVENT_GEN_TIME_MIN_MS, EVENT_GEN_TIME_MAX_MS, 0 },
+    .dispatchMs = DISPATCH_TIME_CONST_MS,
+    .sendTimeoutMs = DISPATCH_SEND_TIMEOUT_MS,
+    .retryMs = DEPARTMENT_RETRY_DELAY_MS,
+    .borrow = 1,
+    .districtCount = 1,
+    .mutualAid = 1,
+    .tasks = {
+        [TASK_GENERATOR] = { 2, TASK_STACK_DEFAULT },
+        [TASK_DISPATCHER] = { 3, TASK_STACK_DEFAULT },   // above the generator and the departments
+        [TASK_DEPARTMENT] = { 2, TASK_STACK_DEFAULT },
+        [TASK_HANDLER] = { 2, TASK_STACK_DEFAULT },
+        [TASK_DISPLAY] = { 1, TASK_STACK_DEFAULT },
+        [TASK_HISTORY] = { 1, TASK_STACK_DEFAULT },
+        [TASK_COMMANDS] = { 1, TASK_STACK_DEFAULT },
+        [TASK_STATUS_PAGE] = { 1, TASK_STACK_DEFAULT },
+        [TASK_RECORDER] = { 1, TASK_STACK_DEFAULT },
+        [TASK_SHARD_LINK] = { 3, TASK_STACK_DEFAULT },   // answers the other shards while the departments wait
+        [TASK_FORECAST] = { 1, TASK_STACK_DEFAULT },     // background what-if runs, below the model tasks
+        [TASK_CPU_STATS] = { 4, TASK_STACK_DEFAULT },    // short, above the model tasks so a busy system still gets sampled
+    },
+};
+
+static const char *taskKeys[NUM_TASK_KINDS] = { "generator", "dispatcher", "department", "handler", "display",
+                                                 "history", "commands", "status_page", "recorder", "shard_link", "forecast",
+                                                 "cpu_stats" };   // indexed by TaskKind
+
+static char borrowSpec[MAX_DEPARTMENTS][INI_LINE_LEN];   // borrow_from lists, resolved once every department is known
+
+int department_code_from_name(const char *name) {
+
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        if (strcasecmp(name, simParams.departments[d].key) == 0) {
+            return d + 1;
+        }
+    }
+
+    return 0;
+}
+
+static int parse_uint(const char *value, uint32_t *out) {   // the whole value is a number, 0 to UINT32_MAX
+
+    char *end = NULL;
+    unsigned long number = strtoul(value, &end, 10);
+
+    if (*value < '0' || *value > '9' || *end != '\0' || number > UINT32_MAX) return 0;   // strtoul takes "-5" and wraps it
+    *out = (uint32_t)number;
+    return 1;
+}
+
+static int parse_count(const char *value, uint32_t *out) {   // positive integer
+
+    uint32_t number;
+
+    if (!parse_uint(value, &number) || number == 0) return 0;
+    *out = number;
+    return 1;
+}
+
+static int parse_time_dist(const char *value, TimeDist *dist) {   // "constant 1500", "uniform 1000 2000", "exponential 5000 60000"
+
+    char kind[16] = "";
+    unsigned long a = 0, b = 0;
+    char extra;
+
+    memset(dist, 0, sizeof(*dist));
+
+    if (sscanf(value, "%lu %c", &a, &extra) == 1 || (sscanf(value, "%15s %lu %c", kind, &a, &extra) == 2 && strcmp(kind, "constant") == 0)) {
+        dist->kind = DIST_CONSTANT;
+        dist->minMs = dist->maxMs = dist->meanMs = (uint32_t)a;
+        return 1;
+    }
+
+    int n = sscanf(value, "%15s %lu %lu %c", kind, &a, &b, &extra);
+
+    if (strcmp(kind, "uniform") == 0 && n == 3 && a <= b) {
+        dist->kind = DIST_UNIFORM;
+        dist->minMs = (uint32_t)a;
+        dist->maxMs = (uint32_t)b;
+        dist->meanMs = (uint32_t)((a + b) / 2);
+        return 1;
+    }
+    if (strcmp(kind, "exponential") == 0 && (n == 2 || n == 3) && a > 0 && (n == 2 || b >= a)) {
+        dist->kind = DIST_EXPONENTIAL;
+        dist->meanMs = (uint32_t)a;
+        dist->maxMs = n == 3 ? (uint32_t)b : 0;
+        return 1;
+    }
+
+    return 0;
+}
+
+static int parse_switch(const char *value, int *out) {
+
+    if (strcmp(value, "on") == 0 || strcmp(value, "1") == 0) *out = 1;
+    else if (strcmp(value, "off") == 0 || strcmp(value, "0") == 0) *out = 0;
+    else return 0;
+    return 1;
+}
+
+static int department_entry(int *replaced, const char *name, const char *key, const char *value) {
+
+    int code = department_code_from_name(name);
+
+    if (!*replaced) {   // the first department section of the file replaces the built-in departments
+        simParams.departmentCount = 0;
+        *replaced = 1;
+        code = 0;
+    }
+
+    if (code == 0) {   // first entry of a new department, the built-in defaults of a department
+        if (simParams.departmentCount == MAX_DEPARTMENTS || strlen(name) >= DEPARTMENT_KEY_LEN) return 0;
+        for (const char *c = name; *c != '\0'; c++) {
+            if (!isalnum((unsigned char)*c) && *c != '_') return 0;   // the key is also a command line option and a JSON key
+        }
+        DepartmentConfig *dept = &simParams.departments[simParams.departmentCount++];
+        memset(dept, 0, sizeof(*dept));
+        strcpy(dept->key, name);   // the length is checked above, name and label are longer than the key
+        strcpy(dept->name, name);
+        dept->name[0] = (char)toupper((unsigned char)dept->name[0]);
+        strcpy(dept->label, dept->name);
+        dept->units = 1;
+        dept->queueLen = DEPARTMENT_QUEUE_LEN;
+        dept->handle = (TimeDist)HANDLE_DEFAULT;
+        dept->weight = 1.0;
+        borrowSpec[simParams.departmentCount - 1][0] = '\0';   // default: borrow from all the others, in code order
+        code = simParams.departmentCount;
+    }
+
+    DepartmentConfig *dept = &simParams.departments[code - 1];
+
+    if (strcmp(key, "name") == 0) {
+        return snprintf(dept->name, sizeof(dept->name), "%s", value) < (int)sizeof(dept->name);
+    }
+    if (strcmp(key, "label") == 0) {
+        return snprintf(dept->label, sizeof(dept->label), "%s", value) < (int)sizeof(dept->label);
+    }
+    if (strcmp(key, "units") == 0) {
+        return parse_count(value, &dept->units);
+    }
+    if (strcmp(key, "queue_len") == 0) {
+        return parse_count(value, &dept->queueLen);
+    }
+    if (strcmp(key, "handle_ms") == 0) {
+        return parse_time_dist(value, &dept->handle);
+    }
+    if (strcmp(key, "weight") == 0) {
+        return ini_parse_list(value, &dept->weight, 1) == 1 && dept->weight >= 0;
+    }
+    if (strcmp(key, "borrow_from") == 0) {   // comma separated keys, "none" for no borrowing
+        snprintf(borrowSpec[code - 1], sizeof(borrowSpec[code - 1]), "%s", value);
+        return 1;
+    }
+
+    return 0;
+}
+
+static int config_entry(void *ctx, const char *section, const char *key, const char *value) {
+
+    int *replaced = (int *)ctx;
+    char name[INI_LINE_LEN];
+
+    if (sscanf(section, "department %s", name) == 1) {   // [department police]
+        return department_entry(replaced, name, key, value);
+    }
+
+    if (strcmp(section, "system") == 0) {
+        if (strcmp(key, "buffer_len") == 0) return parse_count(value, &simParams.bufferLen);
+        if (strcmp(key, "generation_gap_ms") == 0) return parse_time_dist(value, &simParams.generationGap);
+        if (strcmp(key, "dispatch_ms") == 0) return parse_uint(value, &simParams.dispatchMs);
+        if (strcmp(key, "send_timeout_ms") == 0) return parse_uint(value, &simParams.sendTimeoutMs);
+        if (strcmp(key, "retry_ms") == 0) return parse_count(value, &simParams.retryMs);
+        if (strcmp(key, "borrow") == 0) return parse_switch(value, &simParams.borrow);
+        if (strcmp(key, "districts") == 0) {
+            uint32_t count;
+            if (!parse_count(value, &count) || count > MAX_DISTRICTS) return 0;
+            simParams.districtCount = (int)count;
+            return 1;
+        }
+        if (strcmp(key, "mutual_aid") == 0) return parse_switch(value, &simParams.mutualAid);
+        return 0;
+    }
+
+    if (strcmp(section, "tasks") == 0) {   // dispatcher_priority = 3, handler_stack = 65536
+        for (int t = 0; t < NUM_TASK_KINDS; t++) {
+            size_t length = strlen(taskKeys[t]);
+            if (strncmp(key, taskKeys[t], length) != 0) continue;
+            if (strcmp(key + length, "_priority") == 0) {
+                uint32_t priority;
+                if (!parse_uint(value, &priority) || priority >= OS_MAX_PRIORITIES) return 0;
+                simParams.tasks[t].priority = priority;
+                return 1;
+            }
+            if (strcmp(key + length, "_stack") == 0) {
+                return parse_count(value, &simParams.tasks[t].stackWords) && simParams.tasks[t].stackWords >= OS_MIN_STACK_WORDS;
+            }
+        }
+        return 0;
+    }
+
+    return 0;
+}
+
+static int resolve_borrow_order(const char *path) {
+
+    for (int d = 0; d < simParams.departmentCount; d++) {
+
+        DepartmentConfig *dept = &simParams.departments[d];
+        char copy[sizeof(borrowSpec[0])], *save = NULL;
+
+        dept->borrowCount = 0;
+
+        if (borrowSpec[d][0] == '\0') {   // not given: all the other departments, in code order
+            for (int other = 0; other < simParams.departmentCount; other++) {
+                if (other != d) dept->borrowFrom[dept->borrowCount++] = other + 1;
+            }
+            continue;
+        }
+        if (strcmp(borrowSpec[d], "none") == 0) {
+            continue;
+        }
+
+        memcpy(copy, borrowSpec[d], sizeof(copy));
+        for (char *tok = strtok_r(copy, ", ", &save); tok != NULL; tok = strtok_r(NULL, ", ", &save)) {
+            int code = department_code_from_name(tok);
+            if (code == 0 || code == d + 1 || dept->borrowCount == MAX_DEPARTMENTS) {
+                fprintf(stderr, "%s: [department %s] borrow_from: '%s' is not another department\n", path, dept->key, tok);
+                return 0;
+            }
+            dept->borrowFrom[dept->borrowCount++] = code;
+        }
+    }
+
+    return 1;
+}
+
+int config_load(const char *path) {
+
+    int replaced = 0;   // 1 once the file defines its own departments
+
+    for (int d = 0; d < MAX_DEPARTMENTS; d++) {
+        borrowSpec[d][0] = '\0';
+    }
+
+    if (!ini_parse(path, config_entry, &replaced)) {
+        return 0;
+    }
+
+    if (!replaced) {   // only system and task settings, the built-in departments keep their borrow order
+        return 1;
+    }
+
+    double weights = 0;
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        weights += simParams.departments[d].weight;
+    }
+    if (weights <= 0) {
+        fprintf(stderr, "%s: every department has weight 0, the random workload has no events\n", path);
+        return 0;
+    }
+
+    return resolve_borrow_order(path);
+}
+
+int task_create(OsTaskFunction code, const char *name, TaskKind kind, void *params) {
+
+    const TaskConfig *task = &simParams.tasks[kind];
+    uint32_t stack = task->stackWords != TASK_STACK_DEFAULT ? task->stackWords : OS_MIN_STACK_WORDS * 4;
+
+    if (!os_task_create(code, name, stack, params, task->priority)) {
+        return 0;
+    }
+    stack_stats_task_created(name, kind, stack);   // only with --stack-report
+    return 1;
+}
+
+const char *task_kind_key(TaskKind kind) {
+
+    return taskKeys[kind];
+}
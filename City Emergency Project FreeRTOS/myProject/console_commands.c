@@ -0,0 +1,301 @@
+/**
+******************************************************************************
+* @file           : console_commands.c
+* @author         : Nimrod Elstein
+* @brief          : Source code related to the console commands
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+******************************************************************************
+*/
+
+#include "city_emergency_project.h"
+#include <stdarg.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#define MAX_COMMAND_ARGS 8
+
+#define HISTORY_USAGE "history <1s|1m|1h> <from_sec> <to_sec|now> <file.csv>"
+#define UNITS_USAGE "units [<department> <n|+n|-n> [<district>]]"
+#define FORECAST_USAGE "forecast [<minutes>] [<department> <n|+n|-n> [<district>]]"
+#define LATENCY_USAGE "latency [total|priority|department]"
+
+typedef struct {   // console command table entry
+    const char *name;
+    const char *usage;
+    void (*run)(int argc, char **argv);
+} ConsoleCommand;
+
+static void command_help(int argc, char **argv);
+static void command_history(int argc, char **argv);
+static void command_units(int argc, char **argv);
+static void command_forecast(int argc, char **argv);
+static void command_latency(int argc, char **argv);
+
+static const ConsoleCommand commands[] = {
+    { "help", "help", command_help },
+    { "history", HISTORY_USAGE, command_history },
+    { "units", UNITS_USAGE, command_units },
+    { "forecast", FORECAST_USAGE, command_forecast },
+    { "latency", LATENCY_USAGE, command_latency },
+};
+
+#define NUM_COMMANDS ((int)(sizeof(commands) / sizeof(commands[0])))
+
+void command_reply(const char *fmt, ...) {
+
+    char msg[LOG_LINE_LEN];
+    va_list args;
+
+    va_start(args, fmt);
+    vsnprintf(msg, sizeof(msg), fmt, args);
+    va_end(args);
+
+    log_message(msg);   // shown by the status display
+
+    if (projectOptions.headless) {   // no display in headless mode, reply on stdout
+        printf("%s\n", msg);
+        fflush(stdout);
+    }
+}
+
+static void command_help(int argc, char **argv) {
+
+    (void)argc;
+    (void)argv;
+
+    for (int i = 0; i < NUM_COMMANDS; i++) {
+        command_reply("usage: %s", commands[i].usage);
+    }
+}
+
+static void command_history(int argc, char **argv) {
+
+    static const char *levels[NUM_HISTORY_LEVELS] = { "1s", "1m", "1h" };
+    int level = -1;
+
+    if (argc != 5) {
+        command_reply("usage: " HISTORY_USAGE);
+        return;
+    }
+
+    for (int l = 0; l < NUM_HISTORY_LEVELS; l++) {
+        if (strcmp(argv[1], levels[l]) == 0) level = l;
+    }
+    if (level < 0) {
+        command_reply("history: unknown resolution '%s' (1s, 1m or 1h)", argv[1]);
+        return;
+    }
+
+    uint32_t fromSec = (uint32_t)strtoul(argv[2], NULL, 10);
+    uint32_t toSec = strcmp(argv[3], "now") == 0 ? UINT32_MAX : (uint32_t)strtoul(argv[3], NULL, 10);
+
+    int exported = history_export_csv((HistoryLevel)level, fromSec, toSec, argv[4]);
+    if (exported < 0) {
+        command_reply("history: cannot write %s", argv[4]);
+    } else {
+        command_reply("history: exported %d %s samples to %s", exported, levels[level], argv[4]);
+    }
+}
+
+static int parse_fleet_args(const char *command, int argc, char **argv, int *code, int *district, long *units) {   // <department> <n|+n|-n> [<district>], argc 2 or 3
+
+    *code = department_code_from_name(argv[0]);
+    if (*code == 0) {
+        command_reply("%s: unknown department '%s'", command, argv[0]);
+        return 0;
+    }
+
+    *district = argc == 3 ? atoi(argv[2]) : 1;   // 1-based, as shown by the status display
+    if (*district < 1 || *district > simParams.districtCount) {
+        command_reply("%s: no district '%s' (1 to %d)", command, argv[2], simParams.districtCount);
+        return 0;
+    }
+    DepartmentParams *params = &districts[*district - 1].departments[*code - 1];
+
+    char *end = NULL;
+    long value = strtol(argv[1], &end, 10);
+    *units = value;
+    if (*argv[1] == '\0' || *end != '\0') {
+        command_reply("%s: invalid count '%s'", command, argv[1]);
+        return 0;
+    }
+    if (argv[1][0] == '+' || argv[1][0] == '-') {   // relative to the current fleet
+        *units = (long)__atomic_load_n(&params->units, __ATOMIC_RELAXED) + value;
+    }
+    if (*units < 0 || *units > DEPARTMENT_MAX_UNITS) {
+        command_reply("%s: %s must have 0 to %d units", command, argv[0], DEPARTMENT_MAX_UNITS);
+        return 0;
+    }
+
+    return 1;
+}
+
+static void command_units(int argc, char **argv) {
+
+    if (argc == 1) {   // list the fleets
+        for (int k = 0; k < simParams.districtCount; k++) {
+            for (int d = 0; d < simParams.departmentCount; d++) {
+                DepartmentParams *params = &districts[k].departments[d];
+                uint32_t freeUnits = (uint32_t)os_semaphore_count(params->semaphore);
+                char where[24] = "";
+                if (simParams.districtCount > 1) snprintf(where, sizeof(where), " district %d", k + 1);
+                command_reply("units: %s%s %lu (%lu busy, %lu free, %lu retiring)", simParams.departments[d].key, where,
+                              (unsigned long)__atomic_load_n(&params->units, __ATOMIC_RELAXED),
+                              (unsigned long)department_busy_units(params, freeUnits), (unsigned long)freeUnits,
+                              (unsigned long)__atomic_load_n(&params->retiring, __ATOMIC_RELAXED));
+            }
+        }
+        return;
+    }
+
+    if (argc != 3 && argc != 4) {
+        command_reply("usage: " UNITS_USAGE);
+        return;
+    }
+
+    int code, district;
+    long units;
+    if (!parse_fleet_args("units", argc - 1, &argv[1], &code, &district, &units)) {
+        return;
+    }
+    DepartmentParams *params = &districts[district - 1].departments[code - 1];
+
+    int previous = department_resize(params, (uint32_t)units);
+    if (simParams.districtCount > 1) {
+        command_reply("units: %s district %d %d -> %ld", simParams.departments[code - 1].key, district, previous, units);
+    } else {
+        command_reply("units: %s %d -> %ld", simParams.departments[code - 1].key, previous, units);
+    }
+}
+
+static void command_forecast(int argc, char **argv) {
+
+    ForecastRequest request = { .minutes = FORECAST_DEFAULT_MINUTES };
+    int arg = 1;
+
+    if (argc > 1 && department_code_from_name(argv[1]) == 0) {   // the horizon comes first, when given
+        char *end = NULL;
+        long minutes = strtol(argv[1], &end, 10);
+        if (*argv[1] == '\0' || *end != '\0' || minutes < 1 || minutes > FORECAST_MAX_MINUTES) {
+            command_reply("forecast: horizon must be 1 to %d minutes", FORECAST_MAX_MINUTES);
+            return;
+        }
+        request.minutes = (uint32_t)minutes;
+        arg = 2;
+    }
+
+    if (argc - arg != 0 && argc - arg != 2 && argc - arg != 3) {
+        command_reply("usage: " FORECAST_USAGE);
+        return;
+    }
+
+    if (argc > arg) {   // what-if fleet change, the same arguments as units
+        int code, district;
+        long units;
+        if (!parse_fleet_args("forecast", argc - arg, &argv[arg], &code, &district, &units)) {
+            return;
+        }
+        request.change.code = code;
+        request.change.district = district - 1;
+        request.change.delta = (int)(units - (long)__atomic_load_n(&districts[district - 1].departments[code - 1].units, __ATOMIC_RELAXED));
+    }
+
+    int started = forecast_start(&request);
+    if (started > 0) {
+        command_reply("forecast: started, %lu min ahead", (unsigned long)request.minutes);
+    } else if (started == 0) {
+        command_reply("forecast: still running, try again when it replies");
+    } else {
+        command_reply("forecast: cannot start (out of memory)");
+    }
+}
+
+static void command_latency(int argc, char **argv) {
+
+    static const char *views[NUM_LATENCY_VIEWS] = { "total", "priority", "department" };
+    int view = -1;
+
+    if (argc == 1) {   // no view given, the next one
+        view = (get_display_latency_view() + 1) % NUM_LATENCY_VIEWS;
+    } else if (argc == 2) {
+        for (int v = 0; v < NUM_LATENCY_VIEWS; v++) {
+            if (strcmp(argv[1], views[v]) == 0) view = v;
+        }
+    }
+    if (view < 0) {
+        command_reply("usage: " LATENCY_USAGE);
+        return;
+    }
+
+    set_display_latency_view((LatencyView)view);
+    if (projectOptions.headless) {
+        command_reply("latency: no status display in headless mode, the run summary shows every view");
+    } else {
+        command_reply("latency: the status display shows the %s view", views[view]);
+    }
+}
+
+static void run_command(char *line) {
+
+    char *argv[MAX_COMMAND_ARGS];
+    char *save = NULL;
+    int argc = 0;
+
+    for (char *tok = strtok_r(line, " \t\r", &save); tok != NULL && argc < MAX_COMMAND_ARGS; tok = strtok_r(NULL, " \t\r", &save)) {
+        argv[argc++] = tok;
+    }
+
+    if (argc == 0) {   // empty line
+        return;
+    }
+
+    for (int i = 0; i < NUM_COMMANDS; i++) {
+        if (strcmp(argv[0], commands[i].name) == 0) {
+            commands[i].run(argc, argv);
+            return;
+        }
+    }
+
+    command_reply("unknown command '%s', type help", argv[0]);
+}
+
+void CommandTask(void *pvParameters) {
+
+    static char line[COMMAND_LINE_LEN];
+    int length = 0;
+
+    while (1) {
+
+        struct timeval noWait = { 0L, 0L };   // poll stdin, never block the task in read()
+        fd_set fds;
+
+        FD_ZERO(&fds);
+        FD_SET(STDIN_FILENO, &fds);
+
+        while (select(STDIN_FILENO + 1, &fds, NULL, NULL, &noWait) > 0) {
+
+            char c;
+            if (read(STDIN_FILENO, &c, 1) != 1) {   // stdin closed (e.g. redirected from /dev/null), no more commands
+                os_task_exit();
+            }
+
+            if (c == '\n') {
+                line[length] = '\0';
+                run_command(line);
+                length = 0;
+            } else if (length < COMMAND_LINE_LEN - 1) {
+                line[length++] = c;
+            }
+
+            FD_ZERO(&fds);
+            FD_SET(STDIN_FILENO, &fds);
+        }
+
+        os_delay(OS_MS_TO_TICKS(COMMAND_POLL_MS));
+    }
+}
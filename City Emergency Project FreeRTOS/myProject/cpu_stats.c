@@ -0,0 +1,261 @@
+/**
+******************************************************************************
+* @file           : cpu_stats.c
+* @author         : Nimrod Elstein
+* @brief          : Source code related to the per-task CPU sampler (run time stats)
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* CpuStatsTask lists the tasks once per CPU_SAMPLE_MS with their run time
+* (uxTaskGetSystemState() and the nanosecond run time counter on FreeRTOS, the
+* thread CPU clocks on pthreads) and turns the growth since the previous sample
+* into the run time of each group: one group per task name, one per department
+* for the EventWorker tasks ("W:<label>"). The groups' run times per sample are
+* kept in a ring of CPU_WINDOW_LONG samples, the shares are the sums over the
+* short and long windows divided by the wall time of the same samples.
+*
+* EventWorker tasks live for one event, most of them start and end between two
+* samples. Each one adds its whole run time to its department when it ends
+* (cpu_stats_worker_done()); a worker that was seen by earlier samples has its
+* last seen run time taken off again when it disappears, so every worker is
+* counted exactly once. Other tasks that end lose the time since their last sample.
+*
+* With --stack-report each sample also feeds the stack high-water marks of the
+* listed tasks to the stack report (stack_stats.c).
+*
+******************************************************************************
+*/
+
+#include "city_emergency_project.h"
+
+typedef struct {   // a task as seen by the last sample
+    uint32_t id;
+    uint64_t runNs;
+    int group;
+    int worker;   // 1 = an EventWorker, cpu_stats_worker_done() adds its whole run time when it ends
+} CpuTaskSeen;
+
+static char groupNames[CPU_MAX_GROUPS][sizeof(((CpuShare *)0)->name)];
+static int groupCount = 0;
+static int workerGroups[MAX_DEPARTMENTS];                // group of the EventWorker tasks of each department, -1 = not yet seen
+static uint64_t retiredNs[MAX_DEPARTMENTS];              // run time of the ended EventWorker tasks of each department (atomic)
+static uint64_t retiredSeen[MAX_DEPARTMENTS];            // retiredNs at the last sample
+
+static int64_t ring[CPU_WINDOW_LONG][CPU_MAX_GROUPS];   // run time of each group in each sample (ns), see sample_tasks()
+static uint64_t ringWall[CPU_WINDOW_LONG];              // wall time of each sample
+static int ringHead = 0;
+static int ringFilled = 0;
+
+static OsTaskInfo tasks[CPU_MAX_TASKS];
+static CpuTaskSeen seen[2][CPU_MAX_TASKS];   // the last sample and the one being taken
+static int seenCount = 0;
+static int seenIndex = 0;
+static uint64_t lastWall = 0;
+
+static CpuShare published[CPU_MAX_GROUPS];   // the shares of the last sample, largest first, guarded by cpuMutex
+static int publishedCount = 0;
+static OsMutex cpuMutex;
+static FILE *cpuLog = NULL;
+
+const char *worker_task_name(char *name, size_t size, int code) {
+
+    snprintf(name, size, WORKER_TASK_PREFIX "%s", simParams.departments[code - 1].label);   // FreeRTOS keeps 11 characters
+    return name;
+}
+
+int cpu_stats_init(void) {
+
+    for (int d = 0; d < MAX_DEPARTMENTS; d++) {
+        workerGroups[d] = -1;
+    }
+
+    cpuMutex = os_mutex_create();
+    if (cpuMutex == NULL) {
+        return 0;
+    }
+
+    if (projectOptions.cpuLogPath != NULL) {
+        cpuLog = fopen(projectOptions.cpuLogPath, "w");
+        if (cpuLog == NULL) {
+            fprintf(stderr, "error: cannot create the CPU log %s\n", projectOptions.cpuLogPath);
+            return 0;
+        }
+        fprintf(cpuLog, "elapsed_s,task,cpu_ms,cpu_pct\n");   // one row per task (group) and sample, percent of one core
+    }
+
+    return 1;
+}
+
+void cpu_stats_worker_done(int code) {
+
+    __atomic_fetch_add(&retiredNs[code - 1], os_task_run_ns(), __ATOMIC_RELAXED);
+}
+
+static int group_named(const char *name) {
+
+    for (int g = 0; g < groupCount; g++) {
+        if (strcmp(groupNames[g], name) == 0) return g;
+    }
+    if (groupCount == CPU_MAX_GROUPS) {
+        return CPU_MAX_GROUPS - 1;
+    }
+
+    snprintf(groupNames[groupCount], sizeof(groupNames[0]), "%s", groupCount < CPU_MAX_GROUPS - 1 ? name : "(other tasks)");   // the last group collects the rest
+    return groupCount++;
+}
+
+static int worker_group(int d) {
+
+    if (workerGroups[d] < 0) {
+        char name[sizeof(groupNames[0])];
+        snprintf(name, sizeof(name), "EventWorker %s", simParams.departments[d].label);
+        workerGroups[d] = group_named(name);
+    }
+    return workerGroups[d];
+}
+
+static int group_of(const char *name, int *worker) {   // EventWorker tasks by department, the others by name
+
+    size_t prefix = strlen(WORKER_TASK_PREFIX);
+
+    *worker = 0;
+    if (strncmp(name, WORKER_TASK_PREFIX, prefix) == 0 && name[prefix] != '\0') {
+        for (int d = 0; d < simParams.departmentCount; d++) {
+            if (strncmp(simParams.departments[d].label, name + prefix, strlen(name + prefix)) == 0) {   // the name may be cut short
+                *worker = 1;
+                return worker_group(d);
+            }
+        }
+    }
+
+    return group_named(name);
+}
+
+static int compare_task_id(const void *a, const void *b) {
+
+    uint32_t x = ((const OsTaskInfo *)a)->id, y = ((const OsTaskInfo *)b)->id;
+    return (x > y) - (x < y);
+}
+
+static void sample_tasks(int64_t *runs, uint64_t *wall) {   // run time of each group since the last sample
+
+    uint64_t now = os_run_time_ns();
+    int count = os_task_list(tasks, CPU_MAX_TASKS);
+    const CpuTaskSeen *last = seen[seenIndex];
+    CpuTaskSeen *next = seen[seenIndex ^ 1];
+    int j = 0;
+
+    qsort(tasks, (size_t)count, sizeof(OsTaskInfo), compare_task_id);   // merged with the last sample by task number
+    stack_stats_sample(tasks, count);   // the same list has the stack high-water marks
+
+    for (int i = 0; i < count; i++) {
+        while (j < seenCount && last[j].id < tasks[i].id) {   // ended since the last sample
+            if (last[j].worker) runs[last[j].group] -= (int64_t)last[j].runNs;   // its whole run time comes with retiredNs
+            j++;
+        }
+        uint64_t base = 0;
+        if (j < seenCount && last[j].id == tasks[i].id) {
+            base = last[j++].runNs;
+        }
+
+        int worker;
+        int group = group_of(tasks[i].name, &worker);
+        if (tasks[i].runNs > base) runs[group] += (int64_t)(tasks[i].runNs - base);
+        next[i] = (CpuTaskSeen){ tasks[i].id, tasks[i].runNs > base ? tasks[i].runNs : base, group, worker };
+    }
+    for (; j < seenCount; j++) {
+        if (last[j].worker) runs[last[j].group] -= (int64_t)last[j].runNs;
+    }
+
+    for (int d = 0; d < simParams.departmentCount; d++) {   // the workers that ended
+        uint64_t retired = __atomic_load_n(&retiredNs[d], __ATOMIC_RELAXED);
+        if (retired != retiredSeen[d]) {
+            runs[worker_group(d)] += (int64_t)(retired - retiredSeen[d]);
+            retiredSeen[d] = retired;
+        }
+    }
+
+    seenIndex ^= 1;
+    seenCount = count;
+    *wall = now - lastWall;
+    lastWall = now;
+}
+
+static double window_share(int group, int samples) {   // percent of one core over the last samples
+
+    int64_t run = 0;
+    uint64_t wall = 0;
+
+    for (int s = 0; s < samples && s < ringFilled; s++) {
+        int slot = (ringHead - 1 - s + CPU_WINDOW_LONG) % CPU_WINDOW_LONG;
+        run += ring[slot][group];
+        wall += ringWall[slot];
+    }
+
+    return wall > 0 && run > 0 ? 100.0 * (double)run / (double)wall : 0.0;
+}
+
+static int compare_share(const void *a, const void *b) {
+
+    double x = ((const CpuShare *)a)->shortPct, y = ((const CpuShare *)b)->shortPct;
+    return (x < y) - (x > y);
+}
+
+static void publish_shares(void) {
+
+    static CpuShare shares[CPU_MAX_GROUPS];   // static, too large for the task stack
+
+    for (int g = 0; g < groupCount; g++) {
+        snprintf(shares[g].name, sizeof(shares[g].name), "%s", groupNames[g]);
+        shares[g].shortPct = window_share(g, CPU_WINDOW_SHORT);
+        shares[g].longPct = window_share(g, CPU_WINDOW_LONG);
+    }
+    qsort(shares, (size_t)groupCount, sizeof(CpuShare), compare_share);
+
+    os_mutex_lock(cpuMutex);
+    memcpy(published, shares, (size_t)groupCount * sizeof(CpuShare));
+    publishedCount = groupCount;
+    os_mutex_unlock(cpuMutex);
+}
+
+int cpu_stats_top(CpuShare *top, int max) {
+
+    os_mutex_lock(cpuMutex);
+    int count = publishedCount < max ? publishedCount : max;
+    memcpy(top, published, (size_t)count * sizeof(CpuShare));
+    os_mutex_unlock(cpuMutex);
+
+    return count;
+}
+
+void CpuStatsTask(void *pvParameters) {
+
+    OsTick lastWake = os_tick_count();
+
+    while (1) {
+
+        os_delay_until(&lastWake, OS_MS_TO_TICKS(CPU_SAMPLE_MS));
+
+        int slot = ringHead;
+        int64_t *runs = ring[slot];
+        memset(runs, 0, sizeof(ring[0]));
+        sample_tasks(runs, &ringWall[slot]);
+        ringHead = (slot + 1) % CPU_WINDOW_LONG;
+        if (ringFilled < CPU_WINDOW_LONG) ringFilled++;
+
+        publish_shares();
+
+        if (cpuLog != NULL) {   // the sample of every group that ran, for offline analysis
+            double elapsed = lastWall / 1e9;
+            double wall = (double)ringWall[slot];
+            for (int g = 0; g < groupCount; g++) {
+                if (runs[g] == 0) continue;
+                fprintf(cpuLog, "%.3f,%s,%.3f,%.2f\n", elapsed, groupNames[g], runs[g] / 1e6, wall > 0 ? 100.0 * runs[g] / wall : 0.0);
+            }
+            fflush(cpuLog);
+        }
+    }
+}
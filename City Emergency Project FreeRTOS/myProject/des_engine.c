@@ -0,0 +1,419 @@
+/**
+******************************************************************************
+* @file           : des_engine.c
+* @author         : Nimrod Elstein
+* @brief          : Source code related to the discrete-event (virtual time) simulation mode
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* The discrete-event mode runs the generator, dispatcher, department and handler
+* logic against a virtual clock. Every task delay becomes an entry in a pending-event
+* priority queue (binary heap ordered by time), and the clock jumps straight to the
+* next entry instead of waiting for it. The engine uses no OS API: --des runs it
+* before (and instead of) the scheduler, a forecast (forecast.c) runs it in a
+* background task from a copy of the live state, with its own metrics sink.
+* All districts share the one clock and heap.
+*
+******************************************************************************
+*/
+
+#include "city_emergency_project.h"
+
+static uint64_t desClock = 0;   // virtual time (ticks) reached by the last discrete-event run
+static int desRan = 0;
+
+static int des_before(const DesEntry *a, const DesEntry *b) {
+
+    return a->time < b->time || (a->time == b->time && a->seq < b->seq);   // same time: first scheduled runs first
+}
+
+typedef struct {   // des_take_unit() context: the units of one district
+    DesState *state;
+    int district;
+} DesUnitCtx;
+
+static void des_schedule(DesState *state, uint64_t time, DesEntryType type, int district, int code, int unitFrom, int unitDistrict, const Event *evt) {
+
+    if (state->heapCount == state->heapCapacity) {   // grow the pending-event heap (only busy units and the district tasks are pending)
+        state->heapCapacity = state->heapCapacity ? state->heapCapacity * 2 : 32;
+        state->heap = realloc(state->heap, state->heapCapacity * sizeof(DesEntry));
+        if (state->heap == NULL) {
+            fprintf(stderr, "error: discrete-event heap allocation failed\n");
+            exit(1);
+        }
+    }
+
+    DesEntry entry = { time, state->seq++, type, district, code, unitFrom, unitDistrict, { 0 } };
+    if (evt != NULL) entry.evt = *evt;
+
+    int i = state->heapCount++;   // sift up
+    while (i > 0 && des_before(&entry, &state->heap[(i - 1) / 2])) {
+        state->heap[i] = state->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    state->heap[i] = entry;
+}
+
+static DesEntry des_pop(DesState *state) {
+
+    DesEntry top = state->heap[0];
+    DesEntry last = state->heap[--state->heapCount];
+
+    int i = 0;   // sift down
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= state->heapCount) break;
+        if (child + 1 < state->heapCount && des_before(&state->heap[child + 1], &state->heap[child])) child++;
+        if (!des_before(&state->heap[child], &last)) break;
+        state->heap[i] = state->heap[child];
+        i = child;
+    }
+    if (state->heapCount > 0) state->heap[i] = last;
+
+    return top;
+}
+
+static int des_take_unit(int code, void *ctx) {
+
+    DesUnitCtx *units = (DesUnitCtx *)ctx;
+    DesDistrict *district = &units->state->districts[units->district];
+
+    if (district->freeUnits[code - 1] == 0) {
+        return 0;
+    }
+    district->freeUnits[code - 1]--;
+    return 1;
+}
+
+static int des_take_district_unit(int district, int code, void *ctx) {   // mutual aid, ctx: the DesState
+
+    DesUnitCtx units = { (DesState *)ctx, district };
+
+    return des_take_unit(code, &units);
+}
+
+static int queue_push(DesQueue *queue, const Event *evt) {
+
+    if (queue->count == queue->capacity) {
+        return 0;
+    }
+    queue->items[(queue->head + queue->count) % queue->capacity] = *evt;
+    queue->count++;
+    return 1;
+}
+
+static void queue_pop(DesQueue *queue, Event *evt) {
+
+    *evt = queue->items[queue->head];
+    queue->head = (queue->head + 1) % queue->capacity;
+    queue->count--;
+}
+
+static void department_poll(DesState *state, int district, int code) {   // DepartmentTask: receive while not in the retry delay
+
+    DesDistrict *local = &state->districts[district];
+    DesQueue *queue = &local->queues[code - 1];
+    DesUnitCtx units = { state, district };
+
+    while (!local->sleeping[code - 1] && queue->count > 0) {
+
+        Event evt;
+        queue_pop(queue, &evt);
+
+        if (evt.requeues == 0) {
+            evt.receivedTick = (OsTick)state->now;
+        }
+
+        int from = des_take_unit(code, &units) ? code : borrow_unit(code, des_take_unit, &units);   // local resource first, then borrow
+        int lender = district;
+
+        if (from != 0 && from != code) {
+            METRIC_INC(state->metrics->borrowed[code - 1]);
+        } else if (from == 0) {   // the district ran out of units, mutual aid
+            lender = mutual_aid_unit(district, code, des_take_district_unit, state);
+            if (lender >= 0) {
+                from = code;
+                METRIC_INC(state->metrics->mutualAid[code - 1]);
+                METRIC_INC(state->metrics->aidLent[lender]);
+                METRIC_INC(state->metrics->aidReceived[district]);
+            }
+        }
+
+        if (from != 0) {   // EventHandlerTask: hold the unit for the handling time
+            METRIC_INC(state->metrics->handled[code - 1]);
+            evt.assignedTick = (OsTick)state->now;
+            des_schedule(state, state->now + OS_MS_TO_TICKS(evt.handleMs), DES_COMPLETE, district, code, from, lender, &evt);
+        } else {   // no resources, requeue and retry after the delay
+            METRIC_INC(state->metrics->delayed[code - 1]);
+            evt.requeues++;
+            queue_push(queue, &evt);
+            local->sleeping[code - 1] = 1;
+            des_schedule(state, state->now + OS_MS_TO_TICKS(simParams.retryMs), DES_DEPARTMENT_WAKE, district, code, 0, 0, NULL);
+        }
+    }
+}
+
+static void schedule_next_arrival(DesState *state, int district) {   // EventGeneratorTask waits for the arrival of the next event
+
+    EventSource *source = &state->districts[district].source;
+    Event evt;
+    uint64_t arrivalTick;
+
+    if ((state->forecast || event_limit_reserve()) && source->next(source, &evt, &arrivalTick)) {   // nothing more to schedule at the end of a replay or of --events
+        des_schedule(state, arrivalTick > state->now ? arrivalTick : state->now, DES_GENERATE, district, 0, 0, 0, &evt);
+    }
+}
+
+static int des_finished(const DesState *state) {   // only the dispatchers are left and they have nothing to dispatch
+
+    if (state->heapCount != simParams.districtCount) {
+        return 0;
+    }
+    for (int i = 0; i < state->heapCount; i++) {   // one pending dispatch per district, nothing else
+        if (state->heap[i].type != DES_DISPATCH || state->districts[state->heap[i].district].bufferCount != 0) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static Event *des_alloc(int count) {
+
+    Event *items = malloc((size_t)count * sizeof(Event));
+    if (items == NULL) {
+        fprintf(stderr, "error: discrete-event buffer allocation failed\n");
+        exit(1);
+    }
+
+    return items;
+}
+
+void des_init(DesState *state) {
+
+    memset(state, 0, sizeof(*state));
+    state->metrics = &systemMetrics;
+
+    for (int k = 0; k < simParams.districtCount; k++) {
+
+        DesDistrict *district = &state->districts[k];
+
+        event_source_init(&district->source, k);
+
+        district->bufferCapacity = (int)simParams.bufferLen;   // the same sizes as the real-time buffer and queues
+        district->buffer = des_alloc(district->bufferCapacity);
+
+        for (int d = 0; d < simParams.departmentCount; d++) {
+            district->freeUnits[d] = simParams.departments[d].units;
+            district->queues[d].capacity = (int)simParams.departments[d].queueLen;
+            district->queues[d].items = des_alloc(district->queues[d].capacity);
+        }
+    }
+
+    for (int k = 0; k < simParams.districtCount; k++) {   // the dispatchers have the higher task priority, they run first
+        des_schedule(state, 0, DES_DISPATCH, k, 0, 0, 0, NULL);
+    }
+    for (int k = 0; k < simParams.districtCount; k++) {
+        schedule_next_arrival(state, k);
+    }
+}
+
+static void apply_fleet_change(DesDistrict *district, const FleetChange *change) {   // like department_resize()
+
+    int d = change->code - 1;
+
+    if (change->delta > 0) {   // units waiting to retire stay in service, then new free units
+        uint32_t added = (uint32_t)change->delta;
+        uint32_t kept = district->retiring[d] < added ? district->retiring[d] : added;
+        district->retiring[d] -= kept;
+        district->freeUnits[d] += added - kept;
+    } else {   // free units retire now, busy ones when they finish
+        uint32_t removed = (uint32_t)-change->delta;
+        uint32_t now = district->freeUnits[d] < removed ? district->freeUnits[d] : removed;
+        district->freeUnits[d] -= now;
+        district->retiring[d] += removed - now;
+    }
+}
+
+void des_init_forecast(DesState *state, const ForecastSnapshot *snap, const FleetChange *change, uint64_t seed, SystemMetrics *metrics) {
+
+    memset(state, 0, sizeof(*state));
+    state->now = snap->now;
+    state->metrics = metrics;
+    state->forecast = 1;
+
+    for (int k = 0; k < simParams.districtCount; k++) {
+
+        DesDistrict *district = &state->districts[k];
+
+        event_source_fork(&district->source, k, seed, snap->now);
+
+        district->bufferCapacity = (int)simParams.bufferLen;
+        district->buffer = des_alloc(district->bufferCapacity);
+        district->bufferCount = snap->bufferCount[k];
+        memcpy(district->buffer, &snap->buffer[(size_t)k * simParams.bufferLen], (size_t)district->bufferCount * sizeof(Event));
+
+        for (int d = 0; d < simParams.departmentCount; d++) {
+
+            DesQueue *queue = &district->queues[d];
+
+            district->freeUnits[d] = snap->freeUnits[k][d];
+            district->retiring[d] = snap->retiring[k][d];
+            queue->capacity = (int)simParams.departments[d].queueLen;
+            queue->items = des_alloc(queue->capacity);
+
+            for (uint32_t i = 0; i < snap->queueDepth[k][d]; i++) {   // the queued events are not visible, draw them
+                Event evt = { 0 };
+                evt.code = d + 1;
+                evt.priority = (int)rng_below(&district->source.rng.events, MAX_PRIORITY) + 1;
+                evt.district = k;
+                evt.handleMs = draw_handling_time_ms(&district->source.rng, evt.code);
+                evt.generatedTick = evt.dispatchedTick = (OsTick)snap->now;
+                queue_push(queue, &evt);
+            }
+        }
+
+        if (change != NULL && change->code != 0 && change->district == k) {
+            apply_fleet_change(district, change);
+        }
+    }
+
+    for (int i = 0; i < snap->busyCount; i++) {   // the busy units complete at their remaining handling time
+        const ActiveHandling *h = &snap->busy[i].handling;
+        des_schedule(state, snap->busy[i].doneTick, DES_COMPLETE, h->evt.district, h->code, h->unitCode, h->unitDistrict, &h->evt);
+    }
+    for (int k = 0; k < simParams.districtCount; k++) {   // the departments with queued events look for units
+        for (int d = 0; d < simParams.departmentCount; d++) {
+            if (state->districts[k].queues[d].count > 0) {
+                des_schedule(state, snap->now, DES_DEPARTMENT_WAKE, k, d + 1, 0, 0, NULL);
+            }
+        }
+    }
+    for (int k = 0; k < simParams.districtCount; k++) {
+        des_schedule(state, snap->now, DES_DISPATCH, k, 0, 0, 0, NULL);
+    }
+    for (int k = 0; k < simParams.districtCount; k++) {
+        schedule_next_arrival(state, k);
+    }
+}
+
+void des_run(DesState *state, uint64_t untilTick) {
+
+    while (state->heapCount > 0 && state->heap[0].time <= untilTick) {
+
+        if (des_finished(state)) {   // end of a replay, the clock stays at the last completion
+            return;
+        }
+
+        DesEntry entry = des_pop(state);
+        DesDistrict *district = &state->districts[entry.district];
+        state->now = entry.time;   // fast-forward to the next pending event
+
+        switch (entry.type) {
+
+            case DES_GENERATE: {   // EventGeneratorTask
+                Event evt = entry.evt;
+                METRIC_INC(state->metrics->generated);
+                METRIC_INC(state->metrics->districtGenerated[entry.district]);
+                evt.generatedTick = (OsTick)state->now;
+                evt.district = entry.district;
+                if (!state->forecast) record_event(&evt, state->now);
+                if (!event_buffer_push(district->buffer, &district->bufferCount, district->bufferCapacity, evt)) {
+                    METRIC_INC(state->metrics->droppedBuffer);
+                    METRIC_INC(state->metrics->districtDropped[entry.district]);
+                }
+                schedule_next_arrival(state, entry.district);
+                break;
+            }
+
+            case DES_DISPATCH: {   // DispatcherTask
+                Event evt;
+                uint64_t next = state->now + OS_MS_TO_TICKS(simParams.dispatchMs);
+                if (event_buffer_pop(district->buffer, &district->bufferCount, &evt)) {
+                    METRIC_INC(state->metrics->dispatched);
+                    evt.dispatchedTick = (OsTick)state->now;
+                    if (queue_push(&district->queues[evt.code - 1], &evt)) {
+                        department_poll(state, entry.district, evt.code);   // the department task is waiting on its queue
+                    } else {   // the send to a full queue times out and the event is dropped
+                        METRIC_INC(state->metrics->droppedQueue[evt.code - 1]);
+                        next += OS_MS_TO_TICKS(simParams.sendTimeoutMs);
+                    }
+                } else if (next == state->now) {   // dispatch_ms 0 and nothing to dispatch, poll again on the next tick (virtual time must move)
+                    next++;
+                }
+                des_schedule(state, next, DES_DISPATCH, entry.district, 0, 0, 0, NULL);
+                break;
+            }
+
+            case DES_DEPARTMENT_WAKE:   // end of the department retry delay
+                district->sleeping[entry.code - 1] = 0;
+                department_poll(state, entry.district, entry.code);
+                break;
+
+            case DES_COMPLETE: {   // EventHandlerTask done, give back the resource (local, borrowed or mutual aid)
+                DesDistrict *owner = &state->districts[entry.unitDistrict];
+                if (owner->retiring[entry.unitFrom - 1] > 0) {   // the fleet shrank while the unit was busy
+                    owner->retiring[entry.unitFrom - 1]--;
+                } else {
+                    owner->freeUnits[entry.unitFrom - 1]++;
+                }
+                METRIC_INC(state->metrics->completed[entry.code - 1]);
+                METRIC_INC(state->metrics->districtCompleted[entry.district]);
+                record_model_latency(state->metrics, &entry.evt, entry.code, (OsTick)state->now);
+                break;
+            }
+        }
+    }
+
+    if (state->now < untilTick) {
+        state->now = untilTick;
+    }
+}
+
+void des_free(DesState *state) {
+
+    free(state->heap);
+    state->heap = NULL;
+    for (int k = 0; k < simParams.districtCount; k++) {
+        DesDistrict *district = &state->districts[k];
+        free(district->buffer);
+        district->buffer = NULL;
+        for (int d = 0; d < simParams.departmentCount; d++) {
+            free(district->queues[d].items);
+            district->queues[d].items = NULL;
+        }
+    }
+    state->heapCount = state->heapCapacity = 0;
+}
+
+uint64_t simulation_now_ticks(void) {
+
+    return desRan ? desClock : (uint64_t)(os_tick_count() * projectOptions.timeScale);
+}
+
+void run_discrete_event_simulation(void) {
+
+    static DesState state;   // static, the state holds the event buffers and the department queues of every district
+    struct timespec wallStart, wallEnd;
+    uint64_t untilTick = (uint64_t)(projectOptions.simHours * 3600.0 * OS_TICK_RATE_HZ);
+
+    clock_gettime(CLOCK_MONOTONIC, &wallStart);
+
+    des_init(&state);
+    des_run(&state, untilTick);
+
+    clock_gettime(CLOCK_MONOTONIC, &wallEnd);
+
+    desClock = state.now;   // the run summary reports virtual time
+    desRan = 1;
+
+    double wall = (wallEnd.tv_sec - wallStart.tv_sec) + (wallEnd.tv_nsec - wallStart.tv_nsec) / 1e9;
+    double simSeconds = (double)desClock / OS_TICK_RATE_HZ;   // shorter than --sim-hours when a replay ends first
+    fprintf(projectOptions.json ? stderr : stdout, "Discrete-event run: simulated %.1f h in %.3f s wall time (%.0fx real time)\n",
+           simSeconds / 3600.0, wall, wall > 0 ? simSeconds / wall : 0.0);
+
+    des_free(&state);
+}
@@ -15,63 +15,63 @@
 #include "city_emergency_project.h"
 
 void DispatcherTask(void *pvParameters) {
+
+    District *district = (District *)pvParameters;   // the dispatcher serves one district
+    SimTimer timer = { 0 };   // scaled delay schedule (time scale)
+
     while (1) {
 
         Event evt;  // intialize event object
 
-        if (get_highest_priority_event(&evt)) {   // get the highest priority event from the eventBuffer
+        if (get_highest_priority_event(district, &evt)) {   // get the highest priority event from the eventBuffer
+
+            METRIC_INC(systemMetrics.dispatched);
+            evt.dispatchedTick = os_tick_count();
 
             char msg[200];   // initialize message string
 
-            const char *target = (evt.code == CODE_POLICE) ? "Police" : (evt.code == CODE_AMBULANCE) ? "Ambulance" : "Fire Department";  // get the event's target department
+            DepartmentParams *target = &district->departments[evt.code - 1];  // get the event's target department
             
-            snprintf(msg, sizeof(msg), "Dispatcher sent event to %s (priority %d)", target, evt.priority);  // make the logger message
+            snprintf(msg, sizeof(msg), "Dispatcher sent event to %s (priority %d)", target->departmentName, evt.priority);  // make the logger message
             log_message(msg);  // logger message
 
-            switch (evt.code) {  // send event to the correct department's queue. if queue is full, send message and delay the dispatching.
-                case CODE_POLICE:
-                    if (xQueueSendToBack(xPoliceQueue, &evt, pdMS_TO_TICKS(100)) != pdPASS) {
-                        log_message("Warning: Police queue full. Dispatcher dropped or delayed event.");
-                    }
-                    break;
-                case CODE_AMBULANCE:
-                    if (xQueueSendToBack(xAmbulanceQueue, &evt, pdMS_TO_TICKS(100)) != pdPASS) {
-                        log_message("Warning: Ambulance queue full. Dispatcher dropped or delayed event.");
-                    }
-                    break;
-                case CODE_FIRE:
-                    if (xQueueSendToBack(xFireQueue, &evt, pdMS_TO_TICKS(100)) != pdPASS) {
-                        log_message("Warning: Fire queue full. Dispatcher dropped or delayed event.");
-                    }
-                    break;
+            // send event to the correct department's queue. if queue is full, send message and delay the dispatching.
+            if (!os_queue_send(target->queue, &evt, sim_ms_to_ticks(simParams.sendTimeoutMs, &timer.carry))) {
+                snprintf(msg, sizeof(msg), "Warning: %s queue full. Dispatcher dropped or delayed event.", target->departmentName);
+                log_message(msg);
+                METRIC_INC(systemMetrics.droppedQueue[evt.code - 1]);
+                sim_timer_restart(&timer);   // the send timeout delays the dispatching
             }
         }
         
-        vTaskDelay(pdMS_TO_TICKS(DISPATCH_TIME_CONST_MS));  // const dispatcher work time
+        sim_delay_ms(&timer, simParams.dispatchMs);  // const dispatcher work time
     }
 }
 
-int get_highest_priority_event(Event *evtOut) {
+int event_buffer_pop(Event *buffer, int *count, Event *evtOut) {
+
+    if (*count == 0) {  // the buffer is empty
+        return 0;
+    }
 
-    int event_retrieved = 0;  // intialize the returend event flag, 0 means buffer was empty and no event retrieved
+    *evtOut = buffer[0];  // take the highest priority event (first) to the output parameter
 
-    xSemaphoreTake(xEventBufferMutex, portMAX_DELAY);  // lock the eventBuffer with mutex tso other tasks cannot access the eventBuffer
+    for (int i = 1; i < *count; i++) {  // shift all other events one back
+        buffer[i - 1] = buffer[i];
+    }
 
-    if (eventCount > 0) {  // if the eventBuffer is not empty
+    (*count)--;  // correct the event counter
 
-        *evtOut = eventBuffer[0];  // take the highest priority event (first) to the output parameter
+    return 1;
+}
 
-        for (int i = 1; i < eventCount; i++) {  // shift all other events one back
-            eventBuffer[i - 1] = eventBuffer[i];
-        }
+int get_highest_priority_event(District *district, Event *evtOut) {
 
-        eventCount--;  // correct the event counter
+    os_mutex_lock(district->bufferMutex);  // lock the eventBuffer with mutex tso other tasks cannot access the eventBuffer
 
-        event_retrieved = 1;
-    }
+    int event_retrieved = event_buffer_pop(district->eventBuffer, &district->eventCount, evtOut);  // 0 means buffer was empty and no event retrieved
 
-    xSemaphoreGive(xEventBufferMutex);  //  release the mutex nd let other tasks access the eventBuffer
+    os_mutex_unlock(district->bufferMutex);  //  release the mutex nd let other tasks access the eventBuffer
 
     return event_retrieved;  // event retreived flag
 }
-
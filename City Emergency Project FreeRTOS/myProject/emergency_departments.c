@@ -14,6 +14,131 @@
 
 #include "city_emergency_project.h"
 
+uint32_t draw_handling_time_ms(WorkloadRng *rng, int code) {
+
+    return time_dist_draw(&simParams.departments[code - 1].handle, &rng->service);
+}
+
+int borrow_unit(int code, int (*tryTake)(int code, void *ctx), void *ctx) {
+
+    if (!simParams.borrow) {   // --no-borrow: every department works with its own units only
+        return 0;
+    }
+
+    const DepartmentConfig *dept = &simParams.departments[code - 1];
+
+    // resource borrow logic, simple stupid - check who has one and take it, in the configured order
+    for (int i = 0; i < dept->borrowCount; i++) {
+        int from = dept->borrowFrom[i];
+        if (tryTake(from, ctx)) {
+            return from;
+        }
+    }
+
+    return 0;   // no department has a free resource
+}
+
+int mutual_aid_unit(int district, int code, int (*tryTake)(int district, int code, void *ctx), void *ctx) {
+
+    int count = simParams.districtCount;
+
+    if (!simParams.mutualAid) {   // --no-mutual-aid: every district works with its own units only
+        return -1;
+    }
+
+    for (int step = 1; step <= count / 2; step++) {   // the districts form a ring, nearest first
+        int next = (district + step) % count;
+        int previous = (district - step + count) % count;
+        if (tryTake(next, code, ctx)) {
+            return next;
+        }
+        if (previous != next && tryTake(previous, code, ctx)) {
+            return previous;
+        }
+    }
+
+    return -1;   // no district has a free unit of the department
+}
+
+void department_return_unit(DepartmentParams *owner) {
+
+    uint32_t retiring = __atomic_load_n(&owner->retiring, __ATOMIC_RELAXED);
+
+    while (retiring > 0) {   // the fleet shrank while the unit was busy, retire it instead of giving it back
+        if (__atomic_compare_exchange_n(&owner->retiring, &retiring, retiring - 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            return;
+        }
+    }
+
+    os_semaphore_give(owner->semaphore);
+}
+
+static uint32_t cancel_retiring(DepartmentParams *params, uint32_t count) {   // take back up to count of the pending retirements
+
+    uint32_t retiring = __atomic_load_n(&params->retiring, __ATOMIC_RELAXED);
+    uint32_t cancel;
+
+    do {
+        cancel = retiring < count ? retiring : count;
+    } while (cancel > 0 && !__atomic_compare_exchange_n(&params->retiring, &retiring, retiring - cancel, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    return cancel;
+}
+
+int department_resize(DepartmentParams *params, uint32_t units) {
+
+    if (units > DEPARTMENT_MAX_UNITS) {
+        return -1;
+    }
+
+    uint32_t previous = __atomic_exchange_n(&params->units, units, __ATOMIC_ACQ_REL);   // concurrent resizes each apply their own difference
+
+    if (units > previous) {   // bring units online: units waiting to retire stay in service, then new free units
+        uint32_t added = units - previous;
+        added -= cancel_retiring(params, added);
+        for (uint32_t i = 0; i < added; i++) {
+            os_semaphore_give(params->semaphore);
+        }
+    } else {   // retire units: free ones now, busy ones when their handler finishes
+        for (uint32_t i = 0; i < previous - units; i++) {
+            if (!os_semaphore_take(params->semaphore, 0)) {
+                __atomic_fetch_add(&params->retiring, 1, __ATOMIC_ACQ_REL);
+            }
+        }
+        while (__atomic_load_n(&params->retiring, __ATOMIC_ACQUIRE) > 0 && os_semaphore_take(params->semaphore, 0)) {   // a unit came back in between
+            if (cancel_retiring(params, 1) == 0) {
+                os_semaphore_give(params->semaphore);   // its handler retired it already
+                break;
+            }
+        }
+    }
+
+    char msg[200];
+    snprintf(msg, sizeof(msg), "%s fleet resized from %lu to %lu units", params->departmentName, (unsigned long)previous, (unsigned long)units);
+    log_message(msg);
+
+    return (int)previous;
+}
+
+uint32_t department_busy_units(const DepartmentParams *params, uint32_t freeUnits) {
+
+    uint32_t inService = __atomic_load_n(&params->units, __ATOMIC_RELAXED) + __atomic_load_n(&params->retiring, __ATOMIC_RELAXED);
+
+    return inService > freeUnits ? inService - freeUnits : 0;   // the values are read one by one, never report less than 0
+}
+
+static int take_unit_semaphore(int code, void *ctx) {   // ctx: the District
+
+    OsSemaphore semaphore = ((District *)ctx)->departments[code - 1].semaphore;
+
+    return os_semaphore_count(semaphore) > 0 && os_semaphore_take(semaphore, 0);
+}
+
+static int take_district_unit(int district, int code, void *ctx) {
+
+    return take_unit_semaphore(code, &districts[district]);
+}
+
 void EventHandlerTask(void *pvParameters) {
 
     EventHandlerArgs *args = (EventHandlerArgs *)pvParameters;  // get the the input event parameters
@@ -21,106 +146,136 @@ void EventHandlerTask(void *pvParameters) {
     DepartmentParams *params = args->params;
     const char *deptName = params->departmentName;
 
-    TickType_t startTick = xTaskGetTickCount();  // handle the event with a random duration time, calc the duration for logger message
-    vTaskDelay(pdMS_TO_TICKS((rand() % (DEPARTMENT_HANDLE_TIME_MAX_MS - DEPARTMENT_HANDLE_TIME_MIN_MS) ) + DEPARTMENT_HANDLE_TIME_MIN_MS));
-    TickType_t endTick = xTaskGetTickCount();
-    TickType_t duration = endTick - startTick;
+    SimTimer timer = { .carry = 0.5 };   // one delay per handler task, start at half a tick so the scaled time rounds to nearest
+
+    OsTick startTick = os_tick_count();  // handle the event with a random duration time, calc the duration for logger message
+    sim_delay_ms(&timer, evt.handleMs);   // handling time drawn with the event
+    OsTick endTick = os_tick_count();
+    OsTick duration = endTick - startTick;
+    METRIC_INC(systemMetrics.completed[params->code - 1]);
+    METRIC_INC(systemMetrics.districtCompleted[params->district]);
+    record_event_latency(&evt, params->code, endTick);
+    handling_end(args->tracked);   // before the unit is free again, a forecast copy never counts it twice
 
-    if (args->borrowed && args->borrowedFrom != NULL) {  // give back the resourcse (semaphore), local or borrowed
-        xSemaphoreGive(args->borrowedFrom);
+    if (args->aidShard >= 0) {   // a unit of another shard process, give it back through the shard link
+        shard_return_unit(args->aidShard, params->code, args->aidLender);
+    } else if (args->borrowed && args->borrowedFrom != NULL) {  // give back the resourcse (semaphore), local or borrowed
+        department_return_unit(args->borrowedFrom);
     } else {
-        xSemaphoreGive(params->semaphore);
+        department_return_unit(params);
     }
 
     char msg[200];   // send message to logger
-    snprintf(msg, sizeof(msg), "%s completed event in %lu ticks", deptName, (unsigned long)duration);
+    snprintf(msg, sizeof(msg), "%s completed event in %lu ticks", deptName, (unsigned long)sim_ticks_from_real(duration));   // model ticks
     log_message(msg);
 
     free(args);  // free dynamic memory
 
-    vTaskDelete(NULL);  // delete this task when completed
+    cpu_stats_worker_done(params->code);   // the CPU sampler may never have seen this short task
+    stack_stats_task_done(TASK_HANDLER);
+    os_task_exit();  // delete this task when completed
 }
 
 void DepartmentTask(void *pvParameters) { 
 
     DepartmentParams *params = (DepartmentParams *) pvParameters;   // get the the input department parameters
-    QueueHandle_t queue = params->queue;
-    SemaphoreHandle_t semaphore = params->semaphore;
+    District *district = &districts[params->district];
+    OsQueue queue = params->queue;
+    OsSemaphore semaphore = params->semaphore;
     const char *deptName = params->departmentName;
+    SimTimer timer = { 0 };   // scaled retry delay schedule (time scale)
 
     while (1) {
 
         Event evt;   // intialize an empty event object
 
-        if (xQueueReceive(queue, &evt, portMAX_DELAY) == pdPASS) {   // get event from the department's queue (if here is one)
+        if (os_queue_receive(queue, &evt, OS_WAIT_FOREVER)) {   // get event from the department's queue (if here is one)
+
+            if (evt.requeues == 0) {   // stamp the first receive only, requeue time counts as unit wait
+                evt.receivedTick = os_tick_count();
+            }
 
-            BaseType_t local = xSemaphoreTake(semaphore, 0);  // get a local resource, local is true if local resource is available and false if not
-            BaseType_t borrowed = pdFALSE;                   // initialize a borrowed flag to false, if a resource will be borrowed we switch to true
-            SemaphoreHandle_t borrowedFrom = NULL;          // initialize a semaphore handle from who a resource will be borrowed from
+            int local = os_semaphore_take(semaphore, 0);  // get a local resource, local is true if local resource is available and false if not
+            int borrowed = 0;                           // initialize a borrowed flag to false, if a resource will be borrowed we switch to true
+            DepartmentParams *borrowedFrom = NULL;          // initialize the department from who a resource will be borrowed from
+            int aidShard = -1, aidLender = 0;              // shard process and district that lent a unit (mutual aid across shards)
 
             if (!local) {  // if no local resources available (department's own)
 
-                xSemaphoreTake(xResourceMutex, portMAX_DELAY);  // take a mutex, blocking the task so that only one department can borrow at a time
-
-                // resource borrow logic, simple stupid -  check who has one and take it
-                if (strcmp(deptName, "Ambulance") == 0) {      
-                    if (uxSemaphoreGetCount(xPoliceSemaphore) > 0 && xSemaphoreTake(xPoliceSemaphore, 0)) {
-                        borrowed = pdTRUE; 
-                        borrowedFrom = xPoliceSemaphore;
-                        log_message("Ambulance borrowed resource from Police");
-                    } else if (uxSemaphoreGetCount(xFireSemaphore) > 0 && xSemaphoreTake(xFireSemaphore, 0)) {
-                        borrowed = pdTRUE; 
-                        borrowedFrom = xFireSemaphore;
-                        log_message("Ambulance borrowed resource from Fire Department");
-                    }
-                } else if (strcmp(deptName, "Fire Department") == 0) {
-                        if (uxSemaphoreGetCount(xPoliceSemaphore) > 0 && xSemaphoreTake(xPoliceSemaphore, 0)) {
-                            borrowed = pdTRUE; 
-                            borrowedFrom = xPoliceSemaphore;
-                            log_message("Fire Department borrowed resource from Police");
-                        } else if (uxSemaphoreGetCount(xAmbulanceSemaphore) > 0 && xSemaphoreTake(xAmbulanceSemaphore, 0)) {
-                            borrowed = pdTRUE; 
-                            borrowedFrom = xAmbulanceSemaphore;
-                            log_message("Fire Department borrowed resource from Ambulance");
-                        }
-                } else if (strcmp(deptName, "Police") == 0) {
-                        if (uxSemaphoreGetCount(xFireSemaphore) > 0 && xSemaphoreTake(xFireSemaphore, 0)) {
-                            borrowed = pdTRUE; 
-                            borrowedFrom = xFireSemaphore;
-                            log_message("Police borrowed resource from Fire Department");
-                        } else if (uxSemaphoreGetCount(xAmbulanceSemaphore) > 0 && xSemaphoreTake(xAmbulanceSemaphore, 0)) {
-                            borrowed = pdTRUE; 
-                            borrowedFrom = xAmbulanceSemaphore;
-                            log_message("Police borrowed resource from Ambulance");
+                os_mutex_lock(district->resourceMutex);  // take a mutex, blocking the task so that only one department of the district can borrow at a time
+
+                int fromCode = borrow_unit(params->code, take_unit_semaphore, district);
+
+                os_mutex_unlock(district->resourceMutex);   // release the mutex and allow other departments to borrow
+
+                if (fromCode != 0) {
+                    char msg[200];
+                    borrowed = 1;
+                    borrowedFrom = &district->departments[fromCode - 1];
+                    snprintf(msg, sizeof(msg), "%s borrowed resource from %s", deptName, borrowedFrom->departmentName);
+                    log_message(msg);
+                } else {   // the district ran out of units, mutual aid (non-blocking takes, no other district lock is held)
+                    int lender = mutual_aid_unit(district->index, params->code, take_district_unit, NULL);
+                    if (lender >= 0) {
+                        char msg[200];
+                        borrowed = 1;
+                        borrowedFrom = &districts[lender].departments[params->code - 1];
+                        METRIC_INC(systemMetrics.mutualAid[params->code - 1]);
+                        METRIC_INC(systemMetrics.aidLent[lender]);
+                        METRIC_INC(systemMetrics.aidReceived[district->index]);
+                        snprintf(msg, sizeof(msg), "%s (district %d) mutual aid from district %d", deptName, district->index + 1, lender + 1);
+                        log_message(msg);
+                    } else if (projectOptions.shardCount > 1) {   // no district of this process has one, ask the other shards
+                        aidShard = shard_request_aid(params, &aidLender);
+                        if (aidShard >= 0) {
+                            char msg[200];
+                            borrowed = 1;
+                            METRIC_INC(systemMetrics.mutualAid[params->code - 1]);
+                            METRIC_INC(systemMetrics.aidReceived[district->index]);
+                            snprintf(msg, sizeof(msg), "%s mutual aid from shard %d", deptName, aidShard + 1);
+                            log_message(msg);
                         }
+                    }
                 }
 
-                xSemaphoreGive(xResourceMutex);   // release the mutex and allow other departments to borrow
-
             }
 
             if (local || borrowed) {  // if there is an available resource, local or borrowed
 
+                METRIC_INC(systemMetrics.handled[params->code - 1]);
+                if (borrowed && borrowedFrom != NULL && borrowedFrom->district == params->district) METRIC_INC(systemMetrics.borrowed[params->code - 1]);   // mutual aid is counted apart
+
                 char msg[200];      // initialize a message string
                 snprintf(msg, sizeof(msg), "%s handling event (priority %d)%s", deptName, evt.priority, borrowed ? " [borrowed]" : "");
                 log_message(msg); // send a "handling event" message to logger
 
+                evt.assignedTick = os_tick_count();
+
                 EventHandlerArgs *args = malloc(sizeof(EventHandlerArgs));  // allocate dynamic memory for even handler arguments
                 
                 args->evt = evt;      // assign the event handler task arguments
                 args->params = params;
                 args->borrowed = borrowed;
                 args->borrowedFrom = borrowedFrom;
+                args->aidShard = aidShard;
+                args->aidLender = aidLender;
+                args->tracked = aidShard >= 0 ? NULL :   // units of other shards are not forecast
+                    handling_begin(&evt, params->code, borrowed && borrowedFrom != NULL ? borrowedFrom->district : params->district,
+                                   borrowed && borrowedFrom != NULL ? borrowedFrom->code : params->code);
 
-                xTaskCreate(EventHandlerTask, "EventWorker", configMINIMAL_STACK_SIZE * 4, args, 2, NULL);  // handle an event task
+                char workerName[16];
+                task_create(EventHandlerTask, worker_task_name(workerName, sizeof(workerName), params->code), TASK_HANDLER, args);  // handle an event task
 
             } else {  // if no resources available
 
               char msg[200];     // initialize a message string
               snprintf(msg, sizeof(msg), "%s No available or borrowed resources, event delayed", deptName);
               log_message(msg);   // send message to logger
-              xQueueSendToBack(queue, &evt, portMAX_DELAY);   // send the event back to the department's queue, if queue is full then task is blocked until queue space is available
-              vTaskDelay(pdMS_TO_TICKS(500));   // 0.5 sec hardcoded delay
+              METRIC_INC(systemMetrics.delayed[params->code - 1]);
+              evt.requeues++;
+              os_queue_send(queue, &evt, OS_WAIT_FOREVER);   // send the event back to the department's queue, if queue is full then task is blocked until queue space is available
+              sim_timer_restart(&timer);   // the task waited on its queue since the last retry
+              sim_delay_ms(&timer, simParams.retryMs);   // 0.5 sec (model time) delay before retrying
 
             }
         }
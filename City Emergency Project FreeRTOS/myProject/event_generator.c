@@ -14,37 +14,201 @@
 
 #include "city_emergency_project.h"
 
-void EventGeneratorTask(void *pvParameters) {
-    
-    while (1) {
-        Event evt;   // initialize an event object
-        evt.code = (rand() % MAX_CODE) + 1;   // random choice of department code
-        evt.priority = (rand() % MAX_PRIORITY) + 1;   // random choice of priority
-        insert_event(evt);   // insert the event to the eventBuffer
-        vTaskDelay(pdMS_TO_TICKS((rand() % (EVENT_GEN_TIME_MAX_MS - EVENT_GEN_TIME_MIN_MS) ) + EVENT_GEN_TIME_MIN_MS));   // random event generation time
+static AliasTable departmentTable;   // department draw weighted by the configured weights
+static int weighted = 0;            // 0 = all weights equal, a plain uniform draw
+static unsigned long limitTaken = 0;   // events taken from the --events limit, all districts
+static int generatorsDone = 0;         // generator tasks that ended (limit used up or end of the replay)
+
+static void build_department_table(void) {
+
+    double weights[MAX_DEPARTMENTS];
+
+    weighted = 0;
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        weights[d] = simParams.departments[d].weight;
+        if (weights[d] != weights[0]) weighted = 1;
+    }
+
+    if (weighted) {
+        alias_build(&departmentTable, weights, simParams.departmentCount);
     }
 }
 
-void insert_event(Event evt) {
+void generate_random_event(WorkloadRng *rng, Event *evt) {
 
-    xSemaphoreTake(xEventBufferMutex, portMAX_DELAY);   // take a mutex, blocking the task so that only one event can be inserted at a time
+    memset(evt, 0, sizeof(*evt));   // no time stamps yet, no requeues
+    evt->code = (weighted ? alias_draw(&departmentTable, &rng->events)
+                          : (int)rng_below(&rng->events, (uint32_t)simParams.departmentCount)) + 1;   // random choice of department code
+    evt->priority = rng_below(&rng->events, MAX_PRIORITY) + 1;   // random choice of priority
+    evt->handleMs = draw_handling_time_ms(rng, evt->code);   // drawn here, the handling order of the departments does not change the workload
+}
 
-    if (eventCount < MAX_EVENTS) {  // if event buffer is not full
+uint32_t draw_generation_gap_ms(WorkloadRng *rng) {
 
-        int i = eventCount - 1;   // place the new event in buffer according to the priority value (highest priority first in buffer)
-        while (i >= 0 && eventBuffer[i].priority < evt.priority) {
-            eventBuffer[i + 1] = eventBuffer[i];
-            i--;
-        }
-        eventBuffer[i + 1] = evt;
+    return time_dist_draw(&simParams.generationGap, &rng->gaps);
+}
 
-        eventCount++;   // update the total pending events amount
-        
-    } else {   // if eventBuffer is full, event is dropped
+static int random_source_next(EventSource *source, Event *evt, uint64_t *arrivalTick) {
+
+    generate_random_event(&source->rng, evt);
+    *arrivalTick = source->clock;   // the first event arrives at time 0, then one random gap after the previous
+    source->clock += OS_MS_TO_TICKS(draw_generation_gap_ms(&source->rng));
+
+    return 1;   // never runs out
+}
+
+static int replay_source_next(EventSource *source, Event *evt, uint64_t *arrivalTick) {
+
+    return replay_next(&source->cursor, evt, arrivalTick);
+}
+
+static int profile_source_next(EventSource *source, Event *evt, uint64_t *arrivalTick) {
+
+    return profile_next(&source->profile, &source->rng, evt, arrivalTick);
+}
+
+void event_source_init(EventSource *source, int district) {
+
+    int cityDistrict = projectOptions.shardIndex * simParams.districtCount + district;   // a shard process runs a slice of the city
+    int cityDistricts = projectOptions.shardCount * simParams.districtCount;
+
+    memset(source, 0, sizeof(*source));
+    build_department_table();   // before the scheduler starts, a forecast may draw the random workload in any mode
+
+    if (projectOptions.replayPath != NULL) {
+        replay_cursor_init(&source->cursor, cityDistrict, cityDistricts);   // the districts share the trace
+        source->next = replay_source_next;
+    } else if (projectOptions.profilePath != NULL) {
+        workload_rng_init(&source->rng, projectOptions.seed, cityDistrict);
+        profile_state_init(&source->profile, 0);
+        source->next = profile_source_next;
+    } else {
+        workload_rng_init(&source->rng, projectOptions.seed, cityDistrict);
+        source->next = random_source_next;
+    }
+}
+
+void event_source_fork(EventSource *source, int district, uint64_t seed, uint64_t startTick) {
+
+    int cityDistrict = projectOptions.shardIndex * simParams.districtCount + district;
+
+    memset(source, 0, sizeof(*source));
+    workload_rng_init(&source->rng, seed, cityDistrict);
+
+    if (projectOptions.profilePath != NULL) {
+        profile_state_init(&source->profile, (double)startTick / OS_TICK_RATE_HZ);   // the rates of the profile at that time
+        source->next = profile_source_next;
+    } else {
+        source->clock = startTick + OS_MS_TO_TICKS(draw_generation_gap_ms(&source->rng));   // one gap after the copy, not an arrival at once
+        source->next = random_source_next;
+    }
+}
+
+int event_buffer_push(Event *buffer, int *count, int capacity, Event evt) {
+
+    if (*count >= capacity) {   // buffer full
+        return 0;
+    }
+
+    int i = *count - 1;   // place the new event in buffer according to the priority value (highest priority first in buffer)
+    while (i >= 0 && buffer[i].priority < evt.priority) {
+        buffer[i + 1] = buffer[i];
+        i--;
+    }
+    buffer[i + 1] = evt;
+
+    (*count)++;   // update the total pending events amount
+
+    return 1;
+}
+
+int event_limit_reserve(void) {
+
+    if (projectOptions.eventLimit == 0) {
+        return 1;
+    }
+
+    return __atomic_fetch_add(&limitTaken, 1, __ATOMIC_RELAXED) < projectOptions.eventLimit;
+}
+
+static unsigned long events_accounted(void) {   // events that left the system: completed or dropped
+
+    unsigned long done = __atomic_load_n(&systemMetrics.droppedBuffer, __ATOMIC_RELAXED);
+
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        done += __atomic_load_n(&systemMetrics.completed[d], __ATOMIC_RELAXED);
+        done += __atomic_load_n(&systemMetrics.droppedQueue[d], __ATOMIC_RELAXED);
+    }
+
+    return done;
+}
+
+static void end_after_drain(void) {   // the last generator of an --events run ends it once every event is completed or dropped
+
+    if (__atomic_add_fetch(&generatorsDone, 1, __ATOMIC_ACQ_REL) < simParams.districtCount) {
+        return;
+    }
+
+    while (events_accounted() < __atomic_load_n(&systemMetrics.generated, __ATOMIC_RELAXED)) {
+        os_delay(OS_MS_TO_TICKS(10));   // real time, the handlers finish on their own schedule
+    }
+
+    exit(0);   // the run summary is printed by the atexit() handler
+}
+
+void EventGeneratorTask(void *pvParameters) {
+
+    District *district = (District *)pvParameters;
+    SimTimer timer = { 0 };   // scaled delay schedule (time scale)
+    EventSource source;       // random workload (the task's own streams, no shared rand() state) or replay
+    uint64_t arrivalTick, lastArrival = 0;
+    Event evt;   // initialize an event object
+
+    event_source_init(&source, district->index);
+
+    while (event_limit_reserve() && source.next(&source, &evt, &arrivalTick)) {   // next event: random choice of department code, priority and handling time, or replayed
+
+        if (projectOptions.replayFast) {   // no arrival times, wait only for room in the eventBuffer
+            while (__atomic_load_n(&district->eventCount, __ATOMIC_RELAXED) >= (int)simParams.bufferLen) {
+                os_delay(1);
+            }
+        } else if (arrivalTick > lastArrival) {   // wait for the arrival time of the event
+            sim_delay_ms(&timer, (uint32_t)((arrivalTick - lastArrival) * 1000 / OS_TICK_RATE_HZ));
+            lastArrival = arrivalTick;
+        }   // an external trace may go back in time, that event arrives now (like --des)
+
+        METRIC_INC(systemMetrics.generated);
+        METRIC_INC(systemMetrics.districtGenerated[district->index]);
+        evt.district = district->index;
+        evt.generatedTick = os_tick_count();   // time stamp, the other stamps are set along the event's way
+        record_event(&evt, simulation_now_ticks());   // no-op unless recording
+        insert_event(district, evt);   // insert the event to the district's eventBuffer
+    }
+
+    if (projectOptions.eventLimit > 0) {   // --events: all generated, the run ends when the system has drained
+        end_after_drain();
+        os_task_exit();
+    }
+
+    char msg[LOG_LINE_LEN];   // the replayed trace ended, the rest of the system keeps running
+    snprintf(msg, sizeof(msg), "Replay finished: %lu events (%lu skipped)", systemMetrics.districtGenerated[district->index], source.cursor.skipped);
+    log_message(msg);
+    if (projectOptions.headless) fprintf(stderr, "%s\n", msg);   // no display in headless mode
+
+    os_task_exit();
+}
+
+void insert_event(District *district, Event evt) {
+
+    os_mutex_lock(district->bufferMutex);   // take a mutex, blocking the task so that only one event can be inserted at a time
+
+    if (!event_buffer_push(district->eventBuffer, &district->eventCount, (int)simParams.bufferLen, evt)) {   // if eventBuffer is full, event is dropped
 
         log_message("Warning: Event generation buffer full. Event dropped.");   // send message to logger
+        METRIC_INC(systemMetrics.droppedBuffer);
+        METRIC_INC(systemMetrics.districtDropped[district->index]);
         
     }
 
-    xSemaphoreGive(xEventBufferMutex);   // release the mutex
+    os_mutex_unlock(district->bufferMutex);   // release the mutex
 }
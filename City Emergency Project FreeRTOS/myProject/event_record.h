@@ -0,0 +1,150 @@
+/**
+******************************************************************************
+* @file           : event_record.h
+* @author         : Nimrod Elstein
+* @brief          : Binary format of recorded event streams (shared with replay and tools)
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* A recording is an EventRecordHeader followed by one variable length record per
+* generated event:
+*   varint   arrival time - arrival time of the previous record (model ticks)
+*   byte     department code << 4 | priority
+*   varint   handling time (ms, model time)
+* Varints are LEB128 (7 bits per byte, low bits first). A typical record is 4-5 bytes.
+* This header does not depend on FreeRTOS, so tools can include it directly.
+*
+******************************************************************************
+*/
+
+#ifndef EVENT_RECORD_H
+#define EVENT_RECORD_H
+
+/* Includes */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/////////////////////////
+
+/* Defines */
+
+#define EVENT_RECORD_MAGIC      0x52564543u   // "CEVR"
+#define EVENT_RECORD_VERSION    1
+#define EVENT_RECORD_MAX_BYTES  16            // longest encoded record (two 64 bit varints and a byte)
+
+///////////////////////////////// end Defines
+
+/* Variables */
+
+typedef struct {   // file header, host byte order (the simulator only runs on the POSIX port)
+    uint32_t magic;
+    uint16_t version;
+    uint16_t headerSize;      // sizeof(EventRecordHeader), records start after it
+    uint32_t tickRateHz;      // tick rate of the arrival times
+    uint32_t reserved;
+    uint64_t seed;            // master seed of the recorded run
+} EventRecordHeader;
+
+typedef struct {   // one decoded record
+    uint64_t arrivalTick;     // arrival time (model ticks since the start of the run)
+    uint8_t code;
+    uint8_t priority;
+    uint32_t handleMs;
+} EventRecord;
+
+///////////////////////////////// end Variables
+
+/* Function Signatures */
+
+/**
+ * @brief Function that writes a LEB128 varint.
+ *
+ * @param out Output bytes (at least 10 free).
+ * @param value The value.
+ *
+ * @return Number of bytes written.
+ */
+static inline size_t event_record_put_varint(uint8_t *out, uint64_t value) {
+    size_t n = 0;
+    while (value >= 0x80) {
+        out[n++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (uint8_t)value;
+    return n;
+}
+
+/**
+ * @brief Function that reads a LEB128 varint.
+ *
+ * @param in Input bytes.
+ * @param length Number of input bytes available.
+ * @param[out] value Receives the value.
+ *
+ * @return Number of bytes read, 0 if the input ends inside the varint.
+ */
+static inline size_t event_record_get_varint(const uint8_t *in, size_t length, uint64_t *value) {
+    uint64_t result = 0;
+    for (size_t n = 0; n < length && n < 10; n++) {
+        result |= (uint64_t)(in[n] & 0x7f) << (7 * n);
+        if ((in[n] & 0x80) == 0) {
+            *value = result;
+            return n + 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Function that encodes a record, delta encoded against the previous record.
+ *
+ * @param out Output bytes (at least EVENT_RECORD_MAX_BYTES free).
+ * @param rec The record.
+ * @param[in,out] lastTick Arrival time of the previous record (0 before the first record), updated.
+ *
+ * @return Number of bytes written.
+ */
+static inline size_t event_record_encode(uint8_t *out, const EventRecord *rec, uint64_t *lastTick) {
+    size_t n = event_record_put_varint(out, rec->arrivalTick - *lastTick);
+    out[n++] = (uint8_t)((rec->code << 4) | (rec->priority & 0x0f));
+    n += event_record_put_varint(out + n, rec->handleMs);
+    *lastTick = rec->arrivalTick;
+    return n;
+}
+
+/**
+ * @brief Function that decodes a record, see event_record_encode().
+ *
+ * @param in Input bytes.
+ * @param length Number of input bytes available.
+ * @param[out] rec Receives the record.
+ * @param[in,out] lastTick Arrival time of the previous record (0 before the first record), updated.
+ *
+ * @return Number of bytes read, 0 if the input ends inside the record.
+ */
+static inline size_t event_record_decode(const uint8_t *in, size_t length, EventRecord *rec, uint64_t *lastTick) {
+    uint64_t delta, handleMs;
+    size_t n = event_record_get_varint(in, length, &delta);
+    if (n == 0 || n >= length) {
+        return 0;
+    }
+    uint8_t packed = in[n++];
+    size_t m = event_record_get_varint(in + n, length - n, &handleMs);
+    if (m == 0) {
+        return 0;
+    }
+    rec->arrivalTick = *lastTick + delta;
+    rec->code = packed >> 4;
+    rec->priority = packed & 0x0f;
+    rec->handleMs = (uint32_t)handleMs;
+    *lastTick = rec->arrivalTick;
+    return n + m;
+}
+
+///////////////////////////////// end Function Signatures
+
+#endif
@@ -0,0 +1,306 @@
+/**
+******************************************************************************
+* @file           : forecast.c
+* @author         : Nimrod Elstein
+* @brief          : Source code related to the what-if forecasts (live state forked into fast-forward runs)
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* The forecast command copies the live state (eventBuffers, queue depths, free
+* units and the busy units with their remaining handling time) and ForecastTask
+* runs the discrete-event engine from the copy, FORECAST_RUNS times with
+* different seeds, for the fleets as they are and for a what-if fleet change.
+* The live tasks keep running, the runs have their own state and metrics sink.
+*
+******************************************************************************
+*/
+
+#include "city_emergency_project.h"
+
+#define FORECAST_READ_RETRIES 4   // seqlock reads of a busy unit slot before it is skipped
+
+typedef struct {   // the forecast in progress, one at a time
+    ForecastRequest request;
+    ForecastSnapshot snapshot;
+    uint32_t startTick;   // real time the forecast started (reply)
+} ForecastJob;
+
+typedef struct {   // results of the runs of one scenario
+    int waiting[FORECAST_RUNS];   // calls in the eventBuffers and queues at the horizon, one per run
+    double dropsPerRun;
+    uint32_t e2eP50, e2eP95, e2eP99;
+    uint32_t priorityP95[MAX_PRIORITY];
+} ForecastResult;
+
+static ActiveHandling *handlings = NULL;   // DEPARTMENT_MAX_UNITS slots per unit owner (district, department)
+static ForecastJob job;
+static uint32_t running = 0;   // 1 while a ForecastTask runs
+
+int forecast_init(void) {
+
+    size_t slots = (size_t)simParams.districtCount * simParams.departmentCount * DEPARTMENT_MAX_UNITS;
+
+    handlings = calloc(slots, sizeof(ActiveHandling));
+    if (handlings == NULL) {
+        return 0;
+    }
+    for (size_t i = 0; i < slots; i++) {
+        handlings[i].sequence = 1;   // a free slot is odd, a claim is never read before its event is written
+    }
+
+    return 1;
+}
+
+ActiveHandling *handling_begin(const Event *evt, int code, int unitDistrict, int unitCode) {
+
+    if (handlings == NULL) {
+        return NULL;
+    }
+
+    ActiveHandling *slots = &handlings[((size_t)unitDistrict * simParams.departmentCount + unitCode - 1) * DEPARTMENT_MAX_UNITS];
+
+    for (int i = 0; i < DEPARTMENT_MAX_UNITS; i++) {   // an owner never has more busy units than its largest fleet
+
+        uint32_t idle = 0;
+        ActiveHandling *slot = &slots[i];
+
+        if (__atomic_load_n(&slot->active, __ATOMIC_RELAXED) == 0 &&
+            __atomic_compare_exchange_n(&slot->active, &idle, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            slot->evt = *evt;   // the sequence is still odd from handling_end(), the reader retries
+            slot->code = code;
+            slot->unitCode = unitCode;
+            slot->unitDistrict = unitDistrict;
+            __atomic_store_n(&slot->sequence, slot->sequence + 1, __ATOMIC_RELEASE);   // even, consistent
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+void handling_end(ActiveHandling *slot) {
+
+    if (slot != NULL) {
+        __atomic_store_n(&slot->sequence, slot->sequence + 1, __ATOMIC_RELAXED);   // odd until the next handling has written the slot
+        __atomic_store_n(&slot->active, 0, __ATOMIC_RELEASE);                      // after the odd sequence
+    }
+}
+
+static int read_handling(const ActiveHandling *slot, ActiveHandling *copy) {   // seqlock read, 0 = free or never consistent
+
+    for (int attempt = 0; attempt < FORECAST_READ_RETRIES; attempt++) {
+        uint32_t before = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (!__atomic_load_n(&slot->active, __ATOMIC_ACQUIRE)) {
+            return 0;
+        }
+        if (before & 1u) {
+            continue;   // being claimed and written by a handler
+        }
+        memcpy(copy, (const void *)slot, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == before) {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static OsTick model_tick(const ForecastSnapshot *snap, OsTick realNow, OsTick stamp) {   // a live time stamp in model ticks
+
+    return (OsTick)(snap->now - sim_ticks_from_real(realNow - stamp));
+}
+
+static void model_stamps(const ForecastSnapshot *snap, OsTick realNow, Event *evt) {   // stamps the event has not reached yet are set again by the run
+
+    evt->generatedTick = model_tick(snap, realNow, evt->generatedTick);
+    evt->dispatchedTick = model_tick(snap, realNow, evt->dispatchedTick);
+    evt->receivedTick = model_tick(snap, realNow, evt->receivedTick);
+    evt->assignedTick = model_tick(snap, realNow, evt->assignedTick);
+}
+
+static int take_forecast_snapshot(ForecastSnapshot *snap) {
+
+    int slots = simParams.districtCount * simParams.departmentCount * DEPARTMENT_MAX_UNITS;
+    OsTick realNow = os_tick_count();
+
+    memset(snap, 0, sizeof(*snap));
+    snap->now = (uint64_t)(realNow * projectOptions.timeScale);   // simulation_now_ticks() of realNow
+    snap->buffer = malloc((size_t)simParams.districtCount * simParams.bufferLen * sizeof(Event));
+    snap->busy = malloc((size_t)slots * sizeof(ForecastBusy));
+    if (snap->buffer == NULL || snap->busy == NULL) {
+        free(snap->buffer);
+        free(snap->busy);
+        return 0;
+    }
+
+    for (int k = 0; k < simParams.districtCount; k++) {
+
+        District *district = &districts[k];
+        Event *copy = &snap->buffer[(size_t)k * simParams.bufferLen];
+
+        os_mutex_lock(district->bufferMutex);   // one copy, as short as the status display's
+        memcpy(copy, district->eventBuffer, (size_t)district->eventCount * sizeof(Event));
+        snap->bufferCount[k] = district->eventCount;
+        os_mutex_unlock(district->bufferMutex);
+
+        for (int i = 0; i < snap->bufferCount[k]; i++) {
+            model_stamps(snap, realNow, &copy[i]);
+        }
+
+        for (int d = 0; d < simParams.departmentCount; d++) {   // without locks, like the gauges
+            DepartmentParams *params = &district->departments[d];
+            snap->queueDepth[k][d] = os_queue_count(params->queue);
+            snap->freeUnits[k][d] = os_semaphore_count(params->semaphore);
+            snap->retiring[k][d] = __atomic_load_n(&params->retiring, __ATOMIC_RELAXED);
+        }
+    }
+
+    for (int i = 0; i < slots && handlings != NULL; i++) {   // the busy units and the rest of their handling time
+
+        ForecastBusy *busy = &snap->busy[snap->busyCount];
+
+        if (!read_handling(&handlings[i], &busy->handling)) {
+            continue;
+        }
+        uint32_t elapsed = sim_ticks_from_real(realNow - busy->handling.evt.assignedTick);
+        uint32_t total = OS_MS_TO_TICKS(busy->handling.evt.handleMs);
+        model_stamps(snap, realNow, &busy->handling.evt);
+        busy->doneTick = snap->now + (total > elapsed ? total - elapsed : 0);
+        snap->busyCount++;
+    }
+
+    return 1;
+}
+
+int forecast_start(const ForecastRequest *request) {
+
+    uint32_t idle = 0;
+
+    if (!__atomic_compare_exchange_n(&running, &idle, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 0;   // one forecast at a time
+    }
+
+    job.request = *request;
+    job.startTick = os_tick_count();
+
+    if (!take_forecast_snapshot(&job.snapshot)) {
+        __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+        return -1;
+    }
+    if (!task_create(ForecastTask, "Forecast", TASK_FORECAST, &job)) {
+        free(job.snapshot.buffer);
+        free(job.snapshot.busy);
+        __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+        return -1;
+    }
+
+    return 1;
+}
+
+static int compare_int(const void *a, const void *b) {
+
+    return (*(const int *)a > *(const int *)b) - (*(const int *)a < *(const int *)b);
+}
+
+static void run_scenario(const ForecastJob *forecast, const FleetChange *change, DesState *state, SystemMetrics *metrics, ForecastResult *result) {
+
+    const ForecastSnapshot *snap = &forecast->snapshot;
+    uint64_t untilTick = snap->now + (uint64_t)forecast->request.minutes * 60 * OS_TICK_RATE_HZ;
+    unsigned long drops = 0;
+
+    memset(metrics, 0, sizeof(*metrics));
+
+    for (int r = 0; r < FORECAST_RUNS; r++) {
+
+        uint64_t seed = projectOptions.seed ^ (snap->now * 0x9e3779b97f4a7c15ull) ^ ((uint64_t)(r + 1) << 32);   // the same seeds in both scenarios
+
+        des_init_forecast(state, snap, change, seed, metrics);
+        des_run(state, untilTick);
+
+        result->waiting[r] = 0;
+        for (int k = 0; k < simParams.districtCount; k++) {
+            result->waiting[r] += state->districts[k].bufferCount;
+            for (int d = 0; d < simParams.departmentCount; d++) {
+                result->waiting[r] += state->districts[k].queues[d].count;
+            }
+        }
+
+        des_free(state);
+    }
+
+    drops = metrics->droppedBuffer;
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        drops += metrics->droppedQueue[d];
+    }
+
+    qsort(result->waiting, FORECAST_RUNS, sizeof(int), compare_int);
+    result->dropsPerRun = (double)drops / FORECAST_RUNS;
+    result->e2eP50 = histogram_percentile(&metrics->latency[STAGE_END_TO_END], 50.0);
+    result->e2eP95 = histogram_percentile(&metrics->latency[STAGE_END_TO_END], 95.0);
+    result->e2eP99 = histogram_percentile(&metrics->latency[STAGE_END_TO_END], 99.0);
+    for (int p = 0; p < MAX_PRIORITY; p++) {
+        result->priorityP95[p] = histogram_percentile(&metrics->latencyByPriority[STAGE_END_TO_END][p], 95.0);
+    }
+}
+
+static void reply_result(const char *label, const ForecastResult *result) {
+
+    command_reply("forecast %s: waiting calls median %d (%d to %d), %.1f dropped per run, end-to-end p50 %lu p95 %lu p99 %lu ticks",
+                  label, result->waiting[FORECAST_RUNS / 2], result->waiting[0], result->waiting[FORECAST_RUNS - 1], result->dropsPerRun,
+                  (unsigned long)result->e2eP50, (unsigned long)result->e2eP95, (unsigned long)result->e2eP99);
+    command_reply("forecast %s: end-to-end p95 by priority 3 / 2 / 1: %lu / %lu / %lu ticks", label,
+                  (unsigned long)result->priorityP95[2], (unsigned long)result->priorityP95[1], (unsigned long)result->priorityP95[0]);
+}
+
+void ForecastTask(void *pvParameters) {
+
+    ForecastJob *forecast = (ForecastJob *)pvParameters;
+    const ForecastSnapshot *snap = &forecast->snapshot;
+    const FleetChange *change = &forecast->request.change;
+    DesState *state = malloc(sizeof(DesState));        // large, not on the task stack
+    SystemMetrics *metrics = malloc(sizeof(SystemMetrics));
+    ForecastResult result;
+    int waiting = 0;
+
+    for (int k = 0; k < simParams.districtCount; k++) {
+        waiting += snap->bufferCount[k];
+        for (int d = 0; d < simParams.departmentCount; d++) {
+            waiting += (int)snap->queueDepth[k][d];
+        }
+    }
+
+    if (state == NULL || metrics == NULL) {
+        command_reply("forecast: out of memory");
+    } else {
+        command_reply("forecast: %lu min ahead, %d runs from %d waiting calls and %d busy units",
+                      (unsigned long)forecast->request.minutes, FORECAST_RUNS, waiting, snap->busyCount);
+
+        run_scenario(forecast, NULL, state, metrics, &result);
+        reply_result("as is", &result);
+
+        if (change->code != 0) {   // the same runs with the fleet change
+            char label[48];
+            snprintf(label, sizeof(label), "%s %+d", simParams.departments[change->code - 1].key, change->delta);
+            if (simParams.districtCount > 1) {
+                snprintf(label + strlen(label), sizeof(label) - strlen(label), " district %d", change->district + 1);
+            }
+            run_scenario(forecast, change, state, metrics, &result);
+            reply_result(label, &result);
+        }
+
+        command_reply("forecast: done in %lu ms", (unsigned long)((os_tick_count() - forecast->startTick) * 1000u / OS_TICK_RATE_HZ));
+    }
+
+    free(state);
+    free(metrics);
+    free(forecast->snapshot.buffer);
+    free(forecast->snapshot.busy);
+    __atomic_store_n(&running, 0, __ATOMIC_RELEASE);
+
+    stack_stats_task_done(TASK_FORECAST);
+    os_task_exit();
+}
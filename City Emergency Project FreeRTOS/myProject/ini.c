@@ -0,0 +1,109 @@
+/**
+******************************************************************************
+* @file           : ini.c
+* @author         : Nimrod Elstein
+* @brief          : Source code related to reading INI style files (profiles, configuration)
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* Format: "[section]" or "[section name]" lines, "key = value" lines,
+* comments start with ';' or '#'. Runs before the scheduler, plain stdio.
+*
+******************************************************************************
+*/
+
+#include "city_emergency_project.h"
+#include <ctype.h>
+
+static char *trim(char *s) {
+
+    while (isspace((unsigned char)*s)) s++;
+
+    char *end = s + strlen(s);
+    while (end > s && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+
+    return s;
+}
+
+int ini_parse(const char *path, IniHandler handler, void *ctx) {
+
+    char line[INI_LINE_LEN];
+    char section[INI_LINE_LEN] = "";
+    int lineNumber = 0;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        perror(path);
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+
+        lineNumber++;
+
+        char *comment = strpbrk(line, ";#");   // comments, whole line or after a value
+        if (comment != NULL) *comment = '\0';
+
+        char *text = trim(line);
+        if (*text == '\0') {
+            continue;
+        }
+
+        if (*text == '[') {   // [section] or [section name]
+            char *close = strchr(text, ']');
+            if (close == NULL) {
+                fprintf(stderr, "%s:%d: missing ']'\n", path, lineNumber);
+                fclose(file);
+                return 0;
+            }
+            *close = '\0';
+            snprintf(section, sizeof(section), "%s", trim(text + 1));
+            continue;
+        }
+
+        char *equals = strchr(text, '=');
+        if (equals == NULL) {
+            fprintf(stderr, "%s:%d: expected key = value\n", path, lineNumber);
+            fclose(file);
+            return 0;
+        }
+        *equals = '\0';
+
+        if (!handler(ctx, section, trim(text), trim(equals + 1))) {   // the handler rejects the value
+            fprintf(stderr, "%s:%d: invalid entry in [%s]\n", path, lineNumber, section);
+            fclose(file);
+            return 0;
+        }
+    }
+
+    fclose(file);
+
+    return 1;
+}
+
+int ini_parse_list(const char *value, double *out, int max) {
+
+    int count = 0;
+    const char *p = value;
+
+    while (*p != '\0') {
+
+        char *end = NULL;
+        double number = strtod(p, &end);
+        if (end == p || count == max) {   // not a number, or too many values
+            return -1;
+        }
+        out[count++] = number;
+
+        p = end;
+        while (isspace((unsigned char)*p)) p++;
+        if (*p == ',') p++;
+        else if (*p != '\0') return -1;
+    }
+
+    return count;
+}
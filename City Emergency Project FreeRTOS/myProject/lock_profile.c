@@ -0,0 +1,344 @@
+/**
+******************************************************************************
+* @file           : lock_profile.c
+* @author         : Nimrod Elstein
+* @brief          : Source code related to the lock contention profiler (LOCK_PROFILE=1 builds)
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* In a LOCK_PROFILE=1 build os_port.h routes os_mutex_lock/unlock and
+* os_semaphore_take/give here. The objects named with lock_profile_name() are
+* found in a small hash table (filled before the tasks start, read-only after),
+* the others go straight to the backend.
+*
+* A mutex is first tried without waiting: a failed try is a contended
+* acquisition, the task then waits for it. The wait (call to acquired) and the
+* hold (acquired to unlock) go to log2 histograms of nanoseconds, and the hold
+* to the table of the tasks that held the mutex. A mutex's statistics are only
+* written by the task holding it, so the mutex itself orders the writers; the
+* stores are relaxed atomics for the status display that reads them.
+*
+* Counting semaphores (department units) have no owner: takes, failed takes and
+* gives are counted with atomic adds, the wait only when a take may block.
+*
+******************************************************************************
+*/
+
+#define OS_PORT_IMPLEMENTATION   // the real os_* functions, this file is the wrapper
+#include "city_emergency_project.h"
+
+#if LOCK_PROFILE
+
+#define LOCK_PROFILE_SLOTS 128   // hash table of the named objects (power of two, districts * (2 mutexes + departments) fit)
+#define LOCK_HIST_BUCKETS 32     // bucket i counts the times in [2^i, 2^(i+1)) ns, the last one everything above
+#define LOCK_HOLDERS 8           // task names tracked per mutex, later names are counted as "other"
+#define LOCK_TOP_HOLDERS 3       // holders printed per mutex in the exit report
+
+typedef struct {   // time one task (by name) held a mutex
+    char name[16];
+    unsigned long holds;
+    unsigned long totalNs;
+    unsigned long maxNs;
+} LockHolder;
+
+typedef struct {   // one named mutex or semaphore
+    const void *object;   // NULL = free slot
+    const char *name;
+    int district;
+
+    unsigned long acquisitions;   // mutex
+    unsigned long contended;
+    unsigned long waitMaxNs;
+    unsigned long holdMaxNs;
+    unsigned long wait[LOCK_HIST_BUCKETS];
+    unsigned long hold[LOCK_HIST_BUCKETS];
+    unsigned long holdStart;      // written by the holder only
+    const char *holder;
+    int holderCount;              // published with release, the names of the slots below it never change
+    LockHolder holders[LOCK_HOLDERS];
+    LockHolder other;
+
+    unsigned long takes;          // counting semaphore
+    unsigned long failedTakes;
+    unsigned long gives;
+} LockProfile;
+
+static LockProfile profiles[LOCK_PROFILE_SLOTS];
+static LockProfile *named[LOCK_PROFILE_SLOTS];   // in the order they were named, for the report
+static int namedCount = 0;
+
+static LockProfile *find_profile(const void *object) {   // NULL = not named, not profiled
+
+    uint32_t slot = (uint32_t)(((uintptr_t)object >> 4) * 2654435761u) & (LOCK_PROFILE_SLOTS - 1);
+
+    for (int probe = 0; probe < LOCK_PROFILE_SLOTS; probe++) {
+        LockProfile *profile = &profiles[(slot + probe) & (LOCK_PROFILE_SLOTS - 1)];
+        if (profile->object == object) return profile;
+        if (profile->object == NULL) return NULL;
+    }
+
+    return NULL;
+}
+
+void lock_profile_name(const void *object, const char *name, int district) {
+
+    if (object == NULL) {
+        return;
+    }
+
+    uint32_t slot = (uint32_t)(((uintptr_t)object >> 4) * 2654435761u) & (LOCK_PROFILE_SLOTS - 1);
+
+    for (int probe = 0; probe < LOCK_PROFILE_SLOTS; probe++) {
+        LockProfile *profile = &profiles[(slot + probe) & (LOCK_PROFILE_SLOTS - 1)];
+        if (profile->object == NULL || profile->object == object) {
+            if (profile->object == NULL) named[namedCount++] = profile;
+            profile->name = name;
+            profile->district = district;
+            profile->object = object;
+            return;
+        }
+    }
+
+    fprintf(stderr, "lock profile: more than %d objects, %s is not profiled\n", LOCK_PROFILE_SLOTS, name);
+}
+
+/* recording */
+
+static int bucket_of(unsigned long ns) {
+
+    int bucket = ns > 1 ? 63 - __builtin_clzl(ns) : 0;
+    return bucket < LOCK_HIST_BUCKETS ? bucket : LOCK_HIST_BUCKETS - 1;
+}
+
+static inline void add_held(unsigned long *counter, unsigned long value) {   // the caller holds the mutex: no other writer
+
+    __atomic_store_n(counter, __atomic_load_n(counter, __ATOMIC_RELAXED) + value, __ATOMIC_RELAXED);
+}
+
+static inline void max_held(unsigned long *counter, unsigned long value) {
+
+    if (value > __atomic_load_n(counter, __ATOMIC_RELAXED)) __atomic_store_n(counter, value, __ATOMIC_RELAXED);
+}
+
+static LockHolder *holder_slot(LockProfile *profile, const char *name) {   // under the mutex
+
+    int count = profile->holderCount;
+
+    for (int i = 0; i < count; i++) {
+        if (strncmp(profile->holders[i].name, name, sizeof(profile->holders[i].name)) == 0) return &profile->holders[i];
+    }
+    if (count == LOCK_HOLDERS) {
+        return &profile->other;
+    }
+
+    snprintf(profile->holders[count].name, sizeof(profile->holders[count].name), "%s", name);
+    __atomic_store_n(&profile->holderCount, count + 1, __ATOMIC_RELEASE);   // the name is complete before the display sees the slot
+    return &profile->holders[count];
+}
+
+void lock_profile_mutex_lock(OsMutex mutex) {
+
+    LockProfile *profile = find_profile(mutex);
+    if (profile == NULL) {
+        os_mutex_lock(mutex);
+        return;
+    }
+
+    unsigned long start = os_run_time_ns();
+    int contended = !os_mutex_try_lock(mutex);
+    if (contended) {
+        os_mutex_lock(mutex);
+    }
+    unsigned long acquired = os_run_time_ns();
+
+    add_held(&profile->acquisitions, 1);   // held from here on
+    if (contended) add_held(&profile->contended, 1);
+    add_held(&profile->wait[bucket_of(acquired - start)], 1);
+    max_held(&profile->waitMaxNs, acquired - start);
+    profile->holder = os_task_name();
+    profile->holdStart = os_run_time_ns();
+}
+
+void lock_profile_mutex_unlock(OsMutex mutex) {
+
+    LockProfile *profile = find_profile(mutex);
+
+    if (profile != NULL) {   // still held: record before the next task takes it
+        unsigned long hold = os_run_time_ns() - profile->holdStart;
+        add_held(&profile->hold[bucket_of(hold)], 1);
+        max_held(&profile->holdMaxNs, hold);
+
+        LockHolder *holder = holder_slot(profile, profile->holder != NULL ? profile->holder : "?");
+        add_held(&holder->holds, 1);
+        add_held(&holder->totalNs, hold);
+        max_held(&holder->maxNs, hold);
+    }
+
+    os_mutex_unlock(mutex);
+}
+
+int lock_profile_semaphore_take(OsSemaphore semaphore, OsTick wait) {
+
+    LockProfile *profile = find_profile(semaphore);
+    if (profile == NULL) {
+        return os_semaphore_take(semaphore, wait);
+    }
+
+    unsigned long start = wait > 0 ? os_run_time_ns() : 0;
+    int taken = os_semaphore_take(semaphore, wait);
+
+    __atomic_fetch_add(taken ? &profile->takes : &profile->failedTakes, 1, __ATOMIC_RELAXED);
+    if (wait > 0) {   // only a blocking take waits
+        unsigned long waited = os_run_time_ns() - start;
+        __atomic_fetch_add(&profile->wait[bucket_of(waited)], 1, __ATOMIC_RELAXED);
+        unsigned long seen = __atomic_load_n(&profile->waitMaxNs, __ATOMIC_RELAXED);
+        while (waited > seen && !__atomic_compare_exchange_n(&profile->waitMaxNs, &seen, waited, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        }
+    }
+
+    return taken;
+}
+
+void lock_profile_semaphore_give(OsSemaphore semaphore) {
+
+    LockProfile *profile = find_profile(semaphore);
+
+    if (profile != NULL) {
+        __atomic_fetch_add(&profile->gives, 1, __ATOMIC_RELAXED);
+    }
+    os_semaphore_give(semaphore);
+}
+
+/* report */
+
+static unsigned long bucket_percentile(const unsigned long *hist, double q, unsigned long max) {   // upper bound of the bucket
+
+    unsigned long total = 0, seen = 0;
+
+    for (int i = 0; i < LOCK_HIST_BUCKETS; i++) total += __atomic_load_n(&hist[i], __ATOMIC_RELAXED);
+    if (total == 0) {
+        return 0;
+    }
+
+    unsigned long rank = (unsigned long)(q * total);
+    if (rank >= total) rank = total - 1;
+    for (int i = 0; i < LOCK_HIST_BUCKETS - 1; i++) {
+        seen += __atomic_load_n(&hist[i], __ATOMIC_RELAXED);
+        if (seen > rank) {
+            unsigned long upper = 2ul << i;
+            return upper < max ? upper : max;
+        }
+    }
+
+    return max;
+}
+
+static const char *format_ns(char *text, size_t size, unsigned long ns) {
+
+    if (ns < 1000) snprintf(text, size, "%luns", ns);
+    else if (ns < 1000000) snprintf(text, size, "%.1fus", ns / 1e3);
+    else if (ns < 1000000000) snprintf(text, size, "%.1fms", ns / 1e6);
+    else snprintf(text, size, "%.2fs", ns / 1e9);
+    return text;
+}
+
+static void format_times(char *text, size_t size, const unsigned long *hist, unsigned long max) {   // "p50/p99/max"
+
+    char p50[16], p99[16], top[16];
+
+    snprintf(text, size, "%s/%s/%s", format_ns(p50, sizeof(p50), bucket_percentile(hist, 0.50, max)),
+             format_ns(p99, sizeof(p99), bucket_percentile(hist, 0.99, max)), format_ns(top, sizeof(top), max));
+}
+
+static void profile_label(char *label, size_t size, const LockProfile *profile, const char *suffix) {   // "Police units 2"
+
+    if (profile->district >= 0 && simParams.districtCount > 1) {
+        snprintf(label, size, "%s%s %d", profile->name, suffix, profile->district + 1);
+    } else {
+        snprintf(label, size, "%s%s", profile->name, suffix);
+    }
+}
+
+static int top_holders(const LockProfile *profile, const LockHolder **top, int size) {   // by total hold time, longest first
+
+    const LockHolder *sorted[LOCK_HOLDERS];
+    int count = __atomic_load_n(&profile->holderCount, __ATOMIC_ACQUIRE);
+
+    for (int i = 0; i < count; i++) {   // insertion sort, a handful of tasks
+        unsigned long total = __atomic_load_n(&profile->holders[i].totalNs, __ATOMIC_RELAXED);
+        int at = i;
+        while (at > 0 && __atomic_load_n(&sorted[at - 1]->totalNs, __ATOMIC_RELAXED) < total) {
+            sorted[at] = sorted[at - 1];
+            at--;
+        }
+        sorted[at] = &profile->holders[i];
+    }
+
+    if (count > size) count = size;
+    memcpy(top, sorted, (size_t)count * sizeof(*top));
+    return count;
+}
+
+void lock_profile_print(FILE *out, int compact) {
+
+    fprintf(out, "  %-20s %10s %9s  %-26s %s\n", "object", "acquired", "contended", "wait p50/p99/max",
+            compact ? "hold p50/p99/max           top holder" : "hold p50/p99/max");
+
+    for (int n = 0; n < namedCount; n++) {
+        const LockProfile *profile = named[n];
+        char label[40];
+
+        unsigned long takes = __atomic_load_n(&profile->takes, __ATOMIC_RELAXED);
+        unsigned long failed = __atomic_load_n(&profile->failedTakes, __ATOMIC_RELAXED);
+        unsigned long gives = __atomic_load_n(&profile->gives, __ATOMIC_RELAXED);
+        if (takes + failed + gives > 0) {   // a counting semaphore, no owner and no hold time
+            profile_label(label, sizeof(label), profile, " units");
+            fprintf(out, "  %-20s %10lu takes, %lu failed (%.1f%%), %lu gives\n", label, takes, failed,
+                    takes + failed ? 100.0 * failed / (takes + failed) : 0.0, gives);
+            continue;
+        }
+
+        profile_label(label, sizeof(label), profile, "");
+        unsigned long acquisitions = __atomic_load_n(&profile->acquisitions, __ATOMIC_RELAXED);
+        unsigned long contended = __atomic_load_n(&profile->contended, __ATOMIC_RELAXED);
+        char wait[48], hold[48];
+        format_times(wait, sizeof(wait), profile->wait, __atomic_load_n(&profile->waitMaxNs, __ATOMIC_RELAXED));
+        format_times(hold, sizeof(hold), profile->hold, __atomic_load_n(&profile->holdMaxNs, __ATOMIC_RELAXED));
+
+        const LockHolder *top[LOCK_TOP_HOLDERS];
+        int count = top_holders(profile, top, compact ? 1 : LOCK_TOP_HOLDERS);
+
+        fprintf(out, "  %-20s %10lu %8.1f%%  %-26s ", label, acquisitions, acquisitions ? 100.0 * contended / acquisitions : 0.0, wait);
+        if (compact) {
+            fprintf(out, "%-26s %s\n", hold, count > 0 ? top[0]->name : "-");
+        } else {
+            fprintf(out, "%s\n", hold);
+        }
+
+        for (int i = 0; !compact && i < count; i++) {
+            char total[16], longest[16];
+            fprintf(out, "      %-16s %10lu holds, %s held, longest %s\n", top[i]->name, __atomic_load_n(&top[i]->holds, __ATOMIC_RELAXED),
+                    format_ns(total, sizeof(total), __atomic_load_n(&top[i]->totalNs, __ATOMIC_RELAXED)),
+                    format_ns(longest, sizeof(longest), __atomic_load_n(&top[i]->maxNs, __ATOMIC_RELAXED)));
+        }
+        unsigned long otherHolds = __atomic_load_n(&profile->other.holds, __ATOMIC_RELAXED);
+        if (!compact && otherHolds > 0) {
+            char total[16];
+            fprintf(out, "      %-16s %10lu holds, %s held\n", "(other tasks)", otherHolds,
+                    format_ns(total, sizeof(total), __atomic_load_n(&profile->other.totalNs, __ATOMIC_RELAXED)));
+        }
+    }
+}
+
+void lock_profile_exit_report(void) {
+
+    FILE *out = projectOptions.json ? stderr : stdout;   // the --json summary stays one line on stdout
+
+    fprintf(out, "\nLock contention (LOCK_PROFILE build):\n");
+    lock_profile_print(out, 0);
+}
+
+#endif
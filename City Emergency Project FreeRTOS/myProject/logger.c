@@ -14,81 +14,207 @@
 
 #include "city_emergency_project.h"
 
-static char logBuffer[MAX_LOG_LINES][200];   // initialize the log messages buffer (MAX_LOG_LINES to be displayed)
+static char logBuffer[MAX_LOG_LINES][LOG_LINE_LEN];   // initialize the log messages buffer (MAX_LOG_LINES to be displayed)
 static int logIndex = 0;    // message index variable
 static int logCount = 0;   // log messages counter
 
+static LockHoldStats logHoldStats;      // xLogMutex hold time, measured by take_status_snapshot()
+static LockHoldStats bufferHoldStats;  // district eventBuffer mutex hold time, measured by take_status_snapshot()
+
+static void record_hold_time(LockHoldStats *stats, unsigned long holdNs) {
+
+    stats->last = holdNs;
+    if (holdNs > stats->max) stats->max = holdNs;
+    stats->total += holdNs;
+    stats->samples++;
+}
+
 void log_message(const char *msg) {
 
-    xSemaphoreTake(xLogMutex, portMAX_DELAY);   // take a mutex and block other tasks from logging messages
+    if (projectOptions.headless) {   // no status display reads the log ring in headless mode
+        return;
+    }
+
+    os_mutex_lock(xLogMutex);   // take a mutex and block other tasks from logging messages
 
     strncpy(logBuffer[logIndex], msg, sizeof(logBuffer[logIndex]) - 1);
     logBuffer[logIndex][sizeof(logBuffer[logIndex]) - 1] = '\0';
     logIndex = (logIndex + 1) % MAX_LOG_LINES;
     if (logCount < MAX_LOG_LINES) logCount++;
 
-    xSemaphoreGive(xLogMutex);   // release the mutex
+    os_mutex_unlock(xLogMutex);   // release the mutex
+}
+
+void take_status_snapshot(StatusSnapshot *snap) {
+
+    int shown = 0;
+
+    snap->pendingCount = 0;
+    memset(snap->freeUnits, 0, sizeof(snap->freeUnits));
+    memset(snap->busyUnits, 0, sizeof(snap->busyUnits));
+    memset(snap->queueDepth, 0, sizeof(snap->queueDepth));
+
+    for (int k = 0; k < simParams.districtCount; k++) {   // one district at a time, each copy is consistent within its district
+
+        District *district = &districts[k];
+
+        os_mutex_lock(district->bufferMutex);
+        unsigned long bufferStart = os_run_time_ns();
+
+        int rows = district->eventCount < MAX_EVENTS - shown ? district->eventCount : MAX_EVENTS - shown;   // the display shows the first (highest priority) calls
+        memcpy(&snap->pending[shown], district->eventBuffer, rows * sizeof(Event));   // copy the pending calls
+        shown += rows;
+        snap->districtPending[k] = district->eventCount;
+        snap->pendingCount += district->eventCount;
+
+        for (int d = 0; d < simParams.departmentCount; d++) {   // resource counts and queue depths, summed over the districts
+            uint32_t freeUnits = os_semaphore_count(district->departments[d].semaphore);
+            snap->freeUnits[d] += freeUnits;
+            snap->busyUnits[d] += department_busy_units(&district->departments[d], (uint32_t)freeUnits);
+            snap->queueDepth[d] += os_queue_count(district->departments[d].queue);
+        }
+
+        unsigned long bufferEnd = os_run_time_ns();
+        os_mutex_unlock(district->bufferMutex);
+
+        record_hold_time(&bufferHoldStats, bufferEnd - bufferStart);   // only the display task writes the statistics
+    }
+
+    os_mutex_lock(xLogMutex);
+    unsigned long logStart = os_run_time_ns();
+
+    int start = (logIndex - logCount + MAX_LOG_LINES) % MAX_LOG_LINES;   // copy the log ring, oldest message first
+    for (int i = 0; i < logCount; i++) {
+        int idx = (start + i) % MAX_LOG_LINES;
+        memcpy(snap->logLines[i], logBuffer[idx], LOG_LINE_LEN);
+    }
+    snap->logCount = logCount;
+
+    unsigned long logEnd = os_run_time_ns();
+    os_mutex_unlock(xLogMutex);
+
+    record_hold_time(&logHoldStats, logEnd - logStart);
+}
+
+void get_display_lock_stats(LockHoldStats *logHold, LockHoldStats *bufferHold) {
+
+    if (logHold != NULL) *logHold = logHoldStats;
+    if (bufferHold != NULL) *bufferHold = bufferHoldStats;
 }
 
+static void print_lock_stats(const char *name, const LockHoldStats *stats) {
+
+    printf("  %-19s last %6lu ns, avg %6lu ns, max %6lu ns\n", name, stats->last,
+           stats->samples ? stats->total / stats->samples : 0, stats->max);
+}
+
+static void print_department_counts(const uint32_t *counts) {   // one line per department
+
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        char label[DEPARTMENT_NAME_LEN + 1];
+        snprintf(label, sizeof(label), "%s:", simParams.departments[d].label);
+        printf("  %-11s%lu\n", label, (unsigned long)counts[d]);
+    }
+}
+
+static LatencyView latencyView = LATENCY_VIEW_TOTAL;   // written by the command task, read by the display (atomic)
+
+void set_display_latency_view(LatencyView view) {
+
+    __atomic_store_n(&latencyView, view, __ATOMIC_RELAXED);
+}
+
+LatencyView get_display_latency_view(void) {
+
+    return __atomic_load_n(&latencyView, __ATOMIC_RELAXED);
+}
 
 void UpdateDisplayTask(void *pvParameters) {
 
+    static const char *viewTitles[NUM_LATENCY_VIEWS] = { "Latency:", "Stage latency per priority (ticks):",
+                                                         "Stage latency per department (ticks):" };
+
+    static StatusSnapshot snap;   // static, the snapshot is too large for the task stack
+
     while (1) {
 
+        take_status_snapshot(&snap);   // copy the system state, no lock is held from here on
+
         printf("\033[2J\033[H"); // ANSI clear screen 
 
         /* print the log messages */
 
-        xSemaphoreTake(xLogMutex, portMAX_DELAY);  // take a mutex and block other tasks from logging messages
-
         printf("--- LOG MESSAGES ---\n\n");
 
-        int start = (logIndex - logCount + MAX_LOG_LINES) % MAX_LOG_LINES;
-        for (int i = 0; i < logCount; i++) {
-            int idx = (start + i) % MAX_LOG_LINES;
-            printf("[LOG] %s\n", logBuffer[idx]);
+        for (int i = 0; i < snap.logCount; i++) {
+            printf("[LOG] %s\n", snap.logLines[i]);
         }
         printf("\n---------------------\n");
 
-        xSemaphoreGive(xLogMutex);  // release the mutex
-
         ////////////////////////////////// end print log messages
 
         /* print current system status */
 
-        xSemaphoreTake(xEventBufferMutex, portMAX_DELAY);  // take a mutex and block other tasks from adding events to buffer
-
         printf("\n--- SYSTEM STATUS ---\n");
 
-        printf("\nPending Calls: %d\n", eventCount);
-        for (int i = 0; i < eventCount; i++) {
-            const char *type = eventBuffer[i].code == CODE_POLICE ? "Police" :
-                               eventBuffer[i].code == CODE_AMBULANCE ? "Ambulance" : "Fire";
-            printf("  [%d] %s (priority %d)\n", i + 1, type, eventBuffer[i].priority);
+        printf("\nPending Calls: %d\n", snap.pendingCount);
+        for (int i = 0; i < snap.pendingCount && i < MAX_EVENTS; i++) {
+            const char *type = simParams.departments[snap.pending[i].code - 1].label;
+            if (simParams.districtCount > 1) {
+                printf("  [%d] %s (priority %d, district %d)\n", i + 1, type, snap.pending[i].priority, snap.pending[i].district + 1);
+            } else {
+                printf("  [%d] %s (priority %d)\n", i + 1, type, snap.pending[i].priority);
+            }
         }
 
-        xSemaphoreGive(xEventBufferMutex);   // release the mutex
-
         printf("\nActive Department Tasks:\n");
-        printf("  Police:    %lu\n", MAX_POLICE - uxSemaphoreGetCount(xPoliceSemaphore));
-        printf("  Ambulance: %lu\n", MAX_AMBULANCE - uxSemaphoreGetCount(xAmbulanceSemaphore));
-        printf("  Fire:      %lu\n", MAX_FIRE - uxSemaphoreGetCount(xFireSemaphore));
+        print_department_counts(snap.busyUnits);
 
         printf("\nResources Available:\n");
-        printf("  Police:    %lu\n", uxSemaphoreGetCount(xPoliceSemaphore));
-        printf("  Ambulance: %lu\n", uxSemaphoreGetCount(xAmbulanceSemaphore));
-        printf("  Fire:      %lu\n", uxSemaphoreGetCount(xFireSemaphore));
+        print_department_counts(snap.freeUnits);
 
         printf("\nQueue Lengths:\n");
-        printf("  Police:    %lu\n", uxQueueMessagesWaiting(xPoliceQueue));
-        printf("  Ambulance: %lu\n", uxQueueMessagesWaiting(xAmbulanceQueue));
-        printf("  Fire:      %lu\n", uxQueueMessagesWaiting(xFireQueue));
+        print_department_counts(snap.queueDepth);
+
+        if (simParams.districtCount > 1) {
+            printf("\nDistricts (pending, mutual aid lent/received):\n");
+            for (int k = 0; k < simParams.districtCount; k++) {
+                printf("  District %d: %d, %lu/%lu\n", k + 1, snap.districtPending[k],
+                       __atomic_load_n(&systemMetrics.aidLent[k], __ATOMIC_RELAXED),
+                       __atomic_load_n(&systemMetrics.aidReceived[k], __ATOMIC_RELAXED));
+            }
+        }
+
+        LatencyView view = get_display_latency_view();   // "latency <view>" switches the rows
+        printf("\n%s\n", viewTitles[view]);
+        print_stage_latency(view);   // lock-free histograms, read directly
+
+        CpuShare cpu[CPU_TOP_SHOWN];
+        int cpuShown = cpu_stats_top(cpu, CPU_TOP_SHOWN);
+        if (cpuShown > 0) {
+            printf("\nCPU (%% of one core, last %d s / %d s):\n", CPU_WINDOW_SHORT * CPU_SAMPLE_MS / 1000, CPU_WINDOW_LONG * CPU_SAMPLE_MS / 1000);
+            for (int i = 0; i < cpuShown; i++) {
+                printf("  %-22s %6.1f%% %6.1f%%\n", cpu[i].name, cpu[i].shortPct, cpu[i].longPct);
+            }
+        }
+
+        printf("\nSnapshot Lock Hold Times:\n");
+        LockHoldStats logHold, bufferHold;
+        get_display_lock_stats(&logHold, &bufferHold);
+        print_lock_stats("xLogMutex:", &logHold);
+        print_lock_stats("eventBuffer mutex:", &bufferHold);
+
+#if LOCK_PROFILE
+        printf("\nLock Contention (all tasks):\n");
+        lock_profile_print(stdout, 1);
+#endif
 
         printf("\n---------------------\n");
+        fflush(stdout);
         
         ////////////////////////////////// end print system status
 
         
-        vTaskDelay(pdMS_TO_TICKS(500));  // 0.5 sec delay
+        os_delay(OS_MS_TO_TICKS(500));  // 0.5 sec delay
     }
-}
\ No newline at end of file
+}
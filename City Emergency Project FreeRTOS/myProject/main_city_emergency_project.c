@@ -14,49 +14,183 @@
 
 #include "city_emergency_project.h"
 
-QueueHandle_t xPoliceQueue, xAmbulanceQueue, xFireQueue;                    // initialize queue handles
-SemaphoreHandle_t xPoliceSemaphore, xAmbulanceSemaphore, xFireSemaphore;   // intialize semaphore handles
-SemaphoreHandle_t xLogMutex, xResourceMutex, xEventBufferMutex;           // initialize mutex handles
-DepartmentParams policeParams, ambulanceParams, fireParams;              // intialize department parameters (metadata) structs
+OsMutex xLogMutex;           // initialize mutex handles
+OsMutex xHistoryMutex;
+District *districts = NULL;   // the districts, simParams.districtCount entries (allocated in main_city_emergency_project)
 
-Event eventBuffer[MAX_EVENTS];   // initialize the event buffer
-int eventCount = 0;             // initialize the event counter (number of pending events before dispatchment)
+static void create_district(District *district, int index) {   // eventBuffer, mutexes, department queues and semaphores of one district
 
-void main_city_emergency_project(void) {
+    district->index = index;
+    district->eventCount = 0;
+    district->eventBuffer = malloc(simParams.bufferLen * sizeof(Event));   // sized by the run parameters
+    district->departments = calloc(simParams.departmentCount, sizeof(DepartmentParams));   // one entry per configured department
+    if (district->eventBuffer == NULL || district->departments == NULL) {
+        fprintf(stderr, "error: cannot allocate an eventBuffer of %u events and %d departments\n", simParams.bufferLen, simParams.departmentCount);
+        exit(1);
+    }
 
-    srand((unsigned int) time(NULL));  // seed the random number generator
+    district->bufferMutex = os_mutex_create();
+    district->resourceMutex = os_mutex_create();
+    lock_profile_name(district->bufferMutex, "eventBuffer", index);   // LOCK_PROFILE builds only
+    lock_profile_name(district->resourceMutex, "resourceMutex", index);
 
-    xPoliceQueue = xQueueCreate(DEPARTMENT_QUEUE_LEN, sizeof(Event));       // create queues   
-    xAmbulanceQueue = xQueueCreate(DEPARTMENT_QUEUE_LEN, sizeof(Event));
-    xFireQueue = xQueueCreate(DEPARTMENT_QUEUE_LEN, sizeof(Event));
+    for (int d = 0; d < simParams.departmentCount; d++) {   // create the department queues, semaphores and parameter structs
+        const DepartmentConfig *dept = &simParams.departments[d];
+        DepartmentParams *params = &district->departments[d];
+        if (dept->units > DEPARTMENT_MAX_UNITS) {
+            fprintf(stderr, "error: department %s has %u units, at most %d\n", dept->key, dept->units, DEPARTMENT_MAX_UNITS);
+            exit(1);
+        }
+        params->queue = os_queue_create(dept->queueLen, sizeof(Event));
+        params->semaphore = os_semaphore_create(DEPARTMENT_MAX_UNITS, dept->units);   // room to grow the fleet at run time
+        params->departmentName = dept->name;
+        params->code = d + 1;
+        params->district = index;
+        params->units = dept->units;
+        if (params->queue == NULL || params->semaphore == NULL) {
+            fprintf(stderr, "error: cannot create the queue or semaphore of department %s\n", dept->key);
+            exit(1);
+        }
+        lock_profile_name(params->semaphore, dept->label, index);
+    }
+}
+
+static const char *district_task_name(char *name, size_t size, const char *base, int index) {   // "Police", or "Police2" in a city of districts
+
+    if (simParams.districtCount == 1) {
+        return base;
+    }
+    snprintf(name, size, "%.9s%c", base, (char)('1' + index));   // one digit (MAX_DISTRICTS), FreeRTOS keeps the first 11 characters
+    return name;
+}
+
+static void run_time_expired(void) {
+
+    exit(0);   // the run summary is printed by the atexit() handler
+}
+
+void main_city_emergency_project(int argc, char **argv) {
+
+    parse_project_options(argc, argv);   // get the run options from the command line
+#if LOCK_PROFILE
+    atexit(lock_profile_exit_report);   // after the run summary (atexit handlers run in reverse)
+#endif
+    if (projectOptions.stackReportPath != NULL) {
+        atexit(stack_stats_exit_report);
+    }
+    atexit(print_metrics_summary);      // print the run summary when the program exits
+
+    if (!projectOptions.seedSet) {   // no --seed, a new workload every run (the summary prints the seed to repeat it)
+        projectOptions.seed = (uint64_t)time(NULL);
+    }
+
+    if (projectOptions.replayPath != NULL && projectOptions.profilePath != NULL) {
+        fprintf(stderr, "error: --replay and --profile are two different workloads, give one\n");
+        exit(1);
+    }
+
+    if (projectOptions.ratePerMin > 0 && (projectOptions.replayPath != NULL || projectOptions.profilePath != NULL)) {
+        fprintf(stderr, "error: --rate sets the arrivals of the random workload, the trace or profile has its own\n");
+        exit(1);
+    }
+
+    if (projectOptions.replayPath != NULL && !replay_open(projectOptions.replayPath)) {   // replaces the random workload
+        exit(1);
+    }
+
+    if (projectOptions.profilePath != NULL && !profile_load(projectOptions.profilePath)) {
+        exit(1);
+    }
+
+    if (projectOptions.recordPath != NULL && !recorder_open(projectOptions.recordPath)) {
+        exit(1);
+    }
+
+    if ((projectOptions.shardLink != NULL) != (projectOptions.shardCount > 1)) {
+        fprintf(stderr, "error: a shard needs both --shard <i>/<n> (n > 1) and --shard-link, start shards with the shard launcher\n");
+        exit(1);
+    }
+
+    if (projectOptions.des && projectOptions.shardLink != NULL) {
+        fprintf(stderr, "error: shards run in real time (--time-scale), a --des run simulates the whole city in one process (--districts)\n");
+        exit(1);
+    }
+
+    if (projectOptions.stackReportPath != NULL && (!OS_STACK_WATERMARKS || projectOptions.des)) {
+        fprintf(stderr, "error: --stack-report needs the task stack high-water marks of the FreeRTOS build, in real time (not --des)\n");
+        exit(1);
+    }
+
+    if (projectOptions.des) {   // discrete-event mode, same task logic in virtual time, no scheduler
+        projectOptions.headless = 1;
+        projectOptions.timeScale = 1.0;   // virtual time, there is nothing to compress
+        run_discrete_event_simulation();
+        exit(0);   // the run summary is printed by the atexit() handler
+    }
+
+    districts = calloc(simParams.districtCount, sizeof(District));   // every district has its own buffers and locks
+    if (districts == NULL) {
+        fprintf(stderr, "error: cannot allocate %d districts\n", simParams.districtCount);
+        exit(1);
+    }
+    for (int k = 0; k < simParams.districtCount; k++) {
+        create_district(&districts[k], k);
+    }
+
+    if (!forecast_init()) {   // busy unit slots published for the forecast command
+        fprintf(stderr, "error: cannot allocate the forecast state\n");
+        exit(1);
+    }
+
+    xLogMutex = os_mutex_create();   // create mutexes
+    xHistoryMutex = os_mutex_create();
+    lock_profile_name(xLogMutex, "xLogMutex", -1);
+    lock_profile_name(xHistoryMutex, "xHistoryMutex", -1);
+
+    /* create all tasks, priorities and stack sizes from the configuration */
+    for (int k = 0; k < simParams.districtCount; k++) {
+        char name[16];
+        task_create(EventGeneratorTask, district_task_name(name, sizeof(name), "EventGen", k), TASK_GENERATOR, &districts[k]);
+        task_create(DispatcherTask, district_task_name(name, sizeof(name), "Dispatcher", k), TASK_DISPATCHER, &districts[k]);
+        for (int d = 0; d < simParams.departmentCount; d++) {
+            task_create(DepartmentTask, district_task_name(name, sizeof(name), simParams.departments[d].label, k), TASK_DEPARTMENT,
+                        &districts[k].departments[d]);
+        }
+    }
+
+    if (!projectOptions.headless) {   // in headless mode the status goes only to the metrics sink
+        task_create(UpdateDisplayTask, "StatusDisplay", TASK_DISPLAY, NULL);
+    }
+
+    task_create(HistoryTask, "History", TASK_HISTORY, NULL);
 
-    xPoliceSemaphore = xSemaphoreCreateCounting(MAX_POLICE, MAX_POLICE);    // create semaphores
-    xAmbulanceSemaphore = xSemaphoreCreateCounting(MAX_AMBULANCE, MAX_AMBULANCE);
-    xFireSemaphore = xSemaphoreCreateCounting(MAX_FIRE, MAX_FIRE);
+    if (!projectOptions.headless || projectOptions.cpuLogPath != NULL || projectOptions.stackReportPath != NULL) {   // CPU shares, stack high-water marks
+        if (!cpu_stats_init()) {
+            exit(1);
+        }
+        task_create(CpuStatsTask, "CpuStats", TASK_CPU_STATS, NULL);
+    }
 
-    xEventBufferMutex = xSemaphoreCreateMutex();   // create mutexes
-    xLogMutex = xSemaphoreCreateMutex();
-    xResourceMutex = xSemaphoreCreateMutex();
+    recorder_start();   // only when recording
 
-    policeParams.queue = xPoliceQueue;     // create the police parameter struct
-    policeParams.semaphore = xPoliceSemaphore;
-    policeParams.departmentName = "Police";
+#if (TRACE_ON_ENTER != 1)   // with TRACE_ON_ENTER the idle hook reads stdin
+    task_create(CommandTask, "Commands", TASK_COMMANDS, NULL);
+#endif
 
-    ambulanceParams.queue = xAmbulanceQueue;    // create the ambulance parameter struct
-    ambulanceParams.semaphore = xAmbulanceSemaphore;
-    ambulanceParams.departmentName = "Ambulance";
+    if (projectOptions.statusPage && status_page_create()) {   // shared memory page for external monitors
+        task_create(StatusPageTask, "StatusPage", TASK_STATUS_PAGE, NULL);
+    }
 
-    fireParams.queue = xFireQueue;    // create the fire parameter struct
-    fireParams.semaphore = xFireSemaphore;
-    fireParams.departmentName = "Fire Department";
+    if (projectOptions.shardLink != NULL) {   // one shard of a city, mutual aid and metrics through the shared memory link
+        if (!shard_link_attach()) {
+            exit(1);
+        }
+        task_create(ShardLinkTask, "ShardLink", TASK_SHARD_LINK, NULL);
+    }
 
-    /* create all tasks */
-    xTaskCreate(EventGeneratorTask, "EventGen", configMINIMAL_STACK_SIZE * 4, NULL, 2, NULL);
-    xTaskCreate(DispatcherTask, "Dispatcher", configMINIMAL_STACK_SIZE * 4, NULL, 3, NULL);
-    xTaskCreate(DepartmentTask, "Police", configMINIMAL_STACK_SIZE * 4, &policeParams, 2, NULL);
-    xTaskCreate(DepartmentTask, "Ambulance", configMINIMAL_STACK_SIZE * 4, &ambulanceParams, 2, NULL);
-    xTaskCreate(DepartmentTask, "Fire", configMINIMAL_STACK_SIZE * 4, &fireParams, 2, NULL);
-    xTaskCreate(UpdateDisplayTask, "StatusDisplay", configMINIMAL_STACK_SIZE * 4, NULL, 1, NULL);
+    if (projectOptions.duration > 0) {   // one-shot timer that ends the run
+        os_timer_once("RunTime", (OsTick)(projectOptions.duration * OS_TICK_RATE_HZ), run_time_expired);
+    }
 
-    vTaskStartScheduler();
+    os_start();
 }
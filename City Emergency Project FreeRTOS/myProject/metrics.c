@@ -0,0 +1,330 @@
+/**
+******************************************************************************
+* @file           : metrics.c
+* @author         : Nimrod Elstein
+* @brief          : Source code related to the metrics sink and the run summary
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+******************************************************************************
+*/
+
+#include "city_emergency_project.h"
+
+SystemMetrics systemMetrics;   // initialize the metrics sink (all counters zero)
+
+static const char *stageNames[NUM_STAGES] = { "buffer wait", "queue wait", "unit wait", "service", "end-to-end" };
+
+static int histogram_index(uint32_t value) {
+
+    if (value < (1u << HIST_SUB_BITS)) {   // small values are exact
+        return (int)value;
+    }
+
+    int msb = 31 - __builtin_clz(value);   // power of two range of the value, then the sub bucket inside the range
+    int shift = msb - HIST_SUB_BITS;
+    int sub = (int)(value >> shift) - (1 << HIST_SUB_BITS);
+
+    return (1 << HIST_SUB_BITS) + shift * (1 << HIST_SUB_BITS) + sub;
+}
+
+static uint32_t histogram_bucket_high(int index) {
+
+    if (index < (1 << HIST_SUB_BITS)) {
+        return (uint32_t)index;
+    }
+
+    int shift = (index - (1 << HIST_SUB_BITS)) >> HIST_SUB_BITS;
+    uint64_t sub = (uint64_t)((index - (1 << HIST_SUB_BITS)) & ((1 << HIST_SUB_BITS) - 1));
+    uint64_t low = ((1ull << HIST_SUB_BITS) + sub) << shift;
+
+    return (uint32_t)(low + (1ull << shift) - 1);   // highest value that falls in this bucket
+}
+
+void histogram_record(LatencyHistogram *hist, uint32_t value) {
+
+    __atomic_fetch_add(&hist->counts[histogram_index(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->total, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&hist->sum, value, __ATOMIC_RELAXED);
+
+    uint32_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);   // lock-free maximum update
+    while (value > max && !__atomic_compare_exchange_n(&hist->max, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+uint32_t histogram_percentile(const LatencyHistogram *hist, double percentile) {
+
+    uint64_t total = __atomic_load_n(&hist->total, __ATOMIC_RELAXED);
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t target = (uint64_t)((percentile / 100.0) * (double)total + 0.5);   // rank of the requested percentile
+    if (target < 1) target = 1;
+
+    uint64_t seen = 0;
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        seen += __atomic_load_n(&hist->counts[i], __ATOMIC_RELAXED);
+        if (seen >= target) {
+            uint32_t high = histogram_bucket_high(i);
+            uint32_t max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+            return high < max ? high : max;   // never report above the recorded maximum
+        }
+    }
+
+    return __atomic_load_n(&hist->max, __ATOMIC_RELAXED);   // counters are read while tasks record, the total may run ahead
+}
+
+void read_system_gauges(SystemGauges *gauges) {
+
+    memset(gauges, 0, sizeof(*gauges));
+
+    for (int k = 0; k < simParams.districtCount; k++) {   // city totals, summed over the districts
+        const District *district = &districts[k];
+        gauges->pending += (uint32_t)__atomic_load_n(&district->eventCount, __ATOMIC_RELAXED);   // single word, read without the eventBuffer mutex
+        for (int d = 0; d < simParams.departmentCount; d++) {
+            gauges->totalUnits[d] += __atomic_load_n(&district->departments[d].units, __ATOMIC_RELAXED);
+            gauges->freeUnits[d] += (uint32_t)os_semaphore_count(district->departments[d].semaphore);
+            gauges->queueDepth[d] += (uint32_t)os_queue_count(district->departments[d].queue);
+        }
+    }
+}
+
+static void record_stages(SystemMetrics *metrics, const uint32_t stage[NUM_STAGES], int priority, int code) {
+
+    for (int s = 0; s < NUM_STAGES; s++) {
+        histogram_record(&metrics->latency[s], stage[s]);
+        histogram_record(&metrics->latencyByPriority[s][priority - 1], stage[s]);
+        histogram_record(&metrics->latencyByDept[s][code - 1], stage[s]);
+    }
+}
+
+void record_event_latency(const Event *evt, int code, OsTick completedTick) {
+
+    uint32_t stage[NUM_STAGES];   // tick differences are unsigned, so they stay correct across a tick count overflow
+
+    stage[STAGE_BUFFER_WAIT] = sim_ticks_from_real(evt->dispatchedTick - evt->generatedTick);   // model ticks, independent of the time scale
+    stage[STAGE_QUEUE_WAIT] = sim_ticks_from_real(evt->receivedTick - evt->dispatchedTick);
+    stage[STAGE_UNIT_WAIT] = sim_ticks_from_real(evt->assignedTick - evt->receivedTick);
+    stage[STAGE_SERVICE] = sim_ticks_from_real(completedTick - evt->assignedTick);
+    stage[STAGE_END_TO_END] = sim_ticks_from_real(completedTick - evt->generatedTick);
+
+    record_stages(&systemMetrics, stage, evt->priority, code);
+}
+
+void record_model_latency(SystemMetrics *metrics, const Event *evt, int code, OsTick completedTick) {
+
+    uint32_t stage[NUM_STAGES];
+
+    stage[STAGE_BUFFER_WAIT] = evt->dispatchedTick - evt->generatedTick;
+    stage[STAGE_QUEUE_WAIT] = evt->receivedTick - evt->dispatchedTick;
+    stage[STAGE_UNIT_WAIT] = evt->assignedTick - evt->receivedTick;
+    stage[STAGE_SERVICE] = completedTick - evt->assignedTick;
+    stage[STAGE_END_TO_END] = completedTick - evt->generatedTick;
+
+    record_stages(metrics, stage, evt->priority, code);
+}
+
+static void print_latency_row(const char *name, const LatencyHistogram *hist) {
+
+    printf("  %-22s %8lu %8lu %8lu %8lu %8lu\n", name,
+           (unsigned long)__atomic_load_n(&hist->total, __ATOMIC_RELAXED),
+           (unsigned long)histogram_percentile(hist, 50.0),
+           (unsigned long)histogram_percentile(hist, 95.0),
+           (unsigned long)histogram_percentile(hist, 99.0),
+           (unsigned long)__atomic_load_n(&hist->max, __ATOMIC_RELAXED));
+}
+
+void print_latency_report(void) {
+
+    char name[40];
+
+    printf("  %-22s %8s %8s %8s %8s %8s\n", "Latency (ticks)", "count", "p50", "p95", "p99", "max");
+
+    for (int s = 0; s < NUM_STAGES; s++) {   // every stage, all events
+        print_latency_row(stageNames[s], &systemMetrics.latency[s]);
+    }
+
+    for (int p = MAX_PRIORITY; p >= 1; p--) {   // end-to-end per priority, highest first
+        snprintf(name, sizeof(name), "end-to-end priority %d", p);
+        print_latency_row(name, &systemMetrics.latencyByPriority[STAGE_END_TO_END][p - 1]);
+    }
+
+    for (int d = 0; d < simParams.departmentCount; d++) {   // end-to-end per department
+        snprintf(name, sizeof(name), "end-to-end %s", simParams.departments[d].label);
+        print_latency_row(name, &systemMetrics.latencyByDept[STAGE_END_TO_END][d]);
+    }
+}
+
+void print_stage_latency(LatencyView view) {
+
+    char name[40];
+
+    if (view == LATENCY_VIEW_TOTAL) {
+        print_latency_report();
+        return;
+    }
+
+    printf("  %-22s %8s %8s %8s %8s %8s\n", "", "count", "p50", "p95", "p99", "max");
+    for (int s = 0; s < NUM_STAGES; s++) {
+        if (view == LATENCY_VIEW_PRIORITY) {
+            for (int p = MAX_PRIORITY; p >= 1; p--) {   // highest first
+                snprintf(name, sizeof(name), "%s p%d", stageNames[s], p);
+                print_latency_row(name, &systemMetrics.latencyByPriority[s][p - 1]);
+            }
+        } else {
+            for (int d = 0; d < simParams.departmentCount; d++) {
+                snprintf(name, sizeof(name), "%s %s", stageNames[s], simParams.departments[d].label);
+                print_latency_row(name, &systemMetrics.latencyByDept[s][d]);
+            }
+        }
+    }
+}
+
+static void print_stage_breakdown(void) {
+
+    printf("\nStage latency per priority (ticks):\n");
+    print_stage_latency(LATENCY_VIEW_PRIORITY);
+
+    printf("\nStage latency per department (ticks):\n");
+    print_stage_latency(LATENCY_VIEW_DEPARTMENT);
+}
+
+static void print_json_latency(const char *prefix, const LatencyHistogram *hist, int withPercentiles) {
+
+    uint64_t total = __atomic_load_n(&hist->total, __ATOMIC_RELAXED);
+
+    printf(",\"%s_p95\":%lu", prefix, (unsigned long)histogram_percentile(hist, 95.0));
+    if (withPercentiles) {
+        printf(",\"%s_count\":%llu,\"%s_mean\":%.1f,\"%s_p50\":%lu,\"%s_p99\":%lu,\"%s_max\":%lu", prefix,
+               (unsigned long long)total, prefix, total ? (double)__atomic_load_n(&hist->sum, __ATOMIC_RELAXED) / total : 0.0,
+               prefix, (unsigned long)histogram_percentile(hist, 50.0), prefix, (unsigned long)histogram_percentile(hist, 99.0),
+               prefix, (unsigned long)__atomic_load_n(&hist->max, __ATOMIC_RELAXED));
+    }
+}
+
+void print_metrics_json(void) {
+
+    static const char *stageKeys[NUM_STAGES] = { "buffer_wait", "queue_wait", "unit_wait", "service", "e2e" };
+    SystemMetrics *m = &systemMetrics;
+    double seconds = (double)simulation_now_ticks() / OS_TICK_RATE_HZ;
+    unsigned long completed = 0, droppedQueue = 0, borrowed = 0, delayed = 0, aided = 0;
+    char prefix[40];
+
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        completed += m->completed[d];
+        droppedQueue += m->droppedQueue[d];
+        borrowed += m->borrowed[d];
+        delayed += m->delayed[d];
+        aided += m->mutualAid[d];
+    }
+
+    printf("{\"mode\":\"%s\",\"seed\":%llu,\"sim_seconds\":%.1f", projectOptions.des ? "des" : "realtime",
+           (unsigned long long)projectOptions.seed, seconds);   // the run parameters first, then the results
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        printf(",\"%s_units\":%u,\"%s_queue_len\":%u", simParams.departments[d].key, simParams.departments[d].units,
+               simParams.departments[d].key, simParams.departments[d].queueLen);
+    }
+    printf(",\"buffer_len\":%u,\"dispatch_ms\":%u,\"send_timeout_ms\":%u,\"retry_ms\":%u,\"borrow\":%d,\"tick_rate_hz\":%d",
+           simParams.bufferLen, simParams.dispatchMs, simParams.sendTimeoutMs, simParams.retryMs, simParams.borrow, OS_TICK_RATE_HZ);
+    printf(",\"districts\":%d,\"mutual_aid\":%d", simParams.districtCount, simParams.mutualAid);   // units and sizes above are per district
+
+    printf(",\"generated\":%lu,\"dispatched\":%lu,\"completed\":%lu,\"throughput_per_s\":%.4f", m->generated,
+           m->dispatched, completed, seconds > 0 ? completed / seconds : 0.0);
+    printf(",\"dropped_buffer\":%lu,\"dropped_queue\":%lu,\"drop_rate\":%.6f,\"borrowed\":%lu,\"delayed\":%lu",
+           m->droppedBuffer, droppedQueue, m->generated ? (double)(m->droppedBuffer + droppedQueue) / m->generated : 0.0,
+           borrowed, delayed);
+    printf(",\"mutual_aid_units\":%lu", aided);
+    if (!projectOptions.des) {   // real-time runs: the wall time and whether the host kept up with the time scale
+        printf(",\"time_scale\":%g,\"wall_seconds\":%.3f,\"late_wakeups\":%lu,\"max_lag_ms\":%lu", projectOptions.timeScale,
+               (double)os_tick_count() / OS_TICK_RATE_HZ, m->lateWakeups, m->maxLagMs);
+    }
+
+    for (int s = 0; s < NUM_STAGES; s++) {   // latency in model ticks
+        print_json_latency(stageKeys[s], &m->latency[s], s == STAGE_END_TO_END);
+    }
+    for (int p = MAX_PRIORITY; p >= 1; p--) {
+        snprintf(prefix, sizeof(prefix), "p%d_e2e", p);
+        print_json_latency(prefix, &m->latencyByPriority[STAGE_END_TO_END][p - 1], 1);   // latency targets are per priority
+    }
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        const char *key = simParams.departments[d].key;
+        printf(",\"%s_completed\":%lu,\"%s_borrowed\":%lu,\"%s_dropped\":%lu", key, m->completed[d], key,
+               m->borrowed[d], key, m->droppedQueue[d]);
+        snprintf(prefix, sizeof(prefix), "%s_e2e", key);
+        print_json_latency(prefix, &m->latencyByDept[STAGE_END_TO_END][d], 0);
+    }
+    for (int k = 0; k < simParams.districtCount && simParams.districtCount > 1; k++) {   // cross-district traffic
+        printf(",\"d%d_generated\":%lu,\"d%d_completed\":%lu,\"d%d_dropped_buffer\":%lu,\"d%d_aid_lent\":%lu,\"d%d_aid_received\":%lu",
+               k + 1, m->districtGenerated[k], k + 1, m->districtCompleted[k], k + 1, m->districtDropped[k],
+               k + 1, m->aidLent[k], k + 1, m->aidReceived[k]);
+    }
+
+    printf("}\n");
+    fflush(stdout);
+}
+
+void print_metrics_summary(void) {
+
+    if (projectOptions.json) {   // machine readable summary instead of the text one
+        print_metrics_json();
+        return;
+    }
+
+    SystemMetrics *m = &systemMetrics;
+    double seconds = (double)simulation_now_ticks() / OS_TICK_RATE_HZ;
+    unsigned long completed = 0, droppedQueue = 0, borrowed = 0, delayed = 0, aided = 0;
+
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        completed += m->completed[d];
+        droppedQueue += m->droppedQueue[d];
+        borrowed += m->borrowed[d];
+        delayed += m->delayed[d];
+        aided += m->mutualAid[d];
+    }
+
+    printf("\n--- RUN SUMMARY ---\n");
+    printf("\nRun time:           %.1f s\n", seconds);
+    printf("Seed:               %llu\n", (unsigned long long)projectOptions.seed);
+    printf("Events generated:   %lu (%.2f events/s)\n", m->generated, seconds > 0 ? m->generated / seconds : 0.0);
+    printf("Events dispatched:  %lu\n", m->dispatched);
+    printf("Events completed:   %lu (%.2f events/s)\n", completed, seconds > 0 ? completed / seconds : 0.0);
+    printf("Dropped (buffer):   %lu\n", m->droppedBuffer);
+    printf("Dropped (queues):   %lu\n", droppedQueue);
+    printf("Borrowed resources: %lu\n", borrowed);
+    printf("Delayed (no units): %lu\n", delayed);
+    if (!simParams.borrow) {
+        printf("Borrowing:          off (--no-borrow)\n");
+    }
+    if (simParams.districtCount > 1) {
+        printf("Districts:          %d, mutual aid %s, %lu units lent across districts\n", simParams.districtCount,
+               simParams.mutualAid ? "on" : "off (--no-mutual-aid)", aided);
+    }
+    if (projectOptions.timeScale != 1.0) {
+        printf("Time scale:         %gx, %lu late wake-ups (max %lu ms)\n", projectOptions.timeScale, m->lateWakeups, m->maxLagMs);
+    }
+
+    printf("\n%-10s %9s %9s %9s %9s %9s\n", "Department", "handled", "completed", "borrowed", "delayed", "dropped");
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        printf("%-10s %9lu %9lu %9lu %9lu %9lu\n", simParams.departments[d].label, m->handled[d], m->completed[d],
+               m->borrowed[d], m->delayed[d], m->droppedQueue[d]);
+    }
+
+    if (simParams.districtCount > 1) {
+        printf("\n%-10s %9s %9s %9s %9s %9s\n", "District", "generated", "completed", "buf drop", "aid lent", "aid recv");
+        for (int k = 0; k < simParams.districtCount; k++) {
+            printf("%-10d %9lu %9lu %9lu %9lu %9lu\n", k + 1, m->districtGenerated[k], m->districtCompleted[k],
+                   m->districtDropped[k], m->aidLent[k], m->aidReceived[k]);
+        }
+    }
+
+    printf("\n");
+    print_latency_report();
+    print_stage_breakdown();
+
+    printf("\n---------------------\n");
+    fflush(stdout);
+}
@@ -0,0 +1,223 @@
+/**
+******************************************************************************
+* @file           : metrics_history.c
+* @author         : Nimrod Elstein
+* @brief          : Source code related to the multi-resolution metrics history
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+******************************************************************************
+*/
+
+#include "city_emergency_project.h"
+
+#define EXPORT_CHUNK 64   // samples copied per history mutex hold during an export
+
+typedef struct {   // fixed size ring of samples for one resolution
+    HistorySample *samples;
+    uint32_t capacity;
+    uint32_t pushed;          // total samples pushed, sample n is kept at samples[n % capacity]
+    uint32_t mergeSeconds;    // seconds of the level below that make one sample of this level
+    HistorySample pending;    // samples of the level below merged so far (incremental downsampling)
+} HistoryRing;
+
+static HistorySample secondSamples[HISTORY_SECONDS];   // static memory, the history never grows
+static HistorySample minuteSamples[HISTORY_MINUTES];
+static HistorySample hourSamples[HISTORY_HOURS];
+
+static HistoryRing rings[NUM_HISTORY_LEVELS] = {
+    { secondSamples, HISTORY_SECONDS, 0, 1, { 0 } },
+    { minuteSamples, HISTORY_MINUTES, 0, 60, { 0 } },
+    { hourSamples, HISTORY_HOURS, 0, 3600, { 0 } },
+};
+
+static const char *levelNames[NUM_HISTORY_LEVELS] = { "1s", "1m", "1h" };
+
+static void merge_sample(HistorySample *into, const HistorySample *s) {
+
+    if (into->seconds == 0) {   // first sample of the interval
+        *into = *s;
+        return;
+    }
+
+    float n = (float)into->seconds, m = (float)s->seconds;   // gauges: weighted average, extremes
+
+    into->pendingAvg = (into->pendingAvg * n + s->pendingAvg * m) / (n + m);
+    if (s->pendingMax > into->pendingMax) into->pendingMax = s->pendingMax;
+
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        into->queueAvg[d] = (into->queueAvg[d] * n + s->queueAvg[d] * m) / (n + m);
+        if (s->queueMax[d] > into->queueMax[d]) into->queueMax[d] = s->queueMax[d];
+        into->freeAvg[d] = (into->freeAvg[d] * n + s->freeAvg[d] * m) / (n + m);
+        if (s->freeMin[d] < into->freeMin[d]) into->freeMin[d] = s->freeMin[d];
+    }
+
+    into->seconds += s->seconds;   // counters: sums
+    into->generated += s->generated;
+    into->completed += s->completed;
+    into->dropped += s->dropped;
+    into->borrowed += s->borrowed;
+    into->latencySum += s->latencySum;
+    into->latencyCount += s->latencyCount;
+    if (s->latencyP95 > into->latencyP95) into->latencyP95 = s->latencyP95;
+    if (s->latencyMax > into->latencyMax) into->latencyMax = s->latencyMax;
+}
+
+static void push_sample(int level, const HistorySample *s) {
+
+    HistoryRing *ring = &rings[level];
+
+    os_mutex_lock(xHistoryMutex);   // short hold, one sample copy
+    ring->samples[ring->pushed % ring->capacity] = *s;
+    ring->pushed++;
+    os_mutex_unlock(xHistoryMutex);
+
+    if (level + 1 < NUM_HISTORY_LEVELS) {   // downsample into the next resolution
+        HistoryRing *next = &rings[level + 1];
+        merge_sample(&next->pending, s);
+        if (next->pending.seconds >= next->mergeSeconds) {
+            push_sample(level + 1, &next->pending);
+            memset(&next->pending, 0, sizeof(next->pending));
+        }
+    }
+}
+
+void HistoryTask(void *pvParameters) {
+
+    static LatencyHistogram previous;   // end-to-end histogram at the previous sample
+    static LatencyHistogram interval;  // events completed during the last second
+    unsigned long lastGenerated = 0, lastCompleted = 0, lastDropped = 0, lastBorrowed = 0;
+    OsTick lastWake = os_tick_count();
+
+    while (1) {
+
+        os_delay_until(&lastWake, OS_TICK_RATE_HZ);   // exactly one sample per second
+
+        SystemMetrics *m = &systemMetrics;
+        SystemGauges gauges;
+        HistorySample s;
+
+        read_system_gauges(&gauges);   // the same values the status display shows
+
+        memset(&s, 0, sizeof(s));
+        s.startSec = (uint32_t)(lastWake / OS_TICK_RATE_HZ) - 1;
+        s.seconds = 1;
+        s.pendingAvg = (float)gauges.pending;
+        s.pendingMax = gauges.pending;
+
+        unsigned long completed = 0, dropped = m->droppedBuffer, borrowed = 0;
+        for (int d = 0; d < simParams.departmentCount; d++) {
+            s.queueAvg[d] = (float)gauges.queueDepth[d];
+            s.queueMax[d] = gauges.queueDepth[d];
+            s.freeAvg[d] = (float)gauges.freeUnits[d];
+            s.freeMin[d] = gauges.freeUnits[d];
+            completed += m->completed[d];
+            dropped += m->droppedQueue[d];
+            borrowed += m->borrowed[d];
+        }
+
+        s.generated = (uint32_t)(m->generated - lastGenerated);   // counters are cumulative, keep the deltas
+        s.completed = (uint32_t)(completed - lastCompleted);
+        s.dropped = (uint32_t)(dropped - lastDropped);
+        s.borrowed = (uint32_t)(borrowed - lastBorrowed);
+        lastGenerated = m->generated;
+        lastCompleted = completed;
+        lastDropped = dropped;
+        lastBorrowed = borrowed;
+
+        const LatencyHistogram *current = &m->latency[STAGE_END_TO_END];   // latency of this second from the histogram delta
+        for (int i = 0; i < HIST_BUCKETS; i++) {
+            uint32_t count = __atomic_load_n(&current->counts[i], __ATOMIC_RELAXED);
+            interval.counts[i] = count - previous.counts[i];
+            previous.counts[i] = count;
+        }
+        uint64_t total = __atomic_load_n(&current->total, __ATOMIC_RELAXED);
+        uint64_t sum = __atomic_load_n(&current->sum, __ATOMIC_RELAXED);
+        interval.total = total - previous.total;
+        interval.sum = sum - previous.sum;
+        interval.max = UINT32_MAX;   // let the percentile walk report the highest bucket
+        previous.total = total;
+        previous.sum = sum;
+
+        s.latencyCount = (uint32_t)interval.total;
+        s.latencySum = interval.sum;
+        s.latencyP95 = histogram_percentile(&interval, 95.0);
+        s.latencyMax = histogram_percentile(&interval, 100.0);
+
+        push_sample(HISTORY_1S, &s);
+    }
+}
+
+static void write_csv_header(FILE *file) {
+
+    fprintf(file, "resolution,start_sec,seconds,pending_avg,pending_max");
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        const char *key = simParams.departments[d].key;
+        fprintf(file, ",%s_queue_avg,%s_queue_max,%s_free_avg,%s_free_min", key, key, key, key);
+    }
+    fprintf(file, ",generated,completed,throughput_per_s,dropped,borrowed,latency_count,latency_mean,latency_p95,latency_max\n");
+}
+
+static void write_csv_row(FILE *file, HistoryLevel level, const HistorySample *s) {
+
+    fprintf(file, "%s,%u,%u,%.2f,%u", levelNames[level], s->startSec, s->seconds, s->pendingAvg, s->pendingMax);
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        fprintf(file, ",%.2f,%u,%.2f,%u", s->queueAvg[d], s->queueMax[d], s->freeAvg[d], s->freeMin[d]);
+    }
+    fprintf(file, ",%u,%u,%.3f,%u,%u,%u,%.1f,%u,%u\n", s->generated, s->completed,
+            s->seconds ? (double)s->completed / s->seconds : 0.0, s->dropped, s->borrowed, s->latencyCount,
+            s->latencyCount ? (double)s->latencySum / s->latencyCount : 0.0, s->latencyP95, s->latencyMax);
+}
+
+int history_export_csv(HistoryLevel level, uint32_t fromSec, uint32_t toSec, const char *path) {
+
+    static HistorySample chunk[EXPORT_CHUNK];   // only the command task exports
+    HistoryRing *ring = &rings[level];
+    int exported = 0;
+
+    FILE *file = fopen(path, "w");
+    if (file == NULL) {
+        return -1;
+    }
+
+    write_csv_header(file);
+
+    uint32_t next = 0;   // absolute sample number, the ring keeps moving while we export
+    while (1) {
+
+        os_mutex_lock(xHistoryMutex);   // copy a chunk, the file is written without the mutex
+
+        uint32_t oldest = ring->pushed > ring->capacity ? ring->pushed - ring->capacity : 0;
+        if (next < oldest) next = oldest;   // samples overwritten since the last chunk
+
+        int n = 0;
+        while (n < EXPORT_CHUNK && next < ring->pushed) {
+            chunk[n++] = ring->samples[next % ring->capacity];
+            next++;
+        }
+
+        os_mutex_unlock(xHistoryMutex);
+
+        if (n == 0) break;
+
+        int done = 0;
+        for (int i = 0; i < n; i++) {
+            if (chunk[i].startSec >= toSec) {
+                done = 1;
+                break;
+            }
+            if (chunk[i].startSec + chunk[i].seconds > fromSec) {   // sample overlaps the window
+                write_csv_row(file, level, &chunk[i]);
+                exported++;
+            }
+        }
+        if (done) break;
+    }
+
+    fclose(file);
+
+    return exported;
+}
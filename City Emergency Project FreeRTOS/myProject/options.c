@@ -0,0 +1,279 @@
+/**
+******************************************************************************
+* @file           : options.c
+* @author         : Nimrod Elstein
+* @brief          : Source code related to the command line run options
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+******************************************************************************
+*/
+
+#include "city_emergency_project.h"
+#include "status_page.h"
+#include "shard_link.h"
+
+ProjectOptions projectOptions = {   // initialize the run options with the build time defaults
+    .headless = HEADLESS_MODE,
+    .duration = 0,
+    .statusPage = 0,
+    .des = 0,
+    .simHours = DES_DEFAULT_HOURS,
+    .timeScale = 1.0,
+    .seed = 0,
+    .seedSet = 0,
+    .recordPath = NULL,
+    .replayPath = NULL,
+    .replaySpeed = 1.0,
+    .replayFast = 0,
+    .profilePath = NULL,
+    .json = 0,
+    .shardIndex = 0,
+    .shardCount = 1,
+    .shardLink = NULL,
+    .ratePerMin = 0,
+    .eventLimit = 0,
+    .cpuLogPath = NULL,
+    .stackReportPath = NULL,
+};
+
+static void print_usage(const char *program) {
+
+    printf("usage: %s [options]\n\n", program);
+    printf("  --headless        run without the status display, print a summary at exit\n");
+    printf("  --duration <sec>  exit after the given run time (seconds)\n");
+    printf("  --status-page     publish live counters to the shared memory page " STATUS_PAGE_NAME "\n");
+    printf("  --des             discrete-event mode: virtual time, fast-forward between events\n");
+    printf("  --sim-hours <h>   simulated hours of a discrete-event run (default %.0f)\n", DES_DEFAULT_HOURS);
+    printf("  --time-scale <x>  run the model x times faster than real time (default 1)\n");
+    printf("  --seed <n>        master seed of the workload (default: from the clock, printed in the summary)\n");
+    printf("  --record <file>   record the generated events to a compact binary file\n");
+    printf("  --replay <file>   replay a recorded event trace instead of the random workload\n");
+    printf("  --replay-speed <x> replay the trace x times denser (arrival offsets divided by x)\n");
+    printf("  --replay-fast     replay as fast as the system takes the events, ignore arrival times\n");
+    printf("  --profile <file>  draw the workload from a profile (rates, priority mixes, bursts, diurnal curve)\n");
+    printf("  --rate <n>        Poisson arrivals, n calls per minute (model time) in every district\n");
+    printf("  --events <n>      generate n events, end the run when all of them are completed or dropped\n");
+    printf("  --cpu-log <file>  write the CPU time of every task, sampled each second, to a CSV file\n");
+    printf("  --stack-report <file> track the peak stack use of each task kind, write the suggested [tasks] stacks at exit\n");
+    printf("  --config <file>   load the configuration (departments, sizes, timing, tasks), the options below override it\n");
+    printf("  --<department> <n> units of a configured department, e.g. --police %d --ambulance %d --fire %d\n", MAX_POLICE, MAX_AMBULANCE, MAX_FIRE);
+    printf("  --queue-len <n>   queue length of every department (default %d)\n", DEPARTMENT_QUEUE_LEN);
+    printf("  --buffer-len <n>  eventBuffer size (default %d)\n", MAX_EVENTS);
+    printf("  --dispatch-ms <ms> dispatcher work time per event (default %d)\n", DISPATCH_TIME_CONST_MS);
+    printf("  --retry-ms <ms>   department retry delay without resources (default %d)\n", DEPARTMENT_RETRY_DELAY_MS);
+    printf("  --no-borrow       departments never borrow units of other departments\n");
+    printf("  --districts <n>   districts of the city, each with the configured departments and workload (default 1, max %d)\n", MAX_DISTRICTS);
+    printf("  --no-mutual-aid   districts never lend units to each other\n");
+    printf("  --json            print the run summary as one JSON object\n");
+    printf("  --shard <i>/<n>   run shard i (0 based) of a city of n shard processes (set by the shard launcher)\n");
+    printf("  --shard-link <name> shared memory link of the shards (set by the shard launcher)\n");
+    printf("  --help            print this message\n");
+}
+
+static unsigned long parse_number(const char *program, const char *option, const char *value) {
+
+    char *end = NULL;
+
+    if (value == NULL) {   // option given without its value
+        fprintf(stderr, "error: option %s requires a value\n", option);
+        print_usage(program);
+        exit(1);
+    }
+
+    unsigned long number = strtoul(value, &end, 10);
+    if (*value == '\0' || *end != '\0') {
+        fprintf(stderr, "error: invalid value '%s' for option %s\n", value, option);
+        print_usage(program);
+        exit(1);
+    }
+
+    return number;
+}
+
+static unsigned long parse_positive(const char *program, const char *option, const char *value) {
+
+    unsigned long number = parse_number(program, option, value);
+    if (number == 0 || number > UINT32_MAX) {   // sizes and unit counts
+        fprintf(stderr, "error: option %s must be between 1 and %u\n", option, UINT32_MAX);
+        exit(1);
+    }
+
+    return number;
+}
+
+static double parse_decimal(const char *program, const char *option, const char *value) {
+
+    char *end = NULL;
+
+    if (value == NULL) {
+        fprintf(stderr, "error: option %s requires a value\n", option);
+        print_usage(program);
+        exit(1);
+    }
+
+    double number = strtod(value, &end);
+    if (*value == '\0' || *end != '\0' || number < 0) {
+        fprintf(stderr, "error: invalid value '%s' for option %s\n", value, option);
+        print_usage(program);
+        exit(1);
+    }
+
+    return number;
+}
+
+void parse_project_options(int argc, char **argv) {
+
+    for (int i = 1; i < argc - 1; i++) {   // the configuration file first, every other option overrides it
+        if (strcmp(argv[i], "--config") == 0 && !config_load(argv[i + 1])) {
+            exit(1);
+        }
+    }
+
+    for (int i = 1; i < argc; i++) {
+
+        if (strcmp(argv[i], "--config") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: option %s requires a value\n", argv[i]);
+                print_usage(argv[0]);
+                exit(1);
+            }
+            i++;   // loaded above
+        } else if (strcmp(argv[i], "--headless") == 0) {
+            projectOptions.headless = 1;
+        } else if (strcmp(argv[i], "--duration") == 0) {
+            projectOptions.duration = parse_number(argv[0], argv[i], argv[i + 1]);
+            i++;
+        } else if (strcmp(argv[i], "--status-page") == 0) {
+            projectOptions.statusPage = 1;
+        } else if (strcmp(argv[i], "--des") == 0) {
+            projectOptions.des = 1;
+        } else if (strcmp(argv[i], "--sim-hours") == 0) {
+            projectOptions.simHours = parse_decimal(argv[0], argv[i], argv[i + 1]);
+            i++;
+        } else if (strcmp(argv[i], "--time-scale") == 0) {
+            projectOptions.timeScale = parse_decimal(argv[0], argv[i], argv[i + 1]);
+            if (projectOptions.timeScale <= 0) {
+                fprintf(stderr, "error: --time-scale must be greater than 0\n");
+                exit(1);
+            }
+            i++;
+        } else if (strcmp(argv[i], "--seed") == 0) {
+            projectOptions.seed = parse_number(argv[0], argv[i], argv[i + 1]);
+            projectOptions.seedSet = 1;
+            i++;
+        } else if (strcmp(argv[i], "--rate") == 0) {
+            projectOptions.ratePerMin = parse_decimal(argv[0], argv[i], argv[i + 1]);
+            if (projectOptions.ratePerMin <= 0 || projectOptions.ratePerMin > 60000) {
+                fprintf(stderr, "error: --rate must be greater than 0 and at most 60000 calls per minute\n");
+                exit(1);
+            }
+            simParams.generationGap = (TimeDist){ DIST_EXPONENTIAL, 0, 0, (uint32_t)(60000.0 / projectOptions.ratePerMin + 0.5) };   // exponential gaps, no cap
+            i++;
+        } else if (strcmp(argv[i], "--events") == 0) {
+            projectOptions.eventLimit = parse_positive(argv[0], argv[i], argv[i + 1]);
+            i++;
+        } else if (strcmp(argv[i], "--record") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: option %s requires a value\n", argv[i]);
+                print_usage(argv[0]);
+                exit(1);
+            }
+            projectOptions.recordPath = argv[++i];
+        } else if (strcmp(argv[i], "--cpu-log") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: option %s requires a value\n", argv[i]);
+                print_usage(argv[0]);
+                exit(1);
+            }
+            projectOptions.cpuLogPath = argv[++i];
+        } else if (strcmp(argv[i], "--stack-report") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: option %s requires a value\n", argv[i]);
+                print_usage(argv[0]);
+                exit(1);
+            }
+            projectOptions.stackReportPath = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: option %s requires a value\n", argv[i]);
+                print_usage(argv[0]);
+                exit(1);
+            }
+            projectOptions.replayPath = argv[++i];
+        } else if (strcmp(argv[i], "--replay-speed") == 0) {
+            projectOptions.replaySpeed = parse_decimal(argv[0], argv[i], argv[i + 1]);
+            if (projectOptions.replaySpeed <= 0) {
+                fprintf(stderr, "error: --replay-speed must be greater than 0\n");
+                exit(1);
+            }
+            i++;
+        } else if (strcmp(argv[i], "--profile") == 0) {
+            if (i + 1 >= argc) {
+                fprintf(stderr, "error: option %s requires a value\n", argv[i]);
+                print_usage(argv[0]);
+                exit(1);
+            }
+            projectOptions.profilePath = argv[++i];
+        } else if (strcmp(argv[i], "--replay-fast") == 0) {
+            projectOptions.replayFast = 1;
+        } else if (strcmp(argv[i], "--queue-len") == 0) {
+            uint32_t queueLen = (uint32_t)parse_positive(argv[0], argv[i], argv[i + 1]);
+            for (int d = 0; d < simParams.departmentCount; d++) {
+                simParams.departments[d].queueLen = queueLen;
+            }
+            i++;
+        } else if (strcmp(argv[i], "--buffer-len") == 0) {
+            simParams.bufferLen = (uint32_t)parse_positive(argv[0], argv[i], argv[i + 1]);
+            i++;
+        } else if (strcmp(argv[i], "--dispatch-ms") == 0) {
+            simParams.dispatchMs = (uint32_t)parse_number(argv[0], argv[i], argv[i + 1]);
+            i++;
+        } else if (strcmp(argv[i], "--retry-ms") == 0) {
+            simParams.retryMs = (uint32_t)parse_positive(argv[0], argv[i], argv[i + 1]);
+            i++;
+        } else if (strcmp(argv[i], "--no-borrow") == 0) {
+            simParams.borrow = 0;
+        } else if (strcmp(argv[i], "--districts") == 0) {
+            simParams.districtCount = (int)parse_positive(argv[0], argv[i], argv[i + 1]);
+            if (simParams.districtCount > MAX_DISTRICTS) {
+                fprintf(stderr, "error: at most %d districts\n", MAX_DISTRICTS);
+                exit(1);
+            }
+            i++;
+        } else if (strcmp(argv[i], "--no-mutual-aid") == 0) {
+            simParams.mutualAid = 0;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            projectOptions.json = 1;
+        } else if (strcmp(argv[i], "--shard") == 0) {
+            if (argv[i + 1] == NULL || sscanf(argv[i + 1], "%d/%d", &projectOptions.shardIndex, &projectOptions.shardCount) != 2 ||
+                projectOptions.shardCount < 1 || projectOptions.shardCount > SHARD_MAX ||
+                projectOptions.shardIndex < 0 || projectOptions.shardIndex >= projectOptions.shardCount) {
+                fprintf(stderr, "error: --shard needs <index>/<count>, 0 <= index < count <= %d\n", SHARD_MAX);
+                exit(1);
+            }
+            i++;
+        } else if (strcmp(argv[i], "--shard-link") == 0) {
+            projectOptions.shardLink = argv[i + 1];
+            if (projectOptions.shardLink == NULL) {
+                fprintf(stderr, "error: option --shard-link requires a value\n");
+                exit(1);
+            }
+            i++;
+        } else if (strcmp(argv[i], "--help") == 0) {
+            print_usage(argv[0]);
+            exit(0);
+        } else if (strncmp(argv[i], "--", 2) == 0 && department_code_from_name(argv[i] + 2) != 0) {   // --police 4
+            int code = department_code_from_name(argv[i] + 2);
+            simParams.departments[code - 1].units = (uint32_t)parse_positive(argv[0], argv[i], argv[i + 1]);
+            i++;
+        } else {
+            fprintf(stderr, "error: unknown option '%s'\n", argv[i]);
+            print_usage(argv[0]);
+            exit(1);
+        }
+    }
+}
@@ -0,0 +1,394 @@
+/**
+******************************************************************************
+* @file           : os_port.h
+* @author         : Nimrod Elstein
+* @brief          : Thin OS abstraction layer of the project (FreeRTOS or native pthreads backend)
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* The project code uses only the os_* calls below. Two backends:
+*
+*   - FreeRTOS (default): every call is an inline wrapper of the FreeRTOS call it
+*     replaces, the build is the same program as before.
+*   - pthreads (OS_PTHREADS=1, "make pthreads"): tasks are native threads that run
+*     truly in parallel on the host cores, queues and the stream buffer use a mutex
+*     and condition variables, counting semaphores use C11 atomics (the mutex is
+*     only taken to sleep). Implemented in os_pthreads.c. Task priorities are not
+*     used, the host scheduler runs the threads.
+*
+* With LOCK_PROFILE=1 ("make LOCK_PROFILE=1") the mutex lock/unlock and semaphore
+* take/give calls of the project go through the lock contention profiler
+* (lock_profile.c) for the objects named with lock_profile_name(). Without it the
+* calls are the plain backend calls, nothing is added.
+*
+* Times are ticks of OS_TICK_RATE_HZ in both backends.
+*
+******************************************************************************
+*/
+
+#ifndef OS_PORT_H
+#define OS_PORT_H
+
+/* Includes */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef OS_PTHREADS
+#define OS_PTHREADS 0   // 1 = native pthreads backend (set by "make pthreads")
+#endif
+
+#ifndef LOCK_PROFILE
+#define LOCK_PROFILE 0   // 1 = lock contention profiler on the mutex and semaphore calls (set by "make LOCK_PROFILE=1")
+#endif
+
+#if !OS_PTHREADS
+#include <stdio.h>
+#include "FreeRTOS.h"
+#include "task.h"
+#include "queue.h"
+#include "semphr.h"
+#include "stream_buffer.h"
+#include "timers.h"
+#endif
+
+/////////////////////////
+
+/* Defines */
+
+#if OS_PTHREADS
+
+#define OS_BACKEND_NAME     "pthreads"
+#define OS_TICK_RATE_HZ     1000                 // the same tick as the FreeRTOS configuration
+#define OS_WAIT_FOREVER     UINT32_MAX
+#define OS_MIN_STACK_WORDS  16384                // smallest task stack (words), PTHREAD_STACK_MIN like the POSIX port
+#define OS_STACK_WORD_BYTES sizeof(void *)       // StackType_t of the POSIX port is one pointer wide
+#define OS_STACK_WATERMARKS 0                    // host stacks are not painted, no high-water marks
+#define OS_MAX_PRIORITIES   7                    // accepted for the configuration, not used by the host scheduler
+#define OS_MS_TO_TICKS(ms)  ((OsTick)(((uint64_t)(ms) * OS_TICK_RATE_HZ) / 1000u))
+
+#else
+
+#define OS_BACKEND_NAME     "FreeRTOS"
+#define OS_TICK_RATE_HZ     configTICK_RATE_HZ
+#define OS_WAIT_FOREVER     portMAX_DELAY
+#define OS_MIN_STACK_WORDS  configMINIMAL_STACK_SIZE
+#define OS_STACK_WORD_BYTES sizeof(StackType_t)
+#define OS_STACK_WATERMARKS 1                    // the kernel fills new stacks, the untouched part is measured
+#define OS_MAX_PRIORITIES   configMAX_PRIORITIES
+#define OS_MS_TO_TICKS(ms)  pdMS_TO_TICKS(ms)
+
+#endif
+
+///////////////////////////////// end Defines
+
+/* Variables */
+
+typedef void (*OsTaskFunction)(void *param);   // task entry, never returns (ends with os_task_exit())
+typedef void (*OsTimerFunction)(void);         // one-shot timer callback
+
+typedef struct {   // one task of os_task_list()
+    uint32_t id;        // task number, not reused by later tasks
+    char name[16];
+    uint64_t runNs;     // run time so far: time as the running task (FreeRTOS), CPU time of the thread (pthreads)
+    uint32_t stackFreeWords;   // least free stack so far (high-water mark, words), 0 without OS_STACK_WATERMARKS
+} OsTaskInfo;
+
+#if OS_PTHREADS
+
+typedef uint32_t OsTick;
+typedef struct OsQueueDef *OsQueue;           // fixed size items, FIFO
+typedef struct OsSemaphoreDef *OsSemaphore;   // counting semaphore
+typedef struct OsMutexDef *OsMutex;
+typedef struct OsStreamDef *OsStream;         // byte stream, one writer and one reader
+
+#else
+
+typedef TickType_t OsTick;
+typedef QueueHandle_t OsQueue;
+typedef SemaphoreHandle_t OsSemaphore;
+typedef SemaphoreHandle_t OsMutex;
+typedef StreamBufferHandle_t OsStream;
+
+#endif
+
+///////////////////////////////// end Variables
+
+/* Function Signatures */
+
+#if OS_PTHREADS
+
+/**
+ * @brief Function that creates a queue of fixed size items.
+ *
+ * @param length Maximum number of items.
+ * @param itemSize Size of an item in bytes.
+ *
+ * @return The queue, NULL if it could not be allocated.
+ */
+OsQueue os_queue_create(uint32_t length, uint32_t itemSize);
+
+/**
+ * @brief Function that copies an item to the back of a queue, waiting for space up to the given time.
+ *
+ * @return integer that is 1 if the item was queued, 0 if the queue stayed full.
+ */
+int os_queue_send(OsQueue queue, const void *item, OsTick wait);
+
+/**
+ * @brief Function that takes the item at the front of a queue, waiting for one up to the given time.
+ *
+ * @return integer that is 1 if an item was received, 0 if the queue stayed empty.
+ */
+int os_queue_receive(OsQueue queue, void *item, OsTick wait);
+
+/**
+ * @brief Function that returns the number of items in a queue.
+ */
+uint32_t os_queue_count(OsQueue queue);
+
+/**
+ * @brief Function that creates a counting semaphore.
+ *
+ * @param max Maximum count.
+ * @param initial Initial count.
+ *
+ * @return The semaphore, NULL if it could not be allocated.
+ */
+OsSemaphore os_semaphore_create(uint32_t max, uint32_t initial);
+
+/**
+ * @brief Function that takes a semaphore, waiting up to the given time (0 = never wait, lock-free).
+ *
+ * @return integer that is 1 if the semaphore was taken, 0 otherwise.
+ */
+int os_semaphore_take(OsSemaphore semaphore, OsTick wait);
+
+/**
+ * @brief Function that gives a semaphore (a give above the maximum count is ignored).
+ */
+void os_semaphore_give(OsSemaphore semaphore);
+
+/**
+ * @brief Function that returns the current count of a semaphore.
+ */
+uint32_t os_semaphore_count(OsSemaphore semaphore);
+
+/**
+ * @brief Function that creates a mutex.
+ *
+ * @return The mutex, NULL if it could not be allocated.
+ */
+OsMutex os_mutex_create(void);
+
+/**
+ * @brief Function that locks a mutex, waiting as long as needed.
+ */
+void os_mutex_lock(OsMutex mutex);
+
+/**
+ * @brief Function that locks a mutex if it is free, without waiting.
+ *
+ * @return integer that is 1 if the mutex was locked, 0 if another task holds it.
+ */
+int os_mutex_try_lock(OsMutex mutex);
+
+/**
+ * @brief Function that unlocks a mutex.
+ */
+void os_mutex_unlock(OsMutex mutex);
+
+/**
+ * @brief Function that creates a byte stream buffer (one writer task and one reader task).
+ *
+ * @param size Capacity in bytes.
+ * @param trigger Bytes a waiting reader needs before it wakes up.
+ *
+ * @return The stream buffer, NULL if it could not be allocated.
+ */
+OsStream os_stream_create(size_t size, size_t trigger);
+
+/**
+ * @brief Function that writes bytes to a stream buffer, as many as fit within the given time.
+ *
+ * @return The number of bytes written.
+ */
+size_t os_stream_send(OsStream stream, const void *data, size_t length, OsTick wait);
+
+/**
+ * @brief Function that reads up to length bytes from a stream buffer, waiting up to the given time for the trigger level.
+ *
+ * @return The number of bytes read.
+ */
+size_t os_stream_receive(OsStream stream, void *data, size_t length, OsTick wait);
+
+/**
+ * @brief Function that returns the free space of a stream buffer in bytes.
+ */
+size_t os_stream_spaces(OsStream stream);
+
+/**
+ * @brief Function that creates a task. Tasks created before os_start() run once it is called.
+ *
+ * @param code Task entry function.
+ * @param name Task name (diagnostics).
+ * @param stackWords Stack depth in words.
+ * @param param Task parameter.
+ * @param priority Task priority (FreeRTOS backend only).
+ *
+ * @return integer that is 1 if the task was created, 0 otherwise.
+ */
+int os_task_create(OsTaskFunction code, const char *name, uint32_t stackWords, void *param, unsigned priority);
+
+/**
+ * @brief Function that ends the calling task.
+ */
+void os_task_exit(void);
+
+/**
+ * @brief Function that returns the name of the calling task.
+ */
+const char *os_task_name(void);
+
+/**
+ * @brief Function that lists the live tasks with their run time (deleted tasks are left out).
+ *
+ * @param[out] tasks Receives up to max tasks.
+ * @param max Size of the tasks array.
+ *
+ * @return The number of tasks listed.
+ */
+int os_task_list(OsTaskInfo *tasks, int max);
+
+/**
+ * @brief Function that returns the run time of the calling task so far in nanoseconds (see OsTaskInfo).
+ */
+uint64_t os_task_run_ns(void);
+
+/**
+ * @brief Function that returns the least free stack of the calling task so far in words (see OsTaskInfo).
+ */
+uint32_t os_task_stack_free(void);
+
+/**
+ * @brief Function that blocks the calling task for the given number of ticks.
+ */
+void os_delay(OsTick ticks);
+
+/**
+ * @brief Function that blocks the calling task until previousWake + increment, then advances previousWake.
+ */
+void os_delay_until(OsTick *previousWake, OsTick increment);
+
+/**
+ * @brief Function that lets the other ready tasks run.
+ */
+void os_yield(void);
+
+/**
+ * @brief Function that returns the ticks since the program started.
+ */
+OsTick os_tick_count(void);
+
+/**
+ * @brief Function that returns a nanosecond clock for short measurements (lock hold times).
+ */
+unsigned long os_run_time_ns(void);
+
+/**
+ * @brief Function that calls a function once after the given number of ticks (from its own task).
+ *
+ * @return integer that is 1 if the timer was started, 0 otherwise.
+ */
+int os_timer_once(const char *name, OsTick ticks, OsTimerFunction expired);
+
+/**
+ * @brief Function that starts the created tasks. Never returns.
+ */
+void os_start(void);
+
+#else   // FreeRTOS backend, each call is the FreeRTOS call it stands for
+
+static inline OsQueue os_queue_create(uint32_t length, uint32_t itemSize) { return xQueueCreate(length, itemSize); }
+static inline int os_queue_send(OsQueue queue, const void *item, OsTick wait) { return xQueueSendToBack(queue, item, wait) == pdPASS; }
+static inline int os_queue_receive(OsQueue queue, void *item, OsTick wait) { return xQueueReceive(queue, item, wait) == pdPASS; }
+static inline uint32_t os_queue_count(OsQueue queue) { return (uint32_t)uxQueueMessagesWaiting(queue); }
+
+static inline OsSemaphore os_semaphore_create(uint32_t max, uint32_t initial) { return xSemaphoreCreateCounting(max, initial); }
+static inline int os_semaphore_take(OsSemaphore semaphore, OsTick wait) { return xSemaphoreTake(semaphore, wait) == pdTRUE; }
+static inline void os_semaphore_give(OsSemaphore semaphore) { xSemaphoreGive(semaphore); }
+static inline uint32_t os_semaphore_count(OsSemaphore semaphore) { return (uint32_t)uxSemaphoreGetCount(semaphore); }
+
+static inline OsMutex os_mutex_create(void) { return xSemaphoreCreateMutex(); }
+static inline void os_mutex_lock(OsMutex mutex) { xSemaphoreTake(mutex, portMAX_DELAY); }
+static inline int os_mutex_try_lock(OsMutex mutex) { return xSemaphoreTake(mutex, 0) == pdTRUE; }
+static inline void os_mutex_unlock(OsMutex mutex) { xSemaphoreGive(mutex); }
+
+static inline OsStream os_stream_create(size_t size, size_t trigger) { return xStreamBufferCreate(size, trigger); }
+static inline size_t os_stream_send(OsStream stream, const void *data, size_t length, OsTick wait) { return xStreamBufferSend(stream, data, length, wait); }
+static inline size_t os_stream_receive(OsStream stream, void *data, size_t length, OsTick wait) { return xStreamBufferReceive(stream, data, length, wait); }
+static inline size_t os_stream_spaces(OsStream stream) { return xStreamBufferSpacesAvailable(stream); }
+
+static inline int os_task_create(OsTaskFunction code, const char *name, uint32_t stackWords, void *param, unsigned priority) {
+    return xTaskCreate(code, name, (configSTACK_DEPTH_TYPE)stackWords, param, (UBaseType_t)priority, NULL) == pdPASS;
+}
+static inline void os_task_exit(void) { vTaskDelete(NULL); }
+static inline const char *os_task_name(void) { return pcTaskGetName(NULL); }
+static inline int os_task_list(OsTaskInfo *tasks, int max) {   // uxTaskGetSystemState(), the run time stats counter counts nanoseconds
+    UBaseType_t size = uxTaskGetNumberOfTasks() + 8;   // room for tasks created meanwhile
+    TaskStatus_t *status = pvPortMalloc(size * sizeof(TaskStatus_t));
+    int count = 0;
+    if (status == NULL) return 0;
+    UBaseType_t listed = uxTaskGetSystemState(status, size, NULL);
+    for (UBaseType_t i = 0; i < listed && count < max; i++) {
+        if (status[i].eCurrentState == eDeleted) continue;   // waiting for the idle task to free it
+        tasks[count].id = (uint32_t)status[i].xTaskNumber;
+        snprintf(tasks[count].name, sizeof(tasks[count].name), "%s", status[i].pcTaskName);
+        tasks[count].runNs = status[i].ulRunTimeCounter;
+        tasks[count].stackFreeWords = (uint32_t)status[i].usStackHighWaterMark;
+        count++;
+    }
+    vPortFree(status);
+    return count;
+}
+static inline uint64_t os_task_run_ns(void) {
+    TaskStatus_t status;
+    vTaskGetInfo(NULL, &status, pdFALSE, eRunning);   // no stack scan, the state is known
+    return status.ulRunTimeCounter;
+}
+static inline uint32_t os_task_stack_free(void) { return (uint32_t)uxTaskGetStackHighWaterMark2(NULL); }   // scans the untouched part of the stack
+static inline void os_delay(OsTick ticks) { vTaskDelay(ticks); }
+static inline void os_delay_until(OsTick *previousWake, OsTick increment) { vTaskDelayUntil(previousWake, increment); }
+static inline void os_yield(void) { taskYIELD(); }
+static inline OsTick os_tick_count(void) { return xTaskGetTickCount(); }
+static inline unsigned long os_run_time_ns(void) { return ulGetRunTimeCounterValue(); }   // the run time stats counter counts nanoseconds
+
+static inline void os_timer_expired(TimerHandle_t timer) { ((OsTimerFunction)pvTimerGetTimerID(timer))(); }   // the callback is the timer ID
+static inline int os_timer_once(const char *name, OsTick ticks, OsTimerFunction expired) {
+    TimerHandle_t timer = xTimerCreate(name, ticks, pdFALSE, (void *)expired, os_timer_expired);
+    return timer != NULL && xTimerStart(timer, 0) == pdPASS;
+}
+static inline void os_start(void) { vTaskStartScheduler(); }
+
+#endif
+
+#if LOCK_PROFILE && !defined(OS_PORT_IMPLEMENTATION)   // the backends and the profiler itself call the real functions
+
+void lock_profile_mutex_lock(OsMutex mutex);   // lock_profile.c, the profiled calls of the named objects
+void lock_profile_mutex_unlock(OsMutex mutex);
+int lock_profile_semaphore_take(OsSemaphore semaphore, OsTick wait);
+void lock_profile_semaphore_give(OsSemaphore semaphore);
+
+#define os_mutex_lock(mutex)                lock_profile_mutex_lock(mutex)
+#define os_mutex_unlock(mutex)              lock_profile_mutex_unlock(mutex)
+#define os_semaphore_take(semaphore, wait)  lock_profile_semaphore_take(semaphore, wait)
+#define os_semaphore_give(semaphore)        lock_profile_semaphore_give(semaphore)
+
+#endif
+
+///////////////////////////////// end Function Signatures
+
+#endif
@@ -0,0 +1,610 @@
+/**
+******************************************************************************
+* @file           : os_pthreads.c
+* @author         : Nimrod Elstein
+* @brief          : Native pthreads backend of the OS abstraction layer (os_port.h)
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* Built only with OS_PTHREADS=1 ("make pthreads"), without the FreeRTOS kernel.
+* Every task is a detached thread, the threads wait at a start gate until
+* os_start() (like tasks created before vTaskStartScheduler()). Timed waits use
+* CLOCK_MONOTONIC, one tick is one millisecond since the program started.
+*
+******************************************************************************
+*/
+
+#define OS_PORT_IMPLEMENTATION   // the real os_* functions, not the lock profiler wrappers
+#include "os_port.h"
+
+#if OS_PTHREADS
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OS_TASK_NAME_LEN 16   // like configMAX_TASK_NAME_LEN of the POSIX port
+
+extern void main_city_emergency_project(int argc, char **argv);
+
+struct OsQueueDef {
+    pthread_mutex_t lock;
+    pthread_cond_t notEmpty;
+    pthread_cond_t notFull;
+    uint32_t length;
+    uint32_t itemSize;
+    uint32_t head;          // oldest item
+    uint32_t count;
+    unsigned char *items;
+};
+
+struct OsSemaphoreDef {
+    uint32_t count;         // atomic, takes and gives that do not wait never lock
+    uint32_t max;
+    uint32_t waiters;       // atomic, tasks sleeping in os_semaphore_take()
+    pthread_mutex_t lock;   // only to sleep on the condition
+    pthread_cond_t cond;
+};
+
+struct OsMutexDef {
+    pthread_mutex_t lock;
+};
+
+struct OsStreamDef {
+    pthread_mutex_t lock;
+    pthread_cond_t data;    // bytes were written
+    pthread_cond_t space;   // bytes were read
+    size_t size;
+    size_t trigger;
+    size_t head;            // oldest byte
+    size_t count;
+    unsigned char *bytes;
+};
+
+typedef struct {   // start arguments of a task thread
+    OsTaskFunction code;
+    void *param;
+    char name[OS_TASK_NAME_LEN];
+} OsTaskStart;
+
+typedef struct OsTaskRecord {   // a live task thread, listed by os_task_list()
+    struct OsTaskRecord *next;
+    pthread_t thread;
+    uint32_t id;
+    const char *name;
+} OsTaskRecord;
+
+typedef struct {   // a one-shot timer, run by its own task
+    OsTick ticks;
+    OsTimerFunction expired;
+} OsTimer;
+
+static struct timespec startTime;   // tick 0
+static pthread_mutex_t startLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t startCond = PTHREAD_COND_INITIALIZER;
+static int started = 0;              // os_start() opened the gate
+static __thread const char *taskName = "main";
+static pthread_mutex_t taskListLock = PTHREAD_MUTEX_INITIALIZER;
+static OsTaskRecord *taskList = NULL;   // the live task threads
+static uint32_t nextTaskId = 1;
+static __thread OsTaskRecord *taskRecord = NULL;   // this thread's entry, NULL for the main thread
+
+static void init_cond(pthread_cond_t *cond) {   // timed waits measure CLOCK_MONOTONIC, like the ticks
+
+    pthread_condattr_t attr;
+
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+static void deadline_after(OsTick wait, struct timespec *deadline) {
+
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += wait / OS_TICK_RATE_HZ;
+    deadline->tv_nsec += (long)(wait % OS_TICK_RATE_HZ) * (1000000000L / OS_TICK_RATE_HZ);
+    if (deadline->tv_nsec >= 1000000000L) {
+        deadline->tv_sec++;
+        deadline->tv_nsec -= 1000000000L;
+    }
+}
+
+static int wait_on(pthread_cond_t *cond, pthread_mutex_t *lock, OsTick wait, const struct timespec *deadline) {   // 0 once the deadline passed
+
+    if (wait == OS_WAIT_FOREVER) {
+        pthread_cond_wait(cond, lock);
+        return 1;
+    }
+    return pthread_cond_timedwait(cond, lock, deadline) != ETIMEDOUT;
+}
+
+/////////////////////////////////////// queues
+
+OsQueue os_queue_create(uint32_t length, uint32_t itemSize) {
+
+    OsQueue queue = calloc(1, sizeof(*queue));
+    if (queue == NULL || (queue->items = malloc((size_t)length * itemSize)) == NULL) {
+        free(queue);
+        return NULL;
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    init_cond(&queue->notEmpty);
+    init_cond(&queue->notFull);
+    queue->length = length;
+    queue->itemSize = itemSize;
+    return queue;
+}
+
+int os_queue_send(OsQueue queue, const void *item, OsTick wait) {
+
+    struct timespec deadline;
+    int waiting = wait != 0;
+
+    if (waiting && wait != OS_WAIT_FOREVER) deadline_after(wait, &deadline);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == queue->length) {
+        if (!waiting) {
+            pthread_mutex_unlock(&queue->lock);
+            return 0;
+        }
+        waiting = wait_on(&queue->notFull, &queue->lock, wait, &deadline);   // after a timeout the loop checks once more
+    }
+    memcpy(queue->items + (size_t)((queue->head + queue->count) % queue->length) * queue->itemSize, item, queue->itemSize);
+    queue->count++;
+    pthread_cond_signal(&queue->notEmpty);
+    pthread_mutex_unlock(&queue->lock);
+    return 1;
+}
+
+int os_queue_receive(OsQueue queue, void *item, OsTick wait) {
+
+    struct timespec deadline;
+    int waiting = wait != 0;
+
+    if (waiting && wait != OS_WAIT_FOREVER) deadline_after(wait, &deadline);
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->count == 0) {
+        if (!waiting) {
+            pthread_mutex_unlock(&queue->lock);
+            return 0;
+        }
+        waiting = wait_on(&queue->notEmpty, &queue->lock, wait, &deadline);
+    }
+    memcpy(item, queue->items + (size_t)queue->head * queue->itemSize, queue->itemSize);
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_signal(&queue->notFull);
+    pthread_mutex_unlock(&queue->lock);
+    return 1;
+}
+
+uint32_t os_queue_count(OsQueue queue) {
+
+    pthread_mutex_lock(&queue->lock);
+    uint32_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+/////////////////////////////////////// counting semaphores
+
+OsSemaphore os_semaphore_create(uint32_t max, uint32_t initial) {
+
+    OsSemaphore semaphore = calloc(1, sizeof(*semaphore));
+    if (semaphore == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&semaphore->lock, NULL);
+    init_cond(&semaphore->cond);
+    semaphore->count = initial;
+    semaphore->max = max;
+    return semaphore;
+}
+
+static int semaphore_try_take(OsSemaphore semaphore) {   // lock-free decrement of a positive count
+
+    uint32_t count = __atomic_load_n(&semaphore->count, __ATOMIC_SEQ_CST);
+    while (count > 0) {
+        if (__atomic_compare_exchange_n(&semaphore->count, &count, count - 1, 1, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int os_semaphore_take(OsSemaphore semaphore, OsTick wait) {
+
+    struct timespec deadline;
+    int taken;
+    int waiting = 1;
+
+    if (semaphore_try_take(semaphore)) {
+        return 1;
+    }
+    if (wait == 0) {
+        return 0;
+    }
+    if (wait != OS_WAIT_FOREVER) deadline_after(wait, &deadline);
+
+    pthread_mutex_lock(&semaphore->lock);
+    __atomic_add_fetch(&semaphore->waiters, 1, __ATOMIC_SEQ_CST);   // a give after this point sees the waiter and signals
+    while (!(taken = semaphore_try_take(semaphore)) && waiting) {
+        waiting = wait_on(&semaphore->cond, &semaphore->lock, wait, &deadline);
+    }
+    __atomic_sub_fetch(&semaphore->waiters, 1, __ATOMIC_SEQ_CST);
+    pthread_mutex_unlock(&semaphore->lock);
+    return taken;
+}
+
+void os_semaphore_give(OsSemaphore semaphore) {
+
+    uint32_t count = __atomic_load_n(&semaphore->count, __ATOMIC_SEQ_CST);
+    do {
+        if (count >= semaphore->max) {
+            return;   // like xSemaphoreGive() on a full semaphore
+        }
+    } while (!__atomic_compare_exchange_n(&semaphore->count, &count, count + 1, 1, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+    if (__atomic_load_n(&semaphore->waiters, __ATOMIC_SEQ_CST) > 0) {   // only a sleeping taker costs the lock
+        pthread_mutex_lock(&semaphore->lock);
+        pthread_cond_signal(&semaphore->cond);
+        pthread_mutex_unlock(&semaphore->lock);
+    }
+}
+
+uint32_t os_semaphore_count(OsSemaphore semaphore) {
+
+    return __atomic_load_n(&semaphore->count, __ATOMIC_RELAXED);
+}
+
+/////////////////////////////////////// mutexes
+
+OsMutex os_mutex_create(void) {
+
+    OsMutex mutex = calloc(1, sizeof(*mutex));
+    if (mutex != NULL) {
+        pthread_mutex_init(&mutex->lock, NULL);
+    }
+    return mutex;
+}
+
+void os_mutex_lock(OsMutex mutex) {
+
+    pthread_mutex_lock(&mutex->lock);
+}
+
+int os_mutex_try_lock(OsMutex mutex) {
+
+    return pthread_mutex_trylock(&mutex->lock) == 0;
+}
+
+void os_mutex_unlock(OsMutex mutex) {
+
+    pthread_mutex_unlock(&mutex->lock);
+}
+
+/////////////////////////////////////// stream buffers
+
+OsStream os_stream_create(size_t size, size_t trigger) {
+
+    OsStream stream = calloc(1, sizeof(*stream));
+    if (stream == NULL || (stream->bytes = malloc(size)) == NULL) {
+        free(stream);
+        return NULL;
+    }
+    pthread_mutex_init(&stream->lock, NULL);
+    init_cond(&stream->data);
+    init_cond(&stream->space);
+    stream->size = size;
+    stream->trigger = trigger > 0 ? trigger : 1;
+    return stream;
+}
+
+static void stream_write(OsStream stream, const unsigned char *from, size_t length) {   // at the tail, wrapping at the end of the ring
+
+    size_t at = (stream->head + stream->count) % stream->size;
+    size_t first = stream->size - at < length ? stream->size - at : length;
+
+    memcpy(stream->bytes + at, from, first);
+    memcpy(stream->bytes, from + first, length - first);
+    stream->count += length;
+}
+
+static void stream_read(OsStream stream, unsigned char *to, size_t length) {   // from the head, wrapping at the end of the ring
+
+    size_t first = stream->size - stream->head < length ? stream->size - stream->head : length;
+
+    memcpy(to, stream->bytes + stream->head, first);
+    memcpy(to + first, stream->bytes, length - first);
+    stream->head = (stream->head + length) % stream->size;
+    stream->count -= length;
+}
+
+size_t os_stream_send(OsStream stream, const void *data, size_t length, OsTick wait) {
+
+    struct timespec deadline;
+    size_t wanted = length < stream->size ? length : stream->size;
+    int waiting = wait != 0;
+
+    if (waiting && wait != OS_WAIT_FOREVER) deadline_after(wait, &deadline);
+
+    pthread_mutex_lock(&stream->lock);
+    while (stream->size - stream->count < wanted && waiting) {   // like FreeRTOS, wait for room for the whole message, then write what fits
+        waiting = wait_on(&stream->space, &stream->lock, wait, &deadline);
+    }
+    size_t written = stream->size - stream->count < length ? stream->size - stream->count : length;
+    stream_write(stream, data, written);
+    if (stream->count >= stream->trigger) {
+        pthread_cond_signal(&stream->data);
+    }
+    pthread_mutex_unlock(&stream->lock);
+    return written;
+}
+
+size_t os_stream_receive(OsStream stream, void *data, size_t length, OsTick wait) {
+
+    struct timespec deadline;
+    int waiting = wait != 0;
+
+    if (waiting && wait != OS_WAIT_FOREVER) deadline_after(wait, &deadline);
+
+    pthread_mutex_lock(&stream->lock);
+    while (stream->count < stream->trigger && waiting) {
+        waiting = wait_on(&stream->data, &stream->lock, wait, &deadline);
+    }
+    size_t read = stream->count < length ? stream->count : length;
+    stream_read(stream, data, read);
+    if (read > 0) {
+        pthread_cond_signal(&stream->space);
+    }
+    pthread_mutex_unlock(&stream->lock);
+    return read;
+}
+
+size_t os_stream_spaces(OsStream stream) {
+
+    pthread_mutex_lock(&stream->lock);
+    size_t spaces = stream->size - stream->count;
+    pthread_mutex_unlock(&stream->lock);
+    return spaces;
+}
+
+/////////////////////////////////////// tasks and time
+
+static void task_unlist(void) {   // before the thread ends, its CPU clock is not read after this
+
+    pthread_mutex_lock(&taskListLock);
+    for (OsTaskRecord **link = &taskList; *link != NULL; link = &(*link)->next) {
+        if (*link == taskRecord) {
+            *link = taskRecord->next;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&taskListLock);
+    taskRecord = NULL;
+}
+
+static void *task_thread(void *arg) {
+
+    OsTaskStart start = *(OsTaskStart *)arg;
+    OsTaskRecord record = { NULL, pthread_self(), 0, start.name };
+    free(arg);
+    taskName = start.name;   // the copy lives on this thread's stack for its whole life
+
+    pthread_mutex_lock(&taskListLock);
+    record.id = nextTaskId++;
+    record.next = taskList;
+    taskList = &record;
+    taskRecord = &record;
+    pthread_mutex_unlock(&taskListLock);
+
+    pthread_mutex_lock(&startLock);   // wait for os_start()
+    while (!started) {
+        pthread_cond_wait(&startCond, &startLock);
+    }
+    pthread_mutex_unlock(&startLock);
+
+    start.code(start.param);
+    task_unlist();
+    return NULL;
+}
+
+int os_task_create(OsTaskFunction code, const char *name, uint32_t stackWords, void *param, unsigned priority) {
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    size_t stackBytes = (size_t)stackWords * OS_STACK_WORD_BYTES;
+    OsTaskStart *start = malloc(sizeof(*start));
+
+    (void)priority;   // the host scheduler runs the threads, see os_port.h
+
+    if (start == NULL) {
+        return 0;
+    }
+    start->code = code;
+    start->param = param;
+    snprintf(start->name, sizeof(start->name), "%s", name);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_attr_setstacksize(&attr, stackBytes > (size_t)PTHREAD_STACK_MIN ? stackBytes : (size_t)PTHREAD_STACK_MIN);
+    int created = pthread_create(&thread, &attr, task_thread, start) == 0;
+    pthread_attr_destroy(&attr);
+
+    if (!created) {
+        free(start);
+    }
+    return created;
+}
+
+void os_task_exit(void) {
+
+    task_unlist();
+    pthread_exit(NULL);
+}
+
+const char *os_task_name(void) {
+
+    return taskName;
+}
+
+static uint64_t cpu_clock_ns(clockid_t clock) {
+
+    struct timespec now;
+
+    if (clock_gettime(clock, &now) != 0) {
+        return 0;
+    }
+    return (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+}
+
+int os_task_list(OsTaskInfo *tasks, int max) {
+
+    int count = 0;
+
+    pthread_mutex_lock(&taskListLock);   // a listed thread cannot end (task_unlist) while its clock is read
+    for (OsTaskRecord *record = taskList; record != NULL && count < max; record = record->next) {
+        clockid_t clock;
+        tasks[count].id = record->id;
+        snprintf(tasks[count].name, sizeof(tasks[count].name), "%s", record->name);
+        tasks[count].runNs = pthread_getcpuclockid(record->thread, &clock) == 0 ? cpu_clock_ns(clock) : 0;
+        tasks[count].stackFreeWords = 0;   // OS_STACK_WATERMARKS 0
+        count++;
+    }
+    pthread_mutex_unlock(&taskListLock);
+
+    return count;
+}
+
+uint64_t os_task_run_ns(void) {
+
+    return cpu_clock_ns(CLOCK_THREAD_CPUTIME_ID);
+}
+
+uint32_t os_task_stack_free(void) {
+
+    return 0;   // OS_STACK_WATERMARKS 0
+}
+
+static void sleep_until_tick(OsTick tick) {   // absolute sleep, immune to the time the caller spent before it
+
+    struct timespec wake = startTime;
+
+    wake.tv_sec += tick / OS_TICK_RATE_HZ;
+    wake.tv_nsec += (long)(tick % OS_TICK_RATE_HZ) * (1000000000L / OS_TICK_RATE_HZ);
+    if (wake.tv_nsec >= 1000000000L) {
+        wake.tv_sec++;
+        wake.tv_nsec -= 1000000000L;
+    }
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR) {
+    }
+}
+
+void os_delay(OsTick ticks) {
+
+    if (ticks == 0) {
+        sched_yield();
+        return;
+    }
+    sleep_until_tick(os_tick_count() + ticks);
+}
+
+void os_delay_until(OsTick *previousWake, OsTick increment) {
+
+    OsTick wake = *previousWake + increment;
+
+    if ((int32_t)(wake - os_tick_count()) > 0) {   // a wake up time in the past returns at once, like vTaskDelayUntil()
+        sleep_until_tick(wake);
+    }
+    *previousWake = wake;
+}
+
+void os_yield(void) {
+
+    sched_yield();
+}
+
+OsTick os_tick_count(void) {
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (OsTick)((now.tv_sec - startTime.tv_sec) * OS_TICK_RATE_HZ + (now.tv_nsec - startTime.tv_nsec) / (1000000000L / OS_TICK_RATE_HZ));
+}
+
+unsigned long os_run_time_ns(void) {
+
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long)((now.tv_sec - startTime.tv_sec) * 1000000000L + (now.tv_nsec - startTime.tv_nsec));
+}
+
+static void timer_task(void *param) {
+
+    OsTimer timer = *(OsTimer *)param;
+
+    free(param);
+    os_delay(timer.ticks);
+    timer.expired();
+    os_task_exit();
+}
+
+int os_timer_once(const char *name, OsTick ticks, OsTimerFunction expired) {
+
+    OsTimer *timer = malloc(sizeof(*timer));
+
+    if (timer == NULL) {
+        return 0;
+    }
+    timer->ticks = ticks;
+    timer->expired = expired;
+    if (!os_task_create(timer_task, name, OS_MIN_STACK_WORDS, timer, OS_MAX_PRIORITIES - 1)) {
+        free(timer);
+        return 0;
+    }
+    return 1;
+}
+
+void os_start(void) {
+
+    pthread_mutex_lock(&startLock);
+    started = 1;
+    pthread_cond_broadcast(&startCond);
+    pthread_mutex_unlock(&startLock);
+
+    while (1) {   // the tasks run the program, exit() ends it
+        pause();
+    }
+}
+
+static void handle_sigint(int signal) {
+
+    (void)signal;
+    exit(2);   // like the FreeRTOS main.c, the atexit() handlers print the run summary
+}
+
+int main(int argc, char **argv) {
+
+    clock_gettime(CLOCK_MONOTONIC, &startTime);
+    signal(SIGINT, handle_sigint);
+
+    main_city_emergency_project(argc, argv);   // creates the tasks and calls os_start()
+
+    return 0;
+}
+
+#endif
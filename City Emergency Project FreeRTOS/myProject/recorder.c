@@ -0,0 +1,140 @@
+/**
+******************************************************************************
+* @file           : recorder.c
+* @author         : Nimrod Elstein
+* @brief          : Source code related to recording the generated event stream
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* The generators only copy a fixed size record into a stream buffer (no blocking,
+* no file I/O). There is one generator per district and a stream buffer takes
+* one writer, so the space check and the send are one step under xRecordMutex.
+* A generator reads its arrival time before it gets the mutex, a record that
+* overtook it is clamped to the last arrival sent: the trace stays in order. RecorderTask encodes the records (event_record.h) and writes them
+* through a large stdio buffer, flushed when the generator goes quiet.
+*
+******************************************************************************
+*/
+
+#include "city_emergency_project.h"
+#include "event_record.h"
+
+_Static_assert(MAX_DEPARTMENTS <= 15 && MAX_PRIORITY <= 15, "recorded code and priority share one byte");
+
+static FILE *recordFile = NULL;
+static const char *recordPath = NULL;
+static OsStream xRecordStream = NULL;   // generators -> RecorderTask, the writers take xRecordMutex, one reader
+static OsMutex xRecordMutex = NULL;     // one writer at a time, a record is sent whole or not at all
+static uint64_t lastSent = 0;          // arrival time of the last record sent, under xRecordMutex
+static uint64_t lastTick = 0;         // arrival time of the last encoded record (delta encoding)
+static unsigned long recorded = 0;   // records written to the file
+static unsigned long lost = 0;      // records lost because the stream buffer was full, under xRecordMutex
+static unsigned long bytes = 0;    // encoded bytes written, without the header
+
+static void write_record(const EventRecord *rec) {
+
+    uint8_t encoded[EVENT_RECORD_MAX_BYTES];
+    size_t n = event_record_encode(encoded, rec, &lastTick);
+
+    fwrite(encoded, 1, n, recordFile);   // buffered, a system call every RECORD_FILE_BUFFER bytes
+    recorded++;
+    bytes += n;
+}
+
+static size_t receive_batch(OsTick wait) {
+
+    EventRecord batch[RECORD_BATCH];
+
+    size_t got = os_stream_receive(xRecordStream, batch, sizeof(batch), wait) / sizeof(EventRecord);
+    for (size_t i = 0; i < got; i++) {
+        write_record(&batch[i]);
+    }
+
+    return got;
+}
+
+static void recorder_close(void) {
+
+    if (recordFile == NULL) {
+        return;
+    }
+
+    if (xRecordStream != NULL) {   // records the writer task did not get to yet (exit() runs in the running task)
+        while (receive_batch(0) > 0) {
+        }
+    }
+
+    fclose(recordFile);
+    recordFile = NULL;
+
+    fprintf(stderr, "Recorded %lu events to %s (%lu bytes, %.2f bytes/event, %lu lost)\n", recorded, recordPath,
+            bytes + (unsigned long)sizeof(EventRecordHeader), recorded ? (double)bytes / recorded : 0.0, lost);
+}
+
+int recorder_open(const char *path) {
+
+    static char fileBuffer[RECORD_FILE_BUFFER];
+
+    recordFile = fopen(path, "wb");
+    if (recordFile == NULL) {
+        perror("record: fopen");
+        return 0;
+    }
+    setvbuf(recordFile, fileBuffer, _IOFBF, sizeof(fileBuffer));
+
+    EventRecordHeader header = { EVENT_RECORD_MAGIC, EVENT_RECORD_VERSION, sizeof(EventRecordHeader),
+                                 OS_TICK_RATE_HZ, 0, projectOptions.seed };
+    fwrite(&header, sizeof(header), 1, recordFile);
+
+    recordPath = path;
+    atexit(recorder_close);
+
+    return 1;
+}
+
+void recorder_start(void) {
+
+    if (recordFile == NULL) {
+        return;
+    }
+
+    xRecordMutex = os_mutex_create();
+    xRecordStream = os_stream_create(RECORD_STREAM_RECORDS * sizeof(EventRecord), sizeof(EventRecord));
+    task_create(RecorderTask, "Recorder", TASK_RECORDER, NULL);
+}
+
+void record_event(const Event *evt, uint64_t arrivalTick) {
+
+    if (recordFile == NULL) {
+        return;
+    }
+
+    EventRecord rec = { arrivalTick, (uint8_t)evt->code, (uint8_t)evt->priority, evt->handleMs };
+
+    if (xRecordStream == NULL) {   // discrete-event mode, no tasks, encode in line
+        write_record(&rec);
+    } else {
+        os_mutex_lock(xRecordMutex);   // the check and the send as one writer, the space can only grow in between
+        if (os_stream_spaces(xRecordStream) < sizeof(rec)) {   // never block the generator, never send part of a record
+            lost++;
+        } else {
+            if (rec.arrivalTick < lastSent) rec.arrivalTick = lastSent;   // another district's generator sent a later time first
+            lastSent = rec.arrivalTick;
+            os_stream_send(xRecordStream, &rec, sizeof(rec), 0);
+        }
+        os_mutex_unlock(xRecordMutex);
+    }
+}
+
+void RecorderTask(void *pvParameters) {
+
+    while (1) {
+
+        if (receive_batch(OS_MS_TO_TICKS(RECORD_FLUSH_MS)) == 0) {   // the generator was quiet for RECORD_FLUSH_MS, push the buffered bytes out
+            fflush(recordFile);
+        }
+    }
+}
@@ -0,0 +1,129 @@
+/**
+******************************************************************************
+* @file           : replay.c
+* @author         : Nimrod Elstein
+* @brief          : Source code related to replaying a recorded event trace
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* The trace file (event_record.h format) is memory-mapped read only and decoded
+* in place, nothing is copied to the FreeRTOS heap. Pages already replayed are
+* released from the mapping every REPLAY_RELEASE_BYTES, so the resident size stays
+* small however long the trace is.
+*
+******************************************************************************
+*/
+
+#include "city_emergency_project.h"
+#include "event_record.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const uint8_t *traceData = NULL;   // the mapped trace file, shared by every replay cursor (read only)
+static size_t traceSize = 0;
+static uint32_t traceTickRateHz = OS_TICK_RATE_HZ;
+static size_t pageSize = 4096;
+
+int replay_open(const char *path) {
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror("replay: open");
+        return 0;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(EventRecordHeader)) {
+        fprintf(stderr, "error: %s is not an event trace\n", path);
+        close(fd);
+        return 0;
+    }
+
+    void *mapping = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);   // the mapping stays valid after the descriptor is closed
+    if (mapping == MAP_FAILED) {
+        perror("replay: mmap");
+        return 0;
+    }
+
+    const EventRecordHeader *header = (const EventRecordHeader *)mapping;
+    if (header->magic != EVENT_RECORD_MAGIC || header->version != EVENT_RECORD_VERSION ||
+        header->headerSize < sizeof(EventRecordHeader) || header->headerSize > (size_t)st.st_size ||
+        header->tickRateHz == 0) {
+        fprintf(stderr, "error: %s is not a version %d event trace\n", path, EVENT_RECORD_VERSION);
+        munmap(mapping, (size_t)st.st_size);
+        return 0;
+    }
+
+    madvise(mapping, (size_t)st.st_size, MADV_SEQUENTIAL);   // read ahead, drop behind
+
+    traceData = (const uint8_t *)mapping;
+    traceSize = (size_t)st.st_size;
+    traceTickRateHz = header->tickRateHz;
+    if (!projectOptions.seedSet) {   // the summary shows the seed the trace was recorded with
+        projectOptions.seed = header->seed;
+    }
+    pageSize = (size_t)sysconf(_SC_PAGESIZE);
+
+    return 1;
+}
+
+void replay_cursor_init(ReplayCursor *cursor, int first, int stride) {
+
+    memset(cursor, 0, sizeof(*cursor));
+    cursor->offset = traceData ? ((const EventRecordHeader *)traceData)->headerSize : 0;
+    cursor->released = 0;
+    cursor->first = first;
+    cursor->stride = stride;
+}
+
+static void release_replayed(ReplayCursor *cursor) {
+
+    size_t end = cursor->offset & ~(pageSize - 1);   // whole pages before the cursor only
+
+    if (end - cursor->released >= REPLAY_RELEASE_BYTES) {
+        madvise((void *)(traceData + cursor->released), end - cursor->released, MADV_DONTNEED);   // file backed, read again if ever touched
+        cursor->released = end;
+    }
+}
+
+int replay_next(ReplayCursor *cursor, Event *evt, uint64_t *arrivalTick) {
+
+    while (traceData != NULL && cursor->offset < traceSize) {
+
+        EventRecord rec;
+        size_t n = event_record_decode(traceData + cursor->offset, traceSize - cursor->offset, &rec, &cursor->lastTick);
+        if (n == 0) {   // truncated last record (recording interrupted)
+            break;
+        }
+        cursor->offset += n;
+        release_replayed(cursor);
+
+        unsigned long index = cursor->index++;
+        if (index < (unsigned long)cursor->first || (index - cursor->first) % cursor->stride != 0) {   // another district's record
+            continue;
+        }
+
+        if (rec.code < 1 || rec.code > simParams.departmentCount || rec.priority < 1 || rec.priority > MAX_PRIORITY) {
+            cursor->skipped++;   // external trace with a department or priority this build does not have
+            continue;
+        }
+
+        memset(evt, 0, sizeof(*evt));
+        evt->code = rec.code;
+        evt->priority = rec.priority;
+        evt->handleMs = rec.handleMs;
+
+        double ticks = (double)rec.arrivalTick * OS_TICK_RATE_HZ / traceTickRateHz;   // trace tick rate to this build's
+        *arrivalTick = (uint64_t)(ticks / projectOptions.replaySpeed);
+
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,199 @@
+/**
+******************************************************************************
+* @file           : rng.c
+* @author         : Nimrod Elstein
+* @brief          : Source code related to the per-task random number generators
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* xoshiro256** (Blackman and Vigna), seeded with splitmix64. Every generator
+* state belongs to one task, so there is no shared state and no locking.
+* Streams of the same master seed are split with the xoshiro jump function,
+* each stream starts 2^128 numbers after the previous one and never overlaps it.
+*
+******************************************************************************
+*/
+
+#include "city_emergency_project.h"
+#include <math.h>
+
+static inline uint64_t rotl(uint64_t x, int k) {
+
+    return (x << k) | (x >> (64 - k));
+}
+
+static uint64_t splitmix64(uint64_t *x) {
+
+    uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+uint64_t rng_next(RngState *rng) {
+
+    uint64_t *s = rng->s;
+    uint64_t result = rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rotl(s[3], 45);
+
+    return result;
+}
+
+static void rng_jump(RngState *rng) {
+
+    static const uint64_t jump[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL,
+                                     0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+    uint64_t s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+
+    for (int i = 0; i < 4; i++) {   // equivalent to 2^128 calls of rng_next()
+        for (int b = 0; b < 64; b++) {
+            if (jump[i] & (1ULL << b)) {
+                s0 ^= rng->s[0];
+                s1 ^= rng->s[1];
+                s2 ^= rng->s[2];
+                s3 ^= rng->s[3];
+            }
+            rng_next(rng);
+        }
+    }
+
+    rng->s[0] = s0;
+    rng->s[1] = s1;
+    rng->s[2] = s2;
+    rng->s[3] = s3;
+}
+
+void rng_seed(RngState *rng, uint64_t seed, uint32_t stream) {
+
+    uint64_t x = seed;
+
+    for (int i = 0; i < 4; i++) {   // splitmix64 spreads any seed (even 0) over the whole state
+        rng->s[i] = splitmix64(&x);
+    }
+
+    for (uint32_t j = 0; j < stream; j++) {   // stream n of a seed starts n jumps after stream 0
+        rng_jump(rng);
+    }
+}
+
+uint32_t rng_below(RngState *rng, uint32_t bound) {
+
+    uint64_t m = (rng_next(rng) >> 32) * (uint64_t)bound;   // multiply-shift (Lemire), unbiased with the rejection below
+    uint32_t low = (uint32_t)m;
+
+    if (low < bound) {
+        uint32_t threshold = -bound % bound;
+        while (low < threshold) {
+            m = (rng_next(rng) >> 32) * (uint64_t)bound;
+            low = (uint32_t)m;
+        }
+    }
+
+    return (uint32_t)(m >> 32);
+}
+
+double rng_uniform(RngState *rng) {
+
+    return (rng_next(rng) >> 11) * 0x1.0p-53;   // 53 random bits, [0, 1)
+}
+
+uint32_t time_dist_draw(const TimeDist *dist, RngState *rng) {
+
+    switch (dist->kind) {
+
+        case DIST_UNIFORM:
+            return rng_below(rng, dist->maxMs - dist->minMs) + dist->minMs;
+
+        case DIST_EXPONENTIAL: {   // inversion, capped so one draw can not stall a unit for days
+            double ms = dist->minMs - dist->meanMs * log1p(-rng_uniform(rng));
+            if (dist->maxMs > 0 && ms > dist->maxMs) ms = dist->maxMs;
+            return (uint32_t)ms;
+        }
+
+        default:
+            return dist->minMs;
+    }
+}
+
+double time_dist_mean(const TimeDist *dist) {
+
+    switch (dist->kind) {
+
+        case DIST_UNIFORM:
+            return (dist->minMs + dist->maxMs) / 2.0;
+
+        case DIST_EXPONENTIAL:   // the cap is ignored, it only trims the far tail
+            return dist->minMs + (double)dist->meanMs;
+
+        default:
+            return dist->minMs;
+    }
+}
+
+void workload_rng_init(WorkloadRng *rng, uint64_t seed, int district) {
+
+    uint32_t base = (uint32_t)district * NUM_RNG_STREAMS;   // non-overlapping streams per district, district 0 keeps the single city streams
+
+    rng_seed(&rng->events, seed, base + RNG_STREAM_EVENTS);
+    rng_seed(&rng->gaps, seed, base + RNG_STREAM_GAPS);
+    rng_seed(&rng->service, seed, base + RNG_STREAM_SERVICE);
+}
+
+void alias_build(AliasTable *table, const double *weights, int n) {
+
+    double scaled[ALIAS_MAX];
+    int small[ALIAS_MAX], large[ALIAS_MAX];
+    int smallCount = 0, largeCount = 0;
+    double sum = 0;
+
+    for (int i = 0; i < n; i++) {
+        sum += weights[i];
+    }
+
+    table->n = n;
+    for (int i = 0; i < n; i++) {   // Vose: every column holds 1/n of the mass, split between two outcomes
+        scaled[i] = sum > 0 ? weights[i] * n / sum : 1.0;
+        if (scaled[i] < 1.0) small[smallCount++] = i;
+        else large[largeCount++] = i;
+    }
+
+    while (smallCount > 0 && largeCount > 0) {
+        int s = small[--smallCount];
+        int l = large[--largeCount];
+        table->prob[s] = scaled[s];
+        table->alias[s] = (uint8_t)l;
+        scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+        if (scaled[l] < 1.0) small[smallCount++] = l;
+        else large[largeCount++] = l;
+    }
+
+    while (largeCount > 0) {   // left over columns are full (rounding)
+        int l = large[--largeCount];
+        table->prob[l] = 1.0;
+        table->alias[l] = (uint8_t)l;
+    }
+    while (smallCount > 0) {
+        int s = small[--smallCount];
+        table->prob[s] = 1.0;
+        table->alias[s] = (uint8_t)s;
+    }
+}
+
+int alias_draw(const AliasTable *table, RngState *rng) {
+
+    uint64_t bits = rng_next(rng);
+    int column = (int)(((bits >> 32) * (uint64_t)table->n) >> 32);   // one draw: high bits pick the column, low bits the coin
+    double coin = (double)(bits & 0xffffffffu) * 0x1.0p-32;
+
+    return coin < table->prob[column] ? column : table->alias[column];
+}
@@ -0,0 +1,274 @@
+/**
+******************************************************************************
+* @file           : shard.c
+* @author         : Nimrod Elstein
+* @brief          : Source code related to the shard side of a multi-process city (shared memory link)
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* A sharded city runs one simulator process per district slice (started by
+* tools/shards.c). Mutual aid between the processes goes through the rings of the
+* shared memory link (myProject/shard_link.h): a department that ran out of units
+* sends a request to the nearest shard and waits for its reply on a queue,
+* ShardLinkTask answers the requests of the other shards with non-blocking semaphore
+* takes, so no shard ever waits on a lock of another process.
+*
+******************************************************************************
+*/
+
+#include "city_emergency_project.h"
+#include "shard_link.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+_Static_assert(HIST_BUCKETS == SHARD_HIST_BUCKETS, "shard link histogram layout mismatch");
+_Static_assert(MAX_DEPARTMENTS <= SHARD_MAX_DEPARTMENTS, "shard link has too few department slots");
+
+#define SHARD_ATTACH_WAIT_MS 5000   // the shards wait for each other before they start, so their clocks start together
+
+static ShardLink *shardLink = NULL;   // the mapped shared memory link
+static OsMutex sendMutex;   // one producer per ring: the tasks of this process send one at a time
+static OsMutex publishMutex;   // ShardLinkTask and the exit handler publish the metrics slot
+static OsQueue aidReplies[MAX_DISTRICTS][MAX_DEPARTMENTS];   // reply to the pending request of each department
+static uint32_t aidPending[MAX_DISTRICTS][MAX_DEPARTMENTS];       // id of the request a department waits for, 0 = none
+static uint32_t nextRequestId = 0;
+static unsigned long aidDenied = 0;   // requests of this shard another shard could not serve
+
+int shard_link_attach(void) {
+
+    int fd = shm_open(projectOptions.shardLink, O_RDWR, 0);
+    if (fd < 0) {
+        perror("shard link: shm_open");
+        return 0;
+    }
+
+    void *mapping = mmap(NULL, sizeof(ShardLink), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);   // the mapping stays valid after the descriptor is closed
+    if (mapping == MAP_FAILED) {
+        perror("shard link: mmap");
+        return 0;
+    }
+
+    ShardLink *link = (ShardLink *)mapping;
+    if (link->magic != SHARD_LINK_MAGIC || link->version != SHARD_LINK_VERSION || link->shardCount != (uint32_t)projectOptions.shardCount ||
+        link->tickRateHz != OS_TICK_RATE_HZ) {
+        fprintf(stderr, "shard link: %s is not a link of %d shards at %d Hz\n", projectOptions.shardLink, projectOptions.shardCount, OS_TICK_RATE_HZ);
+        munmap(mapping, sizeof(ShardLink));
+        return 0;
+    }
+
+    sendMutex = os_mutex_create();
+    publishMutex = os_mutex_create();
+    lock_profile_name(sendMutex, "shard sendMutex", -1);
+    lock_profile_name(publishMutex, "shard publishMutex", -1);
+    for (int k = 0; k < simParams.districtCount; k++) {
+        for (int d = 0; d < simParams.departmentCount; d++) {
+            aidReplies[k][d] = os_queue_create(1, sizeof(ShardMessage));   // one request in flight per department
+        }
+    }
+
+    shardLink = link;
+    shardLink->shards[projectOptions.shardIndex].pid = (uint32_t)getpid();
+    __atomic_fetch_add(&shardLink->attached, 1, __ATOMIC_ACQ_REL);
+
+    for (int waited = 0; waited < SHARD_ATTACH_WAIT_MS; waited++) {   // before the scheduler starts, plain sleeps
+        if (__atomic_load_n(&shardLink->attached, __ATOMIC_ACQUIRE) >= shardLink->shardCount) break;
+        usleep(1000);
+    }
+
+    atexit(shard_publish_metrics);   // the final counts, when the program exits
+
+    return 1;
+}
+
+static void shard_send(int to, const ShardMessage *msg) {
+
+    ShardRing *ring = &shardLink->rings[to][projectOptions.shardIndex];
+
+    os_mutex_lock(sendMutex);
+    while (!shard_ring_push(ring, msg)) {   // full, the other shard drains its rings every SHARD_POLL_MS
+        os_delay(OS_MS_TO_TICKS(SHARD_POLL_MS));
+    }
+    os_mutex_unlock(sendMutex);
+}
+
+int shard_request_aid(const DepartmentParams *params, int *lender) {
+
+    int count = projectOptions.shardCount;
+    int self = projectOptions.shardIndex;
+
+    if (shardLink == NULL || !simParams.mutualAid) {
+        return -1;
+    }
+
+    OsQueue replies = aidReplies[params->district][params->code - 1];
+    uint32_t *pending = &aidPending[params->district][params->code - 1];
+
+    for (int step = 1; step <= count / 2; step++) {   // the shards form a ring, nearest first (like the districts)
+
+        int peers[2] = { (self + step) % count, (self - step + count) % count };
+
+        for (int p = 0; p < 2; p++) {
+
+            if (p == 1 && peers[1] == peers[0]) break;
+
+            uint32_t id = __atomic_add_fetch(&nextRequestId, 1, __ATOMIC_RELAXED);
+            if (id == 0) id = __atomic_add_fetch(&nextRequestId, 1, __ATOMIC_RELAXED);   // 0 means no request pending
+
+            ShardMessage request = { SHARD_AID_REQUEST, (uint16_t)params->code, (uint16_t)params->district, 0, id, 0 };
+            ShardMessage reply;
+
+            __atomic_store_n(pending, id, __ATOMIC_RELEASE);
+            shard_send(peers[p], &request);
+
+            if (!os_queue_receive(replies, &reply, OS_MS_TO_TICKS(SHARD_AID_TIMEOUT_MS))) {
+                uint32_t expected = id;
+                if (__atomic_compare_exchange_n(pending, &expected, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                    METRIC_INC(aidDenied);   // no reply in time, a late grant is given back by the link task
+                    continue;
+                }
+                os_queue_receive(replies, &reply, OS_WAIT_FOREVER);   // the link task took the reply just now
+            }
+
+            if (reply.type == SHARD_AID_GRANT) {
+                *lender = reply.lender;
+                return peers[p];
+            }
+            METRIC_INC(aidDenied);
+        }
+    }
+
+    return -1;   // no shard has a free unit of the department
+}
+
+void shard_return_unit(int shard, int code, int lender) {
+
+    ShardMessage msg = { SHARD_AID_RETURN, (uint16_t)code, 0, (uint16_t)lender, 0, 0 };
+
+    shard_send(shard, &msg);
+}
+
+static void serve_message(int from, const ShardMessage *msg) {   // a message of shard "from", in the link task
+
+    if (msg->code < 1 || msg->code > simParams.departmentCount) {   // every shard runs the same configuration
+        return;
+    }
+
+    switch (msg->type) {
+
+        case SHARD_AID_REQUEST: {   // lend a free unit of the same department, any district of this shard
+            ShardMessage reply = *msg;
+            reply.type = SHARD_AID_DENY;
+            for (int k = 0; k < simParams.districtCount; k++) {
+                OsSemaphore semaphore = districts[k].departments[msg->code - 1].semaphore;
+                if (os_semaphore_count(semaphore) > 0 && os_semaphore_take(semaphore, 0)) {
+                    reply.type = SHARD_AID_GRANT;
+                    reply.lender = (uint16_t)k;
+                    METRIC_INC(systemMetrics.aidLent[k]);
+                    break;
+                }
+            }
+            shard_send(from, &reply);
+            break;
+        }
+
+        case SHARD_AID_GRANT:
+        case SHARD_AID_DENY: {   // reply to one of our requests, hand it to the waiting department
+            uint32_t expected = msg->id;
+            if (msg->district < simParams.districtCount &&
+                __atomic_compare_exchange_n(&aidPending[msg->district][msg->code - 1], &expected, 0, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                os_queue_send(aidReplies[msg->district][msg->code - 1], msg, 0);
+            } else if (msg->type == SHARD_AID_GRANT) {   // the department stopped waiting, give the unit back
+                ShardMessage back = *msg;
+                back.type = SHARD_AID_RETURN;
+                shard_send(from, &back);
+            }
+            break;
+        }
+
+        case SHARD_AID_RETURN:   // a unit we lent is free again
+            if (msg->lender < simParams.districtCount) {
+                department_return_unit(&districts[msg->lender].departments[msg->code - 1]);
+            }
+            break;
+    }
+}
+
+void shard_publish_metrics(void) {
+
+    static ShardMetrics next;   // built outside the seqlock, then copied into the slot
+    SystemMetrics *m = &systemMetrics;
+
+    if (shardLink == NULL) {
+        return;
+    }
+
+    ShardMetrics *slot = &shardLink->shards[projectOptions.shardIndex];
+
+    os_mutex_lock(publishMutex);
+
+    memset(&next, 0, sizeof(next));
+    next.pid = (uint32_t)getpid();
+    next.simTicks = simulation_now_ticks();
+    next.generated = __atomic_load_n(&m->generated, __ATOMIC_RELAXED);
+    next.dispatched = __atomic_load_n(&m->dispatched, __ATOMIC_RELAXED);
+    next.droppedBuffer = __atomic_load_n(&m->droppedBuffer, __ATOMIC_RELAXED);
+    next.aidDenied = __atomic_load_n(&aidDenied, __ATOMIC_RELAXED);
+
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        next.completedByDept[d] = __atomic_load_n(&m->completed[d], __ATOMIC_RELAXED);
+        next.completed += next.completedByDept[d];
+        next.droppedQueue += __atomic_load_n(&m->droppedQueue[d], __ATOMIC_RELAXED);
+        next.borrowed += __atomic_load_n(&m->borrowed[d], __ATOMIC_RELAXED);
+        next.delayed += __atomic_load_n(&m->delayed[d], __ATOMIC_RELAXED);
+    }
+    for (int k = 0; k < simParams.districtCount; k++) {
+        next.aidLent += __atomic_load_n(&m->aidLent[k], __ATOMIC_RELAXED);
+        next.aidReceived += __atomic_load_n(&m->aidReceived[k], __ATOMIC_RELAXED);
+    }
+
+    const LatencyHistogram *hist = &m->latency[STAGE_END_TO_END];
+    for (int i = 0; i < HIST_BUCKETS; i++) {
+        next.endToEnd.counts[i] = __atomic_load_n(&hist->counts[i], __ATOMIC_RELAXED);
+    }
+    next.endToEnd.total = __atomic_load_n(&hist->total, __ATOMIC_RELAXED);
+    next.endToEnd.sum = __atomic_load_n(&hist->sum, __ATOMIC_RELAXED);
+    next.endToEnd.max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+
+    shard_metrics_write_begin(slot);
+    next.sequence = slot->sequence;   // odd inside the write, the copy keeps it
+    memcpy(slot, &next, sizeof(next));
+    shard_metrics_write_end(slot);
+
+    os_mutex_unlock(publishMutex);
+}
+
+void ShardLinkTask(void *pvParameters) {
+
+    int self = projectOptions.shardIndex;
+    OsTick lastPublish = os_tick_count();
+
+    (void)pvParameters;
+
+    while (1) {
+
+        for (int from = 0; from < projectOptions.shardCount; from++) {   // drain the rings of the other shards
+            ShardMessage msg;
+            if (from == self) continue;
+            while (shard_ring_pop(&shardLink->rings[self][from], &msg)) {
+                serve_message(from, &msg);
+            }
+        }
+
+        if (os_tick_count() - lastPublish >= OS_MS_TO_TICKS(SHARD_PUBLISH_MS)) {
+            shard_publish_metrics();
+            lastPublish = os_tick_count();
+        }
+
+        os_delay(OS_MS_TO_TICKS(SHARD_POLL_MS));
+    }
+}
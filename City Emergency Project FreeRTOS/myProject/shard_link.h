@@ -0,0 +1,234 @@
+/**
+******************************************************************************
+* @file           : shard_link.h
+* @author         : Nimrod Elstein
+* @brief          : Layout of the shared memory link between the shard processes of a city
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* The FreeRTOS POSIX port runs one task at a time, so one simulator process uses
+* one core. The shard launcher (tools/shards.c) runs one simulator process per
+* district, each pinned to its own core, and they meet in this shared memory page:
+*
+*   - rings[to][from]: single producer / single consumer message ring from shard
+*     "from" to shard "to" (mutual aid requests, grants, denials and unit returns).
+*     Lock-free, the head and tail indexes are the only shared state.
+*   - shards[i]: the metrics of shard i, published by the shard under a seqlock and
+*     merged by the launcher into the city summary.
+*
+* This header does not depend on FreeRTOS, the launcher includes it directly.
+*
+******************************************************************************
+*/
+
+#ifndef SHARD_LINK_H
+#define SHARD_LINK_H
+
+/* Includes */
+
+#include <stdint.h>
+#include <string.h>
+
+/////////////////////////
+
+/* Defines */
+
+#define SHARD_LINK_NAME          "/city_emergency_shards"   // default POSIX shared memory object name (the launcher adds its pid)
+#define SHARD_LINK_MAGIC         0x4b4c5343u               // "CSLK"
+#define SHARD_LINK_VERSION       1
+#define SHARD_MAX                8       // shard processes of a city
+#define SHARD_RING_LEN           64      // messages per ring, power of two
+#define SHARD_MAX_DEPARTMENTS    8
+#define SHARD_HIST_SUB_BITS      5       // the latency histogram layout of the simulator (HIST_SUB_BITS)
+#define SHARD_HIST_BUCKETS       ((1 << SHARD_HIST_SUB_BITS) + (32 - SHARD_HIST_SUB_BITS) * (1 << SHARD_HIST_SUB_BITS))
+#define SHARD_CACHE_LINE         64
+
+///////////////////////////////// end Defines
+
+/* Variables */
+
+typedef enum {   // mutual aid protocol between two shards
+    SHARD_AID_REQUEST = 1,   // a department of the sender has no unit, asks for one of the same department
+    SHARD_AID_GRANT,         // reply: a unit of district "lender" is reserved for the requester
+    SHARD_AID_DENY,          // reply: no free unit
+    SHARD_AID_RETURN         // the requester is done with the lent unit of district "lender"
+} ShardMessageType;
+
+typedef struct {   // one ring message
+    uint16_t type;           // ShardMessageType
+    uint16_t code;           // department code
+    uint16_t district;       // requesting district inside the requesting shard
+    uint16_t lender;         // lending district inside the lending shard (GRANT, RETURN)
+    uint32_t id;             // request id, a reply carries the id of its request
+    uint32_t reserved;
+} ShardMessage;
+
+typedef struct {   // single producer / single consumer ring, head and tail on their own cache lines
+    uint32_t head;           // next message to read, written by the consumer only
+    uint8_t padHead[SHARD_CACHE_LINE - sizeof(uint32_t)];
+    uint32_t tail;           // next free slot, written by the producer only
+    uint8_t padTail[SHARD_CACHE_LINE - sizeof(uint32_t)];
+    ShardMessage items[SHARD_RING_LEN];
+} ShardRing;
+
+typedef struct {   // end-to-end latency histogram of a shard (model ticks), the simulator layout
+    uint32_t counts[SHARD_HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum;
+    uint32_t max;
+    uint32_t reserved;
+} ShardHistogram;
+
+typedef struct {   // metrics of one shard, guarded by a seqlock
+    uint32_t sequence;       // seqlock counter, odd while the shard updates the slot
+    uint32_t pid;
+    uint64_t simTicks;       // model time reached by the shard
+    uint64_t generated;
+    uint64_t dispatched;
+    uint64_t completed;
+    uint64_t droppedBuffer;
+    uint64_t droppedQueue;
+    uint64_t borrowed;
+    uint64_t delayed;
+    uint64_t aidLent;        // units lent to other shards
+    uint64_t aidReceived;    // units received from other shards
+    uint64_t aidDenied;      // requests of this shard that another shard could not serve
+    uint64_t completedByDept[SHARD_MAX_DEPARTMENTS];
+    ShardHistogram endToEnd;
+    uint8_t pad[SHARD_CACHE_LINE];
+} ShardMetrics;
+
+typedef struct {   // the shared memory link page, created and initialized by the launcher
+    uint32_t magic;
+    uint32_t version;
+    uint32_t shardCount;
+    uint32_t tickRateHz;
+    uint32_t attached;       // shards that mapped the page, incremented atomically
+    uint8_t pad[SHARD_CACHE_LINE - 5 * sizeof(uint32_t)];
+    ShardRing rings[SHARD_MAX][SHARD_MAX];   // rings[to][from]
+    ShardMetrics shards[SHARD_MAX];
+} ShardLink;
+
+///////////////////////////////// end Variables
+
+/* Function Signatures */
+
+/**
+ * @brief Function that appends a message to a ring (producer side, one producer per ring).
+ *
+ * @param ring The ring.
+ * @param msg The message.
+ *
+ * @return integer that is 1 if the message was added, 0 if the ring is full.
+ */
+static inline int shard_ring_push(ShardRing *ring, const ShardMessage *msg) {
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    if (tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == SHARD_RING_LEN) {
+        return 0;
+    }
+    ring->items[tail % SHARD_RING_LEN] = *msg;
+    __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);   // publishes the message
+    return 1;
+}
+
+/**
+ * @brief Function that takes the oldest message of a ring (consumer side, one consumer per ring).
+ *
+ * @param ring The ring.
+ * @param[out] msg Receives the message.
+ *
+ * @return integer that is 1 if a message was taken, 0 if the ring is empty.
+ */
+static inline int shard_ring_pop(ShardRing *ring, ShardMessage *msg) {
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    if (head == __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    *msg = ring->items[head % SHARD_RING_LEN];
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);   // frees the slot for the producer
+    return 1;
+}
+
+/**
+ * @brief Function that starts a seqlock write of a shard metrics slot.
+ *
+ * @param slot The metrics slot of the shard.
+ *
+ * @return void
+ */
+static inline void shard_metrics_write_begin(ShardMetrics *slot) {
+    __atomic_store_n(&slot->sequence, slot->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Function that ends a seqlock write of a shard metrics slot.
+ *
+ * @param slot The metrics slot of the shard.
+ *
+ * @return void
+ */
+static inline void shard_metrics_write_end(ShardMetrics *slot) {
+    __atomic_store_n(&slot->sequence, slot->sequence + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Function that copies a consistent version of a shard metrics slot (seqlock read).
+ *
+ * @param slot The shared metrics slot.
+ * @param[out] copy Receives the consistent copy.
+ * @param maxRetries Maximum attempts while the shard is updating, 0 = retry until consistent.
+ *
+ * @return integer that is 1 if a consistent copy was made, 0 if the retries ran out.
+ */
+static inline int shard_metrics_read(const ShardMetrics *slot, ShardMetrics *copy, unsigned maxRetries) {
+    for (unsigned attempt = 0; maxRetries == 0 || attempt < maxRetries; attempt++) {
+        uint32_t before = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1u) {
+            continue;   // shard update in progress
+        }
+        memcpy(copy, (const void *)slot, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_RELAXED) == before) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Function that returns a percentile of a shard histogram (the same buckets as the simulator histograms).
+ *
+ * @param hist The histogram, for example the merged histogram of all the shards.
+ * @param percentile The percentile, 0 to 100.
+ *
+ * @return the percentile in ticks (upper edge of its bucket, at most the maximum), 0 for an empty histogram.
+ */
+static inline uint32_t shard_histogram_percentile(const ShardHistogram *hist, double percentile) {
+    if (hist->total == 0) {
+        return 0;
+    }
+    uint64_t target = (uint64_t)((percentile / 100.0) * (double)hist->total + 0.5);
+    uint64_t seen = 0;
+    if (target < 1) target = 1;
+    for (int i = 0; i < SHARD_HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen >= target) {
+            uint32_t high = (uint32_t)i;   // values below 2^SHARD_HIST_SUB_BITS have a bucket each
+            if (i >= (1 << SHARD_HIST_SUB_BITS)) {
+                int shift = (i - (1 << SHARD_HIST_SUB_BITS)) >> SHARD_HIST_SUB_BITS;
+                uint64_t sub = (uint64_t)((i - (1 << SHARD_HIST_SUB_BITS)) & ((1 << SHARD_HIST_SUB_BITS) - 1));
+                high = (uint32_t)((((1ull << SHARD_HIST_SUB_BITS) + sub) << shift) + (1ull << shift) - 1);
+            }
+            return high < hist->max ? high : hist->max;
+        }
+    }
+    return hist->max;
+}
+
+///////////////////////////////// end Function Signatures
+
+#endif
@@ -0,0 +1,87 @@
+/**
+******************************************************************************
+* @file           : sim_time.c
+* @author         : Nimrod Elstein
+* @brief          : Source code related to the simulation time scale (time compression)
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+******************************************************************************
+*/
+
+#include "city_emergency_project.h"
+
+static uint64_t lastLagWarnNs = 0;   // wall time of the last lag warning (rate limit)
+
+static uint64_t wall_clock_ns(void) {
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + (uint64_t)now.tv_nsec;
+}
+
+OsTick sim_ms_to_ticks(uint32_t ms, double *carry) {
+
+    double exact = (double)ms * OS_TICK_RATE_HZ / (1000.0 * projectOptions.timeScale) + *carry;   // scaled delay in ticks, with the part lost by earlier delays
+    OsTick ticks = (OsTick)exact;
+
+    *carry = exact - ticks;   // keep the fraction, short scaled delays add up instead of rounding to zero
+
+    return ticks;
+}
+
+static void report_lag(SimTimer *timer, uint64_t now, unsigned long lagMs) {
+
+    METRIC_INC(systemMetrics.lateWakeups);
+    if (lagMs > __atomic_load_n(&systemMetrics.maxLagMs, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&systemMetrics.maxLagMs, lagMs, __ATOMIC_RELAXED);   // racy max, good enough for a report value
+    }
+
+    uint64_t last = __atomic_load_n(&lastLagWarnNs, __ATOMIC_RELAXED);
+    if (now - last >= SIM_LAG_WARN_INTERVAL_MS * 1000000ULL &&
+        __atomic_compare_exchange_n(&lastLagWarnNs, &last, now, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {   // one warning per interval from all tasks
+        char msg[LOG_LINE_LEN];
+        snprintf(msg, sizeof(msg), "Warning: %s is %lu ms behind schedule, time scale %gx is too fast for this host",
+                 os_task_name(), lagMs, projectOptions.timeScale);
+        log_message(msg);
+        if (projectOptions.headless) fprintf(stderr, "%s\n", msg);   // no display in headless mode
+    }
+
+    timer->started = 0;   // start a new schedule from now, report every fall behind once
+}
+
+void sim_timer_restart(SimTimer *timer) {
+
+    timer->started = 0;
+}
+
+void sim_delay_ms(SimTimer *timer, uint32_t ms) {
+
+    if (!timer->started) {   // first delay, or the task blocked elsewhere since the last one
+        timer->wake = os_tick_count();
+        timer->dueNs = (double)wall_clock_ns();
+        timer->started = 1;
+    }
+
+    OsTick ticks = sim_ms_to_ticks(ms, &timer->carry);
+    timer->dueNs += ms * 1e6 / projectOptions.timeScale;   // exact due time on the host clock, no tick rounding
+
+    if (ticks > 0) {
+        os_delay_until(&timer->wake, ticks);   // from the previous wake up, a late wake up does not push the schedule
+    } else {
+        os_yield();   // shorter than a tick, the carried fraction makes up for it in a later delay
+    }
+
+    uint64_t now = wall_clock_ns();   // the host clock, the tick count itself falls behind when the port cannot keep up
+    if ((double)now > timer->dueNs + SIM_LAG_WARN_MS * 1e6) {
+        report_lag(timer, now, (unsigned long)(((double)now - timer->dueNs) / 1e6));
+    }
+}
+
+uint32_t sim_ticks_from_real(OsTick ticks) {
+
+    return (uint32_t)(ticks * projectOptions.timeScale + 0.5);   // real ticks to simulated ticks (ms of model time)
+}
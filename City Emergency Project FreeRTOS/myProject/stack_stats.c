@@ -0,0 +1,179 @@
+/**
+******************************************************************************
+* @file           : stack_stats.c
+* @author         : Nimrod Elstein
+* @brief          : Source code related to the stack high-water report (--stack-report)
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* The kernel fills every new task stack with a known byte; the high-water mark
+* is the part still untouched, the least free stack the task ever had. Each CPU
+* sample (CpuStatsTask) hands over the high-water marks of all listed tasks,
+* the short tasks (EventWorker, Forecast) also measure their own right before
+* they end. The peak use (stack minus high-water mark) is kept per task kind,
+* the kind of a listed task comes from its name, noted by task_create().
+*
+* At exit the peak use of each kind is printed, and the suggested stacks are
+* written as a [tasks] section: a configuration file for --config, so the next
+* runs create every task, each EventWorker of an active incident above all,
+* with the stack it needs instead of OS_MIN_STACK_WORDS * 4.
+*
+******************************************************************************
+*/
+
+#include "city_emergency_project.h"
+
+typedef struct {   // a task name and its kind
+    char name[16];
+    TaskKind kind;
+    int ready;   // set with release once name and kind are written
+} StackName;
+
+static StackName names[STACK_MAX_NAMES];
+static int nameCount = 0;                          // slots taken (atomic), may pass STACK_MAX_NAMES
+static uint32_t kindStack[NUM_TASK_KINDS];         // stack of the kind's tasks (words), 0 = none created
+static unsigned long kindTasks[NUM_TASK_KINDS];    // tasks created (atomic)
+static uint32_t kindPeak[NUM_TASK_KINDS];          // peak use seen (words, atomic max), 0 = not measured
+
+static int kind_of(const char *name) {   // -1 for the kernel's own tasks (IDLE, Tmr Svc)
+
+    int count = __atomic_load_n(&nameCount, __ATOMIC_ACQUIRE);
+    size_t length = strlen(name);
+
+    for (int i = 0; i < count && i < STACK_MAX_NAMES; i++) {
+        if (!__atomic_load_n(&names[i].ready, __ATOMIC_ACQUIRE)) continue;
+        if (length > 0 && strncmp(names[i].name, name, length) == 0) return (int)names[i].kind;   // the listed name may be cut short
+    }
+
+    return -1;
+}
+
+static void note_free(TaskKind kind, uint32_t freeWords) {
+
+    uint32_t stack = __atomic_load_n(&kindStack[kind], __ATOMIC_RELAXED);
+    if (stack == 0 || freeWords > stack) {
+        return;
+    }
+
+    uint32_t used = stack - freeWords;
+    uint32_t peak = __atomic_load_n(&kindPeak[kind], __ATOMIC_RELAXED);
+    while (used > peak && !__atomic_compare_exchange_n(&kindPeak[kind], &peak, used, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+void stack_stats_task_created(const char *name, TaskKind kind, uint32_t stackWords) {
+
+    if (projectOptions.stackReportPath == NULL) {
+        return;
+    }
+
+    __atomic_store_n(&kindStack[kind], stackWords, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&kindTasks[kind], 1, __ATOMIC_RELAXED);
+
+    if (kind_of(name) >= 0) {   // the EventWorker names repeat
+        return;
+    }
+    int slot = __atomic_fetch_add(&nameCount, 1, __ATOMIC_ACQ_REL);
+    if (slot >= STACK_MAX_NAMES) {   // not sampled, still measured when it ends if it is a short task
+        return;
+    }
+    snprintf(names[slot].name, sizeof(names[slot].name), "%s", name);
+    names[slot].kind = kind;
+    __atomic_store_n(&names[slot].ready, 1, __ATOMIC_RELEASE);
+}
+
+void stack_stats_sample(const OsTaskInfo *tasks, int count) {
+
+    if (projectOptions.stackReportPath == NULL) {
+        return;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int kind = kind_of(tasks[i].name);
+        if (kind >= 0) note_free((TaskKind)kind, tasks[i].stackFreeWords);
+    }
+}
+
+void stack_stats_task_done(TaskKind kind) {
+
+    if (projectOptions.stackReportPath != NULL) {   // the scan of the untouched stack costs, only when asked for
+        note_free(kind, os_task_stack_free());
+    }
+}
+
+static uint32_t suggested_stack(uint32_t peak) {
+
+    uint64_t words = (uint64_t)peak + (uint64_t)peak * STACK_HEADROOM_PCT / 100;
+
+    words = (words + STACK_ROUND_WORDS - 1) / STACK_ROUND_WORDS * STACK_ROUND_WORDS;
+    return words > OS_MIN_STACK_WORDS ? (uint32_t)words : OS_MIN_STACK_WORDS;   // the smallest stack the port accepts
+}
+
+static unsigned long stack_kib(uint32_t words) {
+
+    return (unsigned long)(((uint64_t)words * OS_STACK_WORD_BYTES + 1023) / 1024);
+}
+
+void stack_stats_exit_report(void) {
+
+    FILE *out = projectOptions.json ? stderr : stdout;   // the --json summary stays one line on stdout
+    int created = 0;
+
+    for (int k = 0; k < NUM_TASK_KINDS; k++) {
+        if (__atomic_load_n(&kindTasks[k], __ATOMIC_RELAXED) > 0) created = 1;
+    }
+    if (!created) {   // the run ended before its tasks were created (an option error)
+        return;
+    }
+
+    FILE *file = fopen(projectOptions.stackReportPath, "w");
+    if (file == NULL) {
+        fprintf(stderr, "error: cannot create the stack report %s\n", projectOptions.stackReportPath);
+    } else {
+        fprintf(file, "; Task stacks suggested by --stack-report (words): the peak use of this run + %d%%,\n", STACK_HEADROOM_PCT);
+        fprintf(file, "; rounded up to %d and at least %u. Measure a run with the heaviest expected workload.\n",
+                STACK_ROUND_WORDS, (unsigned)OS_MIN_STACK_WORDS);
+        fprintf(file, "; Load it with --config, or copy the lines to the [tasks] section of a configuration file.\n\n");
+        fprintf(file, "[tasks]\n");
+    }
+
+    fprintf(out, "\nTask stacks (words of %u bytes, peak use from the stack high-water marks):\n", (unsigned)OS_STACK_WORD_BYTES);
+    fprintf(out, "  %-12s %7s %9s %9s %10s\n", "kind", "tasks", "stack", "peak use", "suggested");
+
+    for (int k = 0; k < NUM_TASK_KINDS; k++) {
+
+        unsigned long tasks = __atomic_load_n(&kindTasks[k], __ATOMIC_RELAXED);
+        uint32_t stack = __atomic_load_n(&kindStack[k], __ATOMIC_RELAXED);
+        uint32_t peak = __atomic_load_n(&kindPeak[k], __ATOMIC_RELAXED);
+        const char *key = task_kind_key((TaskKind)k);
+
+        if (tasks == 0) {   // e.g. no status page in this run, its stack stays as configured
+            if (file != NULL) fprintf(file, "; %s_stack: no task of this kind ran\n", key);
+            continue;
+        }
+        if (peak == 0) {   // ended before the first sample
+            fprintf(out, "  %-12s %7lu %9u %9s %10s\n", key, tasks, (unsigned)stack, "-", "-");
+            if (file != NULL) fprintf(file, "; %s_stack: not measured, %lu task(s) ended before the first sample\n", key, tasks);
+            continue;
+        }
+
+        uint32_t suggested = suggested_stack(peak);
+        fprintf(out, "  %-12s %7lu %9u %9u %10u%s\n", key, tasks, (unsigned)stack, (unsigned)peak, (unsigned)suggested,
+                peak >= stack ? "   overflow?" : "");
+        if (file != NULL) fprintf(file, "%s_stack = %u   ; peak %u of %u\n", key, (unsigned)suggested, (unsigned)peak, (unsigned)stack);
+    }
+
+    uint32_t handlerPeak = __atomic_load_n(&kindPeak[TASK_HANDLER], __ATOMIC_RELAXED);
+    if (handlerPeak > 0) {   // one EventWorker per active incident
+        fprintf(out, "EventWorker stack per active incident: %lu KiB, suggested %lu KiB\n",
+                stack_kib(kindStack[TASK_HANDLER]), stack_kib(suggested_stack(handlerPeak)));
+    }
+
+    if (file != NULL) {
+        fclose(file);
+        fprintf(out, "Suggested stacks written to %s (load it with --config)\n", projectOptions.stackReportPath);
+    }
+}
@@ -0,0 +1,120 @@
+/**
+******************************************************************************
+* @file           : status_page.c
+* @author         : Nimrod Elstein
+* @brief          : Source code related to the shared memory status page publisher
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+******************************************************************************
+*/
+
+#include "city_emergency_project.h"
+#include "status_page.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+_Static_assert(MAX_DEPARTMENTS <= STATUS_PAGE_MAX_DEPARTMENTS, "status page has too few department slots");
+_Static_assert(MAX_PRIORITY == STATUS_PAGE_PRIORITIES, "status page priority count mismatch");
+
+static StatusPage *statusPage = NULL;   // the mapped shared memory page
+
+static void status_page_unlink(void) {
+
+    shm_unlink(STATUS_PAGE_NAME);   // remove the page name when the simulator exits
+}
+
+int status_page_create(void) {
+
+    int fd = shm_open(STATUS_PAGE_NAME, O_CREAT | O_RDWR, 0644);
+    if (fd < 0) {
+        perror("status page: shm_open");
+        return 0;
+    }
+
+    if (ftruncate(fd, sizeof(StatusPage)) != 0) {
+        perror("status page: ftruncate");
+        close(fd);
+        return 0;
+    }
+
+    void *mapping = mmap(NULL, sizeof(StatusPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);   // the mapping stays valid after the descriptor is closed
+    if (mapping == MAP_FAILED) {
+        perror("status page: mmap");
+        return 0;
+    }
+
+    statusPage = (StatusPage *)mapping;
+    memset(statusPage, 0, sizeof(StatusPage));
+    statusPage->magic = STATUS_PAGE_MAGIC;
+    statusPage->version = STATUS_PAGE_VERSION;
+    statusPage->tickRateHz = OS_TICK_RATE_HZ;
+    statusPage->departmentCount = simParams.departmentCount;
+
+    atexit(status_page_unlink);
+
+    return 1;
+}
+
+static void fill_latency(StatusPageLatency *out, const LatencyHistogram *hist) {
+
+    out->p50 = histogram_percentile(hist, 50.0);
+    out->p95 = histogram_percentile(hist, 95.0);
+    out->p99 = histogram_percentile(hist, 99.0);
+    out->max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+}
+
+void StatusPageTask(void *pvParameters) {
+
+    static StatusPage next;   // the next version is built here, then copied into the page inside the seqlock
+
+    while (1) {
+
+        SystemMetrics *m = &systemMetrics;   // every value is read without a lock, the seqlock makes the page consistent for readers
+        SystemGauges gauges;
+        read_system_gauges(&gauges);
+
+        next.pendingEvents = gauges.pending;
+        next.generated = __atomic_load_n(&m->generated, __ATOMIC_RELAXED);
+        next.dispatched = __atomic_load_n(&m->dispatched, __ATOMIC_RELAXED);
+        next.droppedBuffer = __atomic_load_n(&m->droppedBuffer, __ATOMIC_RELAXED);
+
+        for (int d = 0; d < simParams.departmentCount; d++) {
+            StatusPageDepartment *dept = &next.departments[d];
+            strncpy(dept->name, simParams.departments[d].name, sizeof(dept->name) - 1);
+            dept->totalUnits = gauges.totalUnits[d];
+            dept->freeUnits = gauges.freeUnits[d];
+            dept->queueDepth = gauges.queueDepth[d];
+            dept->handled = __atomic_load_n(&m->handled[d], __ATOMIC_RELAXED);
+            dept->completed = __atomic_load_n(&m->completed[d], __ATOMIC_RELAXED);
+            dept->borrowed = __atomic_load_n(&m->borrowed[d], __ATOMIC_RELAXED);
+            dept->delayed = __atomic_load_n(&m->delayed[d], __ATOMIC_RELAXED);
+            dept->dropped = __atomic_load_n(&m->droppedQueue[d], __ATOMIC_RELAXED);
+            fill_latency(&dept->endToEnd, &m->latencyByDept[STAGE_END_TO_END][d]);
+        }
+
+        for (int p = 0; p < MAX_PRIORITY; p++) {
+            fill_latency(&next.endToEndByPriority[p], &m->latencyByPriority[STAGE_END_TO_END][p]);
+        }
+
+        status_page_write_begin(statusPage);   // short write section, readers never block the simulator
+
+        statusPage->publishCount++;
+        statusPage->tickCount = os_tick_count();
+        statusPage->pendingEvents = next.pendingEvents;
+        statusPage->generated = next.generated;
+        statusPage->dispatched = next.dispatched;
+        statusPage->droppedBuffer = next.droppedBuffer;
+        memcpy(statusPage->departments, next.departments, sizeof(next.departments));
+        memcpy(statusPage->endToEndByPriority, next.endToEndByPriority, sizeof(next.endToEndByPriority));
+
+        status_page_write_end(statusPage);
+
+        os_delay(OS_MS_TO_TICKS(STATUS_PAGE_PERIOD_MS));
+    }
+}
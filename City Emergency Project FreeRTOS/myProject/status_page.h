@@ -0,0 +1,131 @@
+/**
+******************************************************************************
+* @file           : status_page.h
+* @author         : Nimrod Elstein
+* @brief          : Layout of the shared memory status page (shared with external monitors)
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* This header does not depend on FreeRTOS, so external readers (tools/status_reader.c)
+* can include it directly.
+*
+******************************************************************************
+*/
+
+#ifndef STATUS_PAGE_H
+#define STATUS_PAGE_H
+
+/* Includes */
+
+#include <stdint.h>
+#include <string.h>
+
+/////////////////////////
+
+/* Defines */
+
+#define STATUS_PAGE_NAME            "/city_emergency_status"   // default POSIX shared memory object name
+#define STATUS_PAGE_MAGIC           0x50534543u               // "CESP"
+#define STATUS_PAGE_VERSION         1
+#define STATUS_PAGE_MAX_DEPARTMENTS 8
+#define STATUS_PAGE_PRIORITIES      3
+#define STATUS_PAGE_NAME_LEN        24
+
+///////////////////////////////// end Defines
+
+/* Variables */
+
+typedef struct {   // latency percentiles (ticks)
+    uint32_t p50;
+    uint32_t p95;
+    uint32_t p99;
+    uint32_t max;
+} StatusPageLatency;
+
+typedef struct {   // per department counters
+    char name[STATUS_PAGE_NAME_LEN];
+    uint32_t totalUnits;
+    uint32_t freeUnits;
+    uint32_t queueDepth;
+    uint32_t reserved;
+    uint64_t handled;
+    uint64_t completed;
+    uint64_t borrowed;
+    uint64_t delayed;
+    uint64_t dropped;
+    StatusPageLatency endToEnd;
+} StatusPageDepartment;
+
+typedef struct {   // the shared memory status page, guarded by a seqlock
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sequence;          // seqlock counter, odd while the writer updates the page
+    uint32_t tickRateHz;
+    uint64_t publishCount;      // number of updates since the simulator started
+    uint64_t tickCount;         // simulator tick count at the last update
+    uint32_t pendingEvents;     // events waiting in the eventBuffer
+    uint32_t departmentCount;
+    uint64_t generated;
+    uint64_t dispatched;
+    uint64_t droppedBuffer;
+    StatusPageDepartment departments[STATUS_PAGE_MAX_DEPARTMENTS];
+    StatusPageLatency endToEndByPriority[STATUS_PAGE_PRIORITIES];   // indexed by priority - 1
+} StatusPage;
+
+///////////////////////////////// end Variables
+
+/* Function Signatures */
+
+/**
+ * @brief Function that starts a seqlock write, readers retry while the sequence is odd.
+ *
+ * @param page The status page.
+ *
+ * @return void
+ */
+static inline void status_page_write_begin(StatusPage *page) {
+    __atomic_store_n(&page->sequence, page->sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Function that ends a seqlock write.
+ *
+ * @param page The status page.
+ *
+ * @return void
+ */
+static inline void status_page_write_end(StatusPage *page) {
+    __atomic_store_n(&page->sequence, page->sequence + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Function that copies a consistent version of the status page (seqlock read).
+ *
+ * @param page The shared status page.
+ * @param[out] copy Receives the consistent copy.
+ * @param maxRetries Maximum attempts while the writer is updating, 0 = retry until consistent.
+ *
+ * @return integer that is 1 if a consistent copy was made, 0 if the retries ran out.
+ */
+static inline int status_page_read(const StatusPage *page, StatusPage *copy, unsigned maxRetries) {
+    for (unsigned attempt = 0; maxRetries == 0 || attempt < maxRetries; attempt++) {
+        uint32_t before = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE);
+        if (before & 1u) {
+            continue;   // writer in progress
+        }
+        memcpy(copy, (const void *)page, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&page->sequence, __ATOMIC_RELAXED) == before) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+///////////////////////////////// end Function Signatures
+
+#endif
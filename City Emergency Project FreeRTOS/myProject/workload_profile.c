@@ -0,0 +1,249 @@
+/**
+******************************************************************************
+* @file           : workload_profile.c
+* @author         : Nimrod Elstein
+* @brief          : Source code related to the parametric workload (profile file)
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* Arrivals are a non-homogeneous Poisson process per department. The rate is
+* piecewise constant: base rate * diurnal curve (one value per hour) * the
+* multipliers of the active burst episodes. The next arrival is drawn exactly
+* by inversion, an exponential amount of "rate work" consumed segment by
+* segment, so no draw is ever rejected. Within a segment the department and
+* the priority are drawn with alias tables, built once per segment.
+*
+******************************************************************************
+*/
+
+#include "city_emergency_project.h"
+#include <math.h>
+
+WorkloadProfile workloadProfile;   // loaded by profile_load(), read only while running
+
+static void profile_defaults(WorkloadProfile *p) {   // the configured workload: its mean gap, department weights and handling times
+
+    double weights = 0;
+
+    memset(p, 0, sizeof(*p));
+
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        weights += simParams.departments[d].weight;
+    }
+
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        p->ratePerHour[d] = 3600.0 * 1000.0 / time_dist_mean(&simParams.generationGap) * simParams.departments[d].weight / weights;
+        for (int q = 0; q < MAX_PRIORITY; q++) {
+            p->priorityMix[d][q] = 1.0;
+        }
+        p->handle[d] = simParams.departments[d].handle;
+    }
+
+    for (int h = 0; h < DIURNAL_HOURS; h++) {
+        p->diurnal[h] = 1.0;
+    }
+}
+
+static int parse_range(const char *value, TimeDist *dist) {   // "3000-8000" (both ends included) or "5000"
+
+    unsigned long a, b;
+    char extra;
+
+    if (sscanf(value, "%lu - %lu %c", &a, &b, &extra) == 2 && a <= b) {
+        *dist = (TimeDist){ DIST_UNIFORM, (uint32_t)a, (uint32_t)b + 1, (uint32_t)((a + b) / 2) };
+        return 1;
+    }
+    if (sscanf(value, "%lu %c", &a, &extra) == 1) {
+        *dist = (TimeDist){ DIST_CONSTANT, (uint32_t)a, (uint32_t)a, (uint32_t)a };
+        return 1;
+    }
+
+    return 0;
+}
+
+static int profile_entry(void *ctx, const char *section, const char *key, const char *value) {
+
+    WorkloadProfile *p = (WorkloadProfile *)ctx;
+    double list[DIURNAL_HOURS];
+    char name[INI_LINE_LEN];
+
+    if (sscanf(section, "department %s", name) == 1) {   // [department police]
+
+        int code = department_code_from_name(name);
+        if (code == 0) return 0;
+
+        if (strcmp(key, "rate_per_hour") == 0) {
+            return ini_parse_list(value, &p->ratePerHour[code - 1], 1) == 1 && p->ratePerHour[code - 1] >= 0;
+        }
+        if (strcmp(key, "priority_mix") == 0) {   // weights of priority 1, 2, 3
+            return ini_parse_list(value, p->priorityMix[code - 1], MAX_PRIORITY) == MAX_PRIORITY;
+        }
+        if (strcmp(key, "handle_ms") == 0) {
+            return parse_range(value, &p->handle[code - 1]);
+        }
+        return 0;
+    }
+
+    if (strcmp(section, "diurnal") == 0 && strcmp(key, "curve") == 0) {   // 24 hourly multipliers, from midnight
+
+        if (ini_parse_list(value, list, DIURNAL_HOURS) != DIURNAL_HOURS) return 0;
+        for (int h = 0; h < DIURNAL_HOURS; h++) {
+            if (list[h] < 0) return 0;
+            p->diurnal[h] = list[h];
+        }
+        return 1;
+    }
+
+    if (strncmp(section, "burst", 5) == 0) {   // [burst storm], one episode per section
+
+        WorkloadBurst *b = p->burstCount > 0 ? &p->bursts[p->burstCount - 1] : NULL;
+
+        if (b == NULL || strcmp(b->name, section) != 0) {   // first key of a new burst section
+            if (p->burstCount == PROFILE_MAX_BURSTS) return 0;
+            b = &p->bursts[p->burstCount++];
+            snprintf(b->name, sizeof(b->name), "%s", section);
+            b->multiplier = 1.0;
+            b->departments = (1u << simParams.departmentCount) - 1;
+        }
+
+        double number;
+        if (strcmp(key, "start_h") == 0 && ini_parse_list(value, &number, 1) == 1) {
+            b->startSec = number * 3600.0;
+        } else if (strcmp(key, "duration_min") == 0 && ini_parse_list(value, &number, 1) == 1 && number > 0) {
+            b->durationSec = number * 60.0;
+        } else if (strcmp(key, "repeat_h") == 0 && ini_parse_list(value, &number, 1) == 1 && number >= 0) {
+            b->repeatSec = number * 3600.0;
+        } else if (strcmp(key, "multiplier") == 0 && ini_parse_list(value, &number, 1) == 1 && number >= 0) {
+            b->multiplier = number;
+        } else if (strcmp(key, "departments") == 0) {   // comma separated names, or "all"
+            if (strcmp(value, "all") == 0) return 1;
+            char copy[INI_LINE_LEN], *save = NULL;
+            snprintf(copy, sizeof(copy), "%s", value);
+            b->departments = 0;
+            for (char *tok = strtok_r(copy, ", ", &save); tok != NULL; tok = strtok_r(NULL, ", ", &save)) {
+                int code = department_code_from_name(tok);
+                if (code == 0) return 0;
+                b->departments |= 1u << (code - 1);
+            }
+        } else if (strcmp(key, "priority_mix") == 0 && ini_parse_list(value, b->priorityMix, MAX_PRIORITY) == MAX_PRIORITY) {
+            b->hasPriorityMix = 1;
+        } else {
+            return 0;
+        }
+        return 1;
+    }
+
+    return 0;
+}
+
+int profile_load(const char *path) {
+
+    profile_defaults(&workloadProfile);
+
+    if (!ini_parse(path, profile_entry, &workloadProfile)) {
+        return 0;
+    }
+
+    for (int b = 0; b < workloadProfile.burstCount; b++) {
+        if (workloadProfile.bursts[b].durationSec <= 0) {
+            fprintf(stderr, "%s: [%s] needs duration_min\n", path, workloadProfile.bursts[b].name);
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+static int burst_active(const WorkloadBurst *b, double t, double *boundary) {   // also the next time the burst starts or ends
+
+    if (t < b->startSec) {
+        *boundary = b->startSec;
+        return 0;
+    }
+
+    double phase = b->repeatSec > 0 ? fmod(t - b->startSec, b->repeatSec) : t - b->startSec;
+
+    if (phase < b->durationSec) {
+        *boundary = t + (b->durationSec - phase);
+        return 1;
+    }
+
+    *boundary = b->repeatSec > 0 ? t + (b->repeatSec - phase) : INFINITY;
+    return 0;
+}
+
+static void enter_segment(ProfileState *s) {   // rates and alias tables for the segment that starts at s->nowSec
+
+    const WorkloadProfile *p = &workloadProfile;
+    double hour = floor(s->nowSec / 3600.0);
+    double factor = p->diurnal[(int)fmod(hour, DIURNAL_HOURS)];
+    const double *mix[MAX_DEPARTMENTS];
+
+    s->segmentEndSec = (hour + 1) * 3600.0;   // the diurnal curve changes every hour
+
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        s->rates[d] = p->ratePerHour[d] * factor / 3600.0;   // events per second
+        mix[d] = p->priorityMix[d];
+    }
+
+    for (int i = 0; i < p->burstCount; i++) {
+        const WorkloadBurst *b = &p->bursts[i];
+        double boundary;
+        int active = burst_active(b, s->nowSec, &boundary);
+        if (boundary < s->segmentEndSec) s->segmentEndSec = boundary;
+        if (!active) continue;
+        for (int d = 0; d < simParams.departmentCount; d++) {
+            if (b->departments & (1u << d)) {
+                s->rates[d] *= b->multiplier;
+                if (b->hasPriorityMix) mix[d] = b->priorityMix;   // the last active burst with a mix wins
+            }
+        }
+    }
+
+    s->totalRate = 0;
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        s->totalRate += s->rates[d];
+        alias_build(&s->priorityTable[d], mix[d], MAX_PRIORITY);
+    }
+    if (s->totalRate > 0) {
+        alias_build(&s->departmentTable, s->rates, simParams.departmentCount);
+    }
+}
+
+void profile_state_init(ProfileState *s, double startSec) {
+
+    memset(s, 0, sizeof(*s));
+    s->nowSec = startSec;
+    enter_segment(s);
+}
+
+int profile_next(ProfileState *s, WorkloadRng *rng, Event *evt, uint64_t *arrivalTick) {
+
+    double work = -log1p(-rng_uniform(&rng->gaps));   // Exp(1), consumed at the piecewise constant total rate
+    int emptySegments = 0;
+
+    while (work > s->totalRate * (s->segmentEndSec - s->nowSec)) {   // the arrival is past this segment
+        if (s->totalRate == 0 && ++emptySegments > PROFILE_MAX_EMPTY_SEGMENTS) {   // the profile rate stays 0, no more events
+            return 0;
+        }
+        work -= s->totalRate * (s->segmentEndSec - s->nowSec);
+        s->nowSec = s->segmentEndSec;
+        enter_segment(s);
+    }
+    s->nowSec += work / s->totalRate;
+
+    int d = alias_draw(&s->departmentTable, &rng->events);
+    const WorkloadProfile *p = &workloadProfile;
+
+    memset(evt, 0, sizeof(*evt));
+    evt->code = d + 1;
+    evt->priority = alias_draw(&s->priorityTable[d], &rng->events) + 1;
+    evt->handleMs = time_dist_draw(&p->handle[d], &rng->service);
+
+    *arrivalTick = (uint64_t)(s->nowSec * OS_TICK_RATE_HZ);
+
+    return 1;
+}
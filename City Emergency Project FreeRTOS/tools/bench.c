@@ -0,0 +1,581 @@
+/**
+******************************************************************************
+* @file           : bench.c
+* @author         : Nimrod Elstein
+* @brief          : Microbenchmarks of the eventBuffer, logger, department queue and borrow primitives
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* Links the project code with the native pthreads backend (myProject/os_port.h)
+* in place of main_city_emergency_project.c, sets up one district and times the
+* primitives the tasks call, with no scheduler and no other task running:
+*
+*   insert_event                 one event into the eventBuffer (priority ordered insert)
+*   get_highest_priority_event   one event out of a full eventBuffer
+*   insert_get_pair              insert_event + get_highest_priority_event at half occupancy,
+*                                every thread on the same district (bufferMutex contention)
+*   log_message                  one line into the log ring (xLogMutex contention)
+*   queue_send_receive           os_queue_send + os_queue_receive on a department queue
+*   queue_handoff                one producer and one consumer thread through a department queue
+*   borrow_unit                  no own unit, borrow under the resourceMutex and give it back
+*   borrow_unit_none             no unit in the district, the whole borrow list is tried
+*
+* Build and run with "make bench" (BENCH_ARGS="..." for options), for example:
+*   ./build/bench --buffer-len 10,100,1000 --threads 1,2,4 --reps 7 --out bench.json
+*
+* Every case runs --reps times, the report has the median, min and max ns/op and
+* the ops/s of the median. With threads, ns/op is the wall time (first thread start
+* to last thread end) over the operations of all threads, the inverse of the
+* throughput. --out writes the same results as one JSON document, one entry per
+* case with its samples (the format of tools/benchgate.c, like loadbench).
+*
+******************************************************************************
+*/
+
+#include "city_emergency_project.h"
+#include <pthread.h>
+#include <time.h>
+
+#define BENCH_MAX_SIZES 8
+#define BENCH_MAX_REPS 64
+#define BENCH_MAX_THREADS 64
+#define BENCH_MAX_RESULTS 128
+#define BENCH_CALIBRATE 10000   // clock reads to measure the timer overhead
+
+OsMutex xLogMutex;           // the globals of main_city_emergency_project.c
+OsMutex xHistoryMutex;
+District *districts = NULL;
+
+typedef struct BenchCase BenchCase;
+
+typedef struct {   // one measured case: the case, its buffer length and threads
+    const BenchCase *bench;
+    int bufferLen;   // 0 = not used by the case
+    int threads;
+    long ops;        // operations per repetition, all threads together
+    double nsPerOp[BENCH_MAX_REPS];
+    double median, min, max;
+} BenchResult;
+
+struct BenchCase {
+    const char *name;
+    int sized;        // 1 = run for every --buffer-len
+    int threaded;     // 1 = run for every --threads, else one thread
+    uint64_t (*run)(BenchResult *result);   // runs result->ops operations, returns the measured ns
+};
+
+typedef struct {   // one contention thread
+    BenchResult *result;
+    long ops;
+    pthread_barrier_t *start;
+    int index;
+    uint64_t begin, end;   // the thread's own clock reads around its loop
+} BenchThread;
+
+static int bufferSizes[BENCH_MAX_SIZES] = { 10, 100, 1000 };
+static int bufferSizeCount = 3;
+static int threadCounts[BENCH_MAX_SIZES] = { 1, 2, 4 };
+static int threadCountCount = 3;
+static int reps = 5;
+static long opsPerRep = 200000;
+static const char *caseFilter = NULL;
+
+static BenchResult results[BENCH_MAX_RESULTS];
+static int resultCount = 0;
+static double timerNs = 0;   // overhead of one clock read, subtracted from the batch times
+
+static Event events[1024];   // random priorities and codes, the same for every case
+
+static uint64_t now_ns(void) {
+
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void setup_district(int bufferLen) {   // like create_district(), with the buffer length of the case
+
+    District *district = &districts[0];
+
+    free(district->eventBuffer);
+    simParams.bufferLen = (uint32_t)bufferLen;
+    district->eventBuffer = malloc((size_t)bufferLen * sizeof(Event));
+    district->eventCount = 0;
+    if (district->eventBuffer == NULL) {
+        fprintf(stderr, "error: cannot allocate an eventBuffer of %d events\n", bufferLen);
+        exit(1);
+    }
+}
+
+static void set_free_units(DepartmentParams *params, uint32_t units) {
+
+    while (os_semaphore_take(params->semaphore, 0)) {
+    }
+    for (uint32_t i = 0; i < units; i++) {
+        os_semaphore_give(params->semaphore);
+    }
+}
+
+static void thread_start(BenchThread *thread) {
+
+    pthread_barrier_wait(thread->start);
+    thread->begin = now_ns();
+}
+
+static uint64_t run_threads(BenchResult *result, void *(*body)(void *)) {   // result->threads threads start together, first begin to last end
+
+    int threads = result->threads;
+    pthread_t ids[BENCH_MAX_THREADS];
+    BenchThread args[BENCH_MAX_THREADS];
+    pthread_barrier_t start;
+    uint64_t begin = UINT64_MAX, end = 0;
+
+    pthread_barrier_init(&start, NULL, (unsigned)threads);
+    for (int t = 0; t < threads; t++) {
+        args[t] = (BenchThread){ result, result->ops / threads, &start, t, 0, 0 };
+        pthread_create(&ids[t], NULL, body, &args[t]);
+    }
+
+    for (int t = 0; t < threads; t++) {
+        pthread_join(ids[t], NULL);
+        if (args[t].begin < begin) begin = args[t].begin;
+        if (args[t].end > end) end = args[t].end;
+    }
+
+    pthread_barrier_destroy(&start);
+    return end - begin;
+}
+
+/* cases */
+
+static uint64_t bench_insert_event(BenchResult *result) {   // batches of bufferLen inserts into an empty buffer
+
+    District *district = &districts[0];
+    int batch = result->bufferLen;
+    uint64_t total = 0;
+
+    for (long done = 0; done < result->ops; done += batch) {
+        uint64_t begin = now_ns();
+        for (int i = 0; i < batch; i++) {
+            insert_event(district, events[(done + i) & 1023]);
+        }
+        total += now_ns() - begin;
+        district->eventCount = 0;   // drained without a pop
+    }
+
+    return total;
+}
+
+static uint64_t bench_get_highest_priority_event(BenchResult *result) {   // batches of bufferLen pops from a full buffer
+
+    District *district = &districts[0];
+    int batch = result->bufferLen;
+    uint64_t total = 0;
+    Event evt;
+
+    for (long done = 0; done < result->ops; done += batch) {
+        for (int i = 0; i < batch; i++) {
+            event_buffer_push(district->eventBuffer, &district->eventCount, batch, events[(done + i) & 1023]);
+        }
+        uint64_t begin = now_ns();
+        for (int i = 0; i < batch; i++) {
+            get_highest_priority_event(district, &evt);
+        }
+        total += now_ns() - begin;
+    }
+
+    return total;
+}
+
+static void *insert_get_thread(void *param) {
+
+    BenchThread *thread = (BenchThread *)param;
+    District *district = &districts[0];
+    Event evt;
+
+    thread_start(thread);
+    for (long i = 0; i < thread->ops; i++) {
+        insert_event(district, events[(i * 7 + thread->index) & 1023]);
+        get_highest_priority_event(district, &evt);
+    }
+    thread->end = now_ns();
+
+    return NULL;
+}
+
+static uint64_t bench_insert_get_pair(BenchResult *result) {   // steady occupancy, the threads never fill the buffer
+
+    District *district = &districts[0];
+    int fill = (result->bufferLen - result->threads) / 2;
+
+    district->eventCount = 0;
+    for (int i = 0; i < fill; i++) {
+        event_buffer_push(district->eventBuffer, &district->eventCount, result->bufferLen, events[i & 1023]);
+    }
+
+    return run_threads(result, insert_get_thread);
+}
+
+static void *log_thread(void *param) {
+
+    BenchThread *thread = (BenchThread *)param;
+
+    thread_start(thread);
+    for (long i = 0; i < thread->ops; i++) {
+        log_message("Police handling event (priority 2) [borrowed]");
+    }
+    thread->end = now_ns();
+
+    return NULL;
+}
+
+static uint64_t bench_log_message(BenchResult *result) {
+
+    return run_threads(result, log_thread);
+}
+
+static uint64_t bench_queue_send_receive(BenchResult *result) {
+
+    OsQueue queue = districts[0].departments[0].queue;
+    Event evt = events[0];
+    uint64_t begin = now_ns();
+
+    for (long i = 0; i < result->ops; i++) {
+        os_queue_send(queue, &evt, 0);
+        os_queue_receive(queue, &evt, 0);
+    }
+
+    return now_ns() - begin;
+}
+
+static void *queue_producer(void *param) {
+
+    BenchThread *thread = (BenchThread *)param;
+    OsQueue queue = districts[0].departments[0].queue;
+
+    thread_start(thread);
+    for (long i = 0; i < thread->ops; i++) {
+        os_queue_send(queue, &events[i & 1023], OS_WAIT_FOREVER);   // like the dispatcher, without its send timeout
+    }
+    thread->end = now_ns();
+
+    return NULL;
+}
+
+static void *queue_consumer(void *param) {
+
+    BenchThread *thread = (BenchThread *)param;
+    OsQueue queue = districts[0].departments[0].queue;
+    Event evt;
+
+    thread_start(thread);
+    for (long i = 0; i < thread->ops; i++) {
+        os_queue_receive(queue, &evt, OS_WAIT_FOREVER);   // like the department task
+    }
+    thread->end = now_ns();
+
+    return NULL;
+}
+
+static uint64_t bench_queue_handoff(BenchResult *result) {   // ops = events through the queue
+
+    pthread_t producer, consumer;
+    pthread_barrier_t start;
+    BenchThread send = { result, result->ops, &start, 0, 0, 0 };
+    BenchThread receive = { result, result->ops, &start, 1, 0, 0 };
+
+    pthread_barrier_init(&start, NULL, 2);
+    pthread_create(&producer, NULL, queue_producer, &send);
+    pthread_create(&consumer, NULL, queue_consumer, &receive);
+    pthread_join(producer, NULL);
+    pthread_join(consumer, NULL);
+    pthread_barrier_destroy(&start);
+
+    return (receive.end > send.end ? receive.end : send.end) - (receive.begin < send.begin ? receive.begin : send.begin);
+}
+
+static int take_unit(int code, void *ctx) {   // the DepartmentTask borrow callback
+
+    OsSemaphore semaphore = ((District *)ctx)->departments[code - 1].semaphore;
+
+    return os_semaphore_count(semaphore) > 0 && os_semaphore_take(semaphore, 0);
+}
+
+static int borrow_path(District *district, DepartmentParams *params) {   // the DepartmentTask path without a local unit
+
+    if (os_semaphore_take(params->semaphore, 0)) {
+        department_return_unit(params);
+        return 1;
+    }
+
+    os_mutex_lock(district->resourceMutex);
+    int fromCode = borrow_unit(params->code, take_unit, district);
+    os_mutex_unlock(district->resourceMutex);
+
+    if (fromCode != 0) {
+        department_return_unit(&district->departments[fromCode - 1]);   // the handler gives it back
+    }
+
+    return fromCode;
+}
+
+static void *borrow_thread(void *param) {
+
+    BenchThread *thread = (BenchThread *)param;
+    District *district = &districts[0];
+
+    thread_start(thread);
+    for (long i = 0; i < thread->ops; i++) {
+        borrow_path(district, &district->departments[0]);
+    }
+    thread->end = now_ns();
+
+    return NULL;
+}
+
+static uint64_t bench_borrow_unit(BenchResult *result) {   // the first department has no units, the others more than the threads
+
+    District *district = &districts[0];
+
+    set_free_units(&district->departments[0], 0);
+    for (int d = 1; d < simParams.departmentCount; d++) {
+        set_free_units(&district->departments[d], DEPARTMENT_MAX_UNITS);
+    }
+
+    return run_threads(result, borrow_thread);
+}
+
+static uint64_t bench_borrow_unit_none(BenchResult *result) {
+
+    District *district = &districts[0];
+
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        set_free_units(&district->departments[d], 0);
+    }
+
+    uint64_t begin = now_ns();
+    for (long i = 0; i < result->ops; i++) {
+        borrow_path(district, &district->departments[0]);
+    }
+    uint64_t elapsed = now_ns() - begin;
+
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        set_free_units(&district->departments[d], simParams.departments[d].units);
+    }
+
+    return elapsed;
+}
+
+static const BenchCase cases[] = {
+    { "insert_event", 1, 0, bench_insert_event },
+    { "get_highest_priority_event", 1, 0, bench_get_highest_priority_event },
+    { "insert_get_pair", 1, 1, bench_insert_get_pair },
+    { "log_message", 0, 1, bench_log_message },
+    { "queue_send_receive", 0, 0, bench_queue_send_receive },
+    { "queue_handoff", 0, 0, bench_queue_handoff },
+    { "borrow_unit", 0, 1, bench_borrow_unit },
+    { "borrow_unit_none", 0, 0, bench_borrow_unit_none },
+};
+
+#define NUM_CASES ((int)(sizeof(cases) / sizeof(cases[0])))
+
+/* measurement and report */
+
+static int compare_double(const void *a, const void *b) {
+
+    return (*(const double *)a > *(const double *)b) - (*(const double *)a < *(const double *)b);
+}
+
+static void calibrate_timer(void) {
+
+    uint64_t begin = now_ns();
+    for (int i = 0; i < BENCH_CALIBRATE; i++) {
+        now_ns();
+    }
+    timerNs = (double)(now_ns() - begin) / BENCH_CALIBRATE;
+}
+
+static void measure(const BenchCase *bench, int bufferLen, int threads) {
+
+    if (resultCount == BENCH_MAX_RESULTS) {
+        return;
+    }
+
+    BenchResult *result = &results[resultCount++];
+    double sorted[BENCH_MAX_REPS];
+
+    result->bench = bench;
+    result->bufferLen = bufferLen;
+    result->threads = threads;
+    result->ops = opsPerRep - opsPerRep % (bench->sized ? (long)bufferLen * threads : threads);   // whole batches, the same ops per thread
+    if (result->ops <= 0) {
+        result->ops = bench->sized ? (long)bufferLen * threads : threads;
+    }
+
+    setup_district(bufferLen > 0 ? bufferLen : MAX_EVENTS);
+
+    bench->run(result);   // warm up (caches, page faults, thread stacks)
+
+    for (int r = 0; r < reps; r++) {
+        uint64_t ns = bench->run(result);
+        double overhead = bench->sized && threads == 1 ? 2.0 * timerNs * (double)result->ops / bufferLen : 0;   // two clock reads per batch
+        double net = (double)ns > overhead ? (double)ns - overhead : (double)ns;
+        result->nsPerOp[r] = net / (double)result->ops;
+    }
+
+    memcpy(sorted, result->nsPerOp, (size_t)reps * sizeof(double));
+    qsort(sorted, (size_t)reps, sizeof(double), compare_double);
+    result->min = sorted[0];
+    result->max = sorted[reps - 1];
+    result->median = reps % 2 ? sorted[reps / 2] : (sorted[reps / 2 - 1] + sorted[reps / 2]) / 2;
+
+    char params[48] = "";
+    if (bufferLen > 0) snprintf(params, sizeof(params), " buffer %d", bufferLen);
+    if (bench->threaded) snprintf(params + strlen(params), sizeof(params) - strlen(params), " threads %d", threads);
+    printf("%-28s%-24s %10.1f ns/op  %14.0f ops/s  (min %.1f, max %.1f)\n", bench->name, params,
+           result->median, 1e9 / result->median, result->min, result->max);
+    fflush(stdout);
+}
+
+static int write_json(const char *path) {
+
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        return 0;
+    }
+
+    fprintf(out, "{\"bench\":\"micro\",\"backend\":\"%s\",\"reps\":%d,\"timer_ns\":%.1f,\"results\":[", OS_BACKEND_NAME, reps, timerNs);
+    for (int i = 0; i < resultCount; i++) {
+        const BenchResult *r = &results[i];
+        char id[96];
+        snprintf(id, sizeof(id), "%s", r->bench->name);
+        if (r->bufferLen > 0) snprintf(id + strlen(id), sizeof(id) - strlen(id), "/buffer_len=%d", r->bufferLen);
+        if (r->bench->threaded) snprintf(id + strlen(id), sizeof(id) - strlen(id), "/threads=%d", r->threads);
+        fprintf(out, "%s\n{\"id\":\"%s\",\"name\":\"%s\",\"buffer_len\":%d,\"threads\":%d,\"ops\":%ld,\"unit\":\"ns/op\",\"better\":\"lower\","
+                     "\"median\":%.2f,\"min\":%.2f,\"max\":%.2f,\"ops_per_s\":%.0f,\"samples\":[",
+                i > 0 ? "," : "", id, r->bench->name, r->bufferLen, r->threads, r->ops, r->median, r->min, r->max, 1e9 / r->median);
+        for (int s = 0; s < reps; s++) {
+            fprintf(out, "%s%.2f", s > 0 ? "," : "", r->nsPerOp[s]);
+        }
+        fprintf(out, "]}");
+    }
+    fprintf(out, "\n]}\n");
+
+    return fclose(out) == 0;
+}
+
+static int parse_list(const char *value, int *out, int min, int max) {   // "10,100,1000"
+
+    char copy[128], *save = NULL;
+    int count = 0;
+
+    snprintf(copy, sizeof(copy), "%s", value);
+    for (char *item = strtok_r(copy, ",", &save); item != NULL; item = strtok_r(NULL, ",", &save)) {
+        char *end = NULL;
+        long v = strtol(item, &end, 10);
+        if (*end != '\0' || v < min || v > max || count == BENCH_MAX_SIZES) return 0;
+        out[count++] = (int)v;
+    }
+
+    return count;
+}
+
+static void print_usage(const char *program) {
+
+    printf("usage: %s [--buffer-len <n,..>] [--threads <n,..>] [--reps <n>] [--ops <n>] [--case <name>] [--out <file.json>]\n", program);
+    printf("  cases:");
+    for (int c = 0; c < NUM_CASES; c++) {
+        printf(" %s", cases[c].name);
+    }
+    printf("\n");
+}
+
+void main_city_emergency_project(int argc, char **argv) {   // called by the pthreads backend main()
+
+    const char *outPath = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        int ok = 1;
+        if (strcmp(argv[i], "--buffer-len") == 0 && i + 1 < argc) {
+            ok = (bufferSizeCount = parse_list(argv[++i], bufferSizes, 1, 1 << 20)) > 0;
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            ok = (threadCountCount = parse_list(argv[++i], threadCounts, 1, BENCH_MAX_THREADS)) > 0;
+        } else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+            ok = reps >= 1 && reps <= BENCH_MAX_REPS;
+        } else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+            opsPerRep = atol(argv[++i]);
+            ok = opsPerRep > 0;
+        } else if (strcmp(argv[i], "--case") == 0 && i + 1 < argc) {
+            caseFilter = argv[++i];
+            ok = 0;
+            for (int c = 0; c < NUM_CASES; c++) {
+                if (strcmp(caseFilter, cases[c].name) == 0) ok = 1;
+            }
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            outPath = argv[++i];
+        } else {
+            ok = 0;
+        }
+        if (!ok) {
+            print_usage(argv[0]);
+            exit(1);
+        }
+    }
+
+    projectOptions.headless = 0;   // log_message() writes the log ring
+    simParams.districtCount = 1;
+
+    districts = calloc(1, sizeof(District));
+    districts[0].departments = calloc(simParams.departmentCount, sizeof(DepartmentParams));
+    districts[0].bufferMutex = os_mutex_create();
+    districts[0].resourceMutex = os_mutex_create();
+    xLogMutex = os_mutex_create();
+    xHistoryMutex = os_mutex_create();
+    for (int d = 0; d < simParams.departmentCount; d++) {
+        DepartmentParams *params = &districts[0].departments[d];
+        params->queue = os_queue_create(simParams.departments[d].queueLen, sizeof(Event));
+        params->semaphore = os_semaphore_create(DEPARTMENT_MAX_UNITS, simParams.departments[d].units);
+        params->departmentName = simParams.departments[d].name;
+        params->code = d + 1;
+        params->units = simParams.departments[d].units;
+    }
+
+    EventSource source;
+    projectOptions.seed = 1;   // a fixed workload, every run times the same events
+    event_source_init(&source, 0);
+    for (int i = 0; i < 1024; i++) {
+        generate_random_event(&source.rng, &events[i]);
+    }
+
+    calibrate_timer();
+    printf("backend %s, %d reps of %ld ops per case, median ns/op (timer overhead %.1f ns subtracted from batches)\n",
+           OS_BACKEND_NAME, reps, opsPerRep, timerNs);
+
+    for (int c = 0; c < NUM_CASES; c++) {
+        const BenchCase *bench = &cases[c];
+        if (caseFilter != NULL && strcmp(caseFilter, bench->name) != 0) continue;
+        for (int s = 0; s < (bench->sized ? bufferSizeCount : 1); s++) {
+            for (int t = 0; t < (bench->threaded ? threadCountCount : 1); t++) {
+                int threads = bench->threaded ? threadCounts[t] : 1;
+                int bufferLen = bench->sized ? bufferSizes[s] : 0;
+                if (bench->sized && bench->threaded && threads >= bufferLen) continue;   // the threads would fill the buffer
+                measure(bench, bufferLen, threads);
+            }
+        }
+    }
+
+    if (outPath != NULL) {
+        if (!write_json(outPath)) {
+            fprintf(stderr, "error: cannot write %s\n", outPath);
+            exit(1);
+        }
+        printf("results written to %s\n", outPath);
+    }
+
+    exit(0);
+}
@@ -0,0 +1,437 @@
+/**
+******************************************************************************
+* @file           : benchgate.c
+* @author         : Nimrod Elstein
+* @brief          : Benchmark regression gate, compares benchmark results against a stored baseline
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* Reads two result files of the same benchmark (tools/bench.c or tools/loadbench.c,
+* --out), the committed baseline and the current run. Every result has an id, a
+* direction ("better": lower or higher) and one sample per repetition. For each
+* metric the gate compares the medians and bootstraps a 95% confidence interval of
+* the relative change of the median (resampling both sides, a fixed seed so the
+* verdict is repeatable):
+*
+*   REGRESSION   worse than the threshold and the whole interval on the worse side
+*   improved     better than the threshold and the whole interval on the better side
+*   noisy        past the threshold, but the interval includes no change (more --reps)
+*   ok           within the threshold
+*
+* With one sample on a side there is no interval, the threshold alone decides.
+*
+* Build with "make benchgate", or run the whole gate with "make bench_gate", e.g.:
+*   ./build/benchgate baselines/micro.json build/gate_micro.json --threshold 5 --threshold p1_e2e=15
+*
+* --threshold <pct> sets the default, --threshold <id prefix>=<pct> the metrics
+* whose id starts with the prefix (the longest prefix wins); --ignore <id prefix>
+* leaves metrics out. Exit status: 0 no regression, 1 regressions, 2 error.
+*
+******************************************************************************
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GATE_MAX_METRICS 256
+#define GATE_MAX_SAMPLES 64
+#define GATE_MAX_RULES 32
+#define GATE_ID_LEN 96
+#define GATE_RESAMPLES 2000
+#define GATE_DEFAULT_THRESHOLD 5.0   // percent
+
+typedef struct {   // one result of a benchmark file
+    char id[GATE_ID_LEN];
+    char unit[16];
+    int higherIsBetter;
+    int count;
+    double samples[GATE_MAX_SAMPLES];
+} GateMetric;
+
+typedef struct {   // a benchmark result file
+    char bench[16];      // "micro" or "load"
+    char args[512];      // load benchmark command line, compared for like with like
+    int count;
+    GateMetric metrics[GATE_MAX_METRICS];
+} GateFile;
+
+typedef struct {   // --threshold <prefix>=<pct> and --ignore <prefix>
+    const char *prefix;
+    double threshold;   // percent, < 0 = ignore
+} GateRule;
+
+static GateRule rules[GATE_MAX_RULES];
+static int ruleCount = 0;
+static double defaultThreshold = GATE_DEFAULT_THRESHOLD;
+static uint64_t rngState = 0x243f6a8885a308d3ull;   // fixed, the same verdict for the same files
+
+static GateFile baseline, current;
+
+static void print_usage(const char *program) {
+
+    printf("usage: %s <baseline.json> <current.json> [--threshold <pct>] [--threshold <id prefix>=<pct>]...\n"
+           "          [--ignore <id prefix>]... [--out <diff.json>]\n", program);
+    printf("  default threshold %.0f%%, exit status 0 = no regression, 1 = regressions, 2 = error\n", GATE_DEFAULT_THRESHOLD);
+}
+
+/* result files */
+
+static char *read_file(const char *path) {
+
+    FILE *in = fopen(path, "rb");
+    if (in == NULL) {
+        return NULL;
+    }
+
+    fseek(in, 0, SEEK_END);
+    long size = ftell(in);
+    fseek(in, 0, SEEK_SET);
+
+    char *text = size >= 0 ? malloc((size_t)size + 1) : NULL;
+    if (text != NULL) {
+        size_t length = fread(text, 1, (size_t)size, in);
+        text[length] = '\0';
+    }
+    fclose(in);
+
+    return text;
+}
+
+static int json_string(const char *from, const char *to, const char *key, char *out, size_t size) {   // "key":"value" between from and to
+
+    char pattern[40];
+    snprintf(pattern, sizeof(pattern), "\"%s\":\"", key);
+
+    const char *found = strstr(from, pattern);
+    if (found == NULL || (to != NULL && found >= to)) {
+        return 0;
+    }
+    found += strlen(pattern);
+
+    size_t length = 0;
+    while (found[length] != '"' && found[length] != '\0' && length + 1 < size) {
+        out[length] = found[length];
+        length++;
+    }
+    out[length] = '\0';
+
+    return 1;
+}
+
+static int parse_result(const char *from, const char *to, GateMetric *metric) {   // one {...} entry of "results"
+
+    char better[16] = "";
+
+    if (!json_string(from, to, "id", metric->id, sizeof(metric->id))) {
+        return 0;
+    }
+    json_string(from, to, "unit", metric->unit, sizeof(metric->unit));
+    json_string(from, to, "better", better, sizeof(better));
+    metric->higherIsBetter = strcmp(better, "higher") == 0;
+
+    const char *samples = strstr(from, "\"samples\":[");
+    if (samples == NULL || samples >= to) {
+        return 0;
+    }
+    samples += strlen("\"samples\":[");
+
+    metric->count = 0;
+    while (*samples != ']' && samples < to && metric->count < GATE_MAX_SAMPLES) {
+        char *end = NULL;
+        double value = strtod(samples, &end);
+        if (end == samples) {
+            return 0;
+        }
+        metric->samples[metric->count++] = value;
+        samples = end;
+        while (*samples == ',' || *samples == ' ') samples++;
+    }
+
+    return metric->count > 0;
+}
+
+static int load_results(const char *path, GateFile *file) {
+
+    char *text = read_file(path);
+    if (text == NULL) {
+        fprintf(stderr, "error: cannot read %s\n", path);
+        return 0;
+    }
+
+    const char *results = strstr(text, "\"results\":[");
+    if (results == NULL) {
+        fprintf(stderr, "error: %s is not a benchmark result file (bench --out or loadbench --out)\n", path);
+        free(text);
+        return 0;
+    }
+
+    json_string(text, results, "bench", file->bench, sizeof(file->bench));
+    json_string(text, results, "args", file->args, sizeof(file->args));
+
+    const char *p = results;
+    file->count = 0;
+    while ((p = strchr(p, '{')) != NULL && file->count < GATE_MAX_METRICS) {   // the entries have no nested objects
+        const char *end = strchr(p, '}');
+        if (end == NULL) break;
+        if (parse_result(p, end, &file->metrics[file->count])) {
+            file->count++;
+        } else {
+            fprintf(stderr, "warning: %s: skipped a malformed result\n", path);
+        }
+        p = end + 1;
+    }
+
+    free(text);
+    return 1;
+}
+
+static const GateMetric *find_metric(const GateFile *file, const char *id) {
+
+    for (int i = 0; i < file->count; i++) {
+        if (strcmp(file->metrics[i].id, id) == 0) return &file->metrics[i];
+    }
+
+    return NULL;
+}
+
+/* statistics */
+
+static int compare_double(const void *a, const void *b) {
+
+    return (*(const double *)a > *(const double *)b) - (*(const double *)a < *(const double *)b);
+}
+
+static double median(const double *values, int count) {
+
+    double sorted[GATE_MAX_SAMPLES];
+
+    memcpy(sorted, values, (size_t)count * sizeof(double));
+    qsort(sorted, (size_t)count, sizeof(double), compare_double);
+    return count % 2 ? sorted[count / 2] : (sorted[count / 2 - 1] + sorted[count / 2]) / 2;
+}
+
+static uint32_t next_below(uint32_t bound) {   // splitmix64
+
+    uint64_t z = (rngState += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    z ^= z >> 31;
+    return (uint32_t)(z % bound);
+}
+
+static double resampled_median(const GateMetric *metric) {
+
+    double draw[GATE_MAX_SAMPLES];
+
+    for (int i = 0; i < metric->count; i++) {
+        draw[i] = metric->samples[next_below((uint32_t)metric->count)];
+    }
+    return median(draw, metric->count);
+}
+
+static void bootstrap_change(const GateMetric *base, const GateMetric *now, double *low, double *high) {   // 95% interval of median(now) / median(base) - 1
+
+    static double changes[GATE_RESAMPLES];
+    int count = 0;
+
+    for (int r = 0; r < GATE_RESAMPLES; r++) {
+        double b = resampled_median(base);
+        if (b != 0) {
+            changes[count++] = resampled_median(now) / b - 1.0;
+        }
+    }
+    if (count == 0) {
+        *low = *high = 0;
+        return;
+    }
+
+    qsort(changes, (size_t)count, sizeof(double), compare_double);
+    *low = changes[(int)(0.025 * (count - 1))];
+    *high = changes[(int)(0.975 * (count - 1))];
+}
+
+static double threshold_for(const char *id) {   // percent, < 0 = ignored
+
+    double threshold = defaultThreshold;
+    size_t best = 0;
+
+    for (int i = 0; i < ruleCount; i++) {
+        size_t length = strlen(rules[i].prefix);
+        if (length >= best && strncmp(id, rules[i].prefix, length) == 0) {
+            threshold = rules[i].threshold;
+            best = length;
+        }
+    }
+
+    return threshold;
+}
+
+/* report */
+
+typedef struct {   // verdict of one metric
+    const char *verdict;
+    double baseMedian, nowMedian;
+    double change, low, high;   // relative change of the median and its interval, NAN = none
+    int hasInterval;
+} GateDiff;
+
+static GateDiff compare_metric(const GateMetric *base, const GateMetric *now, double threshold) {
+
+    GateDiff diff = { "ok", median(base->samples, base->count), median(now->samples, now->count), NAN, NAN, NAN, 0 };
+    double sign = now->higherIsBetter ? -1.0 : 1.0;   // positive = worse
+
+    if (diff.baseMedian == 0) {   // no relative change from zero (drops, late wake-ups)
+        double baseMax = base->samples[0], nowMin = now->samples[0];
+        for (int i = 1; i < base->count; i++) if (base->samples[i] > baseMax) baseMax = base->samples[i];
+        for (int i = 1; i < now->count; i++) if (now->samples[i] < nowMin) nowMin = now->samples[i];
+        if (diff.nowMedian == 0) {
+            diff.verdict = "ok";
+        } else if (!now->higherIsBetter && nowMin > baseMax) {   // every current sample above every baseline sample
+            diff.verdict = "REGRESSION";
+        } else {
+            diff.verdict = "noisy";
+        }
+        return diff;
+    }
+
+    diff.change = diff.nowMedian / diff.baseMedian - 1.0;
+    double worse = sign * diff.change * 100.0;
+
+    if (base->count > 1 && now->count > 1) {
+        bootstrap_change(base, now, &diff.low, &diff.high);
+        diff.hasInterval = 1;
+        double worseLow = sign > 0 ? diff.low * 100.0 : -diff.high * 100.0;   // the interval in the worse direction
+        double worseHigh = sign > 0 ? diff.high * 100.0 : -diff.low * 100.0;
+        if (worse > threshold) {
+            diff.verdict = worseLow > 0 ? "REGRESSION" : "noisy";
+        } else if (worse < -threshold) {
+            diff.verdict = worseHigh < 0 ? "improved" : "noisy";
+        }
+    } else if (worse > threshold) {
+        diff.verdict = "REGRESSION";
+    } else if (worse < -threshold) {
+        diff.verdict = "improved";
+    }
+
+    return diff;
+}
+
+int main(int argc, char **argv) {
+
+    const char *paths[2] = { NULL, NULL };
+    const char *outPath = NULL;
+    int pathCount = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--threshold") == 0 || strcmp(argv[i], "--ignore") == 0) && i + 1 < argc) {
+            int ignore = argv[i][2] == 'i';
+            char *value = argv[++i];
+            char *equals = strchr(value, '=');
+            if (!ignore && equals == NULL) {
+                defaultThreshold = atof(value);
+            } else if (ruleCount < GATE_MAX_RULES) {
+                if (equals != NULL) *equals = '\0';
+                rules[ruleCount].prefix = value;
+                rules[ruleCount].threshold = ignore ? -1.0 : atof(equals + 1);
+                ruleCount++;
+            }
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            outPath = argv[++i];
+        } else if (argv[i][0] != '-' && pathCount < 2) {
+            paths[pathCount++] = argv[i];
+        } else {
+            print_usage(argv[0]);
+            return 2;
+        }
+    }
+
+    if (pathCount != 2 || defaultThreshold < 0) {
+        print_usage(argv[0]);
+        return 2;
+    }
+
+    if (!load_results(paths[0], &baseline)) {
+        fprintf(stderr, "no baseline: run \"make bench_baseline\" on the reference host and commit the baselines/ files\n");
+        return 2;
+    }
+    if (!load_results(paths[1], &current)) {
+        return 2;
+    }
+    if (strcmp(baseline.bench, current.bench) != 0) {
+        fprintf(stderr, "error: %s is a \"%s\" benchmark, %s a \"%s\" one\n", paths[0], baseline.bench, paths[1], current.bench);
+        return 2;
+    }
+    if (strcmp(baseline.args, current.args) != 0) {
+        printf("warning: the runs used different arguments, the comparison may not be like with like\n  baseline: %s\n  current:  %s\n",
+               baseline.args, current.args);
+    }
+
+    FILE *out = NULL;
+    if (outPath != NULL && (out = fopen(outPath, "w")) == NULL) {
+        fprintf(stderr, "error: cannot write %s\n", outPath);
+        return 2;
+    }
+    if (out != NULL) fprintf(out, "{\"bench\":\"%s\",\"baseline\":\"%s\",\"current\":\"%s\",\"metrics\":[", current.bench, paths[0], paths[1]);
+
+    int regressions = 0, improvements = 0, noisy = 0, compared = 0;
+
+    printf("\n%s benchmark: %s (baseline) vs %s, default threshold %.1f%%\n\n", current.bench, paths[0], paths[1], defaultThreshold);
+    printf("%-42s %12s %12s %9s %21s  %s\n", "metric", "baseline", "current", "change", "95% interval", "verdict");
+
+    for (int i = 0; i < current.count; i++) {
+        const GateMetric *now = &current.metrics[i];
+        const GateMetric *base = find_metric(&baseline, now->id);
+        double threshold = threshold_for(now->id);
+        char change[16] = "", interval[32] = "";
+
+        if (threshold < 0) {
+            continue;
+        }
+        if (base == NULL) {
+            printf("%-42s %12s %12.4g %9s %21s  new\n", now->id, "-", median(now->samples, now->count), "", "");
+            continue;
+        }
+
+        GateDiff diff = compare_metric(base, now, threshold);
+        compared++;
+        if (strcmp(diff.verdict, "REGRESSION") == 0) regressions++;
+        if (strcmp(diff.verdict, "improved") == 0) improvements++;
+        if (strcmp(diff.verdict, "noisy") == 0) noisy++;
+
+        if (!isnan(diff.change)) snprintf(change, sizeof(change), "%+.1f%%", diff.change * 100.0);
+        if (diff.hasInterval) snprintf(interval, sizeof(interval), "[%+.1f%%, %+.1f%%]", diff.low * 100.0, diff.high * 100.0);
+        printf("%-42s %12.4g %12.4g %9s %21s  %s\n", now->id, diff.baseMedian, diff.nowMedian, change, interval, diff.verdict);
+
+        if (out != NULL) {
+            fprintf(out, "%s\n{\"id\":\"%s\",\"unit\":\"%s\",\"better\":\"%s\",\"baseline\":%.6g,\"current\":%.6g,\"threshold_pct\":%.2f,\"verdict\":\"%s\"",
+                    compared > 1 ? "," : "", now->id, now->unit, now->higherIsBetter ? "higher" : "lower", diff.baseMedian, diff.nowMedian,
+                    threshold, diff.verdict);
+            if (!isnan(diff.change)) fprintf(out, ",\"change_pct\":%.3f", diff.change * 100.0);
+            if (diff.hasInterval) fprintf(out, ",\"ci95_low_pct\":%.3f,\"ci95_high_pct\":%.3f", diff.low * 100.0, diff.high * 100.0);
+            fprintf(out, "}");
+        }
+    }
+
+    for (int i = 0; i < baseline.count; i++) {   // metrics that disappeared (a renamed or removed case)
+        if (find_metric(&current, baseline.metrics[i].id) == NULL && threshold_for(baseline.metrics[i].id) >= 0) {
+            printf("%-42s %12.4g %12s %9s %21s  missing\n", baseline.metrics[i].id,
+                   median(baseline.metrics[i].samples, baseline.metrics[i].count), "-", "", "");
+        }
+    }
+
+    printf("\n%d metrics compared: %d regression%s, %d improved, %d noisy (past the threshold, interval includes no change)\n",
+           compared, regressions, regressions == 1 ? "" : "s", improvements, noisy);
+
+    if (out != NULL) {
+        fprintf(out, "\n],\"regressions\":%d,\"improved\":%d,\"noisy\":%d}\n", regressions, improvements, noisy);
+        fclose(out);
+    }
+
+    return regressions > 0 ? 1 : 0;
+}
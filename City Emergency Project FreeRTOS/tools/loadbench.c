@@ -0,0 +1,318 @@
+/**
+******************************************************************************
+* @file           : loadbench.c
+* @author         : Nimrod Elstein
+* @brief          : End-to-end headless load benchmark of the simulator (throughput, drops, borrows, latency)
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* Every repetition is one real-time simulator process running the whole pipeline
+* (generators, eventBuffers, dispatchers, departments with borrowing, handlers):
+*
+*   posix_demo --headless --json --seed <s> --rate <r> --events <n> --time-scale <x> --duration <cap>
+*
+* The run ends when the n events are completed or dropped (--events), --duration
+* only caps the wall time. The repetitions run one after the other, never in
+* parallel, so they do not take CPU time from each other.
+*
+* Build and run with "make loadbench" (LOADBENCH_ARGS="..." for options), for example:
+*   ./build/loadbench --events 2000 --rate 40 --time-scale 100 --reps 3 --out load.json -- --districts 2
+*
+* The report: sustained events/s (completed per wall second) and the host CPU time
+* per event, drops at the eventBuffer and at each department queue, borrow and mutual
+* aid rates, and the end-to-end latency percentiles per priority (model ms). With
+* --reps, every metric is the median of the repetitions. Late wake-ups mean the
+* host did not keep up with the time scale: lower it, the latencies are not valid.
+*
+******************************************************************************
+*/
+
+#include "sim_runs.h"
+#include <sys/resource.h>
+#include <time.h>
+
+#define MAX_REPS 64
+#define MAX_EXTRA_ARGS 64
+#define MAX_METRICS 96
+#define MAX_DEPARTMENTS 8
+#define KEY_LEN 32
+
+typedef struct {   // one reported metric, one sample per repetition
+    char id[48];
+    const char *unit;
+    int higherIsBetter;   // 1 = throughput, 0 = latency, drops, CPU time
+    double samples[MAX_REPS];
+} LoadMetric;
+
+static LoadMetric metrics[MAX_METRICS];
+static int metricCount = 0;
+static int reps = 1;
+
+static void print_usage(const char *program) {
+
+    printf("usage: %s [--sim <path>] [--events <n>] [--rate <calls/min>] [--time-scale <x>] [--seed <n>] [--reps <n>]\n"
+           "          [--max-seconds <s>] [--out <file.json>] [-- simulator args]\n", program);
+    printf("  defaults: --sim ./build/posix_demo --events 2000 --rate 40 --time-scale 100 --seed 1 --reps 1 --max-seconds 55\n");
+}
+
+static LoadMetric *metric(const char *id, const char *unit, int higherIsBetter) {   // find or add
+
+    for (int i = 0; i < metricCount; i++) {
+        if (strcmp(metrics[i].id, id) == 0) return &metrics[i];
+    }
+    if (metricCount == MAX_METRICS) {
+        return NULL;
+    }
+
+    LoadMetric *m = &metrics[metricCount++];
+    snprintf(m->id, sizeof(m->id), "%s", id);
+    m->unit = unit;
+    m->higherIsBetter = higherIsBetter;
+    return m;
+}
+
+static void set_sample(const char *id, const char *unit, int higherIsBetter, int rep, double value) {
+
+    LoadMetric *m = metric(id, unit, higherIsBetter);
+    if (m != NULL) {
+        m->samples[rep] = value;
+    }
+}
+
+static int department_keys(const char *json, char keys[][KEY_LEN]) {   // "police_units":4 ... in configuration order
+
+    int count = 0;
+    const char *p = json;
+
+    while (count < MAX_DEPARTMENTS && (p = strstr(p, "_units\":")) != NULL) {
+        const char *start = p;
+        while (start > json && start[-1] != '"') start--;
+        size_t length = (size_t)(p - start);
+        if (length > 0 && length < KEY_LEN && !(length == 10 && strncmp(start, "mutual_aid", length) == 0)) {
+            memcpy(keys[count], start, length);
+            keys[count][length] = '\0';
+            count++;
+        }
+        p += 8;
+    }
+
+    return count;
+}
+
+static double ratio(double part, double whole) {
+
+    return whole > 0 ? part / whole : 0.0;
+}
+
+static void collect(int rep, const char *json, double cpuSeconds) {
+
+    char keys[MAX_DEPARTMENTS][KEY_LEN], id[64];
+    int departments = department_keys(json, keys);
+    double hz = sim_json_number(json, "tick_rate_hz");
+    double wall = sim_json_number(json, "wall_seconds");
+    double generated = sim_json_number(json, "generated");
+    double completed = sim_json_number(json, "completed");
+    double droppedBuffer = sim_json_number(json, "dropped_buffer");
+    double droppedQueue = sim_json_number(json, "dropped_queue");
+
+    set_sample("events_per_s", "events/s", 1, rep, ratio(completed, wall));
+    set_sample("generated_per_s", "events/s", 1, rep, ratio(generated, wall));
+    set_sample("cpu_us_per_event", "us", 0, rep, ratio(cpuSeconds * 1e6, generated));
+    set_sample("dropped_buffer", "events", 0, rep, droppedBuffer);
+    set_sample("dropped_queue", "events", 0, rep, droppedQueue);
+    set_sample("drop_rate", "ratio", 0, rep, ratio(droppedBuffer + droppedQueue, generated));
+    set_sample("borrow_rate", "ratio", 0, rep, ratio(sim_json_number(json, "borrowed"), completed));
+    set_sample("mutual_aid_rate", "ratio", 0, rep, ratio(sim_json_number(json, "mutual_aid_units"), completed));
+    set_sample("late_wakeups", "wakeups", 0, rep, sim_json_number(json, "late_wakeups"));
+    set_sample("max_lag_ms", "ms", 0, rep, sim_json_number(json, "max_lag_ms"));
+
+    for (int d = 0; d < departments; d++) {
+        char key[KEY_LEN + 16];
+        snprintf(key, sizeof(key), "%.31s_dropped", keys[d]);
+        snprintf(id, sizeof(id), "%.31s_dropped_queue", keys[d]);
+        set_sample(id, "events", 0, rep, sim_json_number(json, key));
+        snprintf(key, sizeof(key), "%.31s_borrowed", keys[d]);
+        double borrowed = sim_json_number(json, key);
+        snprintf(key, sizeof(key), "%.31s_completed", keys[d]);
+        snprintf(id, sizeof(id), "%.31s_borrow_rate", keys[d]);
+        set_sample(id, "ratio", 0, rep, ratio(borrowed, sim_json_number(json, key)));
+    }
+
+    for (int p = 3; p >= 1; p--) {   // model ms, ticks of the simulator's tick rate
+        static const char *levels[] = { "p50", "p95", "p99" };
+        for (int l = 0; l < 3; l++) {
+            char key[32];
+            snprintf(key, sizeof(key), "p%d_e2e_%s", p, levels[l]);
+            snprintf(id, sizeof(id), "p%d_e2e_%s_ms", p, levels[l]);
+            set_sample(id, "ms", 0, rep, sim_json_number(json, key) * 1000.0 / hz);
+        }
+    }
+}
+
+static int compare_double(const void *a, const void *b) {
+
+    return (*(const double *)a > *(const double *)b) - (*(const double *)a < *(const double *)b);
+}
+
+static double median_of(const LoadMetric *m, double *minOut, double *maxOut) {
+
+    double sorted[MAX_REPS];
+
+    memcpy(sorted, m->samples, (size_t)reps * sizeof(double));
+    qsort(sorted, (size_t)reps, sizeof(double), compare_double);
+    *minOut = sorted[0];
+    *maxOut = sorted[reps - 1];
+    return reps % 2 ? sorted[reps / 2] : (sorted[reps / 2 - 1] + sorted[reps / 2]) / 2;
+}
+
+static int write_json(const char *path, const char *sim, const char *args) {
+
+    FILE *out = fopen(path, "w");
+    if (out == NULL) {
+        return 0;
+    }
+
+    fprintf(out, "{\"bench\":\"load\",\"sim\":\"%s\",\"args\":\"%s\",\"reps\":%d,\"results\":[", sim, args, reps);
+    for (int i = 0; i < metricCount; i++) {
+        const LoadMetric *m = &metrics[i];
+        double min, max, median = median_of(m, &min, &max);
+        fprintf(out, "%s\n{\"id\":\"%s\",\"unit\":\"%s\",\"better\":\"%s\",\"median\":%.6g,\"min\":%.6g,\"max\":%.6g,\"samples\":[",
+                i > 0 ? "," : "", m->id, m->unit, m->higherIsBetter ? "higher" : "lower", median, min, max);
+        for (int r = 0; r < reps; r++) {
+            fprintf(out, "%s%.6g", r > 0 ? "," : "", m->samples[r]);
+        }
+        fprintf(out, "]}");
+    }
+    fprintf(out, "\n]}\n");
+
+    return fclose(out) == 0;
+}
+
+static double children_cpu_seconds(void) {
+
+    struct rusage usage;
+
+    getrusage(RUSAGE_CHILDREN, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+int main(int argc, char **argv) {
+
+    const char *sim = "./build/posix_demo";
+    const char *outPath = NULL;
+    const char *events = "2000", *rate = "40", *timeScale = "100", *seed = "1", *maxSeconds = "55";
+    int extraCount = 0;
+    char **extra = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            extra = &argv[i + 1];
+            extraCount = argc - i - 1;
+            if (extraCount > MAX_EXTRA_ARGS) {
+                fprintf(stderr, "error: too many simulator arguments\n");
+                return 1;
+            }
+            break;
+        } else if (strcmp(argv[i], "--sim") == 0 && i + 1 < argc) {
+            sim = argv[++i];
+        } else if (strcmp(argv[i], "--events") == 0 && i + 1 < argc) {
+            events = argv[++i];
+        } else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            rate = argv[++i];
+        } else if (strcmp(argv[i], "--time-scale") == 0 && i + 1 < argc) {
+            timeScale = argv[++i];
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = argv[++i];
+        } else if (strcmp(argv[i], "--max-seconds") == 0 && i + 1 < argc) {
+            maxSeconds = argv[++i];
+        } else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            outPath = argv[++i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (reps < 1 || reps > MAX_REPS) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    char *simArgv[16 + MAX_EXTRA_ARGS + 1];
+    int n = 0;
+    simArgv[n++] = (char *)sim;
+    simArgv[n++] = "--headless";
+    simArgv[n++] = "--json";
+    simArgv[n++] = "--seed";
+    simArgv[n++] = (char *)seed;
+    simArgv[n++] = "--rate";
+    simArgv[n++] = (char *)rate;
+    simArgv[n++] = "--events";
+    simArgv[n++] = (char *)events;
+    simArgv[n++] = "--time-scale";
+    simArgv[n++] = (char *)timeScale;
+    simArgv[n++] = "--duration";
+    simArgv[n++] = (char *)maxSeconds;
+    for (int i = 0; i < extraCount; i++) {
+        simArgv[n++] = extra[i];
+    }
+    simArgv[n] = NULL;
+
+    char args[512] = "";   // the command line in the report, to compare like with like
+    for (int i = 1; i < n; i++) {
+        snprintf(args + strlen(args), sizeof(args) - strlen(args), "%s%s", i > 1 ? " " : "", simArgv[i]);
+    }
+    fprintf(stderr, "loadbench: %d run(s) of %s %s\n", reps, sim, args);
+
+    unsigned long eventLimit = strtoul(events, NULL, 10);
+    int incomplete = 0;
+
+    for (int r = 0; r < reps; r++) {
+        SimRun run = { .argv = simArgv };
+        double cpuBefore = children_cpu_seconds();
+
+        if (sim_runs_execute(&run, 1, 1) != 0) {
+            fprintf(stderr, "loadbench: run %d failed (status %d)\n", r + 1, run.status);
+            return 1;
+        }
+        double cpu = children_cpu_seconds() - cpuBefore;
+
+        double accounted = sim_json_number(run.output, "completed") + sim_json_number(run.output, "dropped_buffer") +
+                           sim_json_number(run.output, "dropped_queue");
+        if (accounted < (double)eventLimit) {   // --events counts all the districts
+            incomplete++;   // the --max-seconds cap ended the run first
+        }
+        collect(r, run.output, cpu);
+        fprintf(stderr, "loadbench: run %d: %.0f events in %.1f s wall\n", r + 1, accounted, sim_json_number(run.output, "wall_seconds"));
+    }
+
+    printf("\n--- LOAD BENCHMARK (median of %d run%s) ---\n\n", reps, reps > 1 ? "s" : "");
+    printf("%-26s %14s %14s %14s  %s\n", "metric", "median", "min", "max", "unit");
+    for (int i = 0; i < metricCount; i++) {
+        double min, max, median = median_of(&metrics[i], &min, &max);
+        printf("%-26s %14.6g %14.6g %14.6g  %s\n", metrics[i].id, median, min, max, metrics[i].unit);
+    }
+    if (incomplete > 0) {
+        printf("\nwarning: %d run(s) hit the --max-seconds cap before the %lu events drained, lower --events or raise --time-scale\n",
+               incomplete, eventLimit);
+    }
+    double min, max;
+    if (median_of(metric("late_wakeups", "wakeups", 0), &min, &max) >= 1) {   // a single late start-up wake-up is noise
+        printf("\nwarning: late wake-ups, the host did not keep up with --time-scale %s, the latencies are stretched\n", timeScale);
+    }
+
+    if (outPath != NULL) {
+        if (!write_json(outPath, sim, args)) {
+            fprintf(stderr, "error: cannot write %s\n", outPath);
+            return 1;
+        }
+        printf("\nresults written to %s\n", outPath);
+    }
+
+    return 0;
+}
@@ -0,0 +1,447 @@
+/**
+******************************************************************************
+* @file           : planner.c
+* @author         : Nimrod Elstein
+* @brief          : Capacity planner, cheapest unit counts that meet latency targets
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* The planner searches the police / ambulance / fire unit counts (and borrowing
+* on or off) for the cheapest configuration whose end-to-end latency percentiles
+* meet the targets, for example p95 under 60 s for priority 3:
+*
+*   ./build/planner --target p3:95=60 --target p1:95=300 -- --profile profiles/storm_day.ini
+*
+* Every candidate is evaluated with --reps discrete-event runs (posix_demo --des
+* --json) using the same seeds for all candidates (common random numbers), and
+* a candidate passes when the upper end of the 95% confidence interval of every
+* target metric is under its target. The search is:
+*
+*   1. bisection on a uniform fleet (n, n, n), the smallest n that passes
+*   2. greedy descent from there, removing one unit at a time from the department
+*      that saves the most cost while all targets still pass
+*
+* The candidates of one bisection round or descent step are independent and run
+* in parallel (--jobs processes, one per core by default).
+*
+******************************************************************************
+*/
+
+#include "sim_runs.h"
+
+#define NUM_DEPARTMENTS 3
+#define MAX_TARGETS 16
+#define MAX_CANDIDATES 512     // evaluated configurations kept (cache)
+#define MAX_EXTRA_ARGS 64
+
+static const char *departments[NUM_DEPARTMENTS] = { "police", "ambulance", "fire" };   // indexed by department code - 1
+
+typedef struct {   // latency target: the pct percentile of priority's end-to-end latency under limit seconds
+    int priority;
+    int percentile;           // 50, 95 or 99
+    double limitSec;
+    char key[32];             // JSON key of the run summary, e.g. p3_e2e_p95
+} PlanTarget;
+
+typedef struct {   // mean and 95% confidence interval over the replications
+    double mean;
+    double half;              // half width of the interval
+} Estimate;
+
+typedef struct {   // one evaluated configuration
+    int units[NUM_DEPARTMENTS];
+    int borrow;
+    Estimate target[MAX_TARGETS];   // seconds
+    Estimate dropRate;
+    int pass;
+    double slack;             // smallest relative margin to a target, negative when failing
+} Candidate;
+
+static PlanTarget targets[MAX_TARGETS];
+static int targetCount = 0;
+
+static Candidate evaluated[MAX_CANDIDATES];
+static int evaluatedCount = 0;
+
+static const char *sim = "./build/posix_demo";
+static int jobs = 1;
+static int reps = 5;
+static double hours = 168;
+static double maxDropRate = 0.001;
+static unsigned long seedBase = 1;
+static double cost[NUM_DEPARTMENTS] = { 1.0, 1.0, 1.0 };
+static int extraCount = 0;
+static char **extra = NULL;
+static int simulatorRuns = 0;
+
+static void print_usage(const char *program) {
+
+    printf("usage: %s --target p<priority>:<50|95|99>=<seconds>... [options] [-- simulator args]\n\n", program);
+    printf("  --target p3:95=60  the p95 end-to-end latency of priority 3 events under 60 s\n");
+    printf("  --max-drop <rate>  highest dropped event rate (default 0.001)\n");
+    printf("  --borrow on|off|both  borrowing settings to search (default both)\n");
+    printf("  --cost police=1,ambulance=1,fire=1  cost of one unit (default 1 each)\n");
+    printf("  --max-units <n>    largest unit count per department (default 30)\n");
+    printf("  --reps <n>         replications per candidate (default 5)\n");
+    printf("  --hours <h>        simulated hours per replication (default 168)\n");
+    printf("  --seed <n>         seed of the first replication (default 1)\n");
+    printf("  --jobs <n>         parallel simulator runs (default: online cores)\n");
+    printf("  --sim <path>       simulator binary (default ./build/posix_demo)\n");
+}
+
+static int parse_target(const char *spec) {
+
+    PlanTarget *t = &targets[targetCount];
+    char extraChar;
+
+    if (targetCount == MAX_TARGETS) return 0;
+    if (sscanf(spec, "p%d:%d=%lf%c", &t->priority, &t->percentile, &t->limitSec, &extraChar) != 3) return 0;
+    if (t->priority < 1 || t->priority > 3 || t->limitSec <= 0) return 0;
+    if (t->percentile != 50 && t->percentile != 95 && t->percentile != 99) return 0;
+
+    snprintf(t->key, sizeof(t->key), "p%d_e2e_p%d", t->priority, t->percentile);
+    targetCount++;
+    return 1;
+}
+
+static int parse_cost(const char *spec) {
+
+    char copy[256], *save = NULL;
+    snprintf(copy, sizeof(copy), "%s", spec);
+
+    for (char *tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+        char *equals = strchr(tok, '=');
+        int found = 0;
+        if (equals == NULL) return 0;
+        *equals = '\0';
+        for (int d = 0; d < NUM_DEPARTMENTS; d++) {
+            if (strcmp(tok, departments[d]) == 0) {
+                cost[d] = strtod(equals + 1, NULL);
+                found = cost[d] > 0;
+            }
+        }
+        if (!found) return 0;
+    }
+
+    return 1;
+}
+
+static double student_t95(int df) {   // two sided 95% quantile of Student's t
+
+    static const double table[30] = { 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+                                      2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+                                      2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042 };
+
+    return df <= 30 ? table[df - 1] : 1.96;
+}
+
+static Estimate estimate(const double *values, int n) {
+
+    Estimate e = { 0.0, 0.0 };
+
+    for (int i = 0; i < n; i++) e.mean += values[i];
+    e.mean /= n;
+
+    if (n > 1) {
+        double ss = 0.0;
+        for (int i = 0; i < n; i++) ss += (values[i] - e.mean) * (values[i] - e.mean);
+        e.half = student_t95(n - 1) * sqrt(ss / (n - 1)) / sqrt((double)n);
+    }
+
+    return e;
+}
+
+static double config_cost(const int *units) {
+
+    double total = 0.0;
+    for (int d = 0; d < NUM_DEPARTMENTS; d++) total += units[d] * cost[d];
+    return total;
+}
+
+static Candidate *find_evaluated(const int *units, int borrow) {
+
+    for (int c = 0; c < evaluatedCount; c++) {
+        if (evaluated[c].borrow == borrow && memcmp(evaluated[c].units, units, sizeof(evaluated[c].units)) == 0) return &evaluated[c];
+    }
+    return NULL;
+}
+
+static char **build_argv(const int *units, int borrow, int rep) {
+
+    static char options[NUM_DEPARTMENTS][16];
+    int slots = 15 + extraCount;   // 14 arguments at most, then NULL
+    char **argv = calloc(1, (size_t)slots * sizeof(char *) + 5 * 24);   // the option values live behind the pointers, one free()
+    char (*numbers)[24];
+    int argc = 0;
+
+    if (argv == NULL) return NULL;
+    numbers = (char (*)[24])(argv + slots);
+
+    argv[argc++] = (char *)sim;
+    argv[argc++] = "--des";
+    argv[argc++] = "--json";
+    for (int d = 0; d < NUM_DEPARTMENTS; d++) {
+        snprintf(options[d], sizeof(options[d]), "--%s", departments[d]);
+        snprintf(numbers[d], sizeof(numbers[d]), "%d", units[d]);
+        argv[argc++] = options[d];
+        argv[argc++] = numbers[d];
+    }
+    snprintf(numbers[3], sizeof(numbers[3]), "%lu", seedBase + (unsigned long)rep);   // the same seeds for every candidate
+    argv[argc++] = "--seed";
+    argv[argc++] = numbers[3];
+    snprintf(numbers[4], sizeof(numbers[4]), "%g", hours);
+    argv[argc++] = "--sim-hours";
+    argv[argc++] = numbers[4];
+    if (!borrow) argv[argc++] = "--no-borrow";
+    for (int i = 0; i < extraCount; i++) {
+        argv[argc++] = extra[i];
+    }
+    argv[argc] = NULL;
+
+    return argv;
+}
+
+static void print_candidate(const char *tag, const Candidate *c) {
+
+    fprintf(stderr, "%s police=%d ambulance=%d fire=%d borrow=%s cost=%g:", tag, c->units[0], c->units[1], c->units[2],
+            c->borrow ? "on" : "off", config_cost(c->units));
+    for (int t = 0; t < targetCount; t++) {
+        fprintf(stderr, " p%d/p%d %.1f+-%.1f s", targets[t].priority, targets[t].percentile, c->target[t].mean, c->target[t].half);
+    }
+    fprintf(stderr, " drop %.4f %s\n", c->dropRate.mean, c->pass ? "PASS" : "fail");
+}
+
+static int evaluate_batch(int (*units)[NUM_DEPARTMENTS], int borrow, int count, Candidate **out) {   // all candidates x replications in one pool
+
+    SimRun *runs = calloc((size_t)(count * reps), sizeof(SimRun));
+    int todo[MAX_CANDIDATES];
+    int todoCount = 0;
+
+    if (runs == NULL) return 0;
+
+    for (int i = 0; i < count; i++) {
+        out[i] = find_evaluated(units[i], borrow);
+        if (out[i] != NULL) continue;   // the bisection and the descent meet at the same points
+        if (evaluatedCount + todoCount >= MAX_CANDIDATES) break;
+        for (int r = 0; r < reps; r++) {
+            runs[todoCount * reps + r].argv = build_argv(units[i], borrow, r);
+        }
+        todo[todoCount++] = i;
+    }
+
+    int failed = todoCount ? sim_runs_execute(runs, todoCount * reps, jobs) : 0;
+    simulatorRuns += todoCount * reps;
+
+    for (int k = 0; k < todoCount && failed == 0; k++) {
+
+        Candidate *c = &evaluated[evaluatedCount++];
+        double values[reps];
+
+        memset(c, 0, sizeof(*c));
+        memcpy(c->units, units[todo[k]], sizeof(c->units));
+        c->borrow = borrow;
+        c->pass = 1;
+        c->slack = INFINITY;
+
+        for (int t = 0; t < targetCount; t++) {
+            for (int r = 0; r < reps; r++) {
+                const char *json = runs[k * reps + r].output;
+                values[r] = sim_json_number(json, targets[t].key) / sim_json_number(json, "tick_rate_hz");
+            }
+            c->target[t] = estimate(values, reps);
+            double upper = c->target[t].mean + c->target[t].half;   // pass on the whole confidence interval
+            double slack = (targets[t].limitSec - upper) / targets[t].limitSec;
+            if (slack < c->slack) c->slack = slack;
+            if (!(upper <= targets[t].limitSec)) c->pass = 0;   // NaN (missing key) fails too
+        }
+
+        for (int r = 0; r < reps; r++) {
+            values[r] = sim_json_number(runs[k * reps + r].output, "drop_rate");
+        }
+        c->dropRate = estimate(values, reps);
+        if (!(c->dropRate.mean + c->dropRate.half <= maxDropRate)) c->pass = 0;
+
+        out[todo[k]] = c;
+        print_candidate("planner:", c);
+    }
+
+    for (int i = 0; i < todoCount * reps; i++) {
+        if (runs[i].status != 0) fprintf(stderr, "planner: simulator run failed (status %d): %s\n", runs[i].status, runs[i].output);
+        free(runs[i].argv);
+    }
+    free(runs);
+
+    for (int i = 0; i < count; i++) {
+        if (out[i] == NULL) return 0;
+    }
+    return 1;
+}
+
+static Candidate *search(int borrow, int maxUnits) {
+
+    int points[MAX_CANDIDATES][NUM_DEPARTMENTS];
+    Candidate *results[MAX_CANDIDATES];
+    int width = jobs / reps > 1 ? jobs / reps : 1;   // candidates per round, enough to keep every core busy
+
+    fprintf(stderr, "planner: borrowing %s, bisection on a uniform fleet\n", borrow ? "on" : "off");
+
+    for (int d = 0; d < NUM_DEPARTMENTS; d++) points[0][d] = maxUnits;
+    if (!evaluate_batch(points, borrow, 1, results)) return NULL;
+    if (!results[0]->pass) {
+        fprintf(stderr, "planner: %d units per department do not meet the targets\n", maxUnits);
+        return NULL;
+    }
+
+    int lo = 0, hi = maxUnits;   // lo fails (0 units can not serve), hi passes
+    Candidate *best = results[0];
+
+    while (hi - lo > 1) {   // (width + 1)-ary search, the round's points run in parallel
+
+        int count = 0;
+        for (int k = 1; k <= width && count < hi - lo - 1; k++) {
+            int n = lo + (int)((double)(hi - lo) * k / (width + 1) + 0.5);
+            if (n <= lo || n >= hi || (count > 0 && n == points[count - 1][0])) continue;
+            for (int d = 0; d < NUM_DEPARTMENTS; d++) points[count][d] = n;
+            count++;
+        }
+        if (count == 0) {
+            for (int d = 0; d < NUM_DEPARTMENTS; d++) points[0][d] = lo + 1;
+            count = 1;
+        }
+
+        if (!evaluate_batch(points, borrow, count, results)) return NULL;
+
+        for (int i = 0; i < count; i++) {   // points are increasing
+            if (results[i]->pass) {
+                hi = points[i][0];
+                best = results[i];
+                break;
+            }
+            lo = points[i][0];
+        }
+    }
+
+    fprintf(stderr, "planner: borrowing %s, greedy descent from %d units each\n", borrow ? "on" : "off", hi);
+
+    while (1) {   // remove one unit from one department per step
+
+        int count = 0;
+        for (int d = 0; d < NUM_DEPARTMENTS; d++) {
+            if (best->units[d] <= 1) continue;
+            memcpy(points[count], best->units, sizeof(points[count]));
+            points[count][d]--;
+            count++;
+        }
+        if (count == 0 || !evaluate_batch(points, borrow, count, results)) break;
+
+        Candidate *next = NULL;
+        for (int i = 0; i < count; i++) {   // cheapest passing candidate, the larger margin on a tie
+            if (!results[i]->pass) continue;
+            if (next == NULL || config_cost(results[i]->units) < config_cost(next->units) ||
+                (config_cost(results[i]->units) == config_cost(next->units) && results[i]->slack > next->slack)) {
+                next = results[i];
+            }
+        }
+        if (next == NULL) break;   // every single unit removal misses a target
+        best = next;
+    }
+
+    return best;
+}
+
+static void print_plan(const char *title, const Candidate *c) {
+
+    printf("%s\n", title);
+    printf("  police %d, ambulance %d, fire %d, borrowing %s, cost %g\n", c->units[0], c->units[1], c->units[2],
+           c->borrow ? "on" : "off", config_cost(c->units));
+    for (int t = 0; t < targetCount; t++) {
+        printf("  priority %d p%d: %8.1f s  95%% CI [%.1f, %.1f]  target %.1f s\n", targets[t].priority, targets[t].percentile,
+               c->target[t].mean, c->target[t].mean - c->target[t].half, c->target[t].mean + c->target[t].half, targets[t].limitSec);
+    }
+    printf("  drop rate:   %.5f  95%% CI [%.5f, %.5f]  max %.5f\n", c->dropRate.mean, c->dropRate.mean - c->dropRate.half,
+           c->dropRate.mean + c->dropRate.half, maxDropRate);
+}
+
+int main(int argc, char **argv) {
+
+    int maxUnits = 30;
+    int borrowFrom = 0, borrowTo = 1;   // both settings
+
+    jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            extra = &argv[i + 1];
+            extraCount = argc - i - 1;
+            if (extraCount > MAX_EXTRA_ARGS) {
+                fprintf(stderr, "error: too many simulator arguments\n");
+                return 1;
+            }
+            break;
+        } else if (strcmp(argv[i], "--target") == 0 && i + 1 < argc) {
+            if (!parse_target(argv[++i])) {
+                fprintf(stderr, "error: bad --target '%s'\n", argv[i]);
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--cost") == 0 && i + 1 < argc) {
+            if (!parse_cost(argv[++i])) {
+                fprintf(stderr, "error: bad --cost '%s'\n", argv[i]);
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--borrow") == 0 && i + 1 < argc) {
+            i++;
+            borrowFrom = strcmp(argv[i], "on") == 0;
+            borrowTo = strcmp(argv[i], "off") != 0;
+        } else if (strcmp(argv[i], "--max-drop") == 0 && i + 1 < argc) {
+            maxDropRate = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--max-units") == 0 && i + 1 < argc) {
+            maxUnits = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--reps") == 0 && i + 1 < argc) {
+            reps = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--hours") == 0 && i + 1 < argc) {
+            hours = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seedBase = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--sim") == 0 && i + 1 < argc) {
+            sim = argv[++i];
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (targetCount == 0 || reps < 1 || jobs < 1 || maxUnits < 1 || hours <= 0) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    Candidate *best = NULL;
+
+    for (int borrow = borrowFrom; borrow <= borrowTo; borrow++) {
+
+        Candidate *plan = search(borrow, maxUnits);
+        if (plan == NULL) continue;
+
+        print_plan(borrow ? "Borrowing on:" : "Borrowing off:", plan);
+        if (best == NULL || config_cost(plan->units) < config_cost(best->units)) best = plan;
+    }
+
+    if (best == NULL) {
+        printf("No configuration up to %d units per department meets the targets\n", maxUnits);
+        return 2;
+    }
+
+    printf("\nCheapest: police %d, ambulance %d, fire %d, borrowing %s (cost %g)\n", best->units[0], best->units[1],
+           best->units[2], best->borrow ? "on" : "off", config_cost(best->units));
+    printf("%d candidates, %d simulator runs of %g h, %d replications each (seeds %lu..%lu)\n", evaluatedCount,
+           simulatorRuns, hours, reps, seedBase, seedBase + (unsigned long)reps - 1);
+
+    return 0;
+}
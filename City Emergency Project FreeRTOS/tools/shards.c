@@ -0,0 +1,385 @@
+/**
+******************************************************************************
+* @file           : shards.c
+* @author         : Nimrod Elstein
+* @brief          : Multi-process launcher, one simulator process (shard) per core
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* The FreeRTOS POSIX port runs one task at a time, so one simulator uses one core.
+* The launcher splits the city into --shards processes, each pinned to its own core
+* and running its own district(s) of the city. The shards lend units to each other
+* (mutual aid) and publish their metrics through a shared memory link
+* (myProject/shard_link.h); the launcher prints the merged city summary.
+*
+* Build with "make shards", for example:
+*   ./build/shards --shards 4 -- --time-scale 50 --duration 60 --seed 1
+*
+* Arguments after "--" go to every shard. Shards run in real time (optionally
+* time-scaled), a --des run simulates a whole city in one process (--districts).
+*
+******************************************************************************
+*/
+
+#define _GNU_SOURCE
+#include "shard_link.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MAX_EXTRA_ARGS 64
+#define TICK_RATE_HZ 1000   // configTICK_RATE_HZ of the simulator, checked by every shard when it attaches
+
+typedef struct {   // one shard process
+    pid_t pid;
+    int cpu;
+    int status;    // exit status, -1 while running
+} Shard;
+
+static void print_usage(const char *program) {
+
+    printf("usage: %s --shards <n> [--cpus <list>] [--sim <path>] [--logs <dir>] [--interval <s>] [--json] [-- simulator args]\n", program);
+    printf("  --shards <n>    simulator processes, 2 to %d (one district each, mutual aid between them)\n", SHARD_MAX);
+    printf("  --cpus <list>   cores to pin the shards to, e.g. 0,2,4,6 (default: shard i on core i)\n");
+    printf("  --logs <dir>    keep each shard's run summary in <dir>/shard<i>.txt (default: discarded)\n");
+    printf("  --interval <s>  progress line period in seconds, 0 = none (default 1)\n");
+}
+
+static ShardLink *link_create(const char *name, int shards) {
+
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0) {
+        perror("shard link: shm_open");
+        return NULL;
+    }
+
+    if (ftruncate(fd, sizeof(ShardLink)) != 0) {
+        perror("shard link: ftruncate");
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    void *mapping = mmap(NULL, sizeof(ShardLink), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        perror("shard link: mmap");
+        shm_unlink(name);
+        return NULL;
+    }
+
+    ShardLink *link = (ShardLink *)mapping;   // a new object is zero filled: empty rings, zero metrics
+    link->version = SHARD_LINK_VERSION;
+    link->shardCount = (uint32_t)shards;
+    link->tickRateHz = TICK_RATE_HZ;
+    __atomic_store_n(&link->magic, SHARD_LINK_MAGIC, __ATOMIC_RELEASE);   // last, the shards check it
+
+    return link;
+}
+
+static int parse_cpus(const char *list, int *cpus, int max) {
+
+    int count = 0;
+    char *end = NULL;
+
+    for (const char *p = list; *p != '\0' && count < max; p = *end == ',' ? end + 1 : end) {
+        long cpu = strtol(p, &end, 10);
+        if (end == p || cpu < 0 || cpu >= CPU_SETSIZE || (*end != ',' && *end != '\0')) return 0;
+        cpus[count++] = (int)cpu;
+    }
+
+    return count;
+}
+
+static pid_t start_shard(int index, int count, int cpu, const char *sim, const char *linkName, const char *logDir,
+                         const char *seed, int extraCount, char **extra) {
+
+    char shardArg[16];
+    char *argv[MAX_EXTRA_ARGS + 12];
+    int n = 0;
+
+    snprintf(shardArg, sizeof(shardArg), "%d/%d", index, count);
+
+    argv[n++] = (char *)sim;
+    argv[n++] = "--headless";
+    argv[n++] = "--shard";
+    argv[n++] = shardArg;
+    argv[n++] = "--shard-link";
+    argv[n++] = (char *)linkName;
+    if (seed != NULL) {   // the same master seed everywhere, every shard draws its own district streams from it
+        argv[n++] = "--seed";
+        argv[n++] = (char *)seed;
+    }
+    for (int i = 0; i < extraCount; i++) {
+        argv[n++] = extra[i];
+    }
+    argv[n] = NULL;
+
+    pid_t pid = fork();
+    if (pid != 0) {
+        return pid;
+    }
+
+    signal(SIGINT, SIG_DFL);   // the launcher ignores Ctrl-C, the shards stop on it
+
+    cpu_set_t set;   // child: pin to the core, the FreeRTOS task threads created later inherit it
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        fprintf(stderr, "shard %d: cannot pin to core %d: %s\n", index, cpu, strerror(errno));
+    }
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/shard%d.txt", logDir != NULL ? logDir : "", index);
+    int out = open(logDir != NULL ? path : "/dev/null", O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (out >= 0) {   // the run summary of the shard, stderr stays on the terminal
+        dup2(out, STDOUT_FILENO);
+        close(out);
+    }
+    int in = open("/dev/null", O_RDONLY);   // no console commands, the shards share the terminal
+    if (in >= 0) {
+        dup2(in, STDIN_FILENO);
+        close(in);
+    }
+
+    execv(sim, argv);
+    fprintf(stderr, "cannot run %s: %s\n", sim, strerror(errno));
+    _exit(127);
+}
+
+static void merge_metrics(const ShardLink *link, int count, ShardMetrics *shards, ShardMetrics *city) {
+
+    memset(city, 0, sizeof(*city));
+
+    for (int i = 0; i < count; i++) {
+
+        ShardMetrics *m = &shards[i];
+        shard_metrics_read(&link->shards[i], m, 0);
+
+        city->simTicks = m->simTicks > city->simTicks ? m->simTicks : city->simTicks;
+        city->generated += m->generated;
+        city->dispatched += m->dispatched;
+        city->completed += m->completed;
+        city->droppedBuffer += m->droppedBuffer;
+        city->droppedQueue += m->droppedQueue;
+        city->borrowed += m->borrowed;
+        city->delayed += m->delayed;
+        city->aidLent += m->aidLent;
+        city->aidReceived += m->aidReceived;
+        city->aidDenied += m->aidDenied;
+        for (int b = 0; b < SHARD_HIST_BUCKETS; b++) {   // the histograms share their buckets, merging is a sum
+            city->endToEnd.counts[b] += m->endToEnd.counts[b];
+        }
+        city->endToEnd.total += m->endToEnd.total;
+        city->endToEnd.sum += m->endToEnd.sum;
+        if (m->endToEnd.max > city->endToEnd.max) city->endToEnd.max = m->endToEnd.max;
+    }
+}
+
+static double elapsed_s(const struct timespec *start) {
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static void print_summary(const ShardMetrics *shards, int count, const ShardMetrics *city, const int *cpus, double wall, int json) {
+
+    double simSeconds = (double)city->simTicks / TICK_RATE_HZ;
+    const ShardHistogram *e2e = &city->endToEnd;
+
+    if (json) {
+        printf("{\"mode\":\"shards\",\"shards\":%d,\"sim_seconds\":%.1f,\"wall_seconds\":%.2f", count, simSeconds, wall);
+        printf(",\"generated\":%lu,\"dispatched\":%lu,\"completed\":%lu,\"throughput_per_s\":%.4f",
+               (unsigned long)city->generated, (unsigned long)city->dispatched, (unsigned long)city->completed,
+               simSeconds > 0 ? city->completed / simSeconds : 0.0);
+        printf(",\"dropped_buffer\":%lu,\"dropped_queue\":%lu,\"borrowed\":%lu,\"delayed\":%lu",
+               (unsigned long)city->droppedBuffer, (unsigned long)city->droppedQueue, (unsigned long)city->borrowed, (unsigned long)city->delayed);
+        printf(",\"mutual_aid_units\":%lu,\"mutual_aid_denied\":%lu", (unsigned long)city->aidReceived, (unsigned long)city->aidDenied);
+        printf(",\"e2e_count\":%lu,\"e2e_mean\":%.1f,\"e2e_p50\":%u,\"e2e_p95\":%u,\"e2e_p99\":%u,\"e2e_max\":%u",
+               (unsigned long)e2e->total, e2e->total ? (double)e2e->sum / e2e->total : 0.0, shard_histogram_percentile(e2e, 50.0),
+               shard_histogram_percentile(e2e, 95.0), shard_histogram_percentile(e2e, 99.0), e2e->max);
+        for (int i = 0; i < count; i++) {
+            printf(",\"s%d_cpu\":%d,\"s%d_generated\":%lu,\"s%d_completed\":%lu,\"s%d_aid_lent\":%lu,\"s%d_aid_received\":%lu",
+                   i, cpus[i], i, (unsigned long)shards[i].generated, i, (unsigned long)shards[i].completed,
+                   i, (unsigned long)shards[i].aidLent, i, (unsigned long)shards[i].aidReceived);
+        }
+        printf("}\n");
+        return;
+    }
+
+    printf("\n--- CITY SUMMARY (%d shards) ---\n\n", count);
+    printf("Model time:         %.1f s in %.2f s wall time\n", simSeconds, wall);
+    printf("Events generated:   %lu\n", (unsigned long)city->generated);
+    printf("Events completed:   %lu (%.2f events/s model time, %.1f events/s wall time)\n", (unsigned long)city->completed,
+           simSeconds > 0 ? city->completed / simSeconds : 0.0, wall > 0 ? city->completed / wall : 0.0);
+    printf("Dropped (buffer):   %lu\n", (unsigned long)city->droppedBuffer);
+    printf("Dropped (queues):   %lu\n", (unsigned long)city->droppedQueue);
+    printf("Borrowed resources: %lu\n", (unsigned long)city->borrowed);
+    printf("Delayed (no units): %lu\n", (unsigned long)city->delayed);
+    printf("Mutual aid:         %lu units lent across shards, %lu requests denied or timed out\n",
+           (unsigned long)city->aidReceived, (unsigned long)city->aidDenied);
+    printf("End-to-end (ticks): p50 %u  p95 %u  p99 %u  max %u\n\n", shard_histogram_percentile(e2e, 50.0),
+           shard_histogram_percentile(e2e, 95.0), shard_histogram_percentile(e2e, 99.0), e2e->max);
+
+    printf("%-6s %4s %8s %10s %10s %9s %9s\n", "Shard", "cpu", "pid", "generated", "completed", "aid lent", "aid recv");
+    for (int i = 0; i < count; i++) {
+        printf("%-6d %4d %8u %10lu %10lu %9lu %9lu\n", i, cpus[i], shards[i].pid, (unsigned long)shards[i].generated,
+               (unsigned long)shards[i].completed, (unsigned long)shards[i].aidLent, (unsigned long)shards[i].aidReceived);
+    }
+}
+
+int main(int argc, char **argv) {
+
+    const char *sim = "./build/posix_demo";
+    const char *logDir = NULL;
+    const char *cpuList = NULL;
+    int count = 0, json = 0;
+    double interval = 1.0;
+    int extraCount = 0;
+    char **extra = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            extra = &argv[i + 1];
+            extraCount = argc - i - 1;
+            if (extraCount > MAX_EXTRA_ARGS) {
+                fprintf(stderr, "error: too many simulator arguments\n");
+                return 1;
+            }
+            break;
+        } else if (strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+            count = (int)strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--cpus") == 0 && i + 1 < argc) {
+            cpuList = argv[++i];
+        } else if (strcmp(argv[i], "--sim") == 0 && i + 1 < argc) {
+            sim = argv[++i];
+        } else if (strcmp(argv[i], "--logs") == 0 && i + 1 < argc) {
+            logDir = argv[++i];
+        } else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+            interval = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = 1;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (count < 2 || count > SHARD_MAX) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    int cpus[SHARD_MAX];
+    long online = sysconf(_SC_NPROCESSORS_ONLN);
+    int cpuCount = cpuList != NULL ? parse_cpus(cpuList, cpus, SHARD_MAX) : 0;
+    if (cpuList != NULL && cpuCount == 0) {
+        fprintf(stderr, "error: bad --cpus '%s'\n", cpuList);
+        return 1;
+    }
+    for (int i = cpuCount; i < count; i++) {   // default and short lists: the next cores in order
+        cpus[i] = cpuCount > 0 ? cpus[i % cpuCount] : (int)(i % (online > 0 ? online : 1));
+    }
+    if (online > 0 && online < count) {
+        fprintf(stderr, "shards: %d shards on %ld cores, the shards share cores\n", count, online);
+    }
+
+    const char *seed = NULL;   // one seed for the whole city, unless the simulator arguments give it
+    char seedText[24];
+    for (int i = 0; i < extraCount; i++) {
+        if (strcmp(extra[i], "--seed") == 0) seed = "";
+    }
+    if (seed == NULL) {
+        snprintf(seedText, sizeof(seedText), "%lu", (unsigned long)time(NULL));
+        seed = seedText;
+        fprintf(stderr, "shards: seed %s\n", seed);
+    } else {
+        seed = NULL;   // given with the simulator arguments
+    }
+
+    char linkName[64];
+    snprintf(linkName, sizeof(linkName), "%s.%ld", SHARD_LINK_NAME, (long)getpid());
+    ShardLink *link = link_create(linkName, count);
+    if (link == NULL) {
+        return 1;
+    }
+
+    signal(SIGINT, SIG_IGN);   // Ctrl-C stops the shards (same terminal), the launcher stays to print the summary
+
+    Shard shards[SHARD_MAX];
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int i = 0; i < count; i++) {
+        shards[i].cpu = cpus[i];
+        shards[i].status = -1;
+        shards[i].pid = start_shard(i, count, cpus[i], sim, linkName, logDir, seed, extraCount, extra);
+        if (shards[i].pid < 0) {
+            perror("fork");
+            for (int j = 0; j < i; j++) kill(shards[j].pid, SIGTERM);
+            shm_unlink(linkName);
+            return 1;
+        }
+    }
+    fprintf(stderr, "shards: %d shards started, link %s\n", count, linkName);
+
+    int running = count;
+    double nextProgress = interval;
+    ShardMetrics perShard[SHARD_MAX], city;
+
+    while (running > 0) {
+
+        int status;
+        pid_t pid = waitpid(-1, &status, WNOHANG);
+
+        if (pid > 0) {
+            for (int i = 0; i < count; i++) {
+                if (shards[i].pid != pid) continue;
+                shards[i].status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+                running--;
+            }
+            continue;
+        }
+        if (pid < 0 && errno != EINTR) {
+            break;
+        }
+
+        double wall = elapsed_s(&start);
+        if (interval > 0 && wall >= nextProgress) {   // live line from the shared metrics, no IPC round-trip
+            merge_metrics(link, count, perShard, &city);
+            fprintf(stderr, "shards: %6.1f s  model %8.1f s  completed %9lu  aid %7lu  running %d\n", wall,
+                    (double)city.simTicks / TICK_RATE_HZ, (unsigned long)city.completed, (unsigned long)city.aidReceived, running);
+            nextProgress += interval;
+        }
+
+        usleep(10000);
+    }
+
+    double wall = elapsed_s(&start);
+    int failed = 0;
+    for (int i = 0; i < count; i++) {
+        if (shards[i].status != 0) {
+            fprintf(stderr, "shards: shard %d exited with status %d\n", i, shards[i].status);
+            failed++;
+        }
+    }
+
+    merge_metrics(link, count, perShard, &city);
+    print_summary(perShard, count, &city, cpus, wall, json);
+
+    munmap(link, sizeof(ShardLink));
+    shm_unlink(linkName);
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,165 @@
+/**
+******************************************************************************
+* @file           : sim_runs.h
+* @author         : Nimrod Elstein
+* @brief          : Process pool of simulator runs, shared by the sweep and planner tools
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* Every run is an independent simulator process (posix_demo --des --json ...),
+* at most "jobs" of them at a time. The pool reads the children's stdout pipes
+* with poll() and keeps each one's output (the one line JSON run summary).
+* Header only, the tools are single file programs.
+*
+******************************************************************************
+*/
+
+#ifndef SIM_RUNS_H
+#define SIM_RUNS_H
+
+#include <errno.h>
+#include <math.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define SIM_OUTPUT_LEN 8192   // a JSON run summary is a few KB
+
+typedef struct {   // one simulator run
+    char **argv;                   // command line, argv[0] is the simulator path, NULL terminated
+    pid_t pid;
+    int fd;                        // read end of the child's stdout
+    size_t length;
+    char output[SIM_OUTPUT_LEN];
+    int status;                    // exit status, 0 = JSON summary received
+} SimRun;
+
+static inline int sim_run_start(SimRun *run) {
+
+    int fds[2];
+
+    if (pipe(fds) != 0) return 0;
+
+    pid_t pid = fork();
+    if (pid == 0) {   // child: stdout to the pipe, stderr stays on the terminal
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execv(run->argv[0], run->argv);
+        fprintf(stderr, "cannot run %s: %s\n", run->argv[0], strerror(errno));
+        _exit(127);
+    }
+
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return 0;
+    }
+
+    run->pid = pid;
+    run->fd = fds[0];
+    run->length = 0;
+    run->output[0] = '\0';
+    run->status = -1;
+    return 1;
+}
+
+/**
+ * @brief Runs the simulator command lines, at most jobs at a time
+ * @param runs  the runs, argv set by the caller
+ * @param count number of runs
+ * @param jobs  maximum number of runs in parallel
+ * @return number of failed runs (non zero exit or no JSON summary), -1 on a fork/poll error
+ */
+static inline int sim_runs_execute(SimRun *runs, int count, int jobs) {
+
+    struct pollfd *fds = calloc((size_t)jobs, sizeof(struct pollfd));
+    int *active = calloc((size_t)jobs, sizeof(int));   // run index per pool slot
+    int next = 0, running = 0, done = 0, failed = 0;
+
+    if (fds == NULL || active == NULL) {
+        free(fds);
+        free(active);
+        return -1;
+    }
+
+    while (done < count) {
+
+        while (running < jobs && next < count) {   // fill the pool
+            if (!sim_run_start(&runs[next])) {
+                perror("fork");
+                failed = -1;
+                goto out;
+            }
+            active[running] = next;
+            fds[running].fd = runs[next].fd;
+            fds[running].events = POLLIN;
+            running++;
+            next++;
+        }
+
+        if (poll(fds, (nfds_t)running, -1) < 0) {
+            if (errno == EINTR) continue;
+            perror("poll");
+            failed = -1;
+            goto out;
+        }
+
+        for (int slot = 0; slot < running; slot++) {
+
+            if (fds[slot].revents == 0) continue;
+
+            SimRun *run = &runs[active[slot]];
+            size_t room = SIM_OUTPUT_LEN - 1 - run->length;
+            char discard[1024];
+            ssize_t n = room > 0 ? read(run->fd, run->output + run->length, room) : read(run->fd, discard, sizeof(discard));
+
+            if (n > 0) {
+                if (room > 0) run->length += (size_t)n;
+                run->output[run->length] = '\0';
+                continue;
+            }
+
+            int status;   // end of output, collect the process
+            close(run->fd);
+            waitpid(run->pid, &status, 0);
+            run->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+            if (run->status == 0 && strchr(run->output, '{') == NULL) run->status = 1;   // no JSON summary
+            if (run->status != 0) failed++;
+            done++;
+
+            running--;   // move the last slot into this one
+            active[slot] = active[running];
+            fds[slot] = fds[running];
+            slot--;
+        }
+    }
+
+out:
+    free(fds);
+    free(active);
+    return failed;
+}
+
+/**
+ * @brief Looks up a value of a flat one line JSON object ({"key":value,...})
+ * @param json the JSON text
+ * @param key  the key
+ * @return the numeric value, NAN when the key is missing
+ */
+static inline double sim_json_number(const char *json, const char *key) {
+
+    char pattern[80];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+
+    const char *found = strstr(json, pattern);
+    return found ? strtod(found + strlen(pattern), NULL) : NAN;
+}
+
+#endif // SIM_RUNS_H
@@ -0,0 +1,152 @@
+/**
+******************************************************************************
+* @file           : status_reader.c
+* @author         : Nimrod Elstein
+* @brief          : Command line reader for the shared memory status page
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* Build with "make status_reader", run while the simulator runs with --status-page:
+*   ./build/status_reader                 print the page once
+*   ./build/status_reader --watch 200     print the page every 200 ms
+*   ./build/status_reader --json          print the page as one JSON object per line
+*
+******************************************************************************
+*/
+
+#include "status_page.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+static void print_usage(const char *program) {
+
+    printf("usage: %s [--name <shm name>] [--watch <ms>] [--json]\n", program);
+}
+
+static void print_text(const StatusPage *page) {
+
+    printf("tick %llu (%u Hz), update %llu\n", (unsigned long long)page->tickCount, page->tickRateHz,
+           (unsigned long long)page->publishCount);
+    printf("pending %u, generated %llu, dispatched %llu, dropped (buffer) %llu\n", page->pendingEvents,
+           (unsigned long long)page->generated, (unsigned long long)page->dispatched,
+           (unsigned long long)page->droppedBuffer);
+
+    printf("%-16s %5s %5s %5s %9s %9s %8s %8s %8s %8s %8s\n", "department", "units", "free", "queue",
+           "handled", "completed", "borrowed", "delayed", "dropped", "p95", "max");
+    for (uint32_t d = 0; d < page->departmentCount && d < STATUS_PAGE_MAX_DEPARTMENTS; d++) {
+        const StatusPageDepartment *dept = &page->departments[d];
+        printf("%-16.16s %5u %5u %5u %9llu %9llu %8llu %8llu %8llu %8u %8u\n", dept->name, dept->totalUnits,
+               dept->freeUnits, dept->queueDepth, (unsigned long long)dept->handled,
+               (unsigned long long)dept->completed, (unsigned long long)dept->borrowed,
+               (unsigned long long)dept->delayed, (unsigned long long)dept->dropped, dept->endToEnd.p95,
+               dept->endToEnd.max);
+    }
+
+    for (int p = STATUS_PAGE_PRIORITIES; p >= 1; p--) {
+        const StatusPageLatency *lat = &page->endToEndByPriority[p - 1];
+        printf("priority %d end-to-end (ticks): p50 %u, p95 %u, p99 %u, max %u\n", p, lat->p50, lat->p95,
+               lat->p99, lat->max);
+    }
+}
+
+static void print_latency_json(const StatusPageLatency *lat) {
+
+    printf("{\"p50\":%u,\"p95\":%u,\"p99\":%u,\"max\":%u}", lat->p50, lat->p95, lat->p99, lat->max);
+}
+
+static void print_json(const StatusPage *page) {
+
+    printf("{\"tick\":%llu,\"tickRateHz\":%u,\"update\":%llu,\"pending\":%u,\"generated\":%llu,"
+           "\"dispatched\":%llu,\"droppedBuffer\":%llu,\"departments\":[",
+           (unsigned long long)page->tickCount, page->tickRateHz, (unsigned long long)page->publishCount,
+           page->pendingEvents, (unsigned long long)page->generated, (unsigned long long)page->dispatched,
+           (unsigned long long)page->droppedBuffer);
+
+    for (uint32_t d = 0; d < page->departmentCount && d < STATUS_PAGE_MAX_DEPARTMENTS; d++) {
+        const StatusPageDepartment *dept = &page->departments[d];
+        printf("%s{\"name\":\"%.*s\",\"units\":%u,\"free\":%u,\"queue\":%u,\"handled\":%llu,\"completed\":%llu,"
+               "\"borrowed\":%llu,\"delayed\":%llu,\"dropped\":%llu,\"endToEnd\":",
+               d ? "," : "", (int)sizeof(dept->name), dept->name, dept->totalUnits, dept->freeUnits,
+               dept->queueDepth, (unsigned long long)dept->handled, (unsigned long long)dept->completed,
+               (unsigned long long)dept->borrowed, (unsigned long long)dept->delayed,
+               (unsigned long long)dept->dropped);
+        print_latency_json(&dept->endToEnd);
+        printf("}");
+    }
+
+    printf("],\"endToEndByPriority\":[");
+    for (int p = 0; p < STATUS_PAGE_PRIORITIES; p++) {
+        printf("%s", p ? "," : "");
+        print_latency_json(&page->endToEndByPriority[p]);
+    }
+    printf("]}\n");
+}
+
+int main(int argc, char **argv) {
+
+    const char *name = STATUS_PAGE_NAME;
+    long watchMs = 0;
+    int json = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--name") == 0 && i + 1 < argc) {
+            name = argv[++i];
+        } else if (strcmp(argv[i], "--watch") == 0 && i + 1 < argc) {
+            watchMs = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = 1;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "error: cannot open status page %s (is the simulator running with --status-page?)\n", name);
+        return 1;
+    }
+
+    const StatusPage *page = mmap(NULL, sizeof(StatusPage), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (page == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    if (page->magic != STATUS_PAGE_MAGIC || page->version != STATUS_PAGE_VERSION) {
+        fprintf(stderr, "error: %s is not a version %d status page\n", name, STATUS_PAGE_VERSION);
+        return 1;
+    }
+
+    do {
+        StatusPage copy;
+
+        if (!status_page_read(page, &copy, 1000)) {   // the writer section is a few microseconds, this is a stuck writer
+            fprintf(stderr, "error: no consistent status page after 1000 attempts\n");
+            return 1;
+        }
+
+        if (json) {
+            print_json(&copy);
+        } else {
+            print_text(&copy);
+            if (watchMs > 0) printf("\n");
+        }
+        fflush(stdout);
+
+        if (watchMs > 0) {
+            struct timespec delay = { watchMs / 1000, (watchMs % 1000) * 1000000L };
+            nanosleep(&delay, NULL);
+        }
+    } while (watchMs > 0);
+
+    return 0;
+}
@@ -0,0 +1,294 @@
+/**
+******************************************************************************
+* @file           : sweep.c
+* @author         : Nimrod Elstein
+* @brief          : Parallel parameter sweep over simulator runs (capacity planning)
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* Every parameter point is an independent simulator process (posix_demo --des --json
+* plus the point's overrides), at most --jobs of them at a time, one per core by
+* default. The JSON summaries are collected into one CSV or JSON lines report,
+* in parameter point order.
+*
+* Build with "make sweep", for example:
+*   ./build/sweep --param police=3,4,5,6 --param fire=2:4 --out staffing.csv -- --sim-hours 168 --seed 1
+*
+* Values are a comma list (3,4,5) or a range (2:6 or 2:10:2). Arguments after "--"
+* go to every simulator run.
+*
+******************************************************************************
+*/
+
+#include "sim_runs.h"
+
+#define MAX_PARAMS 8
+#define MAX_VALUES 256
+#define MAX_FIELDS 128
+#define MAX_EXTRA_ARGS 64
+#define VALUE_LEN 32
+
+static const char *sweepable[] = { "police", "ambulance", "fire", "queue-len", "buffer-len", "dispatch-ms", "retry-ms", "seed" };
+
+typedef struct {   // one swept simulator option and its values
+    const char *name;
+    char option[VALUE_LEN];   // --name
+    int count;
+    char values[MAX_VALUES][VALUE_LEN];
+} SweepParam;
+
+static SweepParam params[MAX_PARAMS];
+static int paramCount = 0;
+
+static void print_usage(const char *program) {
+
+    printf("usage: %s [--jobs <n>] [--sim <path>] [--out <file>] [--format csv|json] --param <name>=<values>... [-- simulator args]\n", program);
+    printf("  names:  police, ambulance, fire, queue-len, buffer-len, dispatch-ms, retry-ms, seed\n");
+    printf("  values: 3,4,5 or 2:6 or 2:10:2\n");
+}
+
+static int parse_param(const char *spec) {
+
+    const char *equals = strchr(spec, '=');
+    if (equals == NULL || paramCount == MAX_PARAMS) return 0;
+
+    SweepParam *p = &params[paramCount];
+    size_t nameLength = (size_t)(equals - spec);
+
+    p->name = NULL;
+    for (size_t i = 0; i < sizeof(sweepable) / sizeof(sweepable[0]); i++) {
+        if (strlen(sweepable[i]) == nameLength && strncmp(spec, sweepable[i], nameLength) == 0) p->name = sweepable[i];
+    }
+    if (p->name == NULL) return 0;
+    snprintf(p->option, sizeof(p->option), "--%s", p->name);
+
+    long from, to, step = 1;
+    char extra;
+    const char *values = equals + 1;
+
+    if (strchr(values, ':') != NULL) {   // range
+        int n = sscanf(values, "%ld:%ld:%ld%c", &from, &to, &step, &extra);
+        if ((n != 2 && n != 3) || step <= 0 || to < from) return 0;
+        for (long v = from; v <= to; v += step) {
+            if (p->count == MAX_VALUES) return 0;
+            snprintf(p->values[p->count++], VALUE_LEN, "%ld", v);
+        }
+    } else {   // list
+        char copy[MAX_VALUES * VALUE_LEN], *save = NULL;
+        snprintf(copy, sizeof(copy), "%s", values);
+        for (char *tok = strtok_r(copy, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save)) {
+            if (p->count == MAX_VALUES || strlen(tok) >= VALUE_LEN) return 0;
+            snprintf(p->values[p->count++], VALUE_LEN, "%s", tok);
+        }
+    }
+
+    if (p->count == 0) return 0;
+    paramCount++;
+    return 1;
+}
+
+static void point_values(int index, int *choice) {   // mixed radix: the last parameter changes fastest
+
+    for (int i = paramCount - 1; i >= 0; i--) {
+        choice[i] = index % params[i].count;
+        index /= params[i].count;
+    }
+}
+
+static char **build_argv(int index, const char *sim, int extraCount, char **extra) {
+
+    char **argv = calloc((size_t)(4 + 2 * paramCount + extraCount), sizeof(char *));
+    int choice[MAX_PARAMS];
+    int argc = 0;
+
+    if (argv == NULL) return NULL;
+
+    point_values(index, choice);
+
+    argv[argc++] = (char *)sim;
+    argv[argc++] = "--des";
+    argv[argc++] = "--json";
+    for (int i = 0; i < paramCount; i++) {
+        argv[argc++] = params[i].option;
+        argv[argc++] = params[i].values[choice[i]];
+    }
+    for (int i = 0; i < extraCount; i++) {
+        argv[argc++] = extra[i];
+    }
+    argv[argc] = NULL;
+
+    return argv;
+}
+
+static int json_fields(const char *json, char keys[][VALUE_LEN], char values[][VALUE_LEN]) {   // flat {"key":value,...}
+
+    int count = 0;
+    const char *p = strchr(json, '{');
+
+    while (p != NULL && count < MAX_FIELDS) {
+        const char *keyStart = strchr(p, '"');
+        if (keyStart == NULL) break;
+        const char *keyEnd = strchr(keyStart + 1, '"');
+        if (keyEnd == NULL || keyEnd[1] != ':') break;
+        const char *valueStart = keyEnd + 2;
+        const char *valueEnd = valueStart + strcspn(valueStart, ",}");
+
+        snprintf(keys[count], VALUE_LEN, "%.*s", (int)(keyEnd - keyStart - 1), keyStart + 1);
+        snprintf(values[count], VALUE_LEN, "%.*s", (int)(valueEnd - valueStart), valueStart);
+        count++;
+
+        p = *valueEnd == ',' ? valueEnd + 1 : NULL;
+    }
+
+    return count;
+}
+
+static void write_report(FILE *out, int json, SimRun *runs, int total) {
+
+    static char keys[MAX_FIELDS][VALUE_LEN], values[MAX_FIELDS][VALUE_LEN];
+    static char headerKeys[MAX_FIELDS][VALUE_LEN];
+    int headerCount = -1;
+    int choice[MAX_PARAMS];
+
+    for (int r = 0; r < total; r++) {
+
+        SimRun *run = &runs[r];
+        int count = run->status == 0 ? json_fields(run->output, keys, values) : 0;
+
+        point_values(r, choice);
+
+        if (json) {
+            fprintf(out, "{\"point\":%d", r);
+            for (int i = 0; i < paramCount; i++) fprintf(out, ",\"param_%s\":%s", params[i].name, params[i].values[choice[i]]);
+            fprintf(out, ",\"status\":%d", run->status);
+            for (int f = 0; f < count; f++) fprintf(out, ",\"%s\":%s", keys[f], values[f]);
+            fprintf(out, "}\n");
+            continue;
+        }
+
+        if (headerCount < 0 && (count > 0 || r == total - 1)) {   // CSV columns: the parameters, then the simulator fields of the first good run
+            headerCount = count;
+            memcpy(headerKeys, keys, sizeof(keys));
+            fprintf(out, "point");
+            for (int i = 0; i < paramCount; i++) fprintf(out, ",param_%s", params[i].name);
+            fprintf(out, ",status");
+            for (int f = 0; f < headerCount; f++) fprintf(out, ",%s", headerKeys[f]);
+            fprintf(out, "\n");
+            for (int earlier = 0; earlier < r; earlier++) {   // failed runs before the first good one
+                point_values(earlier, choice);
+                fprintf(out, "%d", earlier);
+                for (int i = 0; i < paramCount; i++) fprintf(out, ",%s", params[i].values[choice[i]]);
+                fprintf(out, ",%d\n", runs[earlier].status);
+            }
+            point_values(r, choice);
+        }
+        if (headerCount < 0) continue;
+
+        fprintf(out, "%d", r);
+        for (int i = 0; i < paramCount; i++) fprintf(out, ",%s", params[i].values[choice[i]]);
+        fprintf(out, ",%d", run->status);
+        for (int f = 0; f < headerCount; f++) {
+            const char *value = "";
+            for (int g = 0; g < count; g++) {
+                if (strcmp(keys[g], headerKeys[f]) == 0) value = values[g];
+            }
+            if (value[0] == '"') {   // strings (mode) without the JSON quotes
+                fprintf(out, ",%.*s", (int)strlen(value) - 2, value + 1);
+            } else {
+                fprintf(out, ",%s", value);
+            }
+        }
+        fprintf(out, "\n");
+    }
+}
+
+int main(int argc, char **argv) {
+
+    const char *sim = "./build/posix_demo";
+    const char *outPath = NULL;
+    int json = 0;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int extraCount = 0;
+    char **extra = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--") == 0) {
+            extra = &argv[i + 1];
+            extraCount = argc - i - 1;
+            if (extraCount > MAX_EXTRA_ARGS) {
+                fprintf(stderr, "error: too many simulator arguments\n");
+                return 1;
+            }
+            break;
+        } else if (strcmp(argv[i], "--param") == 0 && i + 1 < argc) {
+            if (!parse_param(argv[++i])) {
+                fprintf(stderr, "error: bad --param '%s'\n", argv[i]);
+                print_usage(argv[0]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            jobs = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--sim") == 0 && i + 1 < argc) {
+            sim = argv[++i];
+        } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+            outPath = argv[++i];
+        } else if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            json = strcmp(argv[++i], "json") == 0;
+        } else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (paramCount == 0 || jobs < 1) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    int total = 1;
+    for (int i = 0; i < paramCount; i++) {
+        total *= params[i].count;
+    }
+
+    SimRun *runs = calloc((size_t)total, sizeof(SimRun));
+    if (runs == NULL) {
+        fprintf(stderr, "error: out of memory\n");
+        return 1;
+    }
+    for (int r = 0; r < total; r++) {
+        runs[r].argv = build_argv(r, sim, extraCount, extra);
+        if (runs[r].argv == NULL) {
+            fprintf(stderr, "error: out of memory\n");
+            return 1;
+        }
+    }
+
+    fprintf(stderr, "sweep: %d parameter points, %ld parallel runs\n", total, jobs);
+
+    int failed = sim_runs_execute(runs, total, (int)jobs);
+    if (failed < 0) {
+        return 1;
+    }
+    for (int r = 0; r < total; r++) {
+        if (runs[r].status != 0) fprintf(stderr, "sweep: point %d failed (status %d)\n", r, runs[r].status);
+    }
+    fprintf(stderr, "sweep: %d runs done, %d failed\n", total, failed);
+
+    FILE *out = outPath ? fopen(outPath, "w") : stdout;
+    if (out == NULL) {
+        perror(outPath);
+        return 1;
+    }
+    write_report(out, json, runs, total);
+    if (out != stdout) fclose(out);
+
+    for (int r = 0; r < total; r++) {
+        free(runs[r].argv);
+    }
+    free(runs);
+
+    return failed ? 2 : 0;
+}
@@ -0,0 +1,173 @@
+/**
+******************************************************************************
+* @file           : trace_tool.c
+* @author         : Nimrod Elstein
+* @brief          : Command line converter between event traces and CSV
+******************************************************************************
+*
+* This FreeRTOS simulator project is the final project for
+* RTG collage RT Concepts course, class of 2024-2025.
+* This project simulates a city emergency dispatcher program.
+*
+* Build with "make trace_tool":
+*   ./build/trace_tool dump <trace> [csv]      trace (--record output) to CSV
+*   ./build/trace_tool encode <csv> <trace>    CSV (external call traces) to a trace for --replay
+*   ./build/trace_tool info <trace>            header, event count and time span
+*
+* CSV columns: arrival_ms,code,priority,handle_ms (one header line, rows sorted by
+* arrival time, arrival times in ms from the start of the trace).
+*
+******************************************************************************
+*/
+
+#include "event_record.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static void print_usage(const char *program) {
+
+    printf("usage: %s dump <trace> [file.csv]\n", program);
+    printf("       %s encode <file.csv> <trace>\n", program);
+    printf("       %s info <trace>\n", program);
+}
+
+static const uint8_t *map_trace(const char *path, size_t *size) {
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0 || fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(EventRecordHeader)) {
+        fprintf(stderr, "error: cannot read trace %s\n", path);
+        exit(1);
+    }
+
+    const uint8_t *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    madvise((void *)data, (size_t)st.st_size, MADV_SEQUENTIAL);
+
+    const EventRecordHeader *header = (const EventRecordHeader *)data;
+    if (header->magic != EVENT_RECORD_MAGIC || header->version != EVENT_RECORD_VERSION || header->tickRateHz == 0) {
+        fprintf(stderr, "error: %s is not a version %d event trace\n", path, EVENT_RECORD_VERSION);
+        exit(1);
+    }
+
+    *size = (size_t)st.st_size;
+    return data;
+}
+
+static int run_dump(const char *tracePath, const char *csvPath, int infoOnly) {
+
+    size_t size;
+    const uint8_t *data = map_trace(tracePath, &size);
+    const EventRecordHeader *header = (const EventRecordHeader *)data;
+    FILE *out = stdout;
+
+    if (!infoOnly && csvPath != NULL && (out = fopen(csvPath, "w")) == NULL) {
+        perror(csvPath);
+        return 1;
+    }
+
+    if (!infoOnly) fprintf(out, "arrival_ms,code,priority,handle_ms\n");
+
+    uint64_t lastTick = 0, count = 0;
+    size_t offset = header->headerSize;
+    EventRecord rec = { 0 };
+
+    while (offset < size) {
+        size_t n = event_record_decode(data + offset, size - offset, &rec, &lastTick);
+        if (n == 0) break;
+        offset += n;
+        count++;
+        if (!infoOnly) {
+            fprintf(out, "%.3f,%u,%u,%u\n", (double)rec.arrivalTick * 1000.0 / header->tickRateHz, rec.code,
+                    rec.priority, rec.handleMs);
+        }
+    }
+
+    if (infoOnly) {
+        printf("trace %s: version %u, %u Hz, seed %llu\n", tracePath, header->version, header->tickRateHz,
+               (unsigned long long)header->seed);
+        printf("%llu events over %.1f s, %zu bytes (%.2f bytes/event)%s\n", (unsigned long long)count,
+               (double)lastTick / header->tickRateHz, size,
+               count ? (double)(size - header->headerSize) / count : 0.0, offset < size ? ", truncated" : "");
+    } else if (out != stdout) {
+        fclose(out);
+    }
+
+    return 0;
+}
+
+static int run_encode(const char *csvPath, const char *tracePath) {
+
+    FILE *in = fopen(csvPath, "r");
+    FILE *out = fopen(tracePath, "wb");
+    char line[256];
+    uint64_t lastTick = 0, count = 0, lineNumber = 0;
+
+    if (in == NULL || out == NULL) {
+        perror(in == NULL ? csvPath : tracePath);
+        return 1;
+    }
+
+    EventRecordHeader header = { EVENT_RECORD_MAGIC, EVENT_RECORD_VERSION, sizeof(EventRecordHeader), 1000, 0, 0 };
+    fwrite(&header, sizeof(header), 1, out);
+
+    while (fgets(line, sizeof(line), in) != NULL) {
+
+        double arrivalMs;
+        unsigned code, priority, handleMs;
+
+        lineNumber++;
+        if (sscanf(line, "%lf,%u,%u,%u", &arrivalMs, &code, &priority, &handleMs) != 4) {
+            if (lineNumber == 1) continue;   // column names
+            fprintf(stderr, "error: %s:%llu: expected arrival_ms,code,priority,handle_ms\n", csvPath,
+                    (unsigned long long)lineNumber);
+            return 1;
+        }
+
+        EventRecord rec = { (uint64_t)(arrivalMs + 0.5), (uint8_t)code, (uint8_t)priority, handleMs };
+        if (arrivalMs < 0 || rec.arrivalTick < lastTick || code > 15 || priority > 15) {
+            fprintf(stderr, "error: %s:%llu: arrival times must not decrease, code and priority must be 0-15\n",
+                    csvPath, (unsigned long long)lineNumber);
+            return 1;
+        }
+
+        uint8_t encoded[EVENT_RECORD_MAX_BYTES];
+        fwrite(encoded, 1, event_record_encode(encoded, &rec, &lastTick), out);
+        count++;
+    }
+
+    fclose(in);
+    if (fclose(out) != 0) {
+        perror(tracePath);
+        return 1;
+    }
+
+    printf("encoded %llu events to %s\n", (unsigned long long)count, tracePath);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+
+    if (argc >= 3 && argc <= 4 && strcmp(argv[1], "dump") == 0) {
+        return run_dump(argv[2], argc == 4 ? argv[3] : NULL, 0);
+    }
+    if (argc == 4 && strcmp(argv[1], "encode") == 0) {
+        return run_encode(argv[2], argv[3]);
+    }
+    if (argc == 3 && strcmp(argv[1], "info") == 0) {
+        return run_dump(argv[2], NULL, 1);
+    }
+
+    print_usage(argv[0]);
+    return 1;
+}